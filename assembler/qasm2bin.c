@@ -0,0 +1,156 @@
+//Converts a qasm output file (.out) or a raw little endian binary (.bin, e.g. created by vlink) into the
+//binary image format .qbin which the emulator loads without parsing text, see emulator/qbin.h
+//
+//how to compile: gcc qasm2bin.c -o qasm2bin -std=c99
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../emulator/qbin.h"
+
+#define MEMORY_SIZE 65536
+
+unsigned int memory[MEMORY_SIZE];
+char used[MEMORY_SIZE];
+
+FILE* input_file;
+FILE* output_file;
+
+unsigned int checksum = 0;
+
+void write_word(unsigned int value)
+{
+    fputc(value & 0xff, output_file);
+    fputc((value >> 8) & 0xff, output_file);
+}
+
+// Calls f(address, length) for every run of consecutive used addresses, returns the number of segments
+int for_each_segment(void (*f)(unsigned int, unsigned int))
+{
+    int segments = 0;
+
+    for (unsigned int address = 0; address < MEMORY_SIZE; )
+    {
+        if (!used[address])
+        {
+            address++;
+            continue;
+        }
+
+        unsigned int length = 0;
+        while (address + length < MEMORY_SIZE && used[address + length] && length < 0xFFFF)
+            length++;
+
+        if (f)
+            f(address, length);
+        segments++;
+        address += length;
+    }
+
+    return segments;
+}
+
+void sum_segment(unsigned int address, unsigned int length)
+{
+    checksum += address + length;
+    for (unsigned int i = 0; i < length; i++)
+        checksum += memory[address + i];
+}
+
+void write_segment(unsigned int address, unsigned int length)
+{
+    write_word(address);
+    write_word(length);
+    for (unsigned int i = 0; i < length; i++)
+        write_word(memory[address + i]);
+}
+
+int main(int argc, char *argv[])
+{
+    char* input_name;
+    char* output_name;
+    int raw_address = -1;
+
+    if (argc == 3)
+    {
+        input_name = argv[1];
+        output_name = argv[2];
+    }
+    else if (argc == 5 && !strcmp(argv[1], "-b"))
+    {
+        raw_address = (int) strtol(argv[2], NULL, 0);
+        input_name = argv[3];
+        output_name = argv[4];
+    }
+    else
+    {
+        printf("usage: qasm2bin <input.out> <output.qbin>\n");
+        printf("       qasm2bin -b <load address> <input.bin> <output.qbin>\n");
+        return -1;
+    }
+
+    input_file = fopen(input_name, raw_address < 0 ? "r" : "rb");
+    if (!input_file)
+    {
+        printf("qasm2bin: input file %s could not be opened\n", input_name);
+        return -2;
+    }
+
+    int words = 0;
+    if (raw_address < 0)
+    {
+        char line[80];
+        unsigned int address, value;
+
+        while (fgets(line, sizeof(line), input_file))
+        {
+            if (sscanf(line, "%i %i", (int*) &address, (int*) &value) != 2)
+                continue;
+            if (address >= MEMORY_SIZE)
+            {
+                printf("qasm2bin: address out of range in line: %s", line);
+                return -4;
+            }
+            memory[address] = value & 0xFFFF;
+            used[address] = 1;
+            words++;
+        }
+    }
+    else
+    {
+        int low, high;
+        unsigned int address = raw_address & 0xFFFF;
+
+        while ((low = fgetc(input_file)) != EOF)
+        {
+            high = fgetc(input_file);
+            memory[address] = low | (high == EOF ? 0 : high << 8);
+            used[address] = 1;
+            address = (address + 1) & 0xFFFF;
+            words++;
+        }
+    }
+    fclose(input_file);
+
+    output_file = fopen(output_name, "wb");
+    if (!output_file)
+    {
+        printf("qasm2bin: output file %s could not be created\n", output_name);
+        return -3;
+    }
+
+    int segments = for_each_segment(sum_segment);
+    checksum += QBIN_VERSION + segments;
+
+    fwrite(QBIN_MAGIC, 1, QBIN_MAGIC_SIZE, output_file);
+    write_word(QBIN_VERSION);
+    write_word(segments);
+    write_word(checksum);
+    for_each_segment(write_segment);
+    fclose(output_file);
+
+    printf("qasm2bin: %i words in %i segment(s) written.\n", words, segments);
+
+    return 0;
+}
@@ -0,0 +1,50 @@
+//;
+//; This is an automatically generated definition file!
+//; Do NOT change manually!
+//;
+#define QMON_EP_RESET                         	0x0000
+#define QMON_EP_GETC                          	0x0002
+#define QMON_EP_PUTC                          	0x0004
+#define QMON_EP_GETS                          	0x0006
+#define QMON_EP_PUTS                          	0x0008
+#define QMON_EP_CRLF                          	0x000A
+#define QMON_EP_TIL                           	0x000C
+#define QMON_EP_MULS                          	0x000E
+#define QMON_EP_MEMSET                        	0x0010
+#define QMON_EP_MEMCPY                        	0x0012
+#define QMON_EP_WAIT                          	0x0014
+#define QMON_EP_EXIT                          	0x0016
+#define QMON_EP_CHR2UPPER                     	0x0018
+#define QMON_EP_STR2UPPER                     	0x001A
+#define QMON_EP_STRLEN                        	0x001C
+#define QMON_EP_CHOMP                         	0x001E
+#define QMON_EP_STRCMP                        	0x0020
+#define QMON_EP_STRCHR                        	0x0022
+#define QMON_EP_GETHEX                        	0x0024
+#define QMON_EP_PUTHEX                        	0x0026
+#define QMON_EP_MULU                          	0x0028
+#define QMON_EP_VGA_CLS                       	0x002A
+#define QMON_EP_DIVU                          	0x002C
+#define QMON_EP_DIVS                          	0x002E
+#define QMON_EP_CHR2LOWER                     	0x0030
+#define QMON_EP_MULU32                        	0x0032
+#define QMON_EP_DIVU32                        	0x0034
+#define QMON_EP_SPLIT                         	0x0036
+#define QMON_EP_H2DSTR                        	0x0038
+#define QMON_EP_SD_RESET                      	0x003A
+#define QMON_EP_SD_R_BLOCK                    	0x003C
+#define QMON_EP_SD_W_BLOCK                    	0x003E
+#define QMON_EP_SD_R_BYTE                     	0x0040
+#define QMON_EP_SD_W_BYTE                     	0x0042
+#define QMON_EP_F32_MNT_SD                    	0x0044
+#define QMON_EP_F32_MNT                       	0x0046
+#define QMON_EP_F32_OD                        	0x0048
+#define QMON_EP_F32_LD                        	0x004A
+#define QMON_EP_F32_CD                        	0x004C
+#define QMON_EP_F32_PD                        	0x004E
+#define QMON_EP_F32_FOPEN                     	0x0050
+#define QMON_EP_F32_FREAD                     	0x0052
+#define QMON_EP_F32_FSEEK                     	0x0054
+#define QMON_EP_GETS_S                        	0x0056
+#define QMON_EP_GETS_SLF                      	0x0058
+#define QMON_EP_VGA_INIT                      	0x005A
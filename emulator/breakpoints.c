@@ -0,0 +1,340 @@
+/*
+**  Breakpoints and watchpoints of the QNICE-emulator, see breakpoints.h.
+**
+**  Conditions are compiled by a recursive descent parser into postfix operations which are evaluated on a small
+** stack, so a condition hit in a loop is not parsed again and again. The shadow bitmaps are rebuilt from the list
+** whenever a breakpoint is added or deleted.
+*/
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "breakpoints.h"
+
+#ifndef TRUE
+# define TRUE 1
+# define FALSE !TRUE
+#endif
+
+#define BREAK_PUSH      0 /* Operations of a compiled condition, operand is the constant resp. register number */
+#define BREAK_REGISTER  1
+#define BREAK_VALUE     2
+#define BREAK_ADDR      3
+#define BREAK_LOAD      4 /* Unary operations */
+#define BREAK_NOT       5
+#define BREAK_INVERT    6
+#define BREAK_ADD       7 /* Binary operations */
+#define BREAK_SUB       8
+#define BREAK_AND       9
+#define BREAK_OR        10
+#define BREAK_XOR       11
+#define BREAK_EQ        12
+#define BREAK_NE        13
+#define BREAK_LT        14
+#define BREAK_LE        15
+#define BREAK_GT        16
+#define BREAK_GE        17
+#define BREAK_LOGIC_AND 18
+#define BREAK_LOGIC_OR  19
+
+typedef struct break_parser {
+  const char *position;
+  breakpoint *entry;
+  char *error;
+  unsigned int error_size;
+} break_parser;
+
+/* Operators in the order they are tried, so "<=" is found before "<" and "&&" before "&" */
+static const struct {
+  const char *text;
+  unsigned int opcode;
+} break_comparisons[] = {{"==", BREAK_EQ}, {"!=", BREAK_NE}, {"<=", BREAK_LE}, {">=", BREAK_GE}, {"<", BREAK_LT},
+                         {">", BREAK_GT}, {NULL, 0}},
+  break_operators[] = {{"+", BREAK_ADD}, {"-", BREAK_SUB}, {"^", BREAK_XOR}, {NULL, 0}};
+
+static void break_error(break_parser *parser, const char *message) {
+  if (!*parser->error)
+    snprintf(parser->error, parser->error_size, "%s at \"%s\"", message, parser->position);
+}
+
+static void break_emit(break_parser *parser, unsigned int opcode, unsigned int operand) {
+  breakpoint *entry = parser->entry;
+
+  if (entry->code_length == BREAK_CONDITION_LENGTH)
+    break_error(parser, "Condition too long");
+  else {
+    entry->code[entry->code_length].opcode = opcode;
+    entry->code[entry->code_length++].operand = operand;
+  }
+}
+
+/* Skip blanks and consume text if it follows, "&" and "|" do not match the start of "&&" resp. "||" */
+static int break_match(break_parser *parser, const char *text) {
+  unsigned int length = strlen(text);
+
+  while (isspace((unsigned char) *parser->position))
+    parser->position++;
+  if (strncmp(parser->position, text, length)
+      || (length == 1 && (*text == '&' || *text == '|') && parser->position[1] == *text))
+    return FALSE;
+  parser->position += length;
+  return TRUE;
+}
+
+static void break_parse_or(break_parser *parser);
+
+static void break_parse_primary(break_parser *parser) {
+  char name[16];
+  unsigned int length;
+
+  if (*parser->error)
+    return;
+  if (break_match(parser, "(")) {
+    break_parse_or(parser);
+    if (!break_match(parser, ")"))
+      break_error(parser, "Expected )");
+  } else if (break_match(parser, "!")) {
+    break_parse_primary(parser);
+    break_emit(parser, BREAK_NOT, 0);
+  } else if (break_match(parser, "~")) {
+    break_parse_primary(parser);
+    break_emit(parser, BREAK_INVERT, 0);
+  } else if (break_match(parser, "@")) {
+    break_parse_primary(parser);
+    break_emit(parser, BREAK_LOAD, 0);
+  } else if (break_match(parser, "$"))
+    break_emit(parser, BREAK_PUSH, strtoul(parser->position, (char **) &parser->position, 16) & 0xffff);
+  else if (isdigit((unsigned char) *parser->position))
+    break_emit(parser, BREAK_PUSH, strtoul(parser->position, (char **) &parser->position,
+                                           !strncmp(parser->position, "0x", 2) || !strncmp(parser->position, "0X", 2)
+                                           ? 16 : 10) & 0xffff);
+  else if (isalpha((unsigned char) *parser->position)) {
+    for (length = 0; isalnum((unsigned char) *parser->position) && length < sizeof(name) - 1; length++)
+      name[length] = toupper((unsigned char) *parser->position++);
+    name[length] = 0;
+
+    if (!strcmp(name, "VALUE"))
+      break_emit(parser, BREAK_VALUE, 0);
+    else if (!strcmp(name, "ADDR"))
+      break_emit(parser, BREAK_ADDR, 0);
+    else if (!strcmp(name, "SP") || !strcmp(name, "SR") || !strcmp(name, "PC"))
+      break_emit(parser, BREAK_REGISTER, *name == 'S' ? (name[1] == 'P' ? 13 : 14) : 15);
+    else if (*name == 'R' && isdigit((unsigned char) name[1]) && atoi(name + 1) < 16
+             && strlen(name) <= 3 && (name[1] != '0' || !name[2]))
+      break_emit(parser, BREAK_REGISTER, atoi(name + 1));
+    else {
+      parser->position -= length;
+      break_error(parser, "Unknown name");
+    }
+  } else
+    break_error(parser, "Expected a number, register or (");
+}
+
+/* Binary operators without precedence among each other, evaluated from left to right */
+static void break_parse_operand(break_parser *parser) {
+  unsigned int i;
+
+  for (break_parse_primary(parser); !*parser->error;) {
+    if (break_match(parser, "&"))
+      i = BREAK_AND;
+    else if (break_match(parser, "|"))
+      i = BREAK_OR;
+    else {
+      for (i = 0; break_operators[i].text && !break_match(parser, break_operators[i].text); i++);
+      if (!break_operators[i].text)
+        return;
+      i = break_operators[i].opcode;
+    }
+    break_parse_primary(parser);
+    break_emit(parser, i, 0);
+  }
+}
+
+static void break_parse_comparison(break_parser *parser) {
+  unsigned int i;
+
+  break_parse_operand(parser);
+  for (i = 0; break_comparisons[i].text && !break_match(parser, break_comparisons[i].text); i++);
+  if (break_comparisons[i].text) {
+    break_parse_operand(parser);
+    break_emit(parser, break_comparisons[i].opcode, 0);
+  }
+}
+
+static void break_parse_and(break_parser *parser) {
+  for (break_parse_comparison(parser); !*parser->error && break_match(parser, "&&");) {
+    break_parse_comparison(parser);
+    break_emit(parser, BREAK_LOGIC_AND, 0);
+  }
+}
+
+static void break_parse_or(break_parser *parser) {
+  for (break_parse_and(parser); !*parser->error && break_match(parser, "||");) {
+    break_parse_and(parser);
+    break_emit(parser, BREAK_LOGIC_OR, 0);
+  }
+}
+
+static unsigned int break_evaluate(breakpoint *entry, unsigned int address, unsigned int value) {
+  unsigned int stack[BREAK_CONDITION_LENGTH], top = 0, i, a, b;
+
+  for (i = 0; i < entry->code_length; i++) {
+    switch (entry->code[i].opcode) {
+      case BREAK_PUSH:
+        stack[top++] = entry->code[i].operand;
+        continue;
+      case BREAK_REGISTER:
+        stack[top++] = break_read_register(entry->code[i].operand);
+        continue;
+      case BREAK_VALUE:
+        stack[top++] = value;
+        continue;
+      case BREAK_ADDR:
+        stack[top++] = address;
+        continue;
+      case BREAK_LOAD:
+        stack[top - 1] = break_read_memory(stack[top - 1]);
+        continue;
+      case BREAK_NOT:
+        stack[top - 1] = !stack[top - 1];
+        continue;
+      case BREAK_INVERT:
+        stack[top - 1] = ~stack[top - 1] & 0xffff;
+        continue;
+    }
+
+    b = stack[--top]; /* Binary operations */
+    a = stack[top - 1];
+    switch (entry->code[i].opcode) {
+      case BREAK_ADD:       a = (a + b) & 0xffff; break;
+      case BREAK_SUB:       a = (a - b) & 0xffff; break;
+      case BREAK_AND:       a &= b;               break;
+      case BREAK_OR:        a |= b;               break;
+      case BREAK_XOR:       a ^= b;               break;
+      case BREAK_EQ:        a = a == b;           break;
+      case BREAK_NE:        a = a != b;           break;
+      case BREAK_LT:        a = a < b;            break;
+      case BREAK_LE:        a = a <= b;           break;
+      case BREAK_GT:        a = a > b;            break;
+      case BREAK_GE:        a = a >= b;           break;
+      case BREAK_LOGIC_AND: a = a && b;           break;
+      case BREAK_LOGIC_OR:  a = a || b;           break;
+    }
+    stack[top - 1] = a;
+  }
+
+  return top ? stack[top - 1] : TRUE;
+}
+
+/* Set the bits of all breakpoints in the shadow bitmaps */
+static void breakpoint_map(breakpoint_module *module) {
+  unsigned int i, kind, address;
+  breakpoint *entry;
+
+  memset(module->map, 0, sizeof(module->map));
+  for (i = 0; i < module->count; i++)
+    for (entry = module->list + i, kind = 0; kind < BREAK_KINDS; kind++)
+      if (entry->kinds & (1 << kind))
+        for (address = entry->first; address <= entry->last; address++)
+          module->map[kind][address >> 3] |= 1 << (address & 7);
+}
+
+int breakpoint_add(breakpoint_module *module, unsigned int kinds, unsigned int first, unsigned int last,
+                   const char *condition, char *error, unsigned int error_size) {
+  breakpoint entry, *list;
+  break_parser parser = {condition, &entry, error, error_size};
+
+  *error = 0;
+  memset(&entry, 0, sizeof(entry));
+  if (condition) {
+    if (strlen(condition) >= BREAK_CONDITION_LENGTH) {
+      snprintf(error, error_size, "Condition too long");
+      return -1;
+    }
+    strcpy(entry.condition, condition);
+    break_parse_or(&parser);
+    break_match(&parser, "");                       /* Skip trailing blanks */
+    if (!*error && *parser.position)
+      break_error(&parser, "Unexpected text");
+    if (*error)
+      return -1;
+  }
+
+  if (module->count == module->size) {
+    if (!(list = realloc(module->list, (module->size ? 2 * module->size : 16) * sizeof(breakpoint)))) {
+      snprintf(error, error_size, "Out of memory");
+      return -1;
+    }
+    module->list = list;
+    module->size = module->size ? 2 * module->size : 16;
+  }
+
+  entry.number = ++module->last_number;
+  entry.kinds = kinds;
+  entry.first = first & 0xffff;
+  entry.last = last < first ? entry.first : last & 0xffff;
+  module->list[module->count++] = entry;
+  breakpoint_map(module);
+  return entry.number;
+}
+
+int breakpoint_delete(breakpoint_module *module, unsigned int number) {
+  unsigned int i;
+
+  if (!number)
+    module->count = 0;
+  else {
+    for (i = 0; i < module->count && module->list[i].number != number; i++);
+    if (i == module->count)
+      return FALSE;
+    memmove(module->list + i, module->list + i + 1, (module->count - i - 1) * sizeof(breakpoint));
+    module->count--;
+  }
+  breakpoint_map(module);
+  return TRUE;
+}
+
+breakpoint *breakpoint_check(breakpoint_module *module, unsigned int kind, unsigned int address, unsigned int value) {
+  breakpoint *entry;
+  unsigned int i;
+
+  for (i = 0; i < module->count; i++) {
+    entry = module->list + i;
+    if ((entry->kinds & (1 << kind)) && address >= entry->first && address <= entry->last
+        && (!entry->code_length || break_evaluate(entry, address, value))) {
+      entry->hits++;
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+void breakpoint_list(breakpoint_module *module, FILE *handle) {
+  unsigned int i;
+  breakpoint *entry;
+  char range[16];
+
+  if (!module->count) {
+    fprintf(handle, "No breakpoints or watchpoints set\n");
+    return;
+  }
+
+  fprintf(handle, "  NO KIND ADDRESS            HITS CONDITION\n");
+  for (i = 0; i < module->count; i++) {
+    entry = module->list + i;
+    if (entry->first == entry->last)
+      sprintf(range, "%04X", entry->first);
+    else
+      sprintf(range, "%04X..%04X", entry->first, entry->last);
+    fprintf(handle, "%4u %c%c%c  %-10s %12llu %s\n", entry->number,
+            entry->kinds & (1 << BREAK_EXECUTE) ? 'X' : '-', entry->kinds & (1 << BREAK_READ) ? 'R' : '-',
+            entry->kinds & (1 << BREAK_WRITE) ? 'W' : '-', range, entry->hits, entry->condition);
+  }
+}
+
+void breakpoint_free(breakpoint_module *module) {
+  free(module->list);
+  module->list = NULL;
+  module->count = module->size = 0;
+}
@@ -0,0 +1,72 @@
+/*
+**  Header file for the breakpoints and watchpoints of the QNICE-emulator: Each kind of access (execute, read, write)
+** has a shadow bitmap with one bit per address of the 64K address space. A bit is set if at least one breakpoint
+** resp. watchpoint covers the address, so the core only tests this bit (BREAK_HIT) on its fast path. The list of
+** breakpoints and their conditions is only consulted if the bit is set, any number of them can be used without
+** slowing down the emulation of code which does not hit them.
+**
+**  A condition is an expression which is evaluated when the bit is hit, the breakpoint triggers only if it is not
+** zero. It consists of numbers (decimal or hexadecimal with the prefix 0x or $), the registers R0..R15, SP, SR, PC,
+** VALUE (the word read or written resp. the instruction at a breakpoint), ADDR (the address accessed), @ (memory word
+** at an address), the operators + - & | ^ ~ !, the comparisons == != < <= > >= (unsigned), && || and parentheses,
+** e.g. "R8 == 0x0D && @R9 != 0". All values have 16 bits.
+*/
+
+#ifndef BREAKPOINTS_H
+#define BREAKPOINTS_H
+
+#include <stdio.h>
+
+#define BREAK_EXECUTE           0 /* Kinds of accesses, indices of the shadow bitmaps */
+#define BREAK_READ              1
+#define BREAK_WRITE             2
+#define BREAK_KINDS             3
+
+#define BREAK_ADDRESSES         65536
+#define BREAK_CONDITION_LENGTH  128
+
+/* TRUE if at least one breakpoint of the kind covers the address */
+#define BREAK_HIT(module, kind, address) ((module)->map[kind][(address) >> 3] & (1 << ((address) & 7)))
+
+typedef struct break_operation {
+  unsigned int opcode, operand;
+} break_operation;
+
+typedef struct breakpoint {
+  unsigned int number,
+    kinds,                                          /* Bitmask of 1 << BREAK_* */
+    first, last;                                    /* Addresses covered */
+  unsigned long long hits;
+  char condition[BREAK_CONDITION_LENGTH];           /* Source of the condition, empty if there is none */
+  break_operation code[BREAK_CONDITION_LENGTH];     /* The condition compiled to postfix operations */
+  unsigned int code_length;
+} breakpoint;
+
+typedef struct breakpoint_module {
+  unsigned char map[BREAK_KINDS][BREAK_ADDRESSES / 8];
+  unsigned int armed;                               /* Watchpoints trigger only while set (during RUN and STEP) */
+  breakpoint *list;
+  unsigned int count, size, last_number;
+} breakpoint_module;
+
+/*
+**  Add a breakpoint resp. watchpoint for the kinds (bitmask of 1 << BREAK_*) and the addresses first..last, condition
+** may be NULL. Returns its number or -1 if the condition is invalid, the reason is written to error.
+*/
+int breakpoint_add(breakpoint_module *, unsigned int kinds, unsigned int first, unsigned int last,
+                   const char *condition, char *error, unsigned int error_size);
+
+/* Delete the breakpoint with the number, 0 deletes all. Returns FALSE if there is no such breakpoint. */
+int breakpoint_delete(breakpoint_module *, unsigned int number);
+
+/* Called if the bit of the address is set: Returns the first breakpoint whose condition holds resp. NULL */
+breakpoint *breakpoint_check(breakpoint_module *, unsigned int kind, unsigned int address, unsigned int value);
+
+void breakpoint_list(breakpoint_module *, FILE *handle);
+void breakpoint_free(breakpoint_module *);
+
+/* Provided by the core (qnice.c): The registers of the current bank and the memory (0 for the IO area) */
+unsigned int break_read_register(unsigned int number);
+unsigned int break_read_memory(unsigned int address);
+
+#endif
@@ -0,0 +1,80 @@
+/*
+**  Code coverage of the QNICE-emulator, see coverage.h.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "coverage.h"
+
+void coverage_clear(coverage_module *module) {
+  memset(module->map, 0, sizeof(module->map));
+}
+
+int coverage_load(coverage_module *module, const char *file_name) {
+  unsigned char magic[COVERAGE_MAGIC_LENGTH], *map;
+  unsigned int i;
+  FILE *handle;
+  int result = -1;
+
+  if (!(handle = fopen(file_name, "rb")))
+    return -1;
+
+  if ((map = malloc(sizeof(module->map)))
+      && fread(magic, 1, COVERAGE_MAGIC_LENGTH, handle) == COVERAGE_MAGIC_LENGTH
+      && !memcmp(magic, COVERAGE_MAGIC, COVERAGE_MAGIC_LENGTH)
+      && fread(map, 1, sizeof(module->map), handle) == sizeof(module->map)) {
+    for (i = 0; i < sizeof(module->map); i++)
+      ((unsigned char *) module->map)[i] |= map[i];
+    result = 0;
+  }
+
+  free(map);
+  fclose(handle);
+  return result;
+}
+
+int coverage_save(coverage_module *module, const char *file_name) {
+  coverage_module *merged;
+  FILE *handle;
+  int result = -1;
+
+  if (!(merged = malloc(sizeof(coverage_module))))
+    return -1;
+
+  memcpy(merged->map, module->map, sizeof(module->map));
+  if ((handle = fopen(file_name, "rb"))) { /* An existing file has to be a coverage file, it is never overwritten */
+    fclose(handle);
+    if (coverage_load(merged, file_name)) {
+      free(merged);
+      return -1;
+    }
+  }
+
+  if ((handle = fopen(file_name, "wb"))) {
+    if (fwrite(COVERAGE_MAGIC, 1, COVERAGE_MAGIC_LENGTH, handle) == COVERAGE_MAGIC_LENGTH
+        && fwrite(merged->map, 1, sizeof(merged->map), handle) == sizeof(merged->map))
+      result = 0;
+    if (fclose(handle))
+      result = -1;
+  }
+
+  free(merged);
+  return result;
+}
+
+void coverage_report(coverage_module *module, FILE *handle) {
+  unsigned int address, executed = 0, branches = 0, taken = 0, not_taken = 0;
+
+  for (address = 0; address < COVERAGE_ADDRESSES; address++) {
+    executed += COVERAGE_TEST(module, COVERAGE_EXECUTED, address);
+    branches += COVERAGE_TEST(module, COVERAGE_BRANCH, address);
+    taken += COVERAGE_TEST(module, COVERAGE_TAKEN, address);
+    not_taken += COVERAGE_TEST(module, COVERAGE_NOT_TAKEN, address);
+  }
+
+  fprintf(handle, "\tInstructions executed:       %8u\n", executed);
+  fprintf(handle, "\tConditional branches:        %8u\n", branches);
+  fprintf(handle, "\t  taken:                     %8u\n", taken);
+  fprintf(handle, "\t  not taken:                 %8u\n", not_taken);
+}
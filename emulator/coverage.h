@@ -0,0 +1,47 @@
+/*
+**  Header file for the code coverage of the QNICE-emulator: While coverage is enabled, the core sets one bit per
+** executed instruction (the address of its first word) and records the outcomes of conditional branches, i.e.
+** whether the branch at an address has been taken and whether it has fallen through. Only bits are kept, so the
+** coverage of the whole 64K address space needs 32 KB and the coverage of many runs is merged by ORing the bitmaps.
+**
+**  Coverage files contain COVERAGE_MAGIC followed by the bitmaps in the order of the COVERAGE_* kinds below, bit
+** (address & 7) of byte (address >> 3) belongs to an address. Saving into an existing coverage file merges them, so
+** a file accumulates the coverage of all runs saving into it. The tool qnice-coverage (coverage_report.c) maps a
+** coverage file to the source lines of listings (.lis) resp. the functions of vlink map files.
+*/
+
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <stdio.h>
+
+#define COVERAGE_EXECUTED       0 /* Kinds of bits, indices of the bitmaps */
+#define COVERAGE_BRANCH         1 /* A conditional branch has been executed at the address */
+#define COVERAGE_TAKEN          2
+#define COVERAGE_NOT_TAKEN      3
+#define COVERAGE_KINDS          4
+
+#define COVERAGE_ADDRESSES      65536
+#define COVERAGE_MAGIC          "QNICECOV"
+#define COVERAGE_MAGIC_LENGTH   8
+
+#define COVERAGE_SET(module, kind, address) ((module)->map[kind][(address) >> 3] |= 1 << ((address) & 7))
+#define COVERAGE_TEST(module, kind, address) (((module)->map[kind][(address) >> 3] >> ((address) & 7)) & 1)
+
+typedef struct coverage_module {
+  unsigned int enabled;
+  unsigned char map[COVERAGE_KINDS][COVERAGE_ADDRESSES / 8];
+} coverage_module;
+
+void coverage_clear(coverage_module *);
+
+/* OR the bitmaps of a coverage file into the module, returns -1 if the file cannot be read or is no coverage file */
+int coverage_load(coverage_module *, const char *file_name);
+
+/* Write the bitmaps to a file, merging them with the coverage already in it. Returns -1 on errors. */
+int coverage_save(coverage_module *, const char *file_name);
+
+/* Print the number of executed instructions and of conditional branches taken resp. not taken */
+void coverage_report(coverage_module *, FILE *handle);
+
+#endif
@@ -0,0 +1,377 @@
+/*
+**  Coverage report, built from coverage.c (see coverage.h and make-coverage.bash).
+**
+**  The coverage files given by -c are merged (-o writes the merged file) and mapped to the instructions of the
+** programs they belong to:
+**
+**  - A listing (.lis) written by the assembler contains every instruction with its address. Listings of programs
+**    assembled by the asm script contain the line markers of the preprocessor as comments (";# <line> "<file>""),
+**    so each instruction is attributed to the line of the source file, e.g. of an included file, it stems from.
+**    Without them the lines of the listing itself are used.
+**  - A map file written by vlink (c/qnice/qvc writes "mapfile") contains the address ranges of the text sections of
+**    the object files and the addresses of their symbols. Since it contains no source lines, the program (.out)
+**    has to be given by -p to find the instructions, their addresses are used as line numbers.
+**
+**  For each source file resp. object file the executed instructions and the outcomes of the conditional branches
+** are counted. -l writes a tracefile in the LCOV format, e.g. for genhtml, where each outcome of a conditional
+** branch is a branch of its own and the symbols of map files are functions.
+*/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "coverage.h"
+
+#define MAX_FILES         1024
+#define MAX_FUNCTIONS     4096
+#define MAX_PATH_LENGTH   512
+#define MAX_LINE_LENGTH   1024
+#define LISTING_SOURCE    26        /* Column of the source text in a listing, see write_result() of qasm.c */
+
+typedef struct covered_instruction {
+  unsigned int address, word, line;
+} covered_instruction;
+
+typedef struct source_file {
+  char name[MAX_PATH_LENGTH];
+  covered_instruction *instructions;
+  unsigned int count, size;
+} source_file;
+
+typedef struct covered_function {
+  char name[MAX_PATH_LENGTH];
+  unsigned int address;
+  source_file *file;
+} covered_function;
+
+static coverage_module gbl$coverage;
+static source_file gbl$files[MAX_FILES];
+static covered_function gbl$functions[MAX_FUNCTIONS];
+static unsigned int gbl$number_of_files, gbl$number_of_functions;
+static int gbl$program[COVERAGE_ADDRESSES];         /* Words of the program given by -p, -1 if not loaded */
+static const char *gbl$mnemonics[] = {"MOVE", "ADD", "ADDC", "SUB", "SUBC", "SHL", "SHR", "SWAP", "NOT", "AND", "OR",
+                                      "XOR", "CMP", "HALT", "RTI", "INT", "INCRB", "DECRB", "ABRA", "ASUB", "RBRA",
+                                      "RSUB", NULL};
+
+/* TRUE for a branch depending on a flag, the core records its outcomes (see execute_branch() of qnice.c) */
+int is_conditional_branch(unsigned int word) {
+  return (word >> 12) == 0xf && (word & 0x7);
+}
+
+/* Number of words of an instruction including its constants (operands @R15++), see disassemble_instruction() */
+unsigned int instruction_length(unsigned int word) {
+  unsigned int opcode = word >> 12, length = 1;
+
+  if (opcode < 0xd || opcode == 0xf)
+    length += ((word >> 6) & 0x3f) == 0x3e;
+  if (opcode < 0xd || (opcode == 0xe && ((word >> 6) & 0x3f) == 0x2))
+    length += (word & 0x3f) == 0x3e;
+  return length;
+}
+
+source_file *find_file(const char *name) {
+  unsigned int i;
+
+  for (i = 0; i < gbl$number_of_files; i++)
+    if (!strcmp(gbl$files[i].name, name))
+      return gbl$files + i;
+
+  if (gbl$number_of_files == MAX_FILES) {
+    fprintf(stderr, "More than %d source files!\n", MAX_FILES);
+    exit(2);
+  }
+  strncpy(gbl$files[i].name, name, MAX_PATH_LENGTH - 1);
+  return gbl$files + gbl$number_of_files++;
+}
+
+void add_instruction(source_file *file, unsigned int address, unsigned int word, unsigned int line) {
+  if (file->count == file->size) {
+    file->size = file->size ? 2 * file->size : 256;
+    file->instructions = realloc(file->instructions, file->size * sizeof(*file->instructions));
+  }
+  if (!file->instructions) {
+    fprintf(stderr, "Out of memory!\n");
+    exit(2);
+  }
+  file->instructions[file->count].address = address & 0xffff;
+  file->instructions[file->count].word = word & 0xffff;
+  file->instructions[file->count++].line = line;
+}
+
+/* TRUE if the source text of a listing line (label, mnemonic, operands) contains an instruction */
+int is_instruction(char *source) {
+  char text[MAX_LINE_LENGTH], *token, *p;
+  unsigned int i, position;
+
+  strncpy(text, source, sizeof(text) - 1);
+  text[sizeof(text) - 1] = 0;
+  if ((p = strchr(text, ';')))
+    *p = 0;
+  for (position = 0, token = strtok(text, " \t\r\n"); token && position < 2; token = strtok(NULL, " \t\r\n")) {
+    position++;
+    for (p = token; *p; p++)
+      *p = toupper((unsigned char) *p);
+    for (i = 0; gbl$mnemonics[i]; i++)
+      if (!strcmp(token, gbl$mnemonics[i]))
+        return 1;
+  }
+  return 0;
+}
+
+int read_listing(const char *file_name) {
+  FILE *handle;
+  char line[MAX_LINE_LENGTH], directory[MAX_PATH_LENGTH], name[MAX_PATH_LENGTH], path[2 * MAX_PATH_LENGTH], *p;
+  unsigned int address, word, source_line = 1, marker_line;
+  source_file *file = NULL;
+
+  if (!(handle = fopen(file_name, "r"))) {
+    perror(file_name);
+    return -1;
+  }
+
+  /* The file names of the line markers are relative to the directory the program has been assembled in */
+  strncpy(directory, file_name, sizeof(directory) - 1);
+  if ((p = strrchr(directory, '/')))
+    p[1] = 0;
+  else
+    *directory = 0;
+
+  file = find_file(file_name);
+  while (fgets(line, sizeof(line), handle) && strncmp(line, "EQU-list:", 9)) {
+    if (strlen(line) < 8 || !isdigit((unsigned char) *line) || line[6] != ' ')
+      continue; /* Errors, words of .ASCII_W etc. and empty lines */
+
+    if (strlen(line) > LISTING_SOURCE
+        && sscanf(line + LISTING_SOURCE, ";# %u \"%511[^\"]\"", &marker_line, name) == 2) {
+      if (*name == '<') /* <built-in>, <command-line> */
+        file = find_file(file_name);
+      else {
+        snprintf(path, sizeof(path), "%s%s", *name == '/' ? "" : directory, name);
+        file = find_file(path);
+      }
+      source_line = marker_line;
+      continue;
+    }
+
+    if (strlen(line) > LISTING_SOURCE && sscanf(line + 8, "%4x  %4x", &address, &word) == 2
+        && is_instruction(line + LISTING_SOURCE))
+      add_instruction(file, address, word, source_line);
+    source_line++;
+  }
+
+  fclose(handle);
+  return 0;
+}
+
+/* Read a .out file ("0xADDRESS 0xWORD" per line) into gbl$program */
+int read_program(const char *file_name) {
+  FILE *handle;
+  unsigned int address, word;
+
+  if (!(handle = fopen(file_name, "r"))) {
+    perror(file_name);
+    return -1;
+  }
+  while (fscanf(handle, "%x %x", &address, &word) == 2)
+    gbl$program[address & 0xffff] = word & 0xffff;
+  fclose(handle);
+  return 0;
+}
+
+/* vlink addresses are byte addresses, a QNICE word has two bytes */
+int read_map(const char *file_name) {
+  FILE *handle;
+  char line[MAX_LINE_LENGTH], object[MAX_PATH_LENGTH], section[MAX_PATH_LENGTH], *p;
+  unsigned long first, last, address;
+  unsigned int i, ranges = 0, range_first[MAX_FILES], range_last[MAX_FILES];
+  source_file *range_file[MAX_FILES];
+
+  if (!(handle = fopen(file_name, "r"))) {
+    perror(file_name);
+    return -1;
+  }
+
+  /* Section mapping: "           00010000 - 0001003a startup.o(.text)" */
+  while (fgets(line, sizeof(line), handle))
+    if (sscanf(line, " %lx - %lx %511[^\n]", &first, &last, object) == 3 && (p = strrchr(object, '('))
+        && strstr(p, "text") && last > first && ranges < MAX_FILES) {
+      *p = 0;
+      range_first[ranges] = (first >> 1) & 0xffff;
+      range_last[ranges] = ((last >> 1) - 1) & 0xffff;
+      range_file[ranges++] = find_file(object);
+    }
+
+  /* Symbols: "  0x00010000 _main: ..." */
+  rewind(handle);
+  while (fgets(line, sizeof(line), handle))
+    if (sscanf(line, " 0x%lx %511[^: \n]:", &address, section) == 2)
+      for (i = 0, address = (address >> 1) & 0xffff; i < ranges; i++)
+        if (address >= range_first[i] && address <= range_last[i] && gbl$number_of_functions < MAX_FUNCTIONS) {
+          strcpy(gbl$functions[gbl$number_of_functions].name, section);
+          gbl$functions[gbl$number_of_functions].file = range_file[i];
+          gbl$functions[gbl$number_of_functions++].address = address;
+          break;
+        }
+  fclose(handle);
+
+  /* The instructions of each range are found by decoding the program from the start of the range */
+  for (i = 0; i < ranges; i++)
+    for (address = range_first[i]; address <= range_last[i]; address += instruction_length(gbl$program[address])) {
+      if (gbl$program[address] < 0) {
+        fprintf(stderr, "%s: %04lX is not part of the program, see -p\n", file_name, address);
+        return -1;
+      }
+      add_instruction(range_file[i], address, gbl$program[address], address);
+    }
+  return 0;
+}
+
+void write_lcov(FILE *handle) {
+  unsigned int i, j, hit, found, hits;
+  source_file *file;
+  covered_instruction *instruction;
+  covered_function *function;
+
+  for (i = 0; i < gbl$number_of_files; i++) {
+    if (!(file = gbl$files + i)->count)
+      continue;
+
+    fprintf(handle, "TN:\nSF:%s\n", file->name);
+    for (j = found = hits = 0, function = gbl$functions; j < gbl$number_of_functions; j++, function++)
+      if (function->file == file) {
+        hit = COVERAGE_TEST(&gbl$coverage, COVERAGE_EXECUTED, function->address);
+        fprintf(handle, "FN:%u,%s\nFNDA:%u,%s\n", function->address, function->name, hit, function->name);
+        found++;
+        hits += hit;
+      }
+    fprintf(handle, "FNF:%u\nFNH:%u\n", found, hits);
+
+    for (j = found = hits = 0, instruction = file->instructions; j < file->count; j++, instruction++)
+      if (is_conditional_branch(instruction->word)) {
+        if ((hit = COVERAGE_TEST(&gbl$coverage, COVERAGE_EXECUTED, instruction->address)))
+          fprintf(handle, "BRDA:%u,%u,0,%u\nBRDA:%u,%u,1,%u\n",
+                  instruction->line, instruction->address,
+                  COVERAGE_TEST(&gbl$coverage, COVERAGE_TAKEN, instruction->address),
+                  instruction->line, instruction->address,
+                  COVERAGE_TEST(&gbl$coverage, COVERAGE_NOT_TAKEN, instruction->address));
+        else
+          fprintf(handle, "BRDA:%u,%u,0,-\nBRDA:%u,%u,1,-\n", instruction->line, instruction->address,
+                  instruction->line, instruction->address);
+        found += 2;
+        hits += COVERAGE_TEST(&gbl$coverage, COVERAGE_TAKEN, instruction->address)
+                + COVERAGE_TEST(&gbl$coverage, COVERAGE_NOT_TAKEN, instruction->address);
+      }
+    fprintf(handle, "BRF:%u\nBRH:%u\n", found, hits);
+
+    /* Several instructions in one line (e.g. from a macro) count as one line, executed if one of them is */
+    for (j = found = hits = 0, instruction = file->instructions; j < file->count; found++) {
+      for (hit = 0; j < file->count && file->instructions[j].line == instruction->line; j++)
+        hit |= COVERAGE_TEST(&gbl$coverage, COVERAGE_EXECUTED, file->instructions[j].address);
+      fprintf(handle, "DA:%u,%u\n", instruction->line, hit);
+      hits += hit;
+      instruction = file->instructions + j;
+    }
+    fprintf(handle, "LF:%u\nLH:%u\nend_of_record\n", found, hits);
+  }
+}
+
+double percentage(unsigned int part, unsigned int total) {
+  return total ? 100.0 * part / total : 100.0;
+}
+
+void print_report() {
+  unsigned int i, j, executed, branches, outcomes, total[4] = {0};
+  source_file *file;
+  covered_instruction *instruction;
+
+  printf("%-48s %8s %8s %7s %8s %8s %7s\n", "File", "Instr.", "Exec.", "%", "Branches", "Outcomes", "%");
+  for (i = 0; i < gbl$number_of_files; i++) {
+    if (!(file = gbl$files + i)->count)
+      continue;
+
+    executed = branches = outcomes = 0;
+    for (j = 0, instruction = file->instructions; j < file->count; j++, instruction++) {
+      executed += COVERAGE_TEST(&gbl$coverage, COVERAGE_EXECUTED, instruction->address);
+      if (is_conditional_branch(instruction->word)) {
+        branches++;
+        outcomes += COVERAGE_TEST(&gbl$coverage, COVERAGE_TAKEN, instruction->address)
+                    + COVERAGE_TEST(&gbl$coverage, COVERAGE_NOT_TAKEN, instruction->address);
+      }
+    }
+    printf("%-48s %8u %8u %6.1f%% %8u %8u %6.1f%%\n", file->name, file->count, executed,
+           percentage(executed, file->count), branches, outcomes, percentage(outcomes, 2 * branches));
+    total[0] += file->count;
+    total[1] += executed;
+    total[2] += branches;
+    total[3] += outcomes;
+  }
+  printf("%-48s %8u %8u %6.1f%% %8u %8u %6.1f%%\n", "Total", total[0], total[1], percentage(total[1], total[0]),
+         total[2], total[3], percentage(total[3], 2 * total[2]));
+}
+
+int main(int argc, char **argv) {
+  char *lcov_name = NULL, *merged_name = NULL, *map_name = NULL, *program_name = NULL;
+  int option, coverage_files = 0;
+  FILE *handle;
+
+  for (option = 0; option < COVERAGE_ADDRESSES; option++)
+    gbl$program[option] = -1;
+
+  while ((option = getopt(argc, argv, "c:l:m:o:p:")) != -1)
+    switch (option) {
+      case 'c':
+        if (coverage_load(&gbl$coverage, optarg)) {
+          fprintf(stderr, "%s is no coverage file\n", optarg);
+          return 2;
+        }
+        coverage_files++;
+        break;
+      case 'l': lcov_name = optarg; break;
+      case 'm': map_name = optarg; break;
+      case 'o': merged_name = optarg; break;
+      case 'p': program_name = optarg; break;
+      default:
+        fprintf(stderr, "Usage: %s -c coverage ... [-o merged] [-l lcov] [-m mapfile -p program] [listing ...]\n\
+\t-c reads a coverage file written by qnice (COV SAVE, -C) resp. qnice-regression (-c), several are merged\n\
+\t-o writes the merged coverage file\n\
+\t-l writes an LCOV tracefile\n\
+\t-m reads a map file of vlink, -p the program it belongs to\n", argv[0]);
+        return 2;
+    }
+
+  if (!coverage_files) {
+    fprintf(stderr, "Expected at least one coverage file (-c)\n");
+    return 2;
+  }
+  if (merged_name && coverage_save(&gbl$coverage, merged_name)) {
+    fprintf(stderr, "Could not write %s\n", merged_name);
+    return 2;
+  }
+
+  if (map_name && (!program_name || read_program(program_name) || read_map(map_name))) {
+    if (!program_name)
+      fprintf(stderr, "A map file needs the program (-p)\n");
+    return 2;
+  }
+  for (; optind < argc; optind++)
+    if (read_listing(argv[optind]))
+      return 2;
+
+  if (gbl$number_of_files)
+    print_report();
+  else
+    coverage_report(&gbl$coverage, stdout);
+
+  if (lcov_name) {
+    if (!(handle = fopen(lcov_name, "w"))) {
+      perror(lcov_name);
+      return 2;
+    }
+    write_lcov(handle);
+    fclose(handle);
+  }
+  return 0;
+}
@@ -5,23 +5,40 @@
 **
 ** done by sy2002 in February 2020
 **
+** The FIFO is a lock-free ring buffer for exactly one producer thread (push) and one consumer
+** thread (pull, clear): head and tail count the pushes and pulls, so head - tail is the amount
+** of data. The producer publishes data by storing head with release semantics after writing
+** the slots, the consumer frees slots by storing tail with release semantics after reading them.
+** Elements are one byte (UART) or two bytes (keyboard codes) wide.
+**
+** The consumer can block until data arrives using fifo_wait. The producer only takes the lock to wake it up
+** if the consumer announced that it is waiting, so pushing stays lock-free otherwise.
 */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "fifo.h"
 
-fifo_t* fifo_init(unsigned int size)
+fifo_t* fifo_init(unsigned int size, unsigned int width)
 {
+    unsigned int slots = 1;
+    while (slots < size)
+        slots <<= 1;
+
     fifo_t* fifo = malloc(sizeof(fifo_t));
-    if (fifo && (fifo->data = malloc(size * sizeof(int))))
+    if (fifo && (fifo->data = malloc(slots * width)))
     {
-#ifndef __EMSCRIPTEN__ 
-        fifo->mutex = SDL_CreateMutex();
-#endif
         fifo->size = size;
-        fifo_clear(fifo);
+        fifo->mask = slots - 1;
+        fifo->width = width;
+        atomic_init(&fifo->head, 0);
+        atomic_init(&fifo->tail, 0);
+        atomic_init(&fifo->waiting, 0);
+        pthread_mutex_init(&fifo->lock, NULL);
+        pthread_cond_init(&fifo->filled, NULL);
         return fifo;
     }
     else
@@ -34,60 +51,118 @@ fifo_t* fifo_init(unsigned int size)
 
 void fifo_free(fifo_t* fifo)
 {
-#ifndef __EMSCRIPTEN__    
-    SDL_DestroyMutex(fifo->mutex);
-#endif
+    pthread_cond_destroy(&fifo->filled);
+    pthread_mutex_destroy(&fifo->lock);
     free(fifo->data);
     free(fifo);
 }
 
+//must be called by the consumer
 void fifo_clear(fifo_t* fifo)
 {
-#ifndef __EMSCRIPTEN__
-    SDL_LockMutex(fifo->mutex);
-    fifo->head = fifo->tail = fifo->count = 0;
-    SDL_UnlockMutex(fifo->mutex);
-#else
-    fifo->head = fifo->tail = fifo->count = 0;
-#endif
+    atomic_store_explicit(&fifo->tail, atomic_load_explicit(&fifo->head, memory_order_acquire), memory_order_release);
+}
+
+//wakes up the consumer if it is blocked in fifo_wait, called by the producer after publishing data
+static void fifo_wake(fifo_t* fifo)
+{
+    atomic_thread_fence(memory_order_seq_cst); //pairs with the fence in fifo_wait
+    if (atomic_load_explicit(&fifo->waiting, memory_order_relaxed))
+    {
+        pthread_mutex_lock(&fifo->lock);
+        pthread_cond_signal(&fifo->filled);
+        pthread_mutex_unlock(&fifo->lock);
+    }
+}
+
+unsigned int fifo_count(fifo_t* fifo)
+{
+    return atomic_load_explicit(&fifo->head, memory_order_acquire) - atomic_load_explicit(&fifo->tail, memory_order_acquire);
 }
 
 void fifo_push(fifo_t* fifo, int data)
 {
-#ifndef __EMSCRIPTEN__
-    SDL_LockMutex(fifo->mutex);
-#endif
-    if (fifo->count < fifo->size)
+    unsigned int head = atomic_load_explicit(&fifo->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&fifo->tail, memory_order_acquire) < fifo->size)
     {
-        fifo->data[fifo->head] = data;
-        fifo->count++;
-        if (fifo->head < (fifo->size - 1))
-            fifo->head++;
+        if (fifo->width == 1)
+            fifo->data[head & fifo->mask] = data;
         else
-            fifo->head = 0;
+            ((unsigned short*) fifo->data)[head & fifo->mask] = data;
+        atomic_store_explicit(&fifo->head, head + 1, memory_order_release);
+        fifo_wake(fifo);
     }
-#ifndef __EMSCRIPTEN__
-    SDL_UnlockMutex(fifo->mutex);
-#endif
+}
+
+/* Pushes as many bytes as fit into a FIFO of width 1 and returns their amount */
+unsigned int fifo_push_bulk(fifo_t* fifo, const unsigned char* data, unsigned int length)
+{
+    unsigned int head = atomic_load_explicit(&fifo->head, memory_order_relaxed);
+    unsigned int space = fifo->size - (head - atomic_load_explicit(&fifo->tail, memory_order_acquire));
+    if (length > space)
+        length = space;
+
+    //copy in at most two parts: up to the end of the buffer and from its start
+    unsigned int start = head & fifo->mask;
+    unsigned int first = fifo->mask + 1 - start < length ? fifo->mask + 1 - start : length;
+    memcpy(fifo->data + start, data, first);
+    memcpy(fifo->data, data + first, length - first);
+
+    atomic_store_explicit(&fifo->head, head + length, memory_order_release);
+    if (length)
+        fifo_wake(fifo);
+    return length;
 }
 
 int fifo_pull(fifo_t* fifo)
 {
-#ifndef __EMSCRIPTEN__
-    SDL_LockMutex(fifo->mutex);
-#endif
     int retval = 0;
-    if (fifo->count)
+    unsigned int tail = atomic_load_explicit(&fifo->tail, memory_order_relaxed);
+    if (atomic_load_explicit(&fifo->head, memory_order_acquire) != tail)
     {
-        retval = fifo->data[fifo->tail];
-        fifo->count--;
-        if (fifo->tail < (fifo->size - 1))
-            fifo->tail++;
+        if (fifo->width == 1)
+            retval = fifo->data[tail & fifo->mask];
         else
-            fifo->tail = 0;
+            retval = ((unsigned short*) fifo->data)[tail & fifo->mask];
+        atomic_store_explicit(&fifo->tail, tail + 1, memory_order_release);
     }
-#ifndef __EMSCRIPTEN__
-    SDL_UnlockMutex(fifo->mutex);
-#endif
     return retval;
 }
+
+/* Pulls at most length bytes from a FIFO of width 1 and returns their amount */
+unsigned int fifo_pull_bulk(fifo_t* fifo, unsigned char* data, unsigned int length)
+{
+    unsigned int tail = atomic_load_explicit(&fifo->tail, memory_order_relaxed);
+    unsigned int count = atomic_load_explicit(&fifo->head, memory_order_acquire) - tail;
+    if (length > count)
+        length = count;
+
+    //copy out in at most two parts like fifo_push_bulk
+    unsigned int start = tail & fifo->mask;
+    unsigned int first = fifo->mask + 1 - start < length ? fifo->mask + 1 - start : length;
+    memcpy(data, fifo->data + start, first);
+    memcpy(data + first, fifo->data, length - first);
+
+    atomic_store_explicit(&fifo->tail, tail + length, memory_order_release);
+    return length;
+}
+
+/* Waits at most timeout_ns nanoseconds for data and returns the amount of data, must be called by the consumer */
+unsigned int fifo_wait(fifo_t* fifo, long long timeout_ns)
+{
+    struct timespec deadline;
+    unsigned int count;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (deadline.tv_nsec + timeout_ns) / 1000000000;
+    deadline.tv_nsec = (deadline.tv_nsec + timeout_ns) % 1000000000;
+
+    //the producer either sees waiting set and signals under the lock or its data is seen by fifo_count
+    pthread_mutex_lock(&fifo->lock);
+    atomic_store_explicit(&fifo->waiting, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (!(count = fifo_count(fifo)) && !pthread_cond_timedwait(&fifo->filled, &fifo->lock, &deadline));
+    atomic_store_explicit(&fifo->waiting, 0, memory_order_relaxed);
+    pthread_mutex_unlock(&fifo->lock);
+    return count;
+}
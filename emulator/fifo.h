@@ -8,29 +8,32 @@
 #ifndef _QEMU_FIFO_H
 #define _QEMU_FIFO_H
 
-#ifndef __EMSCRIPTEN__
-# include "SDL.h"
-#endif
+#include <pthread.h>
+#include <stdatomic.h>
 
 struct fifo_type_s
 {
-    unsigned int size;      //overall size of FIFO < sizeof (unsigned int)
-    unsigned int count;     //amount of data
-    unsigned int head;      //position where the next push puts data to
-    unsigned int tail;      //position where the net pull gets data from
-    int* data;              //data buffer
-
-#ifndef __EMSCRIPTEN__
-    SDL_mutex*   mutex;     //avoid race conditions: push vs. pull
-#endif
+    unsigned int size;          //overall size of FIFO < sizeof (unsigned int)
+    unsigned int mask;          //the buffer has mask + 1 slots, a power of two >= size
+    unsigned int width;         //bytes per element: 1 or 2
+    atomic_uint  head;          //number of pushes so far, only written by the producer
+    atomic_uint  tail;          //number of pulls so far, only written by the consumer
+    unsigned char* data;        //data buffer
+    atomic_uint  waiting;       //TRUE while the consumer is blocked in fifo_wait
+    pthread_mutex_t lock;       //lock and condition of fifo_wait, only used while the consumer is waiting
+    pthread_cond_t  filled;
 };
 
 typedef struct fifo_type_s fifo_t;
 
-fifo_t*     fifo_init(unsigned int size);
-void        fifo_free(fifo_t* fifo);
-void        fifo_clear(fifo_t* fifo);
-void        fifo_push(fifo_t* fifo, int data);
-int         fifo_pull(fifo_t* fifo);
+fifo_t*         fifo_init(unsigned int size, unsigned int width);
+void            fifo_free(fifo_t* fifo);
+void            fifo_clear(fifo_t* fifo);
+unsigned int    fifo_count(fifo_t* fifo);
+void            fifo_push(fifo_t* fifo, int data);
+unsigned int    fifo_push_bulk(fifo_t* fifo, const unsigned char* data, unsigned int length);
+int             fifo_pull(fifo_t* fifo);
+unsigned int    fifo_pull_bulk(fifo_t* fifo, unsigned char* data, unsigned int length);
+unsigned int    fifo_wait(fifo_t* fifo, long long timeout_ns);
 
-#endif
\ No newline at end of file
+#endif
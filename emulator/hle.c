@@ -0,0 +1,417 @@
+/*
+**  High-level emulation of monitor routines, see hle.h.
+**
+**  Each routine below mirrors its counterpart in the monitor libraries as far as the results are concerned: The
+** memory is written in the same order (this matters for the IO area), the result registers are set and the carry
+** and overflow flags are set like by the last instruction of the routine which changes them. X, Z and N are
+** always set by the RET and therefore by the core. A routine returns FALSE before changing anything if it cannot
+** be executed natively, then it is interpreted as usual.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../dist_kit/sysdef.h"
+#include "hle.h"
+
+#ifndef TRUE
+# define TRUE 1
+# define FALSE !TRUE
+#endif
+
+#define HLE_LINE_LENGTH 1024
+
+#define R8  8
+#define R9  9
+#define R10 10
+#define R11 11
+
+typedef struct hle_routine {
+  const char *name;
+  int (*execute)(void);
+} hle_routine;
+
+/*
+** IO$PUTCHAR, IO$PUTS, IO$PUT_CRLF: Only output to the UART is done natively, the VGA output is interpreted.
+*/
+static int hle_uart_ready() {
+  return !(hle_read_memory(IO_SWITCH_REG) & 0x0002) && (hle_read_memory(IO_UART_SRA) & 0x0002);
+}
+
+static int hle_putchar() {
+  unsigned int character = hle_read_register(R8);
+
+  if (character & KBD_SPECIAL) /* Special keys are not printed */
+    return TRUE;
+  if (!hle_uart_ready())
+    return FALSE;
+
+  hle_write_memory(IO_UART_THRA, character);
+  return TRUE;
+}
+
+static int hle_puts() {
+  unsigned int address = hle_read_register(R8), character;
+
+  if (!hle_uart_ready())
+    return FALSE;
+
+  while ((character = hle_read_memory(address++) & 0x00ff))
+    hle_write_memory(IO_UART_THRA, character);
+  return TRUE;
+}
+
+static int hle_put_crlf() {
+  if (!hle_uart_ready())
+    return FALSE;
+
+  hle_write_memory(IO_UART_THRA, 0x0a);
+  hle_write_memory(IO_UART_THRA, 0x0d);
+  return TRUE;
+}
+
+/*
+** MEM$FILL (R8 = destination, R9 = count, R10 = value) and MEM$MOVE (R8 = source, R9 = destination, R10 = count):
+** The loop counter ends with SUB 1, R1 resp. R2 from 1 to 0.
+*/
+static int hle_mem_fill() {
+  unsigned int destination = hle_read_register(R8), count = hle_read_register(R9), value = hle_read_register(R10);
+
+  if (!count)
+    return TRUE;
+
+  while (count--)
+    hle_write_memory(destination++, value);
+  hle_arithmetic(0, 1, 1, TRUE);
+  return TRUE;
+}
+
+static int hle_mem_move() {
+  unsigned int source = hle_read_register(R8), destination = hle_read_register(R9), count = hle_read_register(R10);
+
+  if (!count)
+    return TRUE;
+
+  while (count--)
+    hle_write_memory(destination++, hle_read_memory(source++));
+  hle_arithmetic(0, 1, 1, TRUE);
+  return TRUE;
+}
+
+/*
+** CHR$TO_UPPER, CHR$TO_LOWER (R8 = character): Both change R8 in place.
+*/
+static int hle_chr_to_upper() {
+  unsigned int character = hle_read_register(R8), difference;
+
+  difference = character - 'a';                                    /* SUB 'a', R0 */
+  if (!(difference & 0x8000)) {
+    difference = 'z' - character;                                  /* SUB R8, R0 */
+    if (!(difference & 0x8000)) {
+      hle_arithmetic(character - 'a' + 'A', (character - 'a') & 0xffff, 'A', FALSE);
+      hle_write_register(R8, character - 'a' + 'A');
+      return TRUE;
+    }
+    hle_arithmetic(difference, 'z', character, TRUE);
+  } else
+    hle_arithmetic(difference, character, 'a', TRUE);
+  return TRUE;
+}
+
+static int hle_chr_to_lower() {
+  unsigned int character = hle_read_register(R8);
+
+  hle_compare(character, '@');
+  if (character <= '@')
+    return TRUE;
+  hle_compare(character, 'Z');
+  if (character > 'Z')
+    return TRUE;
+
+  hle_arithmetic(character + 0x20, character, 0x20, FALSE);
+  hle_write_register(R8, character + 0x20);
+  return TRUE;
+}
+
+/* Flags of the ADD 0x0001, Rx advancing a pointer from address to address + 1 */
+static void hle_increment_flags(unsigned int address) {
+  address &= 0xffff;
+  hle_arithmetic(address + 1, address, 1, FALSE);
+}
+
+/*
+** STR$TO_UPPER (R8 = string): The pointer is advanced by ADD 0x0001, R0 after each character.
+*/
+static int hle_str_to_upper() {
+  unsigned int address = hle_read_register(R8), character;
+  int empty = TRUE;
+
+  for (; (character = hle_read_memory(address)); address++, empty = FALSE) {
+    if (!((character - 'a') & 0x8000) && !(('z' - character) & 0x8000))
+      hle_write_memory(address, character - 'a' + 'A');
+  }
+
+  if (!empty)
+    hle_increment_flags(address - 1);
+  return TRUE;
+}
+
+/*
+** STR$LEN (R8 = string, length in R9): R9 counts up from 0xFFFF by ADD 0x0001, R9.
+*/
+static unsigned int hle_strlen(unsigned int address) {
+  unsigned int length = 0;
+
+  while (hle_read_memory(address++))
+    length++;
+  return length & 0xffff;
+}
+
+static int hle_str_len() {
+  unsigned int length = hle_strlen(hle_read_register(R8));
+
+  hle_write_register(R9, length);
+  hle_increment_flags(length - 1);
+  return TRUE;
+}
+
+/*
+** STR$CHOMP (R8 = string): Removes a trailing CR and/or LF, the last SUB tests for the LF. The call of STR$LEN is
+** part of the routine, its ADD sets the flags of an empty string.
+*/
+static int hle_str_chomp() {
+  unsigned int address = hle_read_register(R8), length, character;
+
+  if (!(length = hle_strlen(address))) {
+    hle_increment_flags(0xffff);
+    return TRUE;
+  }
+
+  address += length - 1;                                           /* MOVE @--R2, R3 */
+  if (hle_read_memory(address) == 0x000d) {
+    hle_write_memory(address, 0);
+    address--;
+  }
+  character = hle_read_memory(address);                            /* MOVE @R2, R3 */
+  hle_arithmetic(character - 0x000a, character, 0x000a, TRUE);
+  if (character == 0x000a)
+    hle_write_memory(address, 0);
+  return TRUE;
+}
+
+/*
+** STR$CMP (R8 = first string, R9 = second string, R10 = difference of the first characters which are not equal).
+*/
+static int hle_str_cmp() {
+  unsigned int first = hle_read_register(R8), second = hle_read_register(R9), character_0, character_1;
+
+  for (;;) {
+    character_0 = hle_read_memory(first);                          /* MOVE @R0, R10 */
+    character_1 = hle_read_memory(second++);                       /* MOVE @R1++, R2 */
+    if (character_1 != character_0)
+      break;
+    if (!hle_read_memory(first++)) {                               /* MOVE @R0++, R10 */
+      hle_arithmetic(0, character_1, character_0, TRUE);
+      hle_write_register(R10, 0);
+      return TRUE;
+    }
+  }
+
+  character_1 = hle_read_memory(--second);                         /* MOVE @--R1, R2 */
+  hle_arithmetic(character_0 - character_1, character_0, character_1, TRUE);
+  hle_write_register(R10, character_0 - character_1);
+  return TRUE;
+}
+
+/*
+** STR$STRCHR (R8 = character, R9 = string, R10 = address of the character or 0): The last CMP sets V, the last
+** ADD 0x0001, R0 (if any) C.
+*/
+static int hle_str_strchr() {
+  unsigned int character = hle_read_register(R8), address = hle_read_register(R9), value, found = 0;
+  int empty = TRUE;
+
+  for (;; address++, empty = FALSE) {
+    if (!empty)
+      hle_increment_flags(address - 1);
+    if (!(value = hle_read_memory(address))) {                     /* CMP 0x0000, @R0 */
+      hle_compare(0, value);
+      break;
+    }
+    if ((value = hle_read_memory(address)) == character) {         /* CMP R8, @R0 */
+      hle_compare(character, value);
+      found = address & 0xffff;
+      break;
+    }
+  }
+
+  hle_write_register(R10, found);
+  return TRUE;
+}
+
+/*
+** MTH$MULU32 (R9|R8 * R11|R10 = R11|R10|R9|R8): The partial products are computed natively, but the operands are
+** written to the EAE just like MTH$MULU does, so the EAE is left in the same state. The result ends with
+** ADD R10, R2 followed by ADDC R11, R3.
+*/
+static unsigned int hle_mulu(unsigned int a, unsigned int b) {
+  hle_write_memory(IO_EAE_OPERAND_0, a);
+  hle_write_memory(IO_EAE_OPERAND_1, b);
+  hle_write_memory(IO_EAE_CSR, EAE_MULU);
+  return a * b;
+}
+
+static int hle_mulu32() {
+  unsigned int a_lo = hle_read_register(R8), a_hi = hle_read_register(R9),
+    b_lo = hle_read_register(R10), b_hi = hle_read_register(R11), product, r0, r1, r2, r3, sum, carry;
+
+  product = hle_mulu(a_lo, b_lo);
+  r0 = product & 0xffff;
+  r1 = product >> 16;
+
+  product = hle_mulu(a_hi, b_lo);                                  /* ADD R10, R1; ADDC R11, R2; ADDC 0, R3 */
+  sum = r1 + (product & 0xffff);
+  r1 = sum & 0xffff;
+  sum = (product >> 16) + (sum >> 16);
+  r2 = sum & 0xffff;
+  r3 = sum >> 16;
+
+  product = hle_mulu(a_lo, b_hi);
+  sum = r1 + (product & 0xffff);
+  r1 = sum & 0xffff;
+  sum = r2 + (product >> 16) + (sum >> 16);
+  r2 = sum & 0xffff;
+  r3 = (r3 + (sum >> 16)) & 0xffff;
+
+  product = hle_mulu(a_hi, b_hi);                                  /* ADD R10, R2; ADDC R11, R3 */
+  sum = r2 + (product & 0xffff);
+  r2 = sum & 0xffff;
+  carry = sum >> 16;
+  sum = r3 + (product >> 16) + carry;
+  hle_arithmetic(sum, r3, product >> 16, FALSE);
+  r3 = sum & 0xffff;
+
+  hle_write_register(R8, r0);
+  hle_write_register(R9, r1);
+  hle_write_register(R10, r2);
+  hle_write_register(R11, r3);
+  return TRUE;
+}
+
+/*
+** MTH$DIVU32 (R9|R8 / R11|R10, quotient in R9|R8, remainder in R11|R10): The monitor uses a restoring division
+** with a 32 bit remainder register, this is done the same way here. Dividing by zero returns zero for both, after
+** CMP R10, R0 has been executed; otherwise the loop ends with SUB 1, R4 from 0 to -1.
+*/
+static int hle_divu32() {
+  unsigned int dividend = hle_read_register(R8) | (hle_read_register(R9) << 16),
+    divisor = hle_read_register(R10) | (hle_read_register(R11) << 16), quotient = 0, remainder = 0;
+  int i;
+
+  if (!divisor) {
+    hle_compare(0, 0);
+    hle_write_register(R8, 0);
+    hle_write_register(R9, 0);
+    hle_write_register(R10, 0);
+    hle_write_register(R11, 0);
+    return TRUE;
+  }
+
+  for (i = 31; i >= 0; i--) {
+    remainder = (remainder << 1) | ((dividend >> i) & 1);
+    if (remainder >= divisor) {
+      remainder -= divisor;
+      quotient |= 1u << i;
+    }
+  }
+
+  hle_arithmetic(0u - 1, 0, 1, TRUE);
+  hle_write_register(R8, quotient & 0xffff);
+  hle_write_register(R9, quotient >> 16);
+  hle_write_register(R10, remainder & 0xffff);
+  hle_write_register(R11, remainder >> 16);
+  return TRUE;
+}
+
+static hle_routine hle_routines[] = {
+  {"IO$PUTCHAR",   hle_putchar},
+  {"IO$PUTS",      hle_puts},
+  {"IO$PUT_CRLF",  hle_put_crlf},
+  {"MEM$FILL",     hle_mem_fill},
+  {"MEM$MOVE",     hle_mem_move},
+  {"CHR$TO_UPPER", hle_chr_to_upper},
+  {"CHR$TO_LOWER", hle_chr_to_lower},
+  {"STR$TO_UPPER", hle_str_to_upper},
+  {"STR$LEN",      hle_str_len},
+  {"STR$CHOMP",    hle_str_chomp},
+  {"STR$CMP",      hle_str_cmp},
+  {"STR$STRCHR",   hle_str_strchr},
+  {"MTH$MULU32",   hle_mulu32},
+  {"MTH$DIVU32",   hle_divu32},
+};
+
+#define HLE_ROUTINES (sizeof(hle_routines) / sizeof(*hle_routines))
+
+void hle_clear(hle_module *unit) {
+  unsigned int mode = unit->mode;
+
+  memset(unit, 0, sizeof(*unit));
+  unit->mode = mode;
+}
+
+/* The symbol table at the end of a listing consists of entries of the form "NAME : 0xADDR". */
+int hle_load(hle_module *unit, const char *file_name) {
+  FILE *handle;
+  char line[HLE_LINE_LENGTH], *token[HLE_LINE_LENGTH / 2 + 1], *state;
+  unsigned int count, i, j;
+
+  if (!(handle = fopen(file_name, "r")))
+    return -1;
+
+  hle_clear(unit);
+  while (fgets(line, HLE_LINE_LENGTH, handle)) {
+    for (count = 0, token[0] = strtok_r(line, " \t\r\n", &state); token[count];
+         token[++count] = strtok_r(NULL, " \t\r\n", &state));
+
+    for (i = 0; i + 2 < count; i++)
+      if (!strcmp(token[i + 1], ":")) {
+        for (j = 0; j < HLE_ROUTINES; j++)
+          if (!strcmp(token[i], hle_routines[j].name) && !unit->address[j]) {
+            unit->address[j] = strtol(token[i + 2], NULL, 0) & 0xffff;
+            unit->entry[unit->address[j]] = j + 1;
+            unit->routines++;
+          }
+        i += 2;
+      }
+  }
+
+  fclose(handle);
+  return unit->routines;
+}
+
+int hle_execute(hle_module *unit, unsigned int address) {
+  unsigned int routine = unit->entry[address & 0xffff] - 1;
+
+  if (!hle_routines[routine].execute()) {
+    unit->fallbacks[routine]++;
+    return FALSE;
+  }
+
+  unit->calls[routine]++;
+  return TRUE;
+}
+
+const char *hle_name(hle_module *unit, unsigned int address) {
+  return unit->entry[address & 0xffff] ? hle_routines[unit->entry[address & 0xffff] - 1].name : NULL;
+}
+
+void hle_report(hle_module *unit, FILE *handle) {
+  unsigned int i;
+
+  fprintf(handle, "ROUTINE          ADDR            CALLS      FALLBACKS   INTERPRETED (STRICT)\n");
+  fprintf(handle, "----------------------------------------------------------------------------\n");
+  for (i = 0; i < HLE_ROUTINES; i++)
+    if (unit->address[i])
+      fprintf(handle, "%-16s %04X %16llu %14llu %14llu\n", hle_routines[i].name, unit->address[i], unit->calls[i],
+              unit->fallbacks[i], unit->interpreted[i]);
+}
@@ -0,0 +1,57 @@
+/*
+**  Header file for the high-level emulation (HLE) of monitor routines: The entry addresses of frequently used
+** routines of the monitor (output, memory, string and 32 bit math routines) are taken from the label list of the
+** monitor (monitor.lis). When the CPU reaches such an address, the routine is executed natively and the core performs
+** the RET ending it, so the registers, the memory, the flags and the IO registers written are the same as if the
+** routine had been interpreted. Not reproduced are the values the routine leaves in its scratch register banks
+** (the banks above the one of the caller) and the return addresses of nested calls below the stack pointer.
+**
+**  In strict mode each call is executed both natively and by interpretation and the results are compared, the
+** machine continues with the interpreted result, so strict mode does not change the behaviour of a program.
+*/
+
+#ifndef HLE_H
+#define HLE_H
+
+#include <stdio.h>
+
+#define HLE_OFF             0
+#define HLE_ON              1
+#define HLE_STRICT          2
+
+#define HLE_ADDRESSES       65536
+#define HLE_MAX_ROUTINES    32
+#define HLE_CYCLES          4       /* A routine executed natively costs as much as the RET ending it */
+
+typedef struct hle_module {
+  unsigned int mode, routines;                      /* Number of routines found in the label list */
+  unsigned char entry[HLE_ADDRESSES];               /* Number of the routine starting at an address plus 1 */
+  unsigned int address[HLE_MAX_ROUTINES];
+  unsigned long long calls[HLE_MAX_ROUTINES],       /* Calls executed natively resp. verified in strict mode */
+    fallbacks[HLE_MAX_ROUTINES],                    /* Calls interpreted since native execution was not possible */
+    interpreted[HLE_MAX_ROUTINES];                  /* Instructions needed by the interpretation in strict mode */
+} hle_module;
+
+/* Read the addresses of the routines from a listing (.lis), returns the number of routines found resp. -1 */
+int hle_load(hle_module *, const char *file_name);
+void hle_clear(hle_module *);
+
+/* Execute the routine starting at address natively, FALSE if it has to be interpreted (e.g. output to VGA) */
+int hle_execute(hle_module *, unsigned int address);
+
+const char *hle_name(hle_module *, unsigned int address);
+void hle_report(hle_module *, FILE *handle);
+
+/*
+**  Provided by the core (qnice.c): Memory accesses, including the IO area, and the registers of the current bank.
+** hle_arithmetic() sets the flags like an ADD/ADDC (subtract = 0) resp. SUB/SUBC instruction with these operands
+** and this (not yet truncated) result, hle_compare() sets Z, N and V like a CMP instruction.
+*/
+unsigned int hle_read_memory(unsigned int address);
+void hle_write_memory(unsigned int address, unsigned int value);
+unsigned int hle_read_register(unsigned int number);
+void hle_write_register(unsigned int number, unsigned int value);
+void hle_arithmetic(unsigned int destination, unsigned int source_0, unsigned int source_1, int subtract);
+void hle_compare(unsigned int source_0, unsigned int source_1);
+
+#endif
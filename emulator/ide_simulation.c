@@ -25,14 +25,24 @@
 *	assembler directive is interpreted the BSY bit has been reset to zero (we would need multithreading to
 *	implement it otherwise). Anyway the BSY bit should always been checked in the assembler code because with
 *	a real drive it may take some time until a command is executed or aborted and the BSY bit is reseted to 0.
-*---	Currently only CHS addressing is supported even though according to cf spec LBA should be supported too. 
+*---	CHS and LBA addressing are supported. In CHS mode cylinders and heads are counted from 1 like sectors.
+*---	The card stores bytes in pages of SECTORS_PER_PAGE sectors which are allocated on the first write, so an
+*	unused card needs (almost) no memory and reads of unwritten sectors return zeros. Alternatively an image file
+*	can be attached (attachIDEImage), which is memory mapped and thus persists the card. A sector is copied
+*	between the storage and the transfer buffer in one go, the data register accesses only move words between
+*	the buffer and the host.
 * @Author: Kai Lutterbeck
 */
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "ide_simulation.h"
+#include "snapshot.h"
 
 #undef DEBUG
 
@@ -44,6 +54,9 @@
 #define NO_OF_SECTORS                    32
 #define NO_OF_BYTES_PER_SECTOR    		512
 #define MAX_SECTORS_PER_ACCESS			256
+#define NO_OF_SECTORS_TOTAL			(NO_OF_CYLINDERS * NO_OF_HEADS * NO_OF_SECTORS)
+#define SECTORS_PER_PAGE			64
+#define NO_OF_PAGES				(NO_OF_SECTORS_TOTAL / SECTORS_PER_PAGE)
 
 //All registers are 8bit long except the data register which is 16bit long.
 #define NO_OF_INTERNAL_IDE_REGISTERS 	12
@@ -62,15 +75,17 @@
 
 #define READ_MODE   TRUE
 #define WRITE_MODE  FALSE
-/*All information in the ide_device struct are specific for one device.*/
+/*All information in the ide_device struct are specific for one device. The contents of the card are kept
+  outside of the struct (see gbl$pages and gbl$image), so the struct is part of machine snapshots. */
 typedef struct ide_device
 {
-	int device[NO_OF_CYLINDERS][NO_OF_HEADS][NO_OF_SECTORS][NO_OF_BYTES_PER_SECTOR],
-		registers[NO_OF_INTERNAL_IDE_REGISTERS], 
-		buffer[NO_OF_BYTES_PER_SECTOR],
+	unsigned char buffer[NO_OF_BYTES_PER_SECTOR];
+	int registers[NO_OF_INTERNAL_IDE_REGISTERS], 
 		current_cylinder,
 		current_head,
 		current_sector,
+		current_lba,
+		lba_mode,
 		no_sectors_to_access,
 		sector_count, 
 		pio_datain_in_progress,
@@ -82,6 +97,12 @@ typedef struct ide_device
 
 ide_device gbl$device0;
 
+/* Sparse storage of the card: Pages of SECTORS_PER_PAGE sectors are allocated on the first write. If an image
+   file is attached, it is mapped to gbl$image instead. */
+unsigned char *gbl$pages[NO_OF_PAGES], *gbl$image = NULL;
+int gbl$image_fd = -1;
+const unsigned char gbl$zero_sector[NO_OF_BYTES_PER_SECTOR];
+
 
 void writeRegister(unsigned int address, unsigned int value);
 void writeDataRegister(unsigned int value);
@@ -92,6 +113,75 @@ void executeCommand();
 void handleReadWriteSectors(int isReadMode, int isVerifyOnly); 
 void verifyReadSectors();
 void prepareNextSectorForPIO(int isReadMode, int isVerifyOnly);
+void writeAddressRegisters();
+
+
+/* Returns the storage of a sector. Unwritten sectors of the sparse storage are only allocated for writing, for
+ * reading they are represented by a sector of zeros. */
+unsigned char *sectorStorage(int lba, int isReadMode)
+{
+	unsigned char **page = &gbl$pages[lba / SECTORS_PER_PAGE];
+
+	if (gbl$image)
+		return gbl$image + (size_t) lba * NO_OF_BYTES_PER_SECTOR;
+
+	if (! *page) {
+		if (isReadMode)
+			return (unsigned char *) gbl$zero_sector;
+		if (! (*page = calloc(SECTORS_PER_PAGE, NO_OF_BYTES_PER_SECTOR))) {
+			printf("sectorStorage: Out of memory!\n");
+			exit(-1);
+		}
+	}
+	return *page + (lba % SECTORS_PER_PAGE) * NO_OF_BYTES_PER_SECTOR;
+}
+
+/* Attaches an image file as the contents of the card. The file is created resp. extended (sparsely) to the size
+ * of the card if necessary. The previous contents of the card are discarded. Returns FALSE on failure. */
+int attachIDEImage(char *filename)
+{
+	size_t size = (size_t) NO_OF_SECTORS_TOTAL * NO_OF_BYTES_PER_SECTOR;
+	struct stat status;
+	void *image;
+	int fd;
+
+	if ((fd = open(filename, O_RDWR | O_CREAT, 0644)) < 0 || fstat(fd, &status) ||
+		(status.st_size < (off_t) size && ftruncate(fd, size)) ||
+		(image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		printf("attachIDEImage: Unable to attach image file >>%s<<!\n", filename);
+		if (fd >= 0)
+			close(fd);
+		return FALSE;
+	}
+
+	detachIDEImage();
+	gbl$image = image;
+	gbl$image_fd = fd;
+	return TRUE;
+}
+
+/* Detaches the image file resp. clears the sparse storage */
+void detachIDEImage()
+{
+	int i;
+
+	if (gbl$image) {
+		munmap(gbl$image, (size_t) NO_OF_SECTORS_TOTAL * NO_OF_BYTES_PER_SECTOR);
+		close(gbl$image_fd);
+		gbl$image = NULL;
+		gbl$image_fd = -1;
+	}
+	for (i = 0; i < NO_OF_PAGES; i++) {
+		free(gbl$pages[i]);
+		gbl$pages[i] = NULL;
+	}
+}
+
+/* The registers and the transfer state are part of machine snapshots, the contents of the card are not. */
+void registerIDESnapshot()
+{
+	snapshot_register("gbl$device0", &gbl$device0, sizeof(gbl$device0), NULL, NULL, NULL, NULL, 0);
+}
 
 
 
@@ -328,28 +418,28 @@ void handleReadWriteSectors(int isReadMode, int isVerifyOnly) {
 		last command execution. */
 	writeRegister(ERROR_REGISTER, 0x00);
 	
-	/*check addressing mode  - only CHS is supported 
-	  We have to exit here because a controller should support both modes and for this reason 
-	  no error code or behavior is defined
-	*/
-	if ((readRegister(SDH_REGISTER) & 0x40))  { 
-		//LBA (bit 6) is set.
-		printf("LBA addressing is currently not supported!\n");
-		exit(-1);
-	}
-	
 	//begin determine parameters
+	gbl$device0.lba_mode = (readRegister(SDH_REGISTER) & 0x40) != 0;
 	
-	//determine starting cylinder 
-	gbl$device0.current_cylinder = 
-		(readRegister(CYLINDER_HIGH_REGISTER)<<8) 
-		| readRegister(CYLINDER_LOW_REGISTER);
-	
-	//determine starting head - lower 4 bits of SDH Register
-	gbl$device0.current_head = readRegister(SDH_REGISTER) & 0xf;
-	
-	//determine starting sector
-	gbl$device0.current_sector = readRegister(SECTOR_NUMBER_REGISTER);
+	if (gbl$device0.lba_mode) {
+		//LBA (bit 6) is set: bits 27..24 are in the SDH Register, bits 7..0 in the Sector Number Register
+		gbl$device0.current_lba = 
+			((readRegister(SDH_REGISTER) & 0xf) << 24)
+			| (readRegister(CYLINDER_HIGH_REGISTER) << 16)
+			| (readRegister(CYLINDER_LOW_REGISTER) << 8)
+			| readRegister(SECTOR_NUMBER_REGISTER);
+	} else {
+		//determine starting cylinder 
+		gbl$device0.current_cylinder = 
+			(readRegister(CYLINDER_HIGH_REGISTER)<<8) 
+			| readRegister(CYLINDER_LOW_REGISTER);
+		
+		//determine starting head - lower 4 bits of SDH Register
+		gbl$device0.current_head = readRegister(SDH_REGISTER) & 0xf;
+		
+		//determine starting sector
+		gbl$device0.current_sector = readRegister(SECTOR_NUMBER_REGISTER);
+	}
 	
 	//determine numbers of sectors to read or write
 	gbl$device0.no_sectors_to_access = readRegister(SECTOR_COUNT_REGISTER);
@@ -358,15 +448,18 @@ void handleReadWriteSectors(int isReadMode, int isVerifyOnly) {
 		gbl$device0.no_sectors_to_access = MAX_SECTORS_PER_ACCESS;
 	//end determine parameterss
 #ifdef DEBUG
-	printf("handleReadWriteSectors: Parameters found:\nCylinder: %i\nHead: %i\nSector: %i\n", 
+	printf("handleReadWriteSectors: Parameters found:\nLBA mode: %i\nLBA: %i\nCylinder: %i\nHead: %i\nSector: %i\n", 
+		gbl$device0.lba_mode, gbl$device0.current_lba,
 		gbl$device0.current_cylinder, gbl$device0.current_head, gbl$device0.current_sector);
 #endif
 	//check if parameters are valid
-	if ( gbl$device0.current_cylinder == 0 || gbl$device0.current_cylinder > NO_OF_CYLINDERS ||
+	if (gbl$device0.lba_mode ? gbl$device0.current_lba >= NO_OF_SECTORS_TOTAL :
+		 gbl$device0.current_cylinder == 0 || gbl$device0.current_cylinder > NO_OF_CYLINDERS ||
 		 gbl$device0.current_head == 0 || gbl$device0.current_head > NO_OF_HEADS ||
 		 gbl$device0.current_sector == 0 || gbl$device0.current_sector > NO_OF_SECTORS) {
 #ifdef DEBUG
-			printf("handleReadWriteSectors: Invalid parameter(s):\nCylinder: %x\nHead: %x\nSector: %x\n", 
+			printf("handleReadWriteSectors: Invalid parameter(s):\nLBA: %x\nCylinder: %x\nHead: %x\nSector: %x\n", 
+				gbl$device0.current_lba,
 				gbl$device0.current_cylinder, gbl$device0.current_head, gbl$device0.current_sector);
 #endif
 			//Setting ABRT (Command aborted)
@@ -377,6 +470,9 @@ void handleReadWriteSectors(int isReadMode, int isVerifyOnly) {
 			writeRegister(STATUS_REGISTER, 0x51);    
 			writeRegister(ALTERNATE_STATUS_REGISTER, 0x51);  
 			error = TRUE;	
+	} else if (! gbl$device0.lba_mode) {
+		gbl$device0.current_lba = ((gbl$device0.current_cylinder - 1) * NO_OF_HEADS + 
+			gbl$device0.current_head - 1) * NO_OF_SECTORS + gbl$device0.current_sector - 1;
 	}
 	
 	if (! error) {
@@ -409,62 +505,34 @@ void prepareNextSectorForPIO(int isReadMode, int isVerifyOnly) {
 		
 		//when not the start sector is transfered we have to increase current sector
 		if (gbl$device0.sector_count > 0) { 
-			//check if increasing the sector would cross a head boundary  
-			if ((gbl$device0.current_sector + 1) > NO_OF_SECTORS){
-				//setting sector to first sector of the new head
-				gbl$device0.current_sector = 1;
-				//check if increasing the head would cross a cylinder boundary
-				if ((gbl$device0.current_head + 1) > NO_OF_HEADS){
-					//go to the first head of the next cylinder
-					gbl$device0.current_head = 1;
-					gbl$device0.current_cylinder++;
-					//if going to the next cylinder reaches end of disk read must be aborted!
-					if (gbl$device0.current_cylinder > NO_OF_CYLINDERS) {
+			gbl$device0.current_lba++;
+			//if going to the next sector reaches end of disk the access must be aborted!
+			if (gbl$device0.current_lba >= NO_OF_SECTORS_TOTAL) {
 #ifdef DEBUG
-						printf("prepareNextSectorForPIO: Invalid address:\nCylinder: %x\nHead: %x\nSector: %x\n", 
-							gbl$device0.current_cylinder, gbl$device0.current_head, 
-							gbl$device0.current_sector);
+				printf("prepareNextSectorForPIO: Invalid address:\nLBA: %x\n", gbl$device0.current_lba);
 #endif
-						//Setting ABRT (Command aborted)
-						writeRegister(ERROR_REGISTER, 0x04); 
-						//in this case CHS-Registers should contain the address the access error occured at
-						writeRegister(SDH_REGISTER, (gbl$device0.current_head & 0xf) |
-													  (readRegister(SDH_REGISTER) & 0xf0));
-						writeRegister(SECTOR_NUMBER_REGISTER, gbl$device0.current_sector & 0xff);
-						writeRegister(CYLINDER_HIGH_REGISTER, (gbl$device0.current_cylinder >> 8) & 0xff);
-						writeRegister(CYLINDER_LOW_REGISTER, gbl$device0.current_cylinder & 0x00ff);
-						//Extended error code: invalid address
-						gbl$device0.extended_error_code=0x21;  
-						//Setting DRDY, DSC and ERR and clearing BSY
-						writeRegister(STATUS_REGISTER, 0x51);    
-						writeRegister(ALTERNATE_STATUS_REGISTER, 0x51);  
-						error = TRUE;	
-					}
-				} else {
-					gbl$device0.current_head++;
-				}
-			} else {
-				gbl$device0.current_sector++;
-			}			
+				//Setting ABRT (Command aborted)
+				writeRegister(ERROR_REGISTER, 0x04); 
+				//in this case CHS-Registers should contain the address the access error occured at
+				writeAddressRegisters();
+				//Extended error code: invalid address
+				gbl$device0.extended_error_code=0x21;  
+				//Setting DRDY, DSC and ERR and clearing BSY
+				writeRegister(STATUS_REGISTER, 0x51);    
+				writeRegister(ALTERNATE_STATUS_REGISTER, 0x51);  
+				error = TRUE;	
+			}
 		} //end of increasing sector
 		
 		if (! error) {
 			if (isReadMode) {
 			    //fill read buffer with next sector
-				int i;
-				for (i=0; i<NO_OF_BYTES_PER_SECTOR; i++) {
-					gbl$device0.buffer[i] = 
-						gbl$device0.device[gbl$device0.current_cylinder-1][gbl$device0.current_head-1]
-						[gbl$device0.current_sector-1][i];
-				}
+				memcpy(gbl$device0.buffer, sectorStorage(gbl$device0.current_lba, READ_MODE), NO_OF_BYTES_PER_SECTOR);
 				gbl$device0.no_of_bytes_transfered=0;
 				gbl$device0.buffer_filled=TRUE;
 			} else {
 				//clear buffer
-				int i;
-				for (i=0; i<NO_OF_BYTES_PER_SECTOR; i++) {
-					gbl$device0.buffer[i] = 0;
-				}
+				memset(gbl$device0.buffer, 0, NO_OF_BYTES_PER_SECTOR);
 				gbl$device0.no_of_bytes_transfered=0;
 			}
 			if (! isVerifyOnly) {
@@ -481,13 +549,29 @@ void prepareNextSectorForPIO(int isReadMode, int isVerifyOnly) {
 		gbl$device0.pio_dataout_in_progress=FALSE;
 		
 		//At end of command CHS-Registers should contain the address of the last sector read or written
-		writeRegister(SDH_REGISTER, (gbl$device0.current_head & 0xf) |
-									  (readRegister(SDH_REGISTER) & 0xf0));
+		writeAddressRegisters();
+		writeRegister(STATUS_REGISTER, 0x50);  
+		writeRegister(ALTERNATE_STATUS_REGISTER, 0x50);
+	}
+}
+
+/* Writes the current sector to the CHS resp. LBA registers, depending on the addressing mode of the command */
+void writeAddressRegisters() {
+	int lba = gbl$device0.current_lba;
+
+	if (! gbl$device0.lba_mode) {
+		gbl$device0.current_sector = lba % NO_OF_SECTORS + 1;
+		gbl$device0.current_head = (lba / NO_OF_SECTORS) % NO_OF_HEADS + 1;
+		gbl$device0.current_cylinder = lba / (NO_OF_SECTORS * NO_OF_HEADS) + 1;
+		writeRegister(SDH_REGISTER, (gbl$device0.current_head & 0xf) | (readRegister(SDH_REGISTER) & 0xf0));
 		writeRegister(SECTOR_NUMBER_REGISTER, gbl$device0.current_sector & 0xff);
 		writeRegister(CYLINDER_HIGH_REGISTER, (gbl$device0.current_cylinder >> 8) & 0xff);
 		writeRegister(CYLINDER_LOW_REGISTER, gbl$device0.current_cylinder & 0x00ff);
-		writeRegister(STATUS_REGISTER, 0x50);  
-		writeRegister(ALTERNATE_STATUS_REGISTER, 0x50);
+	} else {
+		writeRegister(SDH_REGISTER, ((lba >> 24) & 0xf) | (readRegister(SDH_REGISTER) & 0xf0));
+		writeRegister(CYLINDER_HIGH_REGISTER, (lba >> 16) & 0xff);
+		writeRegister(CYLINDER_LOW_REGISTER, (lba >> 8) & 0xff);
+		writeRegister(SECTOR_NUMBER_REGISTER, lba & 0xff);
 	}
 }
 
@@ -500,9 +584,9 @@ unsigned int readDataRegister(){
 		//expecting 256 reads in a row. 
 		if (gbl$device0.no_of_bytes_transfered < NO_OF_BYTES_PER_SECTOR && gbl$device0.buffer_filled) {
 			//write bytes to the Data Register before read.
-			writeRegister(DATA_REGISTER, (gbl$device0.buffer[gbl$device0.no_of_bytes_transfered+1]<<8) 
-											| gbl$device0.buffer[gbl$device0.no_of_bytes_transfered]);
-			returnCode = readRegister(DATA_REGISTER);
+			returnCode = gbl$device0.registers[DATA_REGISTER] = 
+				(gbl$device0.buffer[gbl$device0.no_of_bytes_transfered+1]<<8) 
+				| gbl$device0.buffer[gbl$device0.no_of_bytes_transfered];
 			//prepare for next read
 			gbl$device0.no_of_bytes_transfered += 2;
 #ifdef DEBUG
@@ -540,11 +624,7 @@ void writeDataRegister(unsigned int value){
 			//check if last two bytes of the sector were transfered
 			if (gbl$device0.no_of_bytes_transfered==NO_OF_BYTES_PER_SECTOR)	{
 				//write buffer to sector
-				int i;
-				for (i=0; i<NO_OF_BYTES_PER_SECTOR; i++) {
-					gbl$device0.device[gbl$device0.current_cylinder-1][gbl$device0.current_head-1]
-						[gbl$device0.current_sector-1][i] = gbl$device0.buffer[i];
-				}
+				memcpy(sectorStorage(gbl$device0.current_lba, WRITE_MODE), gbl$device0.buffer, NO_OF_BYTES_PER_SECTOR);
 				//prepare next sector for write
 				gbl$device0.sector_count+=1;
 				prepareNextSectorForPIO(WRITE_MODE, FALSE);
@@ -564,13 +644,12 @@ void initializeIDEDevice() {
 		gbl$device0.buffer_filled=FALSE;
 		gbl$device0.pio_datain_in_progress=FALSE;
 		gbl$device0.pio_dataout_in_progress=FALSE;
-		int i;
-		for (i=0; i<NO_OF_BYTES_PER_SECTOR; i++) {
-			gbl$device0.buffer[i] = 0;
-		}
+		memset(gbl$device0.buffer, 0, NO_OF_BYTES_PER_SECTOR);
 		gbl$device0.current_cylinder=0;
 		gbl$device0.current_head=0;
 		gbl$device0.current_sector=0;
+		gbl$device0.current_lba=0;
+		gbl$device0.lba_mode=FALSE;
 		gbl$device0.no_sectors_to_access=0;
 		gbl$device0.sector_count=0; 
 		gbl$device0.no_of_bytes_transfered=0;
@@ -3,11 +3,15 @@
 # define FALSE !TRUE
 #endif
 
+#define IDE_BASE_ADDRESS        0xFF40 /* Not used by the hardware, which has no IDE controller */
 #define IDE_NUMBER_OF_REGISTERS 16
 
 void writeIDEDeviceRegister(unsigned int address, unsigned int value);
 unsigned int readIDEDeviceRegister(unsigned int address);
 void initializeIDEDevice();
+int attachIDEImage(char *filename);
+void detachIDEImage();
+void registerIDESnapshot();
 
 //For testing purposes only - will be removed at end of development
 void testMe();
@@ -0,0 +1,25 @@
+/*
+**  Header file for the IO dispatch of the QNICE-emulator: Every address of the IO area (0xFF00..0xFFFF) has an
+** entry in a 256 entry table which is filled by devices calling io_register(...). Addresses which are not
+** registered read as 0, writes to them are ignored.
+**
+**  The handlers are called with the absolute IO address and the context pointer given when registering.
+*/
+
+#ifndef IO_H
+#define IO_H
+
+#define IO_PAGE_SIZE 256
+
+/* Results of the functions of input devices which wait for input, e.g. uart_wait_input() */
+#define IO_INPUT_READY   0
+#define IO_INPUT_TIMEOUT 1
+#define IO_INPUT_NEVER   2 /* No input can arrive anymore, e.g. at the end of a redirected input file */
+
+typedef unsigned int (*io_read_handler)(void *context, unsigned int address);
+typedef void (*io_write_handler)(void *context, unsigned int address, unsigned int value);
+
+/* Register handlers for the addresses first..last, a NULL handler selects the default behaviour. */
+void io_register(unsigned int first, unsigned int last, io_read_handler, io_write_handler, void *context);
+
+#endif
@@ -0,0 +1,4 @@
+#!/bin/bash
+#Build the coverage report tool qnice-coverage, see coverage_report.c
+source ../tools/detect.include
+$COMPILER coverage_report.c coverage.c -O3 -o qnice-coverage
@@ -0,0 +1,33 @@
+#!/bin/bash
+#Build the emulator library libqnice (static and shared), see qnice_machine.h
+source ../tools/detect.include
+FILES="qnice.c fifo.c uart.c sd.c timer.c snapshot.c profiler.c symbols.c hle.c breakpoints.c coverage.c recorder.c x86_64.c"
+DEF_SWITCHES="-DQNICE_LIBRARY -DUSE_SD -DUSE_UART -DUSE_TIMER"
+#The VGA (window and threads) and the IDE simulation are not part of the library
+UNDEF_SWITCHES="-UUSE_VGA -UUSE_IDE -U__EMSCRIPTEN__"
+CORE_SWITCHES="-DUSE_THREADED_CORE"
+if [ $OSTP = "OSX" ]; then
+    SHARED_SWITCHES="-dynamiclib"
+    SHARED_LIBRARY="libqnice.dylib"
+else
+    SHARED_SWITCHES="-shared"
+    SHARED_LIBRARY="libqnice.so"
+    MORE_SWITCHES="-lpthread"
+fi;
+
+OBJECTS=""
+for FILE in $FILES; do
+    $COMPILER -c $FILE -O3 -fPIC -fvisibility=hidden $DEF_SWITCHES $UNDEF_SWITCHES $CORE_SWITCHES -o ${FILE%.c}.lib.o || exit 1
+    OBJECTS="$OBJECTS ${FILE%.c}.lib.o"
+done
+
+#Only the functions of qnice_machine.h are exported, the internal symbols of the static library are made local, too
+rm -f libqnice.a
+if hash objcopy 2>/dev/null; then
+    ld -r $OBJECTS -o libqnice.o && objcopy --localize-hidden libqnice.o && ar rcs libqnice.a libqnice.o
+    rm -f libqnice.o
+else
+    ar rcs libqnice.a $OBJECTS
+fi;
+$COMPILER $SHARED_SWITCHES $OBJECTS $MORE_SWITCHES -o $SHARED_LIBRARY
+rm -f $OBJECTS
@@ -0,0 +1,4 @@
+#!/bin/bash
+#Build the trace query tool qnice-trace, see trace_query.c
+source ../tools/detect.include
+$COMPILER trace_query.c recorder.c snapshot.c fifo.c -O3 -lpthread -o qnice-trace
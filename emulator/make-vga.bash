@@ -45,7 +45,9 @@ fi
 
 SDL2_LIBS=`sdl2-config --libs`
 
-FILES="qnice.c fifo.c sd.c uart.c vga.c timer.c"
+FILES="qnice.c fifo.c sd.c uart.c vga.c timer.c snapshot.c profiler.c symbols.c hle.c breakpoints.c coverage.c recorder.c x86_64.c"
 DEF_SWITCHES="-DUSE_SD -DUSE_UART -DUSE_VGA -DUSE_TIMER"
 UNDEF_SWITCHES="-UUSE_IDE -U__EMSCRIPTEN__"
-$COMPILER $FILES -O3 $DEF_SWITCHES $UNDEF_SWITCHES $SDL2_CFLAGS $SDL2_LIBS -o qnice-vga
+#Glyph rendering uses SSE2 on x86-64, add "-mavx2" (or "-march=native") for AVX2
+SIMD_SWITCHES=""
+$COMPILER $FILES -O3 $DEF_SWITCHES $UNDEF_SWITCHES $SIMD_SWITCHES $SDL2_CFLAGS $SDL2_LIBS -o qnice-vga
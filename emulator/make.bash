@@ -1,9 +1,12 @@
 #!/bin/bash
 source ../tools/detect.include
-FILES="qnice.c uart.c sd.c timer.c"
+FILES="qnice.c fifo.c uart.c sd.c timer.c snapshot.c profiler.c symbols.c hle.c breakpoints.c coverage.c recorder.c x86_64.c ide_simulation.c"
 DEF_SWITCHES="-DUSE_SD -DUSE_UART -DUSE_TIMER"
+#IDE/CF card simulation at 0xFF40 (no hardware counterpart): replace "-UUSE_IDE" by "-DUSE_IDE"
 UNDEF_SWITCHES="-UUSE_VGA -UUSE_IDE -U__EMSCRIPTEN__"
+#Interpreter core: "-DUSE_THREADED_CORE" selects the computed goto core (gcc/clang only), "-UUSE_THREADED_CORE" the portable one
+CORE_SWITCHES="-DUSE_THREADED_CORE"
 if [ $OSTP = "LINUX" ]; then
     MORE_SWITCHES="-lpthread"
 fi;
-$COMPILER $FILES -O3 $DEF_SWITCHES $UNDEF_SWITCHES $MORE_SWITCHES -o qnice
+$COMPILER $FILES -O3 $DEF_SWITCHES $UNDEF_SWITCHES $CORE_SWITCHES $MORE_SWITCHES -o qnice
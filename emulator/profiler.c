@@ -0,0 +1,230 @@
+/*
+**  Execution profiler, see profiler.h.
+**
+**  Each node of the call tree stands for a subroutine reached via a certain call path. A shadow stack holds the
+** nodes of the active calls together with the stack pointer right after the return address was pushed. A return
+** pops all frames whose return address lies below the new stack pointer, so subroutines which do not return via
+** MOVE @R13++, R15 (e.g. the monitor's exit) are cleaned up by the next return of one of their callers.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profiler.h"
+#include "symbols.h"
+
+#define PROFILE_ADDRESSES   65536
+#define PROFILE_ROOT        0xffffffff  /* Address of the root node, i.e. code not called by any subroutine */
+#define PROFILE_NAME_LENGTH 80
+
+typedef struct profile_node {
+  unsigned int address, parent, first_child, next_sibling;
+  unsigned long long calls, self;
+} profile_node;
+
+typedef struct profile_frame {
+  unsigned int node, sp;
+} profile_frame;
+
+static unsigned long long counts[PROFILE_ADDRESSES], taken[PROFILE_ADDRESSES], not_taken[PROFILE_ADDRESSES];
+
+static profile_node nodes[PROFILE_MAX_NODES];
+static unsigned int no_of_nodes, current;
+
+static profile_frame stack[PROFILE_MAX_DEPTH];
+static unsigned int depth;
+
+void profile_reset() {
+  memset(counts, 0, sizeof(counts));
+  memset(taken, 0, sizeof(taken));
+  memset(not_taken, 0, sizeof(not_taken));
+
+  memset(nodes, 0, sizeof(profile_node));
+  nodes[0].address = PROFILE_ROOT;
+  no_of_nodes = 1;
+  current = depth = 0;
+}
+
+void profile_instruction(unsigned int address, unsigned int cost) {
+  counts[address]++;
+  nodes[current].self += cost;
+}
+
+void profile_branch(unsigned int address, int condition) {
+  if (condition)
+    taken[address]++;
+  else
+    not_taken[address]++;
+}
+
+void profile_call(unsigned int target, unsigned int sp) {
+  unsigned int child;
+
+  if (depth == PROFILE_MAX_DEPTH)
+    return;
+
+  for (child = nodes[current].first_child; child && nodes[child].address != target; child = nodes[child].next_sibling);
+  if (!child && no_of_nodes < PROFILE_MAX_NODES) {
+    child = no_of_nodes++;
+    nodes[child].address = target;
+    nodes[child].parent = current;
+    nodes[child].first_child = 0;
+    nodes[child].next_sibling = nodes[current].first_child;
+    nodes[child].calls = nodes[child].self = 0;
+    nodes[current].first_child = child;
+  }
+  if (!child) /* The call tree is full */
+    child = current;
+
+  nodes[child].calls++;
+  stack[depth].node = current = child;
+  stack[depth++].sp = sp;
+}
+
+void profile_return(unsigned int sp) {
+  while (depth && stack[depth - 1].sp < sp)
+    depth--;
+  current = depth ? stack[depth - 1].node : 0;
+}
+
+static char *profile_name(unsigned int address, char *buffer) {
+  if (address == PROFILE_ROOT)
+    return strcpy(buffer, "[root]");
+  return symbols_format(address, buffer, PROFILE_NAME_LENGTH);
+}
+
+static unsigned long long *sort_keys;
+
+static int profile_compare(const void *a, const void *b) {
+  unsigned long long key_a = sort_keys[*(const unsigned int *) a], key_b = sort_keys[*(const unsigned int *) b];
+
+  return key_a < key_b ? 1 : key_a > key_b ? -1 : 0;
+}
+
+/* Sort the indices 0..PROFILE_ADDRESSES-1 descending by keys */
+static unsigned int *profile_sort(unsigned long long *keys) {
+  unsigned int *index;
+
+  if (!(index = malloc(PROFILE_ADDRESSES * sizeof(unsigned int))))
+    return NULL;
+
+  for (unsigned int i = 0; i < PROFILE_ADDRESSES; i++)
+    index[i] = i;
+  sort_keys = keys;
+  qsort(index, PROFILE_ADDRESSES, sizeof(unsigned int), profile_compare);
+  return index;
+}
+
+/*
+**  Print the most frequently executed addresses and the subroutines with the highest exclusive costs. The inclusive
+** cost of a subroutine only counts its outermost activations, so recursion is not counted twice.
+*/
+void profile_report(FILE *handle, unsigned int entries) {
+  unsigned long long total = 0, executed = 0, *total_of_node, *inclusive, *exclusive, *calls;
+  unsigned int i, node, *index = NULL;
+  char name[PROFILE_NAME_LENGTH];
+
+  total_of_node = calloc(no_of_nodes, sizeof(unsigned long long));
+  inclusive = calloc(PROFILE_ADDRESSES, sizeof(unsigned long long));
+  exclusive = calloc(PROFILE_ADDRESSES, sizeof(unsigned long long));
+  calls = calloc(PROFILE_ADDRESSES, sizeof(unsigned long long));
+  if (!total_of_node || !inclusive || !exclusive || !calls) {
+    fprintf(handle, "Not enough memory for the profile report!\n");
+    goto cleanup;
+  }
+
+  for (node = no_of_nodes; node--;) { /* Children are always created after their parents */
+    total_of_node[node] += nodes[node].self;
+    if (node)
+      total_of_node[nodes[node].parent] += total_of_node[node];
+    total += nodes[node].self;
+  }
+
+  for (node = 1; node < no_of_nodes; node++) {
+    unsigned int address = nodes[node].address, ancestor;
+
+    exclusive[address] += nodes[node].self;
+    calls[address] += nodes[node].calls;
+    for (ancestor = nodes[node].parent; ancestor && nodes[ancestor].address != address;
+         ancestor = nodes[ancestor].parent);
+    if (!ancestor)
+      inclusive[address] += total_of_node[node];
+  }
+
+  for (i = 0; i < PROFILE_ADDRESSES; executed += counts[i++]);
+  if (!total) {
+    fprintf(handle, "No profile has been gathered so far! Use PROF ON and RUN.\n");
+    goto cleanup;
+  }
+
+  fprintf(handle, "\n%llu instructions (%llu cycles) have been profiled, %u call paths. Most frequently executed \
+addresses:\n\n\
+ADDR  EXECUTIONS       RELATIVE  SYMBOL\n\
+-------------------------------------------------------------------------\n", executed, total, no_of_nodes - 1);
+  if (!(index = profile_sort(counts)))
+    goto cleanup;
+  for (i = 0; i < entries && counts[index[i]]; i++)
+    fprintf(handle, "%04X  %16llu (%5.2f%%)  %s\n", index[i], counts[index[i]],
+            (float) (100 * counts[index[i]]) / (float) executed, profile_name(index[i], name));
+  free(index);
+
+  fprintf(handle, "\nSubroutines with the highest exclusive costs (clock cycles):\n\n\
+SUBROUTINE                CALLS        EXCLUSIVE          INCLUSIVE\n\
+-------------------------------------------------------------------------\n");
+  if (!(index = profile_sort(exclusive)))
+    goto cleanup;
+  fprintf(handle, "%-20s  %10s  %16llu (%5.2f%%)\n", "[root]", "", nodes[0].self,
+          (float) (100 * nodes[0].self) / (float) total);
+  for (i = 0; i < entries && exclusive[index[i]]; i++)
+    fprintf(handle, "%-20s  %10llu  %16llu (%5.2f%%)  %16llu (%5.2f%%)\n", profile_name(index[i], name),
+            calls[index[i]], exclusive[index[i]], (float) (100 * exclusive[index[i]]) / (float) total,
+            inclusive[index[i]], (float) (100 * inclusive[index[i]]) / (float) total);
+  fprintf(handle, "\n");
+
+cleanup:
+  free(index);
+  free(calls);
+  free(exclusive);
+  free(inclusive);
+  free(total_of_node);
+}
+
+/* Disassemble a memory region with execution counts and branch statistics. */
+void profile_annotate(FILE *handle, unsigned int start, unsigned int stop, profile_disassembler disassembler) {
+  unsigned int address, words;
+  const char *label;
+  char text[PROFILE_NAME_LENGTH * 2];
+
+  fprintf(handle, "      EXECUTIONS      TAKEN  NOT TAKEN  ADDR  DISASSEMBLY\n");
+  for (address = start; address <= stop && address < PROFILE_ADDRESSES; address += words) {
+    if ((label = symbols_name(address)))
+      fprintf(handle, "%s:\n", label);
+
+    words = disassembler(address, text);
+    fprintf(handle, "%16llu ", counts[address]);
+    if (taken[address] || not_taken[address])
+      fprintf(handle, "%10llu %10llu", taken[address], not_taken[address]);
+    else
+      fprintf(handle, "%21s", "");
+    fprintf(handle, "  %04X  %s\n", address, text);
+  }
+}
+
+/* Write the call tree as folded stacks ("caller;callee;... cost" per line) as used by flamegraph.pl. */
+void profile_folded(FILE *handle) {
+  unsigned int node, path[PROFILE_MAX_DEPTH + 1], length, ancestor;
+  char name[PROFILE_NAME_LENGTH];
+
+  for (node = 0; node < no_of_nodes; node++) {
+    if (!nodes[node].self)
+      continue;
+
+    for (length = 0, ancestor = node; ancestor && length < PROFILE_MAX_DEPTH; ancestor = nodes[ancestor].parent)
+      path[length++] = ancestor;
+    fprintf(handle, "[root]");
+    while (length--)
+      fprintf(handle, ";%s", profile_name(nodes[path[length]].address, name));
+    fprintf(handle, " %llu\n", nodes[node].self);
+  }
+}
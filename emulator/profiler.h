@@ -0,0 +1,31 @@
+/*
+**  Header file for the execution profiler of the QNICE-emulator: While profiling is active, the core reports every
+** executed instruction, every conditional branch and every subroutine call and return. Executions are counted per
+** address, the costs (clock cycles) are attributed to a call tree which is built from ASUB/RSUB and the returns
+** (MOVE @R13++, R15), so inclusive and exclusive costs per subroutine as well as folded stacks for flame graphs
+** can be reported.
+*/
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdio.h>
+
+#define PROFILE_MAX_NODES   65536   /* Size of the call tree, deeper call paths are attributed to their parent */
+#define PROFILE_MAX_DEPTH   4096    /* Size of the shadow call stack */
+
+/* Writes the disassembly of the instruction at address into text and returns the number of words it occupies */
+typedef unsigned int (*profile_disassembler)(unsigned int address, char *text);
+
+void profile_reset();
+
+void profile_instruction(unsigned int address, unsigned int cost);
+void profile_branch(unsigned int address, int taken);
+void profile_call(unsigned int target, unsigned int sp);
+void profile_return(unsigned int sp);
+
+void profile_report(FILE *handle, unsigned int entries);
+void profile_annotate(FILE *handle, unsigned int start, unsigned int stop, profile_disassembler disassembler);
+void profile_folded(FILE *handle);
+
+#endif
@@ -0,0 +1,23 @@
+/*
+**  Header file describing the binary image format (.qbin) which can be loaded by the QNICE-emulator as an
+** alternative to the textual .out format. It is created by assembler/qasm2bin.
+**
+**  All fields are 16 bit words stored in little endian byte order:
+**
+**    Header:   'Q' 'B' 'I' 'N' (four bytes), version, number of segments, checksum
+**    Segment:  load address, number of words (1..0xFFFF), followed by the data words
+**
+**  The checksum is the 16 bit sum of all segment words (segment headers as well as data) and the version
+** and segment count fields.
+*/
+
+#ifndef QBIN_H
+#define QBIN_H
+
+#define QBIN_MAGIC          "QBIN"
+#define QBIN_MAGIC_SIZE     4
+#define QBIN_VERSION        1
+#define QBIN_HEADER_WORDS   3       /* Version, segment count, checksum */
+#define QBIN_SEGMENT_WORDS  2       /* Load address, length */
+
+#endif
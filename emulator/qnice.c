@@ -14,27 +14,42 @@
 **
 ** The following defines are available:
 **
-**   USE_IDE         (currently always undefined)
+**   USE_IDE         Simulates a compact flash card in True IDE mode at IDE_BASE_ADDRESS (no hardware counterpart)
 **   USE_SD
 **   USE_UART
 **   USE_VGA
 **   USE_TIMER
 **   OLD_V_LOGIC    If defined, the old overflow logic is used (v1.6 requires this!)
+**   USE_THREADED_CORE  If defined, the fast core dispatches via computed gotos to handlers which are specialised
+**                      for every addressing mode combination (needs gcc or clang)
+**   QNICE_LIBRARY  Build the library libqnice instead of the executable, see qnice_machine.h and make-lib.bash
+**   USE_JIT        Defined automatically on x86-64 hosts (but not for emscripten): Translated blocks are compiled to
+**                  native code, see jit_compile_block()
 **
-** The different make scripts "make.bash", "make-vga.bash" and "make-emscripten.bash"
+** The different make scripts "make.bash", "make-vga.bash", "make-lib.bash" and "make-emscripten.bash"
 ** are defining these. The emscripten environment is automatically defining __EMSCRIPTEN__.
 */
 
-#undef USE_IDE
 #define OLD_V_LOGIC
 
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <wordexp.h>
 
 #include "../dist_kit/sysdef.h"
+#include "breakpoints.h"
+#include "coverage.h"
+#include "hle.h"
+#include "io.h"
+#include "profiler.h"
+#include "qbin.h"
+#include "qnice_machine.h"
+#include "recorder.h"
+#include "snapshot.h"
+#include "symbols.h"
 
 #ifdef USE_IDE
 # include "ide_simulation.h"
@@ -67,6 +82,12 @@
 # include <signal.h>
 #endif
 
+#if defined(__x86_64__) && !defined(__EMSCRIPTEN__)
+# define USE_JIT
+# include <stddef.h>
+# include "x86_64.h"
+#endif
+
 /*
 ** Some preliminaries...
 */
@@ -112,48 +133,317 @@
 #define SR  14  // Status register
 #define SP  13  // Stack pointer
 
+#define X_FLAG 1 /* Positions of the flags in SR resp. indices into gbl$flags */
+#define C_FLAG 2
+#define Z_FLAG 3
+#define N_FLAG 4
+#define V_FLAG 5
+#define ALL_FLAGS 0xff
+
 #define MAX_LAST_ADDRESSES     16
+#define PROFILE_REPORT_ENTRIES 20 /* Number of lines per table printed by PROF */
+#define MAX_BLOCK_LENGTH       64 /* Maximum number of instructions in a translated basic block */
+#define MAX_CHAINED_BLOCKS     32 /* Maximum number of blocks executed by one call of execute_block() */
+#define DIRTY_PAGE_SIZE        256 /* Words per page of the main memory for copy-on-write snapshots */
+#define JIT_THRESHOLD          8 /* Executions of a block before it is compiled to native code */
+#define JIT_BUFFER_SIZE        (16 << 20) /* Bytes of native code per machine */
+#define JIT_BLOCK_SIZE         (64 << 10) /* Upper limit of the native code of one block */
+#define JIT_HOST_REGISTERS     8 /* QNICE registers kept in host registers by the native code of a block */
+
+#define INTERRUPT_CYCLES       4 /* Fetch state detecting the request, waiting for the ISR address and jumping to it */
+#define UART_READ_WAIT_STATES  2 /* Reading the receive register stalls the CPU until the FIFO has delivered the byte */
+
+#define IDLE_MAX_LENGTH        8 /* Maximum number of instructions of an idle loop, see idle_loop() */
+#define IDLE_OPCODES           0x1f8b /* MOVE, ADD, SUB, SWAP, NOT, AND, OR, XOR, CMP: no flags are read */
+#define IDLE_POLLS_UART        1 /* Input status registers read by an idle loop, see core_access_memory() */
+#define IDLE_POLLS_KEYBOARD    2
+#define IDLE_MAX_WAIT_NS       10000000 /* Longest wait of the CPU thread for input before checking CTRL-C etc. */
+#define IDLE_POLL_NS           1000000 /* Slices of a wait for input which has no FIFO (keyboard) */
+#define IDLE_UNLIMITED         (~0ull)
+#define CLOCK_CYCLE_NS         20 /* One clock cycle of the 50 MHz system clock */
+
+#define HLE_NATIVE             1 /* Phases of a call verified in strict HLE mode, see hle_verify() */
+#define HLE_INTERPRETED        2
+#define HLE_IO_LOG_SIZE        1024
+#define HLE_VERIFY_STEPS       10000000 /* A routine not returning after this many instructions is an error */
+
+#define STOP_HALT              QNICE_STOP_HALT /* Reasons for the end of a run, see gbl$stop_reasons */
+#define STOP_BREAKPOINT        QNICE_STOP_BREAKPOINT
+#define STOP_ILLEGAL           QNICE_STOP_ILLEGAL
+#define STOP_ERROR             QNICE_STOP_ERROR
+#define STOP_BUDGET            QNICE_STOP_BUDGET
+#define STOP_TIMEOUT           QNICE_STOP_TIMEOUT
+#define STOP_CTRL_C            QNICE_STOP_CTRL_C
+#define STOP_WATCHPOINT        QNICE_STOP_WATCHPOINT
+#define STOP_TRACE_END         QNICE_STOP_TRACE_END
+
+/* The instruction handlers are specialised for constant addressing modes by the threaded core, see execute(). */
+#define INLINE                 static inline __attribute__((always_inline))
 
-#ifdef USE_UART
-uart gbl$first_uart;
-#endif
+/*
+**  The core is compiled in three variants which differ in their debug and statistics hooks, see execute_block().
+** hooks is always a constant, so the tests below vanish completely in the NO_HOOKS variant.
+*/
+#define NO_HOOKS               0 /* Fast variant without any instrumentation */
+#define STATISTICS_HOOKS       1 /* Gather statistics */
+#define TRACE_HOOKS            2 /* Gather statistics and print debug/verbose output */
+#define NO_OF_HOOK_VARIANTS    3
+
+#define STATISTICS(hooks)      ((hooks) != NO_HOOKS && gbl$gather_statistics)
+#define TRACE(hooks)           ((hooks) == TRACE_HOOKS && gbl$debug)
+#define VERBOSE(hooks)         ((hooks) == TRACE_HOOKS && (gbl$debug || gbl$verbose))
+#define PROFILING(hooks)       ((hooks) != NO_HOOKS && gbl$profiling)
+#define COVERAGE(hooks)        ((hooks) != NO_HOOKS && gbl$coverage.enabled)
+#define RECORDING(hooks)       ((hooks) != NO_HOOKS && gbl$recorder.armed) /* Recording or replaying a trace */
+
+#define RETURN_INSTRUCTION     0x0DBC /* MOVE @R13++, R15 */
 
 typedef struct statistic_data {
   unsigned long long instruction_frequency[NO_OF_INSTRUCTIONS], /* Count the number of executions per instruction */
     addressing_modes[2][NO_OF_ADDRESSING_MODES],                /* 0 -> read, 1 -> write */
-    memory_accesses[2];                                         /* 0 -> read, 1 -> write */
+    memory_accesses[2],                                         /* 0 -> read, 1 -> write */
+    cycles;                                                     /* Clock cycles of the instructions counted */
 } statistic_data;
 
-int gbl$memory[MEMORY_SIZE], gbl$registers[REGMEM_SIZE], gbl$debug = FALSE, gbl$verbose = FALSE,
-    gbl$normal_operands[] = {2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2}, gbl$gather_statistics = FALSE, 
-    gbl$ctrl_c = FALSE, gbl$breakpoint = -1, gbl$cycle_counter_state = 0, gbl$eae_operand_0 = 0,
-    gbl$eae_operand_1 = 0, gbl$eae_result_lo = 0, gbl$eae_result_hi = 0, gbl$eae_csr = 0,
-    gbl$error = FALSE;;
+int gbl$debug = FALSE, gbl$verbose = FALSE,
+    gbl$normal_operands[] = {2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2},
+    gbl$statistics_enabled = FALSE, /* Set by STAT ON, otherwise RUN uses the fast core without statistics */
+    gbl$profiling = FALSE;          /* Set by PROF ON */
+
+/*
+**  Lazy flag evaluation: update_status_bits only records the results and operands of the last instruction(s)
+** affecting the flags. An entry of gbl$flags is computed from these records by read_flag when it is actually needed
+** (conditional branches, ADDC, SUBC, shifts, reading SR, interrupts, ...). X, Z and N are derived from the result of
+** the last ALU instruction, C and V are kept separately since most instructions leave them unchanged.
+*/
+typedef struct lazy_flags {
+  unsigned int valid,   /* Bitmask (same layout as SR) of those entries of gbl$flags which are up to date */
+    result,             /* Result of the last instruction setting X, Z and N */
+    carry_result,       /* Result (17 bits) of the last instruction setting C */
+    source_0, source_1, overflow_result, operation; /* Operands, result and type of the last instruction setting V */
+} lazy_flags;
 
-unsigned long long gbl$cycle_counter = 0l; /* This cycle counter is effectively an instruction counter... */
+/*
+**  Timing model: Every instruction is charged the clock cycles the state machine of the CPU needs for it (see
+** instruction_cycles()). gbl$cycles and gbl$instructions count from the start of the emulator on, the hardware
+** counters IO$CYC_* and IO$INS_* are derived from them, so the core only has to increment two variables.
+*/
+typedef struct hardware_counter {
+  unsigned long long *source, /* &gbl$cycles resp. &gbl$instructions */
+    start,                    /* *source minus the value of the counter while it is counting */
+    value;                    /* Value of the counter while it is stopped */
+  unsigned int counting;
+} hardware_counter;
 
 char *gbl$normal_mnemonics[] = {"MOVE", "ADD", "ADDC", "SUB", "SUBC", "SHL", "SHR", "SWAP", 
                                 "NOT", "AND", "OR", "XOR", "CMP", "rsvd", "ctrl"},
      *gbl$control_mnemonics[] = {"HALT", "RTI", "INT", "INCRB", "DECRB"}, 
      *gbl$branch_mnemonics[] = {"ABRA", "ASUB", "RBRA", "RSUB"}, 
      *gbl$sr_bits = "1XCZNV--",
-     *gbl$addressing_mnemonics[] = {"rx", "@rx", "@rx++", "@--rx"};
+     *gbl$addressing_mnemonics[] = {"rx", "@rx", "@rx++", "@--rx"},
+     *gbl$stop_reasons[] = {"halt", "breakpoint", "illegal_instruction", "error", "instruction_budget", "timeout",
+                            "ctrl_c", "watchpoint", "trace_end"};
+
+snapshot *gbl$snapshot = NULL;                              /* In-memory snapshot of SNAPSHOT and RESTORE */
+
+typedef struct decoded_instruction {
+  unsigned int valid,                               /* FALSE if the entry has to be decoded (again) */
+    address, instruction, opcode, source_mode, source_regaddr, destination_mode, destination_regaddr,
+    variant,                                        /* opcode << 4 | source mode << 2 | destination mode */
+    source_constant, destination_constant,          /* TRUE if the operand is a prefetched constant (@R15++) */
+    constant[2],                                    /* 0 -> source, 1 -> destination */
+    cycles;                                         /* Clock cycles, see instruction_cycles() */
+} decoded_instruction;
+
+typedef struct translated_block {
+  unsigned int generation,                          /* Valid if equal to gbl$block_generation */
+    length,                                         /* Number of instructions */
+    idle;                                           /* TRUE if the block is an idle loop, see idle_loop() */
+#ifdef USE_JIT
+  unsigned int runs;                                /* Executions so far, compiled after JIT_THRESHOLD */
+  unsigned int (*native)(qnice_machine *);          /* Native code of the block resp. NULL */
+#endif
+} translated_block;
+
+#ifdef USE_JIT
+/* Native code of the translated blocks, see jit_compile_block() */
+typedef struct jit_module {
+  unsigned int enabled,                             /* Switched by JIT ON resp. OFF */
+    generation;                                     /* Block generation of the code in the buffer */
+  x86_64_code code;
+  unsigned long long blocks;                        /* Blocks compiled */
+} jit_module;
+#endif
+
+/* Idle loop detection, see idle_fast_forward() */
+typedef struct idle_detection {
+  unsigned int enabled,                             /* Switched by IDLE ON resp. OFF */
+    batch,                                          /* TRUE if the last execute_block() only ran an idle loop */
+    polled,                                         /* IDLE_POLLS_* of the input status registers read by it */
+    io_reads;                                       /* Counts the reads of all other IO registers */
+  unsigned long long instructions, wait_ns;         /* Instructions skipped and wall clock time waited for input */
+} idle_detection;
+
+/*
+**  Strict HLE mode (see hle.h): A call is executed natively first, then the machine is set back to the state before
+** the call and the routine is interpreted. The IO writes of both executions are logged, those of the native execution
+** are not performed.
+*/
+typedef struct hle_io_log {
+  unsigned int count, address[HLE_IO_LOG_SIZE], value[HLE_IO_LOG_SIZE];
+} hle_io_log;
+
+typedef struct hle_verification {
+  int memory[2][IO_AREA_START], registers[2][REGMEM_SIZE], sr[2]; /* [0] before the call, [1] after the native one */
+  hle_io_log log[2];                                /* [0] native, [1] interpreted */
+} hle_verification;
+
+/* Handlers of an address of the IO area, see io.h and register_io_devices() */
+typedef struct io_handler {
+  io_read_handler read;
+  io_write_handler write;
+  void *context;
+} io_handler;
+
+/*
+**  Machine context: The state of an emulated QNICE machine is kept in a qnice_machine, so a process can run several
+** independent machines (see qnice_machine.h). All functions access the state of the current machine gbl$m using the
+** gbl$ names defined below. The emulator itself has exactly one machine, so gbl$m is a constant and these accesses
+** are as cheap as accesses to plain global variables. In the library build (QNICE_LIBRARY) gbl$m is a thread local
+** pointer which is set by every function of the API, so each thread can run a different machine.
+*/
+struct qnice_machine {
+  int memory[MEMORY_SIZE], registers[REGMEM_SIZE],
+    gather_statistics, ctrl_c, eae_operand_0, eae_operand_1, eae_result_lo, eae_result_hi, eae_csr, error;
+  /*
+  **  Register window: R0..R7 are read and written through gbl$bank which always points to the current register bank
+  ** in gbl$registers, so the bank number has to be extracted from SR only when SR changes. The lower eight bits of
+  ** SR are kept unpacked in gbl$flags (one entry per bit, bit 0 is always 1), gbl$registers[SR] holds the upper
+  ** eight bits only. The complete SR is assembled by read_register(SR).
+  */
+  int *bank, flags[8];
+  lazy_flags lazy;
+  unsigned long long cycles, instructions;
+  hardware_counter cycle_counter, instruction_counter;
+  unsigned int interrupt_address,                   // Interrupt address as set by the interrupting "device"
+    interrupt_request,                              // This flag denotes an interrupt request.
+    interrupt_active,                               // true if an interrupt is currently being serviced.
+    interrupt_R14,                                  // Shadow registers for R14 / R15.
+    interrupt_R15,
+    last_addresses[MAX_LAST_ADDRESSES],             // List of last addresses executed
+    last_addresses_pointer,                         // Pointer into the aforementioned list
+    last_address;                                   // Just the last address to save accessing the ring buffer for this info
+  statistic_data stat;
+  unsigned char dirty_pages[MEMORY_SIZE / DIRTY_PAGE_SIZE]; /* Pages written since the last snapshot, see snapshot.h */
+  decoded_instruction decoded[MEMORY_SIZE];         /* Instruction cache, see decode_instruction() */
+  translated_block blocks[MEMORY_SIZE];             /* Basic blocks by start address, see translate_block() */
+  unsigned int translated[MEMORY_SIZE],             /* Block generation of the block(s) a word belongs to */
+    block_generation;
+  io_handler io[IO_PAGE_SIZE];
+  unsigned int stop_reason;                         //why the last run() ended
+  unsigned long long instruction_budget,            //maximum number of instructions per run(), 0 means unlimited
+    instructions_executed,                          //number of instructions executed by the last run()
+    cycles_executed;                                //number of clock cycles of the last run()
+#ifdef USE_UART
+  uart first_uart;
+# ifdef QNICE_LIBRARY
+  FILE *uart_input, *uart_output;                   /* See qnice_uart_redirect() */
+# endif
+#endif
+#ifdef QNICE_LIBRARY
+  FILE *messages;                                   /* See qnice_set_messages() */
+#endif
+#ifdef USE_SD
+  sd_card sd;
+#endif
+#ifdef USE_TIMER
+  timer_module timer;
+#endif
+  idle_detection idle;
+  breakpoint_module breakpoints;                    /* Breakpoints and watchpoints, see breakpoints.h */
+  coverage_module coverage;                         /* Executed instructions and branch outcomes, see coverage.h */
+  recorder_module recorder;                         /* Execution trace recorded resp. replayed, see recorder.h */
+  hle_module hle;                                   /* High-level emulation of monitor routines, see hle.h */
+#ifdef USE_JIT
+  jit_module jit;                                   /* Native code of the translated blocks */
+#endif
+  hle_verification *hle_verification;               /* Allocated by the first call verified in strict mode */
+  unsigned int hle_phase,                           /* HLE_NATIVE resp. HLE_INTERPRETED while verifying a call */
+    hle_suspended;                                  /* HLE mode while tracing resp. recording the coverage */
+};
+
+#ifdef QNICE_LIBRARY
+static __thread qnice_machine *gbl$m __attribute__((tls_model("initial-exec")));
+#else
+static qnice_machine gbl$machine;
+# define gbl$m (&gbl$machine)
+#endif
 
-unsigned int gbl$interrupt_address,                 // Interrupt address as set by the interrupting "device"
-             gbl$interrupt_request = FALSE,         // This flag denotes an interrupt request.
-             gbl$interrupt_active = FALSE,          // true if an interrupt is currently being serviced.
-             gbl$interrupt_R14,                     // Shadow registers for R14 / R15.
-             gbl$interrupt_R15,
-             gbl$last_addresses[MAX_LAST_ADDRESSES],// List of last addresses executed 
-             gbl$last_addresses_pointer = 0,        // Pointer into the aforementioned list
-             gbl$last_address;                      // Just the last address to save accessing the ring buffer for this info
+/* Messages of the core about events in the simulated machine (HALT, breakpoints etc.) */
+#ifdef QNICE_LIBRARY
+# define MESSAGE(...) (gbl$m->messages ? fprintf(gbl$m->messages, __VA_ARGS__) : 0)
+#else
+# define MESSAGE(...) printf(__VA_ARGS__)
+#endif
 
-statistic_data gbl$stat;
+#define gbl$memory                 (gbl$m->memory)
+#define gbl$registers              (gbl$m->registers)
+#define gbl$bank                   (gbl$m->bank)
+#define gbl$flags                  (gbl$m->flags)
+#define gbl$lazy                   (gbl$m->lazy)
+#define gbl$gather_statistics      (gbl$m->gather_statistics)
+#define gbl$ctrl_c                 (gbl$m->ctrl_c)
+#define gbl$eae_operand_0          (gbl$m->eae_operand_0)
+#define gbl$eae_operand_1          (gbl$m->eae_operand_1)
+#define gbl$eae_result_lo          (gbl$m->eae_result_lo)
+#define gbl$eae_result_hi          (gbl$m->eae_result_hi)
+#define gbl$eae_csr                (gbl$m->eae_csr)
+#define gbl$error                  (gbl$m->error)
+#define gbl$cycles                 (gbl$m->cycles)
+#define gbl$instructions           (gbl$m->instructions)
+#define gbl$cycle_counter          (gbl$m->cycle_counter)
+#define gbl$instruction_counter    (gbl$m->instruction_counter)
+#define gbl$interrupt_address      (gbl$m->interrupt_address)
+#define gbl$interrupt_request      (gbl$m->interrupt_request)
+#define gbl$interrupt_active       (gbl$m->interrupt_active)
+#define gbl$interrupt_R14          (gbl$m->interrupt_R14)
+#define gbl$interrupt_R15          (gbl$m->interrupt_R15)
+#define gbl$last_addresses         (gbl$m->last_addresses)
+#define gbl$last_addresses_pointer (gbl$m->last_addresses_pointer)
+#define gbl$last_address           (gbl$m->last_address)
+#define gbl$stat                   (gbl$m->stat)
+#define gbl$dirty_pages            (gbl$m->dirty_pages)
+#define gbl$decoded                (gbl$m->decoded)
+#define gbl$blocks                 (gbl$m->blocks)
+#define gbl$translated             (gbl$m->translated)
+#define gbl$block_generation       (gbl$m->block_generation)
+#define gbl$io                     (gbl$m->io)
+#define gbl$stop_reason            (gbl$m->stop_reason)
+#define gbl$instruction_budget     (gbl$m->instruction_budget)
+#define gbl$instructions_executed  (gbl$m->instructions_executed)
+#define gbl$cycles_executed        (gbl$m->cycles_executed)
+#define gbl$first_uart             (gbl$m->first_uart)
+#define gbl$sd                     (gbl$m->sd)
+#define gbl$timer                  (gbl$m->timer)
+#define gbl$idle                   (gbl$m->idle)
+#define gbl$breakpoints            (gbl$m->breakpoints)
+#define gbl$coverage               (gbl$m->coverage)
+#define gbl$recorder               (gbl$m->recorder)
+#define gbl$hle                    (gbl$m->hle)
+#define gbl$hle_verification       (gbl$m->hle_verification)
+#define gbl$hle_phase              (gbl$m->hle_phase)
+#define gbl$hle_suspended          (gbl$m->hle_suspended)
+#define gbl$jit                    (gbl$m->jit)
 
 bool gbl$cpu_running      = false;              //thread-sync: is the CPU currently running?
 bool gbl$shutdown_signal  = false;              //thread-sync: shut down the emulator when set to true
 bool gbl$initial_run      = true;               //thread-sync: is the current run() the very first one?
 
+double             gbl$timeout = 0;                 //maximum wall clock time per run() in seconds, 0 means unlimited
+#if defined(USE_TIMER) && !defined(USE_VGA)
+int                gbl$pacing = FALSE;              //PACE ON: emulated time does not run ahead of the wall clock
+#endif
+
 #if defined(USE_VGA) && !defined(__EMSCRIPTEN__)
 sigset_t  gbl$sigset;                           //multithreaded signal handling
 pthread_t ctrlc_thread_id = 0;                  //used for killing the signal handler thread
@@ -232,12 +522,14 @@ int wordexp(const char *s, wordexp_t *p, int flags) {
 #endif
 */
 
+#ifndef QNICE_LIBRARY
 /*
 ** use CTRL+c to pause emulation and to return back to the emulator's console
 */
 static void signal_handler_ctrl_c(int signo) {
   gbl$ctrl_c = TRUE;
 }
+#endif
 
 #if defined(USE_VGA) && !defined(__EMSCRIPTEN__)
 static int signal_handler_ctrl_c_multithreaded(void* param) {
@@ -282,7 +574,11 @@ int char_in(char c, char *string) {
 ** operates on a local copy of this string.
 */
 char *tokenize(char *string, char *delimiters) {
+#ifdef QNICE_LIBRARY
+  static __thread char local_copy[STRING_LENGTH], *position; /* Several machines may load files at the same time */
+#else
   static char local_copy[STRING_LENGTH], *position;
+#endif
   char *token;
 
   if (string) { /* Initial call, create a copy of the string pointer */
@@ -334,727 +630,2602 @@ void chomp(char *string) {
     string[strlen(string) - 1] = (char) 0;
 }
 
+/*
+** Return the condition following " IF " in a command (case insensitive) resp. NULL if there is none.
+*/
+char *break_condition(char *command) {
+  for (; *command; command++)
+    if (command[0] == ' ' && toupper(command[1]) == 'I' && toupper(command[2]) == 'F' && command[3] == ' ')
+      return command + 4;
+  return NULL;
+}
+
+/*
+**  Return a single flag of SR (X_FLAG, C_FLAG, ...), computing it from the records kept in gbl$lazy if necessary.
+**
+**  Caveat: There are currently two implementations of the overflow logic: The old behaviour,
+**          which is not "by the book" and the new behaviour which works as described in 
+**          http://www.righto.com/2012/12/the-6502-overflow-flag-explained.html.
+**
+**          As of 13-AUG-2020 the old logic should be active as the new (more correct :-} )
+**          breaks our existing code! To switch between these two implementation variants,
+**          OLD_V_LOGIC must be defined or undefined.
+*/
+INLINE unsigned int read_flag(unsigned int flag) {
+  unsigned int source_0, source_1, destination;
+
+  if (gbl$lazy.valid & (1 << flag))
+    return gbl$flags[flag];
+
+  switch (flag) {
+    case X_FLAG:
+      gbl$flags[X_FLAG] = (gbl$lazy.result & 0xffff) == 0xffff ? 1 : 0;
+      break;
+    case C_FLAG:
+      gbl$flags[C_FLAG] = gbl$lazy.carry_result & 0x10000 ? 1 : 0;
+      break;
+    case Z_FLAG:
+      gbl$flags[Z_FLAG] = !(gbl$lazy.result & 0xffff) ? 1 : 0;
+      break;
+    case N_FLAG:
+      gbl$flags[N_FLAG] = gbl$lazy.result & 0x8000 ? 1 : 0;
+      break;
+    case V_FLAG:
+      source_0    = gbl$lazy.source_0;
+      source_1    = gbl$lazy.source_1;
+      destination = gbl$lazy.overflow_result;
+#ifdef OLD_V_LOGIC
+      gbl$flags[V_FLAG] = ((!(source_0 & 0x8000) && !(source_1 & 0x8000) && (destination & 0x8000)) ||
+                           ((source_0 & 0x8000) && (source_1 & 0x8000) && !(destination & 0x8000)))
+                          ? 1 : 0;
+#else
+  // See http://www.righto.com/2012/12/the-6502-overflow-flag-explained.html for the logic behind this:
+      if (gbl$lazy.operation == ADD_INSTRUCTION)
+        gbl$flags[V_FLAG] = ((source_0 & 0xffff) ^ (destination & 0xffff)) & ((source_1 & 0xffff) ^ (destination & 0xffff)) & 0x8000 ? 1 : 0;
+      else /* SUB_INSTRUCTION */
+        gbl$flags[V_FLAG] = ((source_0 & 0xffff) ^ (destination & 0xffff)) & (((~source_1) & 0xffff) ^ (destination & 0xffff)) & 0x8000 ? 1 : 0;
+#endif
+      break;
+  }
+
+  gbl$lazy.valid |= 1 << flag;
+  return gbl$flags[flag];
+}
+
+/*
+** Set a single flag explicitly, overriding any pending lazy evaluation.
+*/
+INLINE void write_flag(unsigned int flag, unsigned int value) {
+  gbl$flags[flag] = value;
+  gbl$lazy.valid |= 1 << flag;
+}
+
+/*
+** Compute all pending flags, so that gbl$flags reflects the current state of SR.
+*/
+void materialize_flags() {
+  unsigned int i;
+
+  if (gbl$lazy.valid != ALL_FLAGS)
+    for (i = X_FLAG; i <= V_FLAG; read_flag(i++));
+}
+
 /*
 ** Return the content of a register addressed by its 4 bit register address. The routine takes care of the
 ** necessary bank switching logic.
 */
 unsigned int read_register(unsigned int address) {
-  unsigned int value;
+  unsigned int value, i;
 
   address &= 0xf;
-  if (address & 0x8) /* Upper half -> always bank 0 */
-    value = gbl$registers[address] | (address == 0xe ? 1 : 0); /* The LSB of SR is always 1! */
-  else 
-    value = gbl$registers[address | ((read_register(SR) >> 4) & 0xFF0)];
+  if (!(address & 0x8)) /* Lower half -> current bank */
+    return gbl$bank[address];
+  else if (address != SR) /* Upper half -> always bank 0 */
+    return gbl$registers[address];
 
-  return value & 0xffff;
+  materialize_flags();
+  for (value = gbl$registers[SR] | 1, i = 1; i < 8; i++) /* The LSB of SR is always 1! */
+    value |= gbl$flags[i] << i;
+
+  return value;
 }
 
 /*
 ** Change the contents of a register with provision for bank switching logic.
 */
-void write_register(unsigned int address, unsigned int value) {
+INLINE void core_write_register(unsigned int address, unsigned int value, unsigned int hooks) {
   address &= 0xf;
   value   &= 0xffff;
 
-  if ((gbl$debug))
+  if (TRACE(hooks))
     printf("\twrite_register: address = %04X, value = %02X\n\r", address, value);
 
-  if (address & 0x8)
-    gbl$registers[address] = value | (address == 14 ? 1 : 0); /* Ensure that LSB will always be set. */
-  else /* Take bank switching into account! */
-    gbl$registers[address | ((read_register(SR) >> 4) & 0xFF0)] = value;
+  if (!(address & 0x8)) /* Take bank switching into account! */
+    gbl$bank[address] = value;
+  else if (address != SR)
+    gbl$registers[address] = value;
+  else {
+    unsigned int i;
+
+    gbl$registers[SR] = value & 0xff00;
+    for (i = 1; i < 8; i++)
+      gbl$flags[i] = (value >> i) & 1;
+    gbl$lazy.valid = ALL_FLAGS;
+    gbl$bank = gbl$registers + ((value >> 4) & 0xff0);
+  }
+}
+
+void write_register(unsigned int address, unsigned int value) {
+  core_write_register(address, value, TRACE_HOOKS);
 }
 
 /*
-**  The following function performs all memory access operations necessary for executing code in the 
-** emulator. Support routines like dump, etc. may access memory directly, but in this case be aware
-** of the fact that no IO device emulation will take place!
-**
+**  IO dispatch: gbl$io holds the read and write handlers for every address of the IO area, see io.h. The devices
+** built into the emulator are registered by register_io_devices.
 */
-unsigned int access_memory(unsigned int address, unsigned int operation, unsigned int value) {
-  int eae$temp;
+unsigned int io_default_read(void *context, unsigned int address) {
+  return 0;
+}
 
-  address &= 0xffff;
-  value   &= 0xffff;
+void io_default_write(void *context, unsigned int address, unsigned int value) {
+}
 
-  if (gbl$gather_statistics)
-    gbl$stat.memory_accesses[operation]++;
+void io_register(unsigned int first, unsigned int last, io_read_handler read, io_write_handler write, void *context) {
+  unsigned int address;
 
-  if (operation == READ_MEMORY) {
-    if (address < IO_AREA_START)
-      value = gbl$memory[address];
-    else { /* IO area */
-      value = 0;
-      if ((gbl$debug))
-        printf("\tread_memory: IO-area read access at 0x%04X\n\r", address);
+  for (address = first; address <= last && address <= 0xffff; address++) {
+    if (address < IO_AREA_START) {
+      printf("io_register: %04X is not an IO address!\n", address);
+      continue;
+    }
+
+    gbl$io[address & 0xff].read    = read  ? read  : io_default_read;
+    gbl$io[address & 0xff].write   = write ? write : io_default_write;
+    gbl$io[address & 0xff].context = context;
+  }
+}
+
+unsigned int switch_read_register(void *context, unsigned int address) {
+  return gbl$memory[IO_SWITCH_REG];
+}
+
+void switch_write_register(void *context, unsigned int address, unsigned int value) {
+  gbl$memory[IO_SWITCH_REG] = value;
+  gbl$dirty_pages[IO_SWITCH_REG / DIRTY_PAGE_SIZE] = TRUE;
+}
+
+unsigned long long counter_value(hardware_counter *counter) {
+  return counter->counting ? *counter->source - counter->start : counter->value;
+}
+
+void reset_counter(hardware_counter *counter) {
+  counter->start = *counter->source;
+  counter->value = 0;
+  counter->counting = TRUE;
+}
+
+/* The cycle and the instruction counter share this layout: LO, MID, HI (48 bits) and STATE. */
+unsigned int counter_read_register(void *context, unsigned int address) {
+  hardware_counter *counter = (hardware_counter *) context;
+
+  switch (address & 0x3) {
+    case 0: /* IO_CYC_LO resp. IO_INS_LO */
+      return counter_value(counter) & 0xffff;
+    case 1:
+      return (counter_value(counter) >> 16) & 0xffff;
+    case 2:
+      return (counter_value(counter) >> 32) & 0xffff;
+    default: /* IO_CYC_STATE resp. IO_INS_STATE */
+      return counter->counting ? 0x0002 : 0;
+  }
+}
+
+void counter_write_register(void *context, unsigned int address, unsigned int value) {
+  hardware_counter *counter = (hardware_counter *) context;
+
+  if ((address & 0x3) != 0x3)
+    return;
+
+  if (value & 0x0001) /* Reset and start counting. */
+    reset_counter(counter);
+  else if ((value & 0x0002) && !counter->counting) { /* Continue counting */
+    counter->start = *counter->source - counter->value;
+    counter->counting = TRUE;
+  } else if (!(value & 0x0002) && counter->counting) { /* Stop */
+    counter->value = counter_value(counter);
+    counter->counting = FALSE;
+  }
+}
+
+unsigned int eae_read_register(void *context, unsigned int address) {
+  switch (address) {
+    case IO_EAE_OPERAND_0:
+      return gbl$eae_operand_0 & 0xffff;
+    case IO_EAE_OPERAND_1:
+      return gbl$eae_operand_1 & 0xffff;
+    case IO_EAE_RESULT_LO:
+      return gbl$eae_result_lo;
+    case IO_EAE_RESULT_HI:
+      return gbl$eae_result_hi;
+    case IO_EAE_CSR:
+      return gbl$eae_csr;
+    default:
+      return 0;
+  }
+}
+
+void eae_write_register(void *context, unsigned int address, unsigned int value) {
+  int eae$temp;
+
+  if (address == IO_EAE_OPERAND_0)
+    gbl$eae_operand_0 = value;
+  else if (address == IO_EAE_OPERAND_1)
+    gbl$eae_operand_1 = value;
+  else if (address == IO_EAE_CSR) {
+    switch(gbl$eae_csr = value) {
+      case 0: /* Unsigned multiplication */
+        eae$temp = gbl$eae_operand_0 * gbl$eae_operand_1; /* Since both operands are 16 bit, it is naturally unsigned. */
+        gbl$eae_result_lo = eae$temp & 0xffff;
+        gbl$eae_result_hi = (eae$temp >> 16) & 0xffff;
+        break;
+      case 1: /* Signed multiplication */
+        if (gbl$eae_operand_0 & 0x8000) gbl$eae_operand_0 |= 0xffffffffffff8000; /* Perform a sign extension */
+        if (gbl$eae_operand_1 & 0x8000) gbl$eae_operand_1 |= 0xffffffffffff8000;
+        eae$temp = gbl$eae_operand_0 * gbl$eae_operand_1; /* Now, it is a signed operation. */
+        gbl$eae_result_lo = eae$temp & 0xffff;
+        gbl$eae_result_hi = (eae$temp >> 16) & 0xffff;
+        break;
+      case 2: /* Unsigned division */
+        if (!gbl$eae_operand_1) { // Division by zero!
+          MESSAGE("Attempt to divide by zero in EAE!\n");
+          gbl$error = TRUE;
+        } else {
+          gbl$eae_result_lo = gbl$eae_operand_0 / gbl$eae_operand_1;
+          gbl$eae_result_hi = gbl$eae_operand_0 % gbl$eae_operand_1;
+        }
+        break;
+      case 3: /* Signed division */
+        if (!gbl$eae_operand_1) { // Division by zero!
+          MESSAGE("Attempt to divide by zero in EAE!\n");
+          gbl$error = TRUE;
+        } else {
+          gbl$eae_result_hi = gbl$eae_operand_0 % gbl$eae_operand_1;
+          if (gbl$eae_operand_0 & 0x8000) gbl$eae_operand_0 |= 0xffffffffffff8000; /* Perform a sign extension */
+          if (gbl$eae_operand_1 & 0x8000) gbl$eae_operand_1 |= 0xffffffffffff8000;
+          gbl$eae_result_lo = gbl$eae_operand_0 / gbl$eae_operand_1;
+        }
+        break;
+      default:
+        MESSAGE("Illegal opcode for the EAE detected: CSR = %04X\n", gbl$eae_csr);
+        gbl$error = TRUE;
+        break;
+    }
+
+    gbl$eae_csr &= 0x7fff; /* Clear the busy bit just in case... */
+  }
+}
 
-      if (address == IO_SWITCH_REG) /* Read the switch register */
-        value = gbl$memory[IO_SWITCH_REG];
-      else if (address == IO_CYC_LO) /* Read low word of the cycle (instruction) counter. */
-        value = gbl$cycle_counter;
-      else if (address == IO_CYC_MID)
-        value = gbl$cycle_counter >> 16;
-      else if (address == IO_CYC_HI)
-        value = gbl$cycle_counter >> 24;
-      else if (address == IO_CYC_STATE)
-        value = gbl$cycle_counter_state & 0x0003;
-      else if (address == IO_EAE_OPERAND_0)
-        value = gbl$eae_operand_0;
-      else if (address == IO_EAE_OPERAND_1)
-        value = gbl$eae_operand_1;
-      else if (address == IO_EAE_RESULT_LO)
-        value = gbl$eae_result_lo;
-      else if (address == IO_EAE_RESULT_HI)
-        value = gbl$eae_result_hi;
-      else if (address == IO_EAE_CSR)
-        value = gbl$eae_csr;
 #ifdef USE_SD
-      else if (address >= IO_SD_BASE_ADDRESS && address < IO_SD_BASE_ADDRESS + SD_NUMBER_OF_REGISTERS) /* SD-card ccess */
-        value = sd_read_register(address - IO_SD_BASE_ADDRESS);
+unsigned int sd_io_read(void *context, unsigned int address) {
+  return sd_read_register((sd_card *) context, address - IO_SD_BASE_ADDRESS);
+}
+
+void sd_io_write(void *context, unsigned int address, unsigned int value) {
+  sd_write_register((sd_card *) context, address - IO_SD_BASE_ADDRESS, value);
+}
+
+/* ATTACH resp. -a and -A */
+void attach_sd_image(char *file_name, int mode) {
+  int attached = sd_attach(&gbl$sd, file_name, mode);
+
+  if (attached < 0)
+    printf("Unable to attach SD-card image file >>%s<<!\n", file_name);
+  else if (attached != mode)
+    printf("SD-card image file >>%s<< is read only, writes go to an overlay.\n", file_name);
+}
 #endif
+
 #ifdef USE_UART
-      else if (address >= IO_UART_BASE_ADDRESS && address < IO_UART_BASE_ADDRESS + UART_NUMBER_OF_REGISTERS) /* Some UART0 operation */
-        value = uart_read_register(&gbl$first_uart, address - IO_UART_BASE_ADDRESS);
+unsigned int uart_io_read(void *context, unsigned int address) {
+  return uart_read_register((uart *) context, address - IO_UART_BASE_ADDRESS);
+}
+
+void uart_io_write(void *context, unsigned int address, unsigned int value) {
+  if ((gbl$debug))
+    printf("\twrite uart register: %04X, %02X\n\t", address, value & 0xff);
+  uart_write_register((uart *) context, address - IO_UART_BASE_ADDRESS, value & 0xff);
+}
 #endif
+
 #ifdef USE_VGA
-      else if (address >= VGA_STATE && address <= VGA_OFFS_RW) /* VGA register */
-        value = vga_read_register(address);
-      else if (address >= IO_KBD_STATE && address <= IO_KBD_DATA)
-        value = kbd_read_register(address);
+unsigned int vga_io_read(void *context, unsigned int address) {
+  return vga_read_register(address);
+}
+
+void vga_io_write(void *context, unsigned int address, unsigned int value) {
+  vga_write_register(address, value);
+}
+
+unsigned int kbd_io_read(void *context, unsigned int address) {
+  return kbd_read_register(address);
+}
+
+void kbd_io_write(void *context, unsigned int address, unsigned int value) {
+  kbd_write_register(address, value);
+}
 #endif
+
 #ifdef USE_IDE
-      else if (address >= IDE_BASE_ADDRESS && address < IDE_BASE_ADDRESS + IDE_NUMBER_OF_REGISTERS) /* Some IDE operation */
-        value = readIDEDeviceRegister(address - IDE_BASE_ADDRESS);
+unsigned int ide_io_read(void *context, unsigned int address) {
+  return readIDEDeviceRegister(address - IDE_BASE_ADDRESS);
+}
+
+void ide_io_write(void *context, unsigned int address, unsigned int value) {
+  writeIDEDeviceRegister(address - IDE_BASE_ADDRESS, value);
+}
 #endif
+
 #ifdef USE_TIMER
-      else if (address >= IO_TIMER_BASE_ADDRESS && address < IO_TIMER_BASE_ADDRESS + NUMBER_OF_TIMERS * REG_PER_TIMER)
-        value = readTimerDeviceRegister(address - IO_TIMER_BASE_ADDRESS);
-#endif
-    }
-  } else if (operation == WRITE_MEMORY) {
-    if (address < IO_AREA_START)
-      gbl$memory[address] = value;
-    else { /* IO area */
-      if ((gbl$debug))
-        printf("\twrite_memory: IO-area access from %04X at 0x%04X: 0x%04X\n\r", gbl$last_address, address, value);
+unsigned int timer_io_read(void *context, unsigned int address) {
+  return readTimerDeviceRegister((timer_module *) context, address - IO_TIMER_BASE_ADDRESS);
+}
 
-      if (address == IO_SWITCH_REG) /* Read the switch register */
-        gbl$memory[IO_SWITCH_REG] = value;
-      else if (address == IO_CYC_STATE) {
-        if (value & 0x0001) { /* Reset and start counting. */
-          gbl$cycle_counter = 0l;
-          gbl$cycle_counter_state = 0x0002;
-        }
-      } else if (address == IO_EAE_OPERAND_0)
-        gbl$eae_operand_0 = value;
-      else if (address == IO_EAE_OPERAND_1)
-        gbl$eae_operand_1 = value;
-      else if (address == IO_EAE_CSR) {
-        switch(gbl$eae_csr = value) {
-          case 0: /* Unsigned multiplication */
-            eae$temp = gbl$eae_operand_0 * gbl$eae_operand_1; /* Since both operands are 16 bit, it is naturally unsigned. */
-            gbl$eae_result_lo = eae$temp & 0xffff;
-            gbl$eae_result_hi = (eae$temp >> 16) & 0xffff;
-            break;
-          case 1: /* Signed multiplication */
-            if (gbl$eae_operand_0 & 0x8000) gbl$eae_operand_0 |= 0xffffffffffff8000; /* Perform a sign extension */
-            if (gbl$eae_operand_1 & 0x8000) gbl$eae_operand_1 |= 0xffffffffffff8000;
-            eae$temp = gbl$eae_operand_0 * gbl$eae_operand_1; /* Now, it is a signed operation. */
-            gbl$eae_result_lo = eae$temp & 0xffff;
-            gbl$eae_result_hi = (eae$temp >> 16) & 0xffff;
-            break;
-          case 2: /* Unsigned division */
-            if (!gbl$eae_operand_1) { // Division by zero!
-              printf("Attempt to divide by zero in EAE!\n");
-              gbl$error = TRUE;
-            } else {
-              gbl$eae_result_lo = gbl$eae_operand_0 / gbl$eae_operand_1;
-              gbl$eae_result_hi = gbl$eae_operand_0 % gbl$eae_operand_1;
-            }
-            break;
-          case 3: /* Signed division */
-            if (!gbl$eae_operand_1) { // Division by zero!
-              printf("Attempt to divide by zero in EAE!\n");
-              gbl$error = TRUE;
-            } else {
-              gbl$eae_result_hi = gbl$eae_operand_0 % gbl$eae_operand_1;
-              if (gbl$eae_operand_0 & 0x8000) gbl$eae_operand_0 |= 0xffffffffffff8000; /* Perform a sign extension */
-              if (gbl$eae_operand_1 & 0x8000) gbl$eae_operand_1 |= 0xffffffffffff8000;
-              gbl$eae_result_lo = gbl$eae_operand_0 / gbl$eae_operand_1;
-            }
-            break;
-          default:
-            printf("Illegal opcode for the EAE detected: CSR = %04X\n", gbl$eae_csr);
-            gbl$error = TRUE;
-            break;
-        }
+void timer_io_write(void *context, unsigned int address, unsigned int value) {
+  writeTimerDeviceRegister((timer_module *) context, address - IO_TIMER_BASE_ADDRESS, value);
+}
+#endif
 
-        gbl$eae_csr &= 0x7fff; /* Clear the busy bit just in case... */
-      }
+/*
+** Fill the IO dispatch table with the devices which are part of this build of the emulator.
+*/
+void register_io_devices() {
+  io_register(IO_AREA_START, 0xffff, NULL, NULL, NULL);
+  io_register(IO_SWITCH_REG, IO_SWITCH_REG, switch_read_register, switch_write_register, NULL);
+  io_register(IO_CYC_LO, IO_CYC_STATE, counter_read_register, counter_write_register, &gbl$cycle_counter);
+  io_register(IO_INS_LO, IO_INS_STATE, counter_read_register, counter_write_register, &gbl$instruction_counter);
+  io_register(IO_EAE_OPERAND_0, IO_EAE_CSR, eae_read_register, eae_write_register, NULL);
+#ifdef USE_SD
+  sd_initialize(&gbl$sd, &gbl$cycles);
+  io_register(IO_SD_BASE_ADDRESS, IO_SD_BASE_ADDRESS + SD_NUMBER_OF_REGISTERS - 1, sd_io_read, sd_io_write, &gbl$sd);
+#endif
 #ifdef USE_UART
-      else if (address >= IO_UART_BASE_ADDRESS && address < IO_UART_BASE_ADDRESS + UART_NUMBER_OF_REGISTERS) { /* Some UART0 operation */
-        if ((gbl$debug))
-          printf("\twrite uart register: %04X, %02X\n\t", address, value & 0xff);
-        uart_write_register(&gbl$first_uart, address - IO_UART_BASE_ADDRESS, value & 0xff);
-      }
+  io_register(IO_UART_BASE_ADDRESS, IO_UART_BASE_ADDRESS + UART_NUMBER_OF_REGISTERS - 1, uart_io_read, uart_io_write,
+              &gbl$first_uart);
 #endif
 #ifdef USE_VGA
-      else if (address >= VGA_STATE && address <= VGA_OFFS_RW) /* VGA register */
-        vga_write_register(address, value);
-      else if (address >= IO_KBD_STATE && address <= IO_KBD_DATA)
-        kbd_write_register(address, value);
-#endif      
-#ifdef USE_IDE
-      else if (address >= IDE_BASE_ADDRESS && address < IDE_BASE_ADDRESS + IDE_NUMBER_OF_REGISTERS) /* Some IDE operation */
-        writeIDEDeviceRegister(address - IDE_BASE_ADDRESS, value);
+  io_register(VGA_STATE, VGA_OFFS_RW, vga_io_read, vga_io_write, NULL);
+  io_register(IO_KBD_STATE, IO_KBD_DATA, kbd_io_read, kbd_io_write, NULL);
 #endif
-#ifdef USE_SD
-      else if (address >= IO_SD_BASE_ADDRESS && address < IO_SD_BASE_ADDRESS + SD_NUMBER_OF_REGISTERS) /* SD-card ccess */
-        sd_write_register(address - IO_SD_BASE_ADDRESS, value);
+#ifdef USE_IDE
+  io_register(IDE_BASE_ADDRESS, IDE_BASE_ADDRESS + IDE_NUMBER_OF_REGISTERS - 1, ide_io_read, ide_io_write, NULL);
 #endif
 #ifdef USE_TIMER
-      else if (address >= IO_TIMER_BASE_ADDRESS && address < IO_TIMER_BASE_ADDRESS + NUMBER_OF_TIMERS * REG_PER_TIMER)
-        writeTimerDeviceRegister(address - IO_TIMER_BASE_ADDRESS, value);
+  io_register(IO_TIMER_BASE_ADDRESS, IO_TIMER_BASE_ADDRESS + NUMBER_OF_TIMERS * REG_PER_TIMER - 1, timer_io_read,
+              timer_io_write, &gbl$timer);
 #endif
-    }
-  } else {
-    printf("Illegal operation code in access_memory!\n");
-    exit(-1);
+}
+
+void invalidate_decoded_instruction(unsigned int);
+
+/* Log an IO write while a call is verified in strict HLE mode, returns FALSE if the write must not be performed. */
+int hle_log_write(unsigned int address, unsigned int value) {
+  hle_io_log *log = &gbl$hle_verification->log[gbl$hle_phase == HLE_INTERPRETED];
+
+  if (log->count < HLE_IO_LOG_SIZE) {
+    log->address[log->count] = address;
+    log->value[log->count] = value;
   }
+  log->count++;
+  return gbl$hle_phase == HLE_INTERPRETED;
+}
 
-  return value & 0xffff;
+unsigned int break_read_register(unsigned int number) {
+  return read_register(number & 0xf);
+}
+
+unsigned int break_read_memory(unsigned int address) {
+  return (address &= 0xffff) < IO_AREA_START ? gbl$memory[address] : 0;
 }
 
 /*
-** reset the processor state, registers, memory.
+**  Called if the bit of a breakpoint resp. watchpoint is set in the shadow bitmap. Returns TRUE if the breakpoint at
+** the address triggers, a watchpoint stops the run after the instruction performing the access. Routines verified in
+** strict HLE mode are executed twice, so nothing triggers inside them.
 */
-void reset_machine() {
-  unsigned int i;
-
-  /* Reset main memory and registers */
-  for (i = 0; i < IO_AREA_START; access_memory(i++, WRITE_MEMORY, 0));
-  for (i = 0; i < REGMEM_SIZE; gbl$registers[i++] = 0);
+int break_execute(unsigned int address) {
+  if (gbl$hle_phase || !breakpoint_check(&gbl$breakpoints, BREAK_EXECUTE, address, gbl$memory[address]))
+    return FALSE;
 
-  /* Reset statistics counters */
-  for (i = 0; i < NO_OF_INSTRUCTIONS; gbl$stat.instruction_frequency[i++] = 0);
-  for (i = 0; i < NO_OF_ADDRESSING_MODES; i++)
-    gbl$stat.addressing_modes[0][i] = gbl$stat.addressing_modes[1][i] = 0;
-  gbl$stat.memory_accesses[0] = gbl$stat.memory_accesses[1] = 0;
+  MESSAGE("Breakpoint reached: %04X\n", address);
+  gbl$stop_reason = STOP_BREAKPOINT;
+  return TRUE;
+}
 
-  /* Route use the USB keyboard emulation for stdin and VGA for stdout */
-#if defined(__EMSCRIPTEN__) || (defined(USE_VGA) && !defined(USE_UART))
-  gbl$memory[IO_SWITCH_REG] = 3;
-#endif
+void break_access(unsigned int kind, unsigned int address, unsigned int value) {
+  breakpoint *entry;
 
-  gbl$interrupt_request = FALSE;
-  gbl$interrupt_active = FALSE;
+  if (!gbl$breakpoints.armed || gbl$hle_phase || !(entry = breakpoint_check(&gbl$breakpoints, kind, address, value)))
+    return;
 
-  if (gbl$debug || gbl$verbose)
-    printf("\treset_machine: done\n");
+  MESSAGE("Watchpoint %u: %04X %s %04X by the instruction at %04X\n", entry->number, value,
+          kind == BREAK_READ ? "read from" : "written to", address, gbl$last_address);
+  gbl$stop_reason = STOP_WATCHPOINT;
+  gbl$error = TRUE;
 }
 
+void idle_skip(unsigned long long instructions, unsigned long long cycles);
+void set_hle_mode(unsigned int mode);
+
 /*
-** Decode an operand specified by a 6 bit mask. Returns TRUE if the next word will be a constant, so this can
-** be skipped in the next disassemble step.
+**  Execution traces (see recorder.h): While a trace is recorded resp. replayed, the core reports its events during
+** RUN and STEP. A replayed event is compared with the next one of the trace (IO reads only by their address and
+** cycle), the replay stops with a message at the first difference.
 */
-int decode_operand(unsigned int operand, char *string) {
-  int mode, regaddr;
+int replay_event(unsigned int type, unsigned int address, unsigned int value, record_event *recorded) {
+  record_event event = {type, address, value, gbl$cycles, gbl$recorder.instructions, 0, 0};
+  char expected[96], actual[96];
 
-  mode = operand & 0x3;
-  regaddr = (operand >> 2) & 0xf;
-  *string = (char) 0;
+  if (recorder_read(&gbl$recorder, recorded) && recorded->type == type && recorded->address == address
+      && (type == RECORD_INPUT || recorded->value == value)
+      && (type == RECORD_INSTRUCTION || recorded->cycles == gbl$cycles))
+    return TRUE;
 
-  if (!mode) {
-    sprintf(string, "R%02d", regaddr);
-    return FALSE;
+  if (recorded->type == RECORD_END && !gbl$recorder.complete) { /* Complete traces end in run() */
+    MESSAGE("The end of the trace has been reached after %llu instructions\n", recorded->instructions);
+    gbl$stop_reason = STOP_TRACE_END;
+  } else {
+    if (type == RECORD_INPUT)
+      event.value = recorded->value;
+    recorder_describe(recorded, expected, sizeof(expected));
+    recorder_describe(&event, actual, sizeof(actual));
+    MESSAGE("Replay diverges from the trace: %s instead of %s\n", actual, expected);
+    gbl$stop_reason = STOP_ERROR;
   }
+  gbl$error = TRUE;
+  recorder_close(&gbl$recorder, gbl$cycles);
+  return FALSE;
+}
 
-  if (mode == 1) /* @Rxx */
-    sprintf(string, "@R%02d", regaddr);
-  else if (mode == 2) {
-    sprintf(string, "@R%02d++", regaddr);
+/* Skip the idle loops the recorded run skipped at this point, see idle_fast_forward() */
+void replay_skips() {
+  record_event event;
+
+  while (recorder_peek(&gbl$recorder, &event) && event.type == RECORD_SKIP && replay_event(RECORD_SKIP, 0, 0, &event))
+    idle_skip(event.instructions, event.skipped_cycles);
+}
+
+void record_instruction(unsigned int address) {
+  record_event event;
+
+  if (gbl$recorder.mode == RECORDER_RECORDING)
+    recorder_instruction(&gbl$recorder, address);
+  else {
+    replay_skips();
+    if (gbl$recorder.mode == RECORDER_REPLAYING)
+      replay_event(RECORD_INSTRUCTION, address, 0, &event);
+  }
+}
+
+void record_write(unsigned int address, unsigned int value) {
+  record_event event;
+
+  if (gbl$recorder.mode == RECORDER_RECORDING)
+    recorder_write(&gbl$recorder, gbl$cycles, address, value);
+  else
+    replay_event(RECORD_WRITE, address, value, &event);
+}
+
+void record_interrupt(unsigned int address) {
+  record_event event;
+
+  if (gbl$recorder.mode == RECORDER_RECORDING)
+    recorder_interrupt(&gbl$recorder, gbl$cycles, address);
+  else
+    replay_event(RECORD_INTERRUPT, address, 0, &event);
+}
+
+/* Read an IO register, a replay returns the recorded value without accessing the device */
+unsigned int record_input(unsigned int address) {
+  record_event event;
+  unsigned int value;
+
+  if (gbl$recorder.mode == RECORDER_REPLAYING && replay_event(RECORD_INPUT, address, 0, &event))
+    return event.value;
+
+  value = gbl$io[address & 0xff].read(gbl$io[address & 0xff].context, address);
+  if (gbl$recorder.mode == RECORDER_RECORDING)
+    recorder_input(&gbl$recorder, gbl$cycles, address, value);
+  return value;
+}
+
+/*
+**  Called before RUN and STEP: The first run of a recording writes the snapshot the trace starts with. Traces contain
+** the instructions of the routines emulated by the HLE and the HLE changes where the batches of run() end, i.e.
+** where idle loops are skipped, so the HLE is switched off while a trace is recorded resp. replayed. The same holds
+** for the code coverage, which is meant to show the routines of the monitor executed by a program.
+*/
+void record_arm() {
+  snapshot *start;
+
+  if (gbl$recorder.mode == RECORDER_RECORDING && !gbl$recorder.started) {
+    if (!(start = snapshot_take()) || recorder_begin(&gbl$recorder, start, gbl$instructions, gbl$cycles)) {
+      printf("Unable to record into >>%s<<\n", gbl$recorder.file_name);
+      recorder_close(&gbl$recorder, gbl$cycles);
+    }
+    if (start)
+      snapshot_free(start);
+  }
+  gbl$recorder.armed = gbl$recorder.mode != RECORDER_OFF;
+  if ((gbl$recorder.armed || gbl$coverage.enabled) && gbl$hle.mode) {
+    gbl$hle_suspended = gbl$hle.mode;
+    set_hle_mode(HLE_OFF);
+  }
+}
+
+/* Called after RUN and STEP */
+void record_disarm() {
+  gbl$recorder.armed = FALSE;
+  if (gbl$hle_suspended) {
+    set_hle_mode(gbl$hle_suspended);
+    gbl$hle_suspended = HLE_OFF;
+  }
+}
+
+/* End recording resp. replaying a trace */
+void record_stop() {
+  if (recorder_close(&gbl$recorder, gbl$cycles))
+    printf("Unable to write the trace >>%s<< completely\n", gbl$recorder.file_name);
+}
+
+/* Record the following runs into a file */
+int record_start(const char *file_name) {
+  record_stop();
+  if (recorder_create(&gbl$recorder, file_name)) {
+    printf("Unable to create file >>%s<<\n", file_name);
+    return -1;
+  }
+  return 0;
+}
+
+/* Restore the machine state a trace starts with, the following runs replay the trace */
+int replay_start(const char *file_name) {
+  snapshot *start;
+
+  record_stop();
+  if (recorder_open(&gbl$recorder, file_name, &start)) {
+    printf("Unable to replay >>%s<<\n", file_name);
+    return -1;
+  }
+  snapshot_restore(start);
+  snapshot_free(start);
+  return 0;
+}
+
+/*
+**  The following function performs all memory access operations necessary for executing code in the 
+** emulator. Support routines like dump, etc. may access memory directly, but in this case be aware
+** of the fact that no IO device emulation will take place!
+**
+*/
+INLINE unsigned int core_access_memory(unsigned int address, unsigned int operation, unsigned int value,
+                                       unsigned int hooks) {
+  address &= 0xffff;
+  value   &= 0xffff;
+
+  if (STATISTICS(hooks))
+    gbl$stat.memory_accesses[operation]++;
+
+  if (operation == READ_MEMORY) {
+    if (address < IO_AREA_START)
+      value = gbl$memory[address];
+    else { /* IO area */
+      if (TRACE(hooks))
+        printf("\tread_memory: IO-area read access at 0x%04X\n\r", address);
+
+      value = RECORDING(hooks) ? record_input(address)
+                               : gbl$io[address & 0xff].read(gbl$io[address & 0xff].context, address);
+      if (address == IO_UART_SRA) /* Only the input status registers may be polled by an idle loop */
+        gbl$idle.polled |= IDLE_POLLS_UART;
+      else if (address == IO_KBD_STATE)
+        gbl$idle.polled |= IDLE_POLLS_KEYBOARD;
+      else if (address != IO_SWITCH_REG)
+        gbl$idle.io_reads++;
+#ifdef USE_UART
+      if (address == IO_UART_RHRA)
+        gbl$cycles += UART_READ_WAIT_STATES;
+#endif
+    }
+    if (BREAK_HIT(&gbl$breakpoints, BREAK_READ, address))
+      break_access(BREAK_READ, address, value);
+  } else if (operation == WRITE_MEMORY) {
+    if (BREAK_HIT(&gbl$breakpoints, BREAK_WRITE, address))
+      break_access(BREAK_WRITE, address, value);
+    if (RECORDING(hooks))
+      record_write(address, value);
+    if (address < IO_AREA_START) {
+      gbl$memory[address] = value;
+      gbl$dirty_pages[address / DIRTY_PAGE_SIZE] = TRUE;
+      invalidate_decoded_instruction(address);
+    } else { /* IO area */
+      if (TRACE(hooks))
+        printf("\twrite_memory: IO-area access from %04X at 0x%04X: 0x%04X\n\r", gbl$last_address, address, value);
+
+      if (!gbl$hle_phase || hle_log_write(address, value))
+        gbl$io[address & 0xff].write(gbl$io[address & 0xff].context, address, value);
+    }
+  } else {
+    printf("Illegal operation code in access_memory!\n");
+    exit(-1);
+  }
+
+  return value & 0xffff;
+}
+
+unsigned int access_memory(unsigned int address, unsigned int operation, unsigned int value) {
+  return core_access_memory(address, operation, value, TRACE_HOOKS);
+}
+
+/*
+**  Initialize a newly created machine whose state is still all zero: Set everything not starting with zero and
+** register the IO devices. reset_machine() has to be called afterwards.
+*/
+void initialize_machine() {
+  gbl$bank = gbl$registers;
+  gbl$flags[0] = 1;
+  gbl$lazy.valid = ALL_FLAGS;
+  gbl$cycle_counter.source = &gbl$cycles;
+  gbl$instruction_counter.source = &gbl$instructions;
+  gbl$block_generation = 1;
+  gbl$idle.enabled = TRUE;
+#ifdef USE_JIT
+  gbl$jit.enabled = !x86_64_create(&gbl$jit.code, JIT_BUFFER_SIZE);
+#endif
+
+  register_io_devices();
+#ifdef USE_TIMER
+  initializeTimerModule(&gbl$timer, &gbl$interrupt_request, &gbl$interrupt_address);
+#endif
+}
+
+/*
+** reset the processor state, registers, memory.
+*/
+void reset_machine() {
+  unsigned int i;
+
+  /* Reset main memory and registers */
+  for (i = 0; i < IO_AREA_START; access_memory(i++, WRITE_MEMORY, 0));
+  for (i = 0; i < REGMEM_SIZE; gbl$registers[i++] = 0);
+  write_register(SR, 0); /* Reset flags and register bank pointer */
+
+  /* Reset statistics counters */
+  for (i = 0; i < NO_OF_INSTRUCTIONS; gbl$stat.instruction_frequency[i++] = 0);
+  for (i = 0; i < NO_OF_ADDRESSING_MODES; i++)
+    gbl$stat.addressing_modes[0][i] = gbl$stat.addressing_modes[1][i] = 0;
+  gbl$stat.memory_accesses[0] = gbl$stat.memory_accesses[1] = 0;
+  gbl$stat.cycles = 0;
+
+  /* Route use the USB keyboard emulation for stdin and VGA for stdout */
+#if defined(__EMSCRIPTEN__) || (defined(USE_VGA) && !defined(USE_UART))
+  gbl$memory[IO_SWITCH_REG] = 3;
+#endif
+
+  gbl$interrupt_request = FALSE;
+  gbl$interrupt_active = FALSE;
+
+  /* Like the hardware, both counters start counting from zero after a reset */
+  reset_counter(&gbl$cycle_counter);
+  reset_counter(&gbl$instruction_counter);
+
+  if (gbl$debug || gbl$verbose)
+    printf("\treset_machine: done\n");
+}
+
+/*
+** Decode an operand specified by a 6 bit mask. Returns TRUE if the next word will be a constant, so this can
+** be skipped in the next disassemble step.
+*/
+int decode_operand(unsigned int operand, char *string) {
+  int mode, regaddr;
+
+  mode = operand & 0x3;
+  regaddr = (operand >> 2) & 0xf;
+  *string = (char) 0;
+
+  if (!mode) {
+    sprintf(string, "R%02d", regaddr);
+    return FALSE;
+  }
+
+  if (mode == 1) /* @Rxx */
+    sprintf(string, "@R%02d", regaddr);
+  else if (mode == 2) {
+    sprintf(string, "@R%02d++", regaddr);
     if (regaddr == 0xf) /* PC relative addressing */
       return TRUE;
   } else /* mode == 3 */
     sprintf(string, "@--R%02d", regaddr);
 
-  return FALSE;
+  return FALSE;
+}
+
+/*
+** Disassemble the instruction at address into text, returns the number of words occupied by the instruction
+** including its constants.
+*/
+unsigned int disassemble_instruction(unsigned int address, char *text) {
+  unsigned int opcode, instruction, j, skip_addresses = 0;
+  char scratch[STRING_LENGTH], operands[STRING_LENGTH], mnemonic[STRING_LENGTH];
+
+  opcode = (instruction = access_memory(address, READ_MEMORY, 0) & 0xffff) >> 12;
+  *operands = (char) 0;
+  if (opcode < GENERIC_CONTROL_OPCODE) { /* Normal instruction */
+    if (opcode == 0xd) { /* This one is reserved for future use! */
+      strcpy(mnemonic, "RSVD");
+      *operands = (char) 0;
+    } else {
+      strcpy(mnemonic, gbl$normal_mnemonics[opcode]);
+      if (gbl$normal_operands[opcode]) { /* At least one operand */
+        if ((skip_addresses = decode_operand((instruction >> 6) & 0x3f, scratch))) /* Constant used! */
+          sprintf(scratch, "0x%04X", access_memory(address + 1, READ_MEMORY, 0));
+        strcpy(operands, scratch);
+      }
+
+      if (gbl$normal_operands[opcode] == 2) { /* Decode second operand */
+        if ((j = decode_operand(instruction & 0x3f, scratch)))
+          sprintf(scratch, "0x%04X", access_memory(address + skip_addresses + j, READ_MEMORY, 0));
+        skip_addresses += j;
+        strcat(operands, ", ");
+        strcat(operands, scratch);
+      }
+    }
+  } else if (opcode == GENERIC_CONTROL_OPCODE) { /* Control instruction (HALT, RTI, INT) */
+    strcpy(mnemonic, gbl$control_mnemonics[j = (instruction >> 6) & 0x3f]);
+    if (j == INT_INSTRUCTION) { /* The INT instruction has one parameter */
+      if ((skip_addresses = decode_operand(instruction & 0x3f, scratch))) /* Constant as operand */
+        sprintf(scratch, "0x%04X", access_memory(address + 1, READ_MEMORY, 0));
+      strcpy(operands, scratch);
+    }
+  } else if (opcode == GENERIC_BRANCH_OPCODE) { /* Branch or Subroutine call */
+    strcpy(mnemonic, gbl$branch_mnemonics[(instruction >> 4) & 0x3]);
+    if ((skip_addresses  = decode_operand((instruction >> 6) & 0x3f, scratch)))
+      sprintf(scratch, "0x%04X", access_memory(address + 1, READ_MEMORY, 0));
+    sprintf(operands, "%s, %s%c", scratch, (instruction >> 3) & 1 ? "!" : "", gbl$sr_bits[instruction & 0x7]);
+  } else {
+    strcpy(mnemonic, "???");
+    *operands = (char) 0;
+  }
+
+  sprintf(text, "%04X %-6s\t%s", instruction, mnemonic, operands);
+  return 1 + skip_addresses;
+}
+
+/*
+** Disassemble the contents of a memory region
+*/
+void disassemble(unsigned int start, unsigned int stop) {
+  unsigned int i, words;
+  char text[3 * STRING_LENGTH];
+
+  printf("Disassembled contents of memory locations %04x - %04x:\n", start, stop);
+  for (i = start; i <= stop; i += words) {
+    words = disassemble_instruction(i, text);
+    printf("%04X: %s\n", i, text);
+    for (unsigned int j = 1; j < words; j++) /* Do not decode these machine words -- since they were used in @R15++! */
+      printf("%04X: %04X\n", i + j, access_memory(i + j, READ_MEMORY, 0) & 0xffff);
+  }
+}
+
+/*
+** Read a source operand specified by mode and regaddr. If suppress_increment is set (all instructions with only
+** one argument should do this!), the autoincrement will not be executed since this will be the task of 
+** the operand update step. If this is necessary, mode == 2 can be used as a condition for this.
+** Predecrement will be executed always, postincrement only conditionally.
+*/
+INLINE unsigned int read_source_operand(unsigned int mode, unsigned int regaddr, int suppress_increment,
+                                        unsigned int hooks) {
+  unsigned int source;
+
+  if (TRACE(hooks))
+    printf("\tread_source_operand: mode=%01X, reg=%01X, skip_increment=%d\n\r", mode, regaddr, suppress_increment);
+
+  switch (mode) { /* Mode bits of source operand */
+    case 0: /* Rxx */
+      source = read_register(regaddr);
+      break;
+    case 1: /* @Rxx */
+      source = core_access_memory(read_register(regaddr), READ_MEMORY, 0, hooks);
+      break;
+    case 2: /* @Rxx++ */
+      source = core_access_memory(read_register(regaddr), READ_MEMORY, 0, hooks);
+      if (!suppress_increment)
+        core_write_register(regaddr, read_register(regaddr) + 1, hooks);
+      break;
+    case 3: /* @--Rxx */
+      core_write_register(regaddr, read_register(regaddr) - 1, hooks);
+      source = core_access_memory(read_register(regaddr), READ_MEMORY, 0, hooks);
+      break;
+    default:
+      printf("Internal error, fetch operand!\n");
+      exit(-1);
+  }
+
+  if (STATISTICS(hooks))
+    gbl$stat.addressing_modes[0][mode]++;
+
+  if (TRACE(hooks))
+    printf("\tread_source_operand: value=%04X, r15=%04X\n\r", source, read_register(PC));
+  return source & 0xffff;
+}
+
+/*
+** This is the counterpart function to read_source_operand. The major difference (apart from writing instead of reading :-) )
+** is that predecrements can be suppressed, autoincrements will be executed always.
+*/
+INLINE void write_destination(unsigned int mode, unsigned int regaddr, unsigned int value, int suppress_decrement,
+                              unsigned int hooks) {
+  if (TRACE(hooks))
+    printf("\twrite_operand: mode=%01X, reg=%01X, value=%04X, skip_increment=%d\n\r", mode, regaddr, value, suppress_decrement);
+
+  value &= 0xffff;
+  switch (mode) {
+    case 0: /* rxx */
+      core_write_register(regaddr, value, hooks);
+      break;
+    case 1: /* @Rxx */
+      core_access_memory(read_register(regaddr), WRITE_MEMORY, value, hooks);
+      break;
+    case 2: /* @Rxx++ */
+      core_access_memory(read_register(regaddr), WRITE_MEMORY, value, hooks);
+      core_write_register(regaddr, read_register(regaddr) + 1, hooks);
+      break;
+    case 3: /* @--Rxx */
+      if (!suppress_decrement)
+        core_write_register(regaddr, read_register(regaddr) - 1, hooks);
+      core_access_memory(read_register(regaddr), WRITE_MEMORY, value, hooks);
+      break;
+    default:
+      printf("Internal error, write operand!\n");
+      exit(-1);
+  }
+
+  if (STATISTICS(hooks))
+    gbl$stat.addressing_modes[1][mode]++;
+
+  if (TRACE(hooks))
+    printf("\twrite_destination: r15=%04X\n\r", read_register(PC));
+}
+
+/*
+**  The following function updates the lower six bits of the status register R14 according to 
+** the result of some machine instruction. Please keep in mind that the destination (result)
+** parameter may occupy 17 bits (including the carry)! Do not truncate this parameter prior
+** to calling this routine!
+**
+**  The flags are not computed here but only when they are read, see read_flag. Instructions
+** which retain the X flag (the shifts) must make sure that X is up to date before calling this
+** function since the recorded result will be overwritten.
+*/
+INLINE void update_status_bits(unsigned int destination, unsigned int source_0, unsigned int source_1, 
+                               unsigned int control_bitmask, unsigned int operation) {
+  gbl$lazy.result = destination;
+  gbl$lazy.valid &= ~((1 << Z_FLAG) | (1 << N_FLAG));
+
+  if (!(control_bitmask & DO_NOT_MODIFY_X)) /* Otherwise retain old X-flag */
+    gbl$lazy.valid &= ~(1 << X_FLAG);
+
+  if (!(control_bitmask & DO_NOT_MODIFY_CARRY)) { /* Otherwise retain old C-flag */
+    gbl$lazy.carry_result = destination;
+    gbl$lazy.valid &= ~(1 << C_FLAG);
+  }
+
+  if (!(control_bitmask & DO_NOT_MODIFY_OVERFLOW) && (operation == ADD_INSTRUCTION || operation == SUB_INSTRUCTION)) {
+    gbl$lazy.source_0        = source_0;
+    gbl$lazy.source_1        = source_1;
+    gbl$lazy.overflow_result = destination;
+    gbl$lazy.operation       = operation;
+    gbl$lazy.valid &= ~(1 << V_FLAG);
+  } // Otherwise retain old V-flag
+}
+
+/*
+**  The instruction cache holds one pre-decoded entry per memory address: The instruction fields are already split,
+** constant operands (@R15++) are already fetched and the variant used for dispatching is already determined.
+** access_memory invalidates all entries which might have been decoded from a memory cell being written to, so
+** self modifying code is handled transparently. Instructions in or reaching into the IO area are never cached.
+*/
+void invalidate_decoded_instruction(unsigned int address) {
+  /* An instruction occupies up to three words, so a write might affect the two preceding entries, too. */
+  gbl$decoded[address & 0xffff].valid = gbl$decoded[(address - 1) & 0xffff].valid
+                                      = gbl$decoded[(address - 2) & 0xffff].valid = FALSE;
+
+  if (gbl$translated[address & 0xffff] == gbl$block_generation) /* Self modifying code, see translate_block() */
+    gbl$block_generation++;
+}
+
+void invalidate_all_decoded_instructions() {
+  for (unsigned int i = 0; i < MEMORY_SIZE; gbl$decoded[i++].valid = FALSE);
+}
+
+/*
+**  Machine state for snapshots (see snapshot.h): Besides the main memory, which is restored copy-on-write using
+** gbl$dirty_pages, and the registers, this comprises the interrupt, EAE and cycle counter state as well as the state
+** of all devices. The flags are materialized before saving, the register window is recalculated after restoring.
+*/
+void memory_after_restore(void *context) {
+  for (unsigned int page = 0; page < MEMORY_SIZE / DIRTY_PAGE_SIZE; page++)
+    if (gbl$dirty_pages[page])
+      for (unsigned int i = page * DIRTY_PAGE_SIZE; i < (page + 1) * DIRTY_PAGE_SIZE; i++)
+        invalidate_decoded_instruction(i);
+}
+
+void registers_before_save(void *context) {
+  materialize_flags();
+}
+
+void registers_after_restore(void *context) {
+  gbl$lazy.valid = ALL_FLAGS;
+  gbl$bank = gbl$registers + ((gbl$registers[SR] >> 4) & 0xff0);
+}
+
+#define SNAPSHOT_VARIABLE(variable) snapshot_register(#variable, &variable, sizeof(variable), NULL, NULL, NULL, NULL, 0)
+
+void register_machine_state() {
+  snapshot_register("gbl$memory", gbl$memory, sizeof(gbl$memory), NULL, memory_after_restore, NULL, gbl$dirty_pages,
+                    DIRTY_PAGE_SIZE * sizeof(*gbl$memory));
+  snapshot_register("gbl$registers", gbl$registers, sizeof(gbl$registers), registers_before_save,
+                    registers_after_restore, NULL, NULL, 0);
+  SNAPSHOT_VARIABLE(gbl$flags);
+  SNAPSHOT_VARIABLE(gbl$interrupt_address);
+  SNAPSHOT_VARIABLE(gbl$interrupt_request);
+  SNAPSHOT_VARIABLE(gbl$interrupt_active);
+  SNAPSHOT_VARIABLE(gbl$interrupt_R14);
+  SNAPSHOT_VARIABLE(gbl$interrupt_R15);
+  SNAPSHOT_VARIABLE(gbl$eae_operand_0);
+  SNAPSHOT_VARIABLE(gbl$eae_operand_1);
+  SNAPSHOT_VARIABLE(gbl$eae_result_lo);
+  SNAPSHOT_VARIABLE(gbl$eae_result_hi);
+  SNAPSHOT_VARIABLE(gbl$eae_csr);
+  SNAPSHOT_VARIABLE(gbl$cycles);
+  SNAPSHOT_VARIABLE(gbl$instructions);
+  SNAPSHOT_VARIABLE(gbl$cycle_counter);
+  SNAPSHOT_VARIABLE(gbl$instruction_counter);
+  SNAPSHOT_VARIABLE(gbl$last_address);
+#ifdef USE_UART
+  SNAPSHOT_VARIABLE(gbl$first_uart);
+#endif
+#ifdef USE_SD
+  sd_register_snapshot(&gbl$sd);
+#endif
+#ifdef USE_IDE
+  registerIDESnapshot();
+#endif
+#ifdef USE_VGA
+  vga_register_snapshot();
+#endif
+#ifdef USE_TIMER
+  registerTimerSnapshot(&gbl$timer);
+#endif
+}
+
+/*
+** Read the source operand of a decoded instruction. Constants have been fetched during decoding, so only the
+** program counter has to be advanced.
+*/
+INLINE unsigned int read_source(decoded_instruction *entry, unsigned int source_mode, unsigned int hooks) {
+  if (source_mode != 2 || !entry->source_constant)
+    return read_source_operand(source_mode, entry->source_regaddr, FALSE, hooks);
+
+  core_write_register(PC, read_register(PC) + 1, hooks);
+  if (STATISTICS(hooks)) {
+    gbl$stat.memory_accesses[READ_MEMORY]++;
+    gbl$stat.addressing_modes[0][2]++;
+  }
+
+  if (TRACE(hooks))
+    printf("\tread_source: constant=%04X, r15=%04X\n\r", entry->constant[0], read_register(PC));
+  return entry->constant[0];
+}
+
+/*
+** Read the destination operand of a decoded instruction (as needed by all instructions with two operands).
+*/
+INLINE unsigned int read_destination(decoded_instruction *entry, unsigned int destination_mode, int suppress_increment,
+                                     unsigned int hooks) {
+  if (destination_mode != 2 || !entry->destination_constant)
+    return read_source_operand(destination_mode, entry->destination_regaddr, suppress_increment, hooks);
+
+  if (!suppress_increment)
+    core_write_register(PC, read_register(PC) + 1, hooks);
+  if (STATISTICS(hooks)) {
+    gbl$stat.memory_accesses[READ_MEMORY]++;
+    gbl$stat.addressing_modes[0][2]++;
+  }
+
+  if (TRACE(hooks))
+    printf("\tread_destination: constant=%04X, r15=%04X\n\r", entry->constant[1], read_register(PC));
+  return entry->constant[1];
+}
+
+INLINE int execute_move(decoded_instruction *entry, unsigned int source_mode, unsigned int destination_mode,
+                        unsigned int hooks) {
+  unsigned int destination;
+
+  destination = read_source(entry, source_mode, hooks);
+  update_status_bits(destination, destination, destination, DO_NOT_MODIFY_CARRY | DO_NOT_MODIFY_OVERFLOW,
+                     NO_ADD_SUB_INSTRUCTION);
+  write_destination(destination_mode, entry->destination_regaddr, destination, FALSE, hooks);
+  return FALSE;
+}
+
+INLINE int execute_add(decoded_instruction *entry, unsigned int source_mode, unsigned int destination_mode,
+                       unsigned int hooks) {
+  unsigned int source_0, source_1, destination;
+
+  source_1 = read_source(entry, source_mode, hooks);
+  source_0 = read_destination(entry, destination_mode, TRUE, hooks);
+  destination = source_0 + source_1;
+  update_status_bits(destination, source_0, source_1, MODIFY_ALL, ADD_INSTRUCTION);
+  write_destination(destination_mode, entry->destination_regaddr, destination, TRUE, hooks);
+  return FALSE;
+}
+
+INLINE int execute_addc(decoded_instruction *entry, unsigned int source_mode, unsigned int destination_mode,
+                        unsigned int hooks) {
+  unsigned int source_0, source_1, destination;
+
+  source_1 = read_source(entry, source_mode, hooks);
+  source_0 = read_destination(entry, destination_mode, TRUE, hooks);
+  destination = source_0 + source_1 + read_flag(C_FLAG); /* Take carry into account */
+  update_status_bits(destination, source_0, source_1, MODIFY_ALL, ADD_INSTRUCTION);
+  write_destination(destination_mode, entry->destination_regaddr, destination, TRUE, hooks);
+  return FALSE;
+}
+
+INLINE int execute_sub(decoded_instruction *entry, unsigned int source_mode, unsigned int destination_mode,
+                       unsigned int hooks) {
+  unsigned int source_0, source_1, destination;
+
+  source_1 = read_source(entry, source_mode, hooks);
+  source_0 = read_destination(entry, destination_mode, TRUE, hooks);
+  destination = source_0 - source_1;
+  update_status_bits(destination, source_0, source_1, MODIFY_ALL, SUB_INSTRUCTION);
+  write_destination(destination_mode, entry->destination_regaddr, destination, TRUE, hooks);
+  return FALSE;
+}
+
+INLINE int execute_subc(decoded_instruction *entry, unsigned int source_mode, unsigned int destination_mode,
+                        unsigned int hooks) {
+  unsigned int source_0, source_1, destination;
+
+  source_1 = read_source(entry, source_mode, hooks);
+  source_0 = read_destination(entry, destination_mode, TRUE, hooks);
+  destination = source_0 - source_1 - read_flag(C_FLAG); /* Take carry into account */
+  update_status_bits(destination, source_0, source_1, MODIFY_ALL, SUB_INSTRUCTION);
+  write_destination(destination_mode, entry->destination_regaddr, destination, TRUE, hooks);
+  return FALSE;
+}
+
+/*
+** The shifts without their operands, shared with the native code (see jit_compile_block()). The shifted value is
+** returned unmasked, update_status_bits() only looks at its lower 16 bits anyway.
+*/
+INLINE unsigned int shift_left(unsigned int count, unsigned int destination) {
+  unsigned int i, temp_flag, fill_flag;
+
+  fill_flag = read_flag(X_FLAG); /* X is retained by update_status_bits, so it must be up to date anyway */
+  if (count) {
+    for (i = 0; i < count; i++) {
+      temp_flag = (destination & 0x8000) >> 15;
+      destination = (destination << 1) | fill_flag;                                 /* Fill with X bit */
+    }
+    write_flag(C_FLAG, temp_flag);                                                /* Shift into C bit */
+  }
+  update_status_bits(destination, count, 0,
+                     DO_NOT_MODIFY_CARRY | DO_NOT_MODIFY_X | DO_NOT_MODIFY_OVERFLOW,
+                     NO_ADD_SUB_INSTRUCTION);
+  return destination;
+}
+
+INLINE unsigned int shift_right(unsigned int count, unsigned int destination) {
+  unsigned int i, temp_flag, fill_flag;
+
+  fill_flag = read_flag(C_FLAG);
+  read_flag(X_FLAG); /* X is retained by update_status_bits, so it must be up to date */
+  if (count) {
+    for (i = 0; i < count; i++) {
+      temp_flag = destination & 1;
+      destination = ((destination >> 1) & 0xffff) | (fill_flag << 15);                /* Fill with C bit */
+    }
+    write_flag(X_FLAG, temp_flag);                                                    /* Shift into X bit */
+  }
+  update_status_bits(destination, count, 0,
+                     DO_NOT_MODIFY_CARRY | DO_NOT_MODIFY_X | DO_NOT_MODIFY_OVERFLOW,
+                     NO_ADD_SUB_INSTRUCTION);
+  return destination;
+}
+
+INLINE int execute_shl(decoded_instruction *entry, unsigned int source_mode, unsigned int destination_mode,
+                       unsigned int hooks) {
+  unsigned int source_0, destination;
+
+  source_0 = read_source(entry, source_mode, hooks);
+  destination = shift_left(source_0, read_destination(entry, destination_mode, TRUE, hooks));
+  if (source_0)
+    write_destination(destination_mode, entry->destination_regaddr, destination, FALSE, hooks);
+  return FALSE;
+}
+
+INLINE int execute_shr(decoded_instruction *entry, unsigned int source_mode, unsigned int destination_mode,
+                       unsigned int hooks) {
+  unsigned int source_0, destination;
+
+  source_0 = read_source(entry, source_mode, hooks);
+  destination = shift_right(source_0, read_destination(entry, destination_mode, TRUE, hooks));
+  if (source_0)
+    write_destination(destination_mode, entry->destination_regaddr, destination, FALSE, hooks);
+  return FALSE;
+}
+
+INLINE int execute_swap(decoded_instruction *entry, unsigned int source_mode, unsigned int destination_mode,
+                        unsigned int hooks) {
+  unsigned int source_0, destination;
+
+  source_0 = read_source(entry, source_mode, hooks);
+  destination = (source_0 >> 8) | ((source_0 << 8) & 0xff00);
+  update_status_bits(destination, source_0, source_0, DO_NOT_MODIFY_CARRY | DO_NOT_MODIFY_OVERFLOW, NO_ADD_SUB_INSTRUCTION);
+  write_destination(destination_mode, entry->destination_regaddr, destination, FALSE, hooks);
+  return FALSE;
+}
+
+INLINE int execute_not(decoded_instruction *entry, unsigned int source_mode, unsigned int destination_mode,
+                       unsigned int hooks) {
+  unsigned int source_0, destination;
+
+  source_0 = read_source(entry, source_mode, hooks);
+  destination = ~source_0 & 0xffff;
+  update_status_bits(destination, source_0, source_0, DO_NOT_MODIFY_CARRY | DO_NOT_MODIFY_OVERFLOW, NO_ADD_SUB_INSTRUCTION);
+  write_destination(destination_mode, entry->destination_regaddr, destination, FALSE, hooks);
+  return FALSE;
+}
+
+INLINE int execute_and(decoded_instruction *entry, unsigned int source_mode, unsigned int destination_mode,
+                       unsigned int hooks) {
+  unsigned int source_0, source_1, destination;
+
+  source_1 = read_source(entry, source_mode, hooks);
+  source_0 = read_destination(entry, destination_mode, TRUE, hooks);
+  destination = source_0 & source_1;
+  update_status_bits(destination, source_0, source_1, DO_NOT_MODIFY_CARRY | DO_NOT_MODIFY_OVERFLOW, NO_ADD_SUB_INSTRUCTION);
+  write_destination(destination_mode, entry->destination_regaddr, destination, TRUE, hooks);
+  return FALSE;
+}
+
+INLINE int execute_or(decoded_instruction *entry, unsigned int source_mode, unsigned int destination_mode,
+                      unsigned int hooks) {
+  unsigned int source_0, source_1, destination;
+
+  source_1 = read_source(entry, source_mode, hooks);
+  source_0 = read_destination(entry, destination_mode, TRUE, hooks);
+  destination = source_0 | source_1;
+  update_status_bits(destination, source_0, source_1, DO_NOT_MODIFY_CARRY | DO_NOT_MODIFY_OVERFLOW, NO_ADD_SUB_INSTRUCTION);
+  write_destination(destination_mode, entry->destination_regaddr, destination, TRUE, hooks);
+  return FALSE;
+}
+
+INLINE int execute_xor(decoded_instruction *entry, unsigned int source_mode, unsigned int destination_mode,
+                       unsigned int hooks) {
+  unsigned int source_0, source_1, destination;
+
+  source_1 = read_source(entry, source_mode, hooks);
+  source_0 = read_destination(entry, destination_mode, TRUE, hooks);
+  destination = source_0 ^ source_1;
+  update_status_bits(destination, source_0, source_1, DO_NOT_MODIFY_CARRY | DO_NOT_MODIFY_OVERFLOW, NO_ADD_SUB_INSTRUCTION);
+  write_destination(destination_mode, entry->destination_regaddr, destination, TRUE, hooks);
+  return FALSE;
+}
+
+INLINE int execute_cmp(decoded_instruction *entry, unsigned int source_mode, unsigned int destination_mode,
+                       unsigned int hooks) {
+  unsigned int source_0, source_1;
+  int cmp_0, cmp_1;
+
+  source_0 = read_source(entry, source_mode, hooks);
+  source_1 = read_destination(entry, destination_mode, FALSE, hooks);
+
+  // CMP does NOT use the standard logic for setting the SR bits - this is done explicitly here.
+  write_flag(Z_FLAG, (source_0 & 0xffff) == (source_1 & 0xffff) ? 1 : 0);
+  write_flag(N_FLAG, source_0 > source_1 ? 1 : 0);
+
+  /* Ugly but it works: Convert the unsigned int source_0/1 to signed ints with possible sign extension: */
+  cmp_0 = source_0;
+  cmp_1 = source_1;
+
+  if (source_0 & 0x8000) cmp_0 |= 0xffffffffffff0000;
+  if (source_1 & 0x8000) cmp_1 |= 0xffffffffffff0000;
+  write_flag(V_FLAG, cmp_0 > cmp_1 ? 1 : 0);
+  return FALSE;
+}
+
+INLINE int execute_reserved(decoded_instruction *entry, unsigned int source_mode, unsigned int destination_mode,
+                            unsigned int hooks) {
+  MESSAGE("Attempt to execute a reserved instruction at %04X\n", entry->address);
+  gbl$stop_reason = STOP_ILLEGAL;
+  return 1;
+}
+
+INLINE int execute_control(decoded_instruction *entry, unsigned int source_mode, unsigned int destination_mode,
+                           unsigned int hooks) {
+  unsigned int command, sr_bits, rb;
+
+  switch (command = (entry->instruction >> 6) & 0x3f) {
+    case HALT_INSTRUCTION:
+      MESSAGE("HALT instruction executed at address %04X.\n\n", entry->address);
+      gbl$stop_reason = STOP_HALT;
+      return TRUE;
+      break;    // Not really necessary but good style... :-)
+    case RTI_INSTRUCTION:
+      if (!gbl$interrupt_active) {
+        MESSAGE("Rogue RTI instruction, not servicing an interrupt at address %04X. HALT!\n", entry->address);
+        gbl$stop_reason = STOP_ILLEGAL;
+        return TRUE;
+      }
+      gbl$interrupt_active = FALSE;
+      core_write_register(SR, gbl$interrupt_R14, hooks);
+      core_write_register(PC, gbl$interrupt_R15, hooks);
+      break;
+    case INT_INSTRUCTION:
+      if (gbl$interrupt_active) {
+        MESSAGE("Rogue INT instruction with an ISR at address %04X. HALT!\n", entry->address);
+        gbl$stop_reason = STOP_ILLEGAL;
+        return TRUE;
+      }
+      gbl$interrupt_address = read_destination(entry, destination_mode, TRUE, hooks);
+      write_destination(destination_mode, entry->destination_regaddr, gbl$interrupt_address, TRUE, hooks);
+      gbl$interrupt_request = TRUE;
+      break;
+    case INCRB_INSTRUCTION:
+      sr_bits = read_register(SR);
+      rb = ((sr_bits >> 8) + 1) & 0xff;
+      core_write_register(SR, ((sr_bits & 0x00ff) | (rb << 8)) & 0xffff, hooks);
+      break;
+    case DECRB_INSTRUCTION:
+      sr_bits = read_register(SR);
+      rb = (((sr_bits >> 8) & 0xff) - 1) & 0xff;
+      core_write_register(SR, ((sr_bits & 0x00ff) | (rb << 8)) & 0xffff, hooks);
+      break;
+    default:
+      fprintf(stderr, "Illegal control instruction found: %02X\n", command);
+  }
+  return FALSE;
+}
+
+INLINE int execute_branch(decoded_instruction *entry, unsigned int source_mode, unsigned int destination_mode,
+                          unsigned int hooks) {
+  unsigned int destination;
+  int condition;
+
+  /* Determine destination address in case the branch/subroutine instruction will be performed */
+  destination = read_source(entry, source_mode, hooks); /* Perform autoincrement since no write back occurs! */
+
+  /* Determine which SR bit to use, etc. */
+  condition = read_flag(entry->instruction & 0x7);
+  if (entry->instruction & 0x0008) /* Invert bit to be checked? */
+    condition = 1 - condition;
+
+  if (PROFILING(hooks))
+    profile_branch(entry->address, condition);
+  if (COVERAGE(hooks) && (entry->instruction & 0x7)) { /* Only branches depending on a flag other than the 1 */
+    COVERAGE_SET(&gbl$coverage, COVERAGE_BRANCH, entry->address);
+    COVERAGE_SET(&gbl$coverage, condition ? COVERAGE_TAKEN : COVERAGE_NOT_TAKEN, entry->address);
+  }
+
+  /* Now it is time to determine which branch resp. subroutine call type to execute if the condition is satisfied */
+  if (condition) {
+    switch((entry->instruction >> 4) & 0x3) {
+      case 0: /* ABRA */
+        core_write_register(PC, destination, hooks);
+        break;
+      case 1: /* ASUB */
+        gbl$cycles++; /* Additional state to push the return address */
+        core_write_register(SP, read_register(SP) - 1, hooks);
+        core_access_memory(read_register(SP), WRITE_MEMORY, read_register(PC), hooks);
+        core_write_register(PC, destination, hooks);
+        if (PROFILING(hooks))
+          profile_call(read_register(PC), read_register(SP));
+        break;
+      case 2: /* RBRA */
+        core_write_register(PC, (read_register(PC) + destination) & 0xffff, hooks);
+        break;
+      case 3: /* RSUB */
+        gbl$cycles++;
+        core_write_register(SP, read_register(SP) - 1, hooks);
+        core_access_memory(read_register(SP), WRITE_MEMORY, read_register(PC), hooks);
+        core_write_register(PC, (read_register(PC) + destination) & 0xffff, hooks);
+        if (PROFILING(hooks))
+          profile_call(read_register(PC), read_register(SP));
+        break;
+    }
+  }
+  /* We must increment the PC in case of a constant destination address even if the branch is not taken! */
+// NO, we must not since the PC has already been incremented during the fetch operation!
+//      else if (source_mode == 0x2 && source_regaddr == 0xf) /* This is mode @R15++ */
+//        core_write_register(PC, read_register(PC) + 1, hooks);
+  return FALSE;
+}
+
+/*
+** Clock cycles the state machine of the CPU (see vhdl/qnice_cpu.vhd) needs for an instruction: Fetch and decode,
+** one state per operand read from memory (constants included), execute and one state to store an indirect result.
+** Control instructions are completed in the decode state. MOVE does not read its destination unless it is @--Rxx.
+** A taken ASUB/RSUB needs one more state which is charged by execute_branch(). The memory of the FPGA
+** implementations does not insert wait states, so these are only charged for reading the UART.
+*/
+unsigned int instruction_cycles(decoded_instruction *entry) {
+  if (entry->opcode == GENERIC_CONTROL_OPCODE) /* INT reads the ISR address if it is not given by a register */
+    return 2 + (((entry->instruction >> 6) & 0x3f) == INT_INSTRUCTION && entry->destination_mode);
+  if (entry->opcode == GENERIC_BRANCH_OPCODE)
+    return 3 + (entry->source_mode != 0);
+  return 3 + (entry->source_mode != 0) + (entry->destination_mode != 0)                       /* Store */
+           + (entry->destination_mode != 0 && (entry->opcode != 0 || entry->destination_mode == 3)); /* Read */
+}
+
+/*
+** Split the instruction at address into its fields. Constant operands are only prefetched if cache is TRUE
+** since they cannot be cached for instructions reaching into the IO area.
+*/
+void decode_instruction(unsigned int address, unsigned int instruction, decoded_instruction *entry, int cache) {
+  entry->address             = address;
+  entry->instruction         = instruction;
+  entry->opcode              = (instruction >> 12) & 0xf;
+  entry->source_mode         = (instruction >> 6) & 0x3;
+  entry->source_regaddr      = (instruction >> 8) & 0xf;
+  entry->destination_mode    = instruction & 0x3;
+  entry->destination_regaddr = (instruction >> 2) & 0xf;
+  entry->variant             = (entry->opcode << 4) | (entry->source_mode << 2) | entry->destination_mode;
+
+  /* Only operands which are actually read as a source are taken into account. */
+  entry->source_constant = entry->destination_constant = FALSE;
+  if (cache && entry->opcode != GENERIC_CONTROL_OPCODE) {
+    if (entry->source_mode == 2 && entry->source_regaddr == PC)
+      entry->constant[0] = gbl$memory[address + (entry->source_constant = 1)];
+    if (entry->opcode != 0 && entry->opcode < GENERIC_BRANCH_OPCODE /* MOVE, SWAP and NOT never read it */
+        && entry->opcode != 7 && entry->opcode != 8
+        && entry->destination_mode == 2 && entry->destination_regaddr == PC
+        && !(entry->source_mode == 3 && entry->source_regaddr == PC)) {
+      entry->destination_constant = TRUE;
+      entry->constant[1] = gbl$memory[address + 1 + entry->source_constant];
+    }
+  } else if (cache && ((instruction >> 6) & 0x3f) == INT_INSTRUCTION
+             && entry->destination_mode == 2 && entry->destination_regaddr == PC) {
+    entry->destination_constant = TRUE;
+    entry->constant[1] = gbl$memory[address + 1];
+  }
+
+  entry->cycles = instruction_cycles(entry);
+  entry->valid = cache;
+}
+
+/*
+** Every handler exists once per core variant, the tables are indexed by the hooks and the opcode.
+*/
+#define HANDLER_VARIANT(name, suffix, hooks) \
+  int execute_##name##_##suffix(decoded_instruction *entry) { \
+    return execute_##name(entry, entry->source_mode, entry->destination_mode, hooks); \
+  }
+#define HANDLER_VARIANTS(suffix, hooks) \
+  HANDLER_VARIANT(move, suffix, hooks) HANDLER_VARIANT(add, suffix, hooks)      HANDLER_VARIANT(addc, suffix, hooks) \
+  HANDLER_VARIANT(sub, suffix, hooks)  HANDLER_VARIANT(subc, suffix, hooks)     HANDLER_VARIANT(shl, suffix, hooks) \
+  HANDLER_VARIANT(shr, suffix, hooks)  HANDLER_VARIANT(swap, suffix, hooks)     HANDLER_VARIANT(not, suffix, hooks) \
+  HANDLER_VARIANT(and, suffix, hooks)  HANDLER_VARIANT(or, suffix, hooks)       HANDLER_VARIANT(xor, suffix, hooks) \
+  HANDLER_VARIANT(cmp, suffix, hooks)  HANDLER_VARIANT(reserved, suffix, hooks) HANDLER_VARIANT(control, suffix, hooks) \
+  HANDLER_VARIANT(branch, suffix, hooks)
+#define HANDLER_TABLE(suffix) { \
+    execute_move_##suffix, execute_add_##suffix, execute_addc_##suffix, execute_sub_##suffix, \
+    execute_subc_##suffix, execute_shl_##suffix, execute_shr_##suffix, execute_swap_##suffix, \
+    execute_not_##suffix, execute_and_##suffix, execute_or_##suffix, execute_xor_##suffix, \
+    execute_cmp_##suffix, execute_reserved_##suffix, execute_control_##suffix, execute_branch_##suffix \
+  }
+
+#ifdef USE_THREADED_CORE
+/*
+**  Threaded core: Every combination of opcode, source and destination addressing mode has its own label where
+** the handler is inlined with constant addressing modes, so the compiler removes all mode switches. The
+** dispatch is a single indirect jump using GCC's "labels as values" extension. Only the fast variant of the core
+** is threaded, the statistics and trace variants use the generic handlers to keep the compile time reasonable.
+*/
+# define THREADED_HANDLER(name, sm, dm, hooks) \
+    name##_##sm##_##dm: result = execute_##name(entry, sm, dm, hooks); goto handler_done;
+# define THREADED_HANDLERS(name, hooks) \
+    THREADED_HANDLER(name, 0, 0, hooks) THREADED_HANDLER(name, 0, 1, hooks) THREADED_HANDLER(name, 0, 2, hooks) \
+    THREADED_HANDLER(name, 0, 3, hooks) THREADED_HANDLER(name, 1, 0, hooks) THREADED_HANDLER(name, 1, 1, hooks) \
+    THREADED_HANDLER(name, 1, 2, hooks) THREADED_HANDLER(name, 1, 3, hooks) THREADED_HANDLER(name, 2, 0, hooks) \
+    THREADED_HANDLER(name, 2, 1, hooks) THREADED_HANDLER(name, 2, 2, hooks) THREADED_HANDLER(name, 2, 3, hooks) \
+    THREADED_HANDLER(name, 3, 0, hooks) THREADED_HANDLER(name, 3, 1, hooks) THREADED_HANDLER(name, 3, 2, hooks) \
+    THREADED_HANDLER(name, 3, 3, hooks)
+# define THREADED_LABELS(name) \
+    &&name##_0_0, &&name##_0_1, &&name##_0_2, &&name##_0_3, &&name##_1_0, &&name##_1_1, &&name##_1_2, &&name##_1_3, \
+    &&name##_2_0, &&name##_2_1, &&name##_2_2, &&name##_2_3, &&name##_3_0, &&name##_3_1, &&name##_3_2, &&name##_3_3
+# define THREADED_CORE(suffix, hooks) \
+  int execute_threaded_##suffix(decoded_instruction *entry) { \
+    static void *dispatch_table[] = { \
+      THREADED_LABELS(move), THREADED_LABELS(add),  THREADED_LABELS(addc),     THREADED_LABELS(sub), \
+      THREADED_LABELS(subc), THREADED_LABELS(shl),  THREADED_LABELS(shr),      THREADED_LABELS(swap), \
+      THREADED_LABELS(not),  THREADED_LABELS(and),  THREADED_LABELS(or),       THREADED_LABELS(xor), \
+      THREADED_LABELS(cmp),  THREADED_LABELS(reserved), THREADED_LABELS(control), THREADED_LABELS(branch) \
+    }; \
+    int result; \
+\
+    goto *dispatch_table[entry->variant]; \
+\
+    THREADED_HANDLERS(move, hooks)   THREADED_HANDLERS(add, hooks)      THREADED_HANDLERS(addc, hooks) \
+    THREADED_HANDLERS(sub, hooks)    THREADED_HANDLERS(subc, hooks)     THREADED_HANDLERS(shl, hooks) \
+    THREADED_HANDLERS(shr, hooks)    THREADED_HANDLERS(swap, hooks)     THREADED_HANDLERS(not, hooks) \
+    THREADED_HANDLERS(and, hooks)    THREADED_HANDLERS(or, hooks)       THREADED_HANDLERS(xor, hooks) \
+    THREADED_HANDLERS(cmp, hooks)    THREADED_HANDLERS(reserved, hooks) THREADED_HANDLERS(control, hooks) \
+    THREADED_HANDLERS(branch, hooks) \
+\
+  handler_done: \
+    return result; \
+  }
+
+THREADED_CORE(fast, NO_HOOKS)
+HANDLER_VARIANTS(statistics, STATISTICS_HOOKS)
+HANDLER_VARIANTS(trace, TRACE_HOOKS)
+
+int (*const gbl$instruction_handlers[NO_OF_HOOK_VARIANTS][16])(decoded_instruction *) = {
+  [STATISTICS_HOOKS] = HANDLER_TABLE(statistics), [TRACE_HOOKS] = HANDLER_TABLE(trace)
+};
+#else
+HANDLER_VARIANTS(fast, NO_HOOKS)
+HANDLER_VARIANTS(statistics, STATISTICS_HOOKS)
+HANDLER_VARIANTS(trace, TRACE_HOOKS)
+
+int (*const gbl$instruction_handlers[NO_OF_HOOK_VARIANTS][16])(decoded_instruction *) = {
+  HANDLER_TABLE(fast), HANDLER_TABLE(statistics), HANDLER_TABLE(trace)
+};
+#endif
+
+/*
+** Execute an already fetched and decoded instruction. The return value will be TRUE if the machine has to stop.
+*/
+INLINE int execute_decoded(decoded_instruction *entry, unsigned int hooks) {
+  unsigned int instruction, opcode;
+  int result;
+
+  core_write_register(PC, entry->address + 1, hooks); /* Update program counter */
+  gbl$cycles += entry->cycles;
+  gbl$instructions++;
+
+  instruction = entry->instruction;
+  opcode = entry->opcode;
+  if (VERBOSE(hooks))
+    printf("execute: %04X %04X %s\n\r", entry->address, instruction,
+           opcode == GENERIC_BRANCH_OPCODE ? gbl$branch_mnemonics[(instruction >> 4) & 0x3]
+                                           : gbl$normal_mnemonics[opcode]);
+
+  /* Update the statistics counters */
+  if (opcode < GENERIC_BRANCH_OPCODE && STATISTICS(hooks))
+    gbl$stat.instruction_frequency[opcode]++;
+  else if (opcode == GENERIC_BRANCH_OPCODE && STATISTICS(hooks))
+    gbl$stat.instruction_frequency[opcode + ((instruction >> 4) & 0x3)]++;
+
+  if (PROFILING(hooks))
+    profile_instruction(entry->address, entry->cycles);
+  if (COVERAGE(hooks))
+    COVERAGE_SET(&gbl$coverage, COVERAGE_EXECUTED, entry->address);
+  if (RECORDING(hooks))
+    record_instruction(entry->address);
+
+#ifdef USE_THREADED_CORE
+  if (hooks == NO_HOOKS)
+    return execute_threaded_fast(entry);
+#endif
+  result = gbl$instruction_handlers[hooks][opcode](entry);
+  if (PROFILING(hooks) && instruction == RETURN_INSTRUCTION)
+    profile_return(read_register(SP));
+  return result;
+}
+
+/*
+**  High-level emulation of monitor routines (see hle.h): The interface used by hle.c, the RET ending a routine
+** executed natively and the verification of a call in strict mode.
+*/
+unsigned int hle_read_memory(unsigned int address) {
+  return core_access_memory(address, READ_MEMORY, 0, NO_HOOKS);
+}
+
+void hle_write_memory(unsigned int address, unsigned int value) {
+  core_access_memory(address, WRITE_MEMORY, value, NO_HOOKS);
+}
+
+unsigned int hle_read_register(unsigned int number) {
+  return read_register(number);
+}
+
+void hle_write_register(unsigned int number, unsigned int value) {
+  core_write_register(number, value, NO_HOOKS);
+}
+
+void hle_arithmetic(unsigned int destination, unsigned int source_0, unsigned int source_1, int subtract) {
+  update_status_bits(destination, source_0, source_1, MODIFY_ALL, subtract ? SUB_INSTRUCTION : ADD_INSTRUCTION);
+}
+
+void hle_compare(unsigned int source_0, unsigned int source_1) {
+  write_flag(Z_FLAG, source_0 == source_1 ? 1 : 0);
+  write_flag(N_FLAG, source_0 > source_1 ? 1 : 0);
+  write_flag(V_FLAG, (source_0 ^ 0x8000) > (source_1 ^ 0x8000) ? 1 : 0); /* Signed comparison */
+}
+
+/* MOVE @R13++, R15 */
+INLINE void hle_return(unsigned int hooks) {
+  unsigned int sp = read_register(SP), address = core_access_memory(sp, READ_MEMORY, 0, hooks);
+
+  core_write_register(SP, sp + 1, hooks);
+  core_write_register(PC, address, hooks);
+  update_status_bits(address, address, address, DO_NOT_MODIFY_CARRY | DO_NOT_MODIFY_OVERFLOW, NO_ADD_SUB_INSTRUCTION);
+  gbl$instructions++;
+  gbl$cycles += HLE_CYCLES;
+  if (PROFILING(hooks))
+    profile_return(sp + 1);
+}
+
+int execute();
+
+/*
+**  Execute the call of the routine at address natively and by interpretation, see hle_verification. The machine
+** continues with the result of the interpretation. Returns -1 if the routine cannot be executed natively, TRUE if
+** the results differ.
+*/
+int hle_verify(unsigned int address) {
+  hle_verification *state = gbl$hle_verification;
+  unsigned int sp = read_register(SP), minimum_sp = sp, bank_end, i;
+  unsigned long long instructions = gbl$instructions, cycles = gbl$cycles, steps;
+  int result = FALSE;
+  char difference[STRING_LENGTH] = "";
+
+  if (!state && !(state = gbl$hle_verification = malloc(sizeof(hle_verification))))
+    return -1;
+
+  state->sr[0] = read_register(SR);
+  memcpy(state->registers[0], gbl$registers, sizeof(state->registers[0]));
+  memcpy(state->memory[0], gbl$memory, sizeof(state->memory[0]));
+  state->log[0].count = state->log[1].count = 0;
+
+  gbl$hle_phase = HLE_NATIVE;
+  result = hle_execute(&gbl$hle, address);
+  gbl$hle_phase = FALSE;
+  if (!result)
+    return -1;
+
+  hle_return(NO_HOOKS);
+  state->sr[1] = read_register(SR);
+  memcpy(state->registers[1], gbl$registers, sizeof(state->registers[1]));
+  memcpy(state->memory[1], gbl$memory, sizeof(state->memory[1]));
+
+  /* Back to the state before the call */
+  for (i = 0; i < IO_AREA_START; i++)
+    if (gbl$memory[i] != state->memory[0][i]) {
+      gbl$memory[i] = state->memory[0][i];
+      invalidate_decoded_instruction(i);
+    }
+  memcpy(gbl$registers, state->registers[0], sizeof(state->registers[0]));
+  write_register(SR, state->sr[0]);
+  gbl$instructions = instructions;
+  gbl$cycles = cycles;
+
+  gbl$hle_phase = HLE_INTERPRETED;
+  for (steps = 0, result = FALSE; steps < HLE_VERIFY_STEPS && !result; steps++) {
+    result = execute();
+    if (read_register(SP) < minimum_sp)
+      minimum_sp = read_register(SP);
+    if (read_register(PC) == state->registers[1][PC] && read_register(SP) == state->registers[1][SP])
+      break;
+  }
+  gbl$hle_phase = FALSE;
+  gbl$hle.interpreted[gbl$hle.entry[address] - 1] += gbl$instructions - instructions;
+
+  /* The scratch register banks of the routine and the stack below the return address are not compared */
+  bank_end = (state->sr[0] >> 8) * 16 + 8;
+  if (bank_end < 16)
+    bank_end = 16;
+  if (result || steps == HLE_VERIFY_STEPS)
+    sprintf(difference, "the interpreted routine did not return");
+  else if (read_register(SR) != state->sr[1])
+    sprintf(difference, "SR = %04X instead of %04X", state->sr[1], read_register(SR));
+  for (i = 0; i < bank_end && !*difference; i++)
+    if (gbl$registers[i] != state->registers[1][i])
+      sprintf(difference, "R%u of bank %02X = %04X instead of %04X", i & 0xf, i >> 4, state->registers[1][i],
+              gbl$registers[i]);
+  for (i = 0; i < IO_AREA_START && !*difference; i++)
+    if ((i < minimum_sp || i >= sp) && gbl$memory[i] != state->memory[1][i])
+      sprintf(difference, "memory %04X = %04X instead of %04X", i, state->memory[1][i], gbl$memory[i]);
+  if (!*difference && state->log[0].count != state->log[1].count)
+    sprintf(difference, "%u instead of %u IO writes", state->log[0].count, state->log[1].count);
+  for (i = 0; i < state->log[0].count && i < HLE_IO_LOG_SIZE && !*difference; i++)
+    if (state->log[0].address[i] != state->log[1].address[i] || state->log[0].value[i] != state->log[1].value[i])
+      sprintf(difference, "IO write %u is %04X to %04X instead of %04X to %04X", i + 1, state->log[0].value[i],
+              state->log[0].address[i], state->log[1].value[i], state->log[1].address[i]);
+
+  if (!*difference)
+    return FALSE;
+
+  MESSAGE("HLE of %s (%04X) returning to %04X differs from the interpretation: %s\n", hle_name(&gbl$hle, address),
+          address, state->registers[1][PC], difference);
+  gbl$stop_reason = STOP_ERROR;
+  return TRUE;
+}
+
+/*
+**  Called by execute_instruction() if the PC is the entry address of a routine known to the HLE. Returns -1 if the
+** routine has to be interpreted, otherwise the same as execute_instruction().
+*/
+int hle_call(unsigned int address, unsigned int hooks) {
+  int result;
+
+  if (VERBOSE(hooks))
+    printf("execute: %04X HLE %s\n\r", address, hle_name(&gbl$hle, address));
+
+  if (gbl$hle.mode == HLE_STRICT) {
+    if ((result = hle_verify(address)))
+      return result;
+  } else if (hle_execute(&gbl$hle, address))
+    hle_return(hooks);
+  else
+    return -1;
+
+  address = read_register(PC);
+  if (BREAK_HIT(&gbl$breakpoints, BREAK_EXECUTE, address) && break_execute(address))
+    return TRUE;
+  return gbl$error ? TRUE : FALSE;
+}
+
+/*
+** The following function executes a single QNICE instruction. The return value will be TRUE if an illegal instruction is found.
+*/
+INLINE int execute_instruction(unsigned int hooks) {
+  unsigned int address;
+  decoded_instruction *entry, uncached_entry;
+  int result;
+
+  gbl$error = FALSE;
+
+#ifdef USE_VGA
+  /* global instruction counter for MIPS calcluation; slightly different semantics than gbl$instructions++ */
+  gbl$mips_inst_cnt++;
+  if (gbl$sdl_ticks - gbl$mips_tick_cnt > 1000) {
+    gbl$mips = (float) gbl$mips_inst_cnt / (float) 1000000;
+    gbl$mips_inst_cnt = 0;
+    gbl$mips_tick_cnt = gbl$sdl_ticks;
+  }
+#endif
+
+  // Take care of interrupts
+  if (gbl$interrupt_request && !gbl$interrupt_active) { // Interrupts cannot be nested!
+    gbl$interrupt_active  = TRUE;               // Remember that we are currently servicing an interrupt
+    gbl$interrupt_request = FALSE;
+    gbl$interrupt_R14 = read_register(SR);      // Save status register
+    gbl$interrupt_R15 = read_register(PC);      // and program counter
+    if (RECORDING(hooks))
+      record_interrupt(gbl$interrupt_address);
+    core_write_register(PC, gbl$interrupt_address, hooks);  // Jump to interrupt service routine
+    gbl$cycles += INTERRUPT_CYCLES;
+
+    if (TRACE(hooks)) {
+      printf("Interrupt");
+      if (gbl$verbose)
+        printf(": Address = %04X\n", gbl$interrupt_address);
+      else
+        printf("!\n");
+    }
+  }
+
+  gbl$last_address = gbl$last_addresses[gbl$last_addresses_pointer++ % MAX_LAST_ADDRESSES]
+                   = address = read_register(PC); /* Get PC */
+  if (gbl$hle.mode && gbl$hle.entry[address] && !gbl$hle_phase && (result = hle_call(address, hooks)) >= 0)
+    return result;
+
+  if (address < IO_AREA_START - 2) { /* The instruction including its constants lies completely in RAM */
+    if (!(entry = gbl$decoded + address)->valid)
+      decode_instruction(address, gbl$memory[address], entry, TRUE);
+    if (STATISTICS(hooks))
+      gbl$stat.memory_accesses[READ_MEMORY]++;
+  } else
+    decode_instruction(address, core_access_memory(address, READ_MEMORY, 0, hooks), entry = &uncached_entry, FALSE);
+  if ((result = execute_decoded(entry, hooks)))
+    return result;
+
+  address = read_register(PC);
+  if (BREAK_HIT(&gbl$breakpoints, BREAK_EXECUTE, address) && break_execute(address))
+    return TRUE;
+
+  if (gbl$error) // We encountered some error (division attempt by zero in EAE)
+    return TRUE;
+
+/*  write_register(PC, read_register(PC) + 1); */ /* Update program counter */
+  return FALSE; /* No HALT instruction executed */
+}
+
+int execute() {
+  return execute_instruction(TRACE_HOOKS);
+}
+
+/*
+**  Basic block translation: A basic block is a run of instructions which ends with a branch, a control instruction
+** (HALT, RTI, INT, ...) or any other instruction modifying the program counter. Translating a block means decoding
+** all of its instructions into the instruction cache and remembering its length, so execute_block() can run
+** the whole block without the checks execute() has to perform before and after each single instruction.
+** Blocks are stored by their start address, so chaining a block to its successor is a single array access and
+** execute_block() directly continues with the next block as long as no interrupt is pending.
+**
+**  Each memory word belonging to a translated block is tagged with the current block generation. A write access
+** to such a word (self modifying code) starts a new generation which invalidates all blocks at once. Code in the
+** IO area, interrupts, breakpoints, routines emulated by the HLE and the debug/verbose modes are handled by falling
+** back to execute().
+*/
+void invalidate_all_blocks() {
+  gbl$block_generation++;
+}
+
+/* Blocks end before the entry addresses of the routines emulated by the HLE, so they are translated anew. */
+void set_hle_mode(unsigned int mode) {
+  gbl$hle.mode = mode;
+  invalidate_all_blocks();
+}
+
+/*
+**  A block is an idle loop if it ends with an ABRA/RBRA to its own start and the instructions before only compute
+** registers from constants, from registers the loop does not change and from memory, so every iteration repeats
+** the previous one as long as the memory read does not change. Since the loop writes neither memory nor flags read
+** later on, only the input status registers may change what it reads, this is checked while it runs (see
+** core_execute_block()). The typical idle loop is the one of UART$GETCHAR:
+**
+**   _UART$GETC_LOOP MOVE @R0, R2; AND 0x0001, R2; RBRA _UART$GETC_LOOP, Z
+*/
+int idle_loop(unsigned int start, unsigned int length) {
+  decoded_instruction *entry;
+  unsigned int address = start, i, pass, read, written, changed = 0;
+
+  if (length > IDLE_MAX_LENGTH)
+    return FALSE;
+
+  /* Pass 0 collects the registers changed by the loop, pass 1 checks that they are written before being read */
+  for (pass = 0; pass < 2; pass++) {
+    for (i = written = 0, address = start; i < length - 1; i++, address += 1 + entry->source_constant) {
+      entry = gbl$decoded + address;
+      if (!((IDLE_OPCODES >> entry->opcode) & 1)
+          || (!entry->source_constant && (entry->source_mode > 1 || entry->source_regaddr >= SR))
+          || entry->destination_mode > (entry->opcode == 12) || entry->destination_regaddr >= SR) /* CMP: @Rxx */
+        return FALSE;
+
+      read = (entry->source_constant ? 0 : 1 << entry->source_regaddr)
+           | (entry->opcode != 0 && entry->opcode != 7 && entry->opcode != 8 ? 1 << entry->destination_regaddr : 0);
+      if (read & changed & ~written)
+        return FALSE;
+      if (entry->opcode != 12)
+        written |= 1 << entry->destination_regaddr;
+    }
+    changed = written;
+  }
+
+  entry = gbl$decoded + address;
+  return entry->opcode == GENERIC_BRANCH_OPCODE && !(entry->instruction & 0x10) && entry->source_constant
+         && (((entry->instruction & 0x20 ? address + 2 : 0) + entry->constant[0]) & 0xffff) == start;
+}
+
+void translate_block(unsigned int address, translated_block *block) {
+  decoded_instruction *entry;
+  unsigned int start = address, length = 0, next, i;
+
+  block->generation = gbl$block_generation;
+#ifdef USE_JIT
+  block->runs = 0;
+  block->native = NULL;
+#endif
+  for (;;) {
+    if (!(entry = gbl$decoded + address)->valid)
+      decode_instruction(address, gbl$memory[address], entry, TRUE);
+    for (i = 0; i < 1 + entry->source_constant + entry->destination_constant; i++)
+      gbl$translated[address + i] = gbl$block_generation;
+    next = address + 1 + entry->source_constant;
+    length++;
+
+    if (entry->opcode >= 0xd                                             /* Reserved, control or branch */
+        || entry->destination_regaddr == PC                              /* PC is written */
+        || (entry->source_regaddr == PC && entry->source_mode == 3)      /* @--R15 */
+        || next >= IO_AREA_START - 2 || BREAK_HIT(&gbl$breakpoints, BREAK_EXECUTE, next) || length == MAX_BLOCK_LENGTH
+        || (gbl$hle.mode && gbl$hle.entry[next]))                       /* Routine emulated by the HLE */
+      break;
+    address = next;
+  }
+
+  block->length = length;
+  block->idle = idle_loop(start, length);
+}
+
+#ifdef USE_JIT
+/*
+**  Native code (USE_JIT): A block run JIT_THRESHOLD times by the fast core is compiled to x86-64 code which does
+** exactly what execute_decoded() does for its instructions, so core_execute_block() calls the native code instead of
+** looping over the block. The code gets the machine in RDI and keeps it in R15, RBX points to the register bank. The
+** QNICE registers used most by the block live in host registers while it runs, R15 (PC) is a constant per
+** instruction. The flags stay lazy (gbl$lazy), a conditional branch computes the one it needs directly.
+**
+**  Accesses to the main memory are inlined: A write marks the page dirty, invalidates the instruction cache and
+** starts a new block generation if it hits a translated word, like core_access_memory(). The IO area is accessed
+** through a slow path calling core_access_memory(). Instructions which are not compiled (control instructions, SR as
+** an operand, shifts of memory operands, ...) are executed by calling execute_decoded(). The exits are the same as
+** those of the loop in core_execute_block(): After an instruction which accessed the memory, the code returns if
+** the block generation has changed (self modifying code) or an error occurred. Interrupts, breakpoints, the IO area
+** and the entries of the HLE are handled between the blocks, which end before them anyway (see translate_block()).
+**
+**  The native code returns the number of instructions executed times two plus the result of the last one. It is
+** valid as long as its block, all code in the buffer is discarded when the block generation changes.
+*/
+#define JIT_MACHINE(member)    x86_64_memory(X86_R15, offsetof(qnice_machine, member))
+#define JIT_STOP               x86_64_memory(X86_RSP, 0) /* Set if the block ends after the current instruction */
+#define JIT_PC_SET             0x10000 /* PC of an exit: already written by execute_decoded() */
+#define JIT_PC_DYNAMIC         0x20000 /* PC of an exit: in ESI */
+#define JIT_RESULT_DYNAMIC     2 /* Result of an exit: returned by execute_decoded() in EAX */
+#define JIT_LOGIC_FLAGS        ((1 << X_FLAG) | (1 << Z_FLAG) | (1 << N_FLAG))
+#define JIT_ARITHMETIC_FLAGS   (JIT_LOGIC_FLAGS | (1 << C_FLAG) | (1 << V_FLAG))
+
+typedef struct jit_exit {
+  size_t jump;                                      /* Position of the jump to the exit, see x86_64_jump() */
+  unsigned int count, pc, result,                   /* Instructions executed, JIT_PC_* resp. the PC, JIT_RESULT_* */
+    dirty, cycles, instructions;                    /* State of the compiler at the exit, see jit_compiler */
+} jit_exit;
+
+typedef struct jit_slow_path {
+  size_t jump, back;
+  unsigned int write, cycles, instructions;
+} jit_slow_path;
+
+typedef struct jit_compiler {
+  x86_64_code *code;
+  unsigned int generation,
+    count, addresses[MAX_BLOCK_LENGTH],             /* Instructions compiled so far */
+    dirty,                                          /* Bitmask of the QNICE registers changed in host registers */
+    cycles, instructions,                           /* Not yet added to gbl$cycles resp. gbl$instructions */
+    memory,                                         /* TRUE if the current instruction accesses the memory */
+    exits, slow_paths;
+  int host[16];                                     /* Host register of a QNICE register resp. X86_NONE */
+  jit_exit exit[3 * MAX_BLOCK_LENGTH];
+  jit_slow_path slow_path[4 * MAX_BLOCK_LENGTH];
+} jit_compiler;
+
+/* The callee saved registers first, the others are saved around calls */
+static const int gbl$jit_host_registers[JIT_HOST_REGISTERS] = {X86_RBP, X86_R12, X86_R13, X86_R14,
+                                                               X86_R8, X86_R9, X86_R10, X86_R11};
+
+/* Called by the native code */
+unsigned int jit_read_memory(unsigned int address) {
+  return core_access_memory(address, READ_MEMORY, 0, NO_HOOKS);
+}
+
+void jit_write_memory(unsigned int address, unsigned int value) {
+  core_access_memory(address, WRITE_MEMORY, value, NO_HOOKS);
+}
+
+int jit_execute(decoded_instruction *entry) {
+  return execute_decoded(entry, NO_HOOKS);
+}
+
+unsigned int jit_shift_left(unsigned int count, unsigned int destination) {
+  return shift_left(count, destination) & 0xffff;
+}
+
+unsigned int jit_shift_right(unsigned int count, unsigned int destination) {
+  return shift_right(count, destination) & 0xffff;
+}
+
+/* The native code does not check watchpoints, so it is only used while there are none */
+int jit_usable() {
+  unsigned int i;
+
+  if (!gbl$jit.enabled || !gbl$jit.code.start)
+    return FALSE;
+  for (i = 0; i < gbl$breakpoints.count; i++)
+    if (gbl$breakpoints.list[i].kinds & ((1 << BREAK_READ) | (1 << BREAK_WRITE)))
+      return FALSE;
+  return TRUE;
+}
+
+/* Compiled instructions: all but control instructions, SR as an operand and most uses of PC */
+int jit_native(decoded_instruction *entry) {
+  unsigned int source = entry->source_constant
+                        || (entry->source_mode ? entry->source_regaddr < SR : entry->source_regaddr != SR);
+
+  if (entry->opcode == GENERIC_BRANCH_OPCODE)
+    return source;
+  if (entry->opcode > 12 || !source || entry->destination_regaddr == SR)
+    return FALSE;
+  if (entry->destination_regaddr == PC) /* MOVE ..., R15 is a jump */
+    return entry->opcode == 0 && !entry->destination_mode;
+  if (entry->opcode == 5 || entry->opcode == 6) /* Shifts of registers */
+    return !entry->destination_mode && (entry->source_constant || !entry->source_mode);
+  return TRUE;
+}
+
+x86_64_operand jit_memory_register(unsigned int number) {
+  return number < 8 ? x86_64_memory(X86_RBX, number * sizeof(int))
+                    : x86_64_memory(X86_R15, offsetof(qnice_machine, registers) + number * sizeof(int));
 }
 
-/*
-** Disassemble the contents of a memory region
-*/
-void disassemble(unsigned int start, unsigned int stop) {
-  unsigned int i, opcode, instruction, j;
-  int skip_addresses;
-  char scratch[STRING_LENGTH], operands[STRING_LENGTH], mnemonic[STRING_LENGTH];
+x86_64_operand jit_register(jit_compiler *c, unsigned int number) {
+  return c->host[number] != X86_NONE ? x86_64_register(c->host[number]) : jit_memory_register(number);
+}
 
-  printf("Disassembled contents of memory locations %04x - %04x:\n", start, stop);
-  for (i = start, skip_addresses = 0; i <= stop || skip_addresses; i++) {
-    opcode = (instruction = access_memory(i, READ_MEMORY, 0) & 0xffff) >> 12;
-    if (skip_addresses) { /* Do not decode this machine word -- since it was used in @R15++! */
-      skip_addresses--;
-      printf("%04X: %04X\n", i, instruction);
-      continue;
-    }
+void jit_store_register(jit_compiler *c, unsigned int number, int reg) {
+  x86_64_store(c->code, jit_register(c, number), reg);
+  if (c->host[number] != X86_NONE)
+    c->dirty |= 1 << number;
+}
 
-    *operands = (char) 0;
-    if (opcode < GENERIC_CONTROL_OPCODE) { /* Normal instruction */
-      if (opcode == 0xd) { /* This one is reserved for future use! */
-        strcpy(mnemonic, "RSVD");
-        *operands = (char) 0;
-      } else {
-        strcpy(mnemonic, gbl$normal_mnemonics[opcode]);
-        if (gbl$normal_operands[opcode]) { /* At least one operand */
-          if ((skip_addresses = decode_operand((instruction >> 6) & 0x3f, scratch))) /* Constant used! */
-            sprintf(scratch, "0x%04X", access_memory(i + 1, READ_MEMORY, 0));
-          strcpy(operands, scratch);
-        }
-  
-        if (gbl$normal_operands[opcode] == 2) { /* Decode second operand */
-          if ((j = decode_operand(instruction & 0x3f, scratch)))
-            sprintf(scratch, "0x%04X", access_memory(i + skip_addresses + j, READ_MEMORY, 0));
-          skip_addresses += j;
-          strcat(operands, ", ");
-          strcat(operands, scratch);
-        }
-      }
-    } else if (opcode == GENERIC_CONTROL_OPCODE) { /* Control instruction (HALT, RTI, INT) */
-      strcpy(mnemonic, gbl$control_mnemonics[j = (instruction >> 6) & 0x3f]);
-      if (j == INT_INSTRUCTION) { /* The INT instruction has one parameter */
-        if ((skip_addresses = decode_operand(instruction & 0x3f, scratch))) /* Constant as operand */
-          sprintf(scratch, "0x%04X", access_memory(i + 1, READ_MEMORY, 0));
-        strcpy(operands, scratch);
-      }
-    } else if (opcode == GENERIC_BRANCH_OPCODE) { /* Branch or Subroutine call */
-      strcpy(mnemonic, gbl$branch_mnemonics[(instruction >> 4) & 0x3]);
-      if ((skip_addresses  = decode_operand((instruction >> 6) & 0x3f, scratch)))
-        sprintf(scratch, "0x%04X", access_memory(i + 1, READ_MEMORY, 0));
-      sprintf(operands, "%s, %s%c", scratch, (instruction >> 3) & 1 ? "!" : "", gbl$sr_bits[instruction & 0x7]);
-    } else {
-      strcpy(mnemonic, "???");
-      *operands = (char) 0;
-    }
+void jit_add_register(jit_compiler *c, unsigned int number, int delta) {
+  x86_64_alu_immediate(c->code, X86_ADD, jit_register(c, number), delta, FALSE);
+  x86_64_alu_immediate(c->code, X86_AND, jit_register(c, number), 0xffff, FALSE);
+  if (c->host[number] != X86_NONE)
+    c->dirty |= 1 << number;
+}
 
-    printf("%04X: %04X %-6s\t%s\n", i, instruction, mnemonic, operands);
-  }
+/* Load the host registers, also after execute_decoded() which may have switched the register bank */
+void jit_load_registers(jit_compiler *c) {
+  unsigned int i;
+
+  x86_64_load_wide(c->code, X86_RBX, JIT_MACHINE(bank));
+  for (i = 0; i < SR; i++)
+    if (c->host[i] != X86_NONE)
+      x86_64_load(c->code, c->host[i], jit_memory_register(i));
 }
 
-/*
-** Read a source operand specified by mode and regaddr. If suppress_increment is set (all instructions with only
-** one argument should do this!), the autoincrement will not be executed since this will be the task of 
-** the operand update step. If this is necessary, mode == 2 can be used as a condition for this.
-** Predecrement will be executed always, postincrement only conditionally.
-*/
-unsigned int read_source_operand(unsigned int mode, unsigned int regaddr, int suppress_increment) {
-  unsigned int source;
+void jit_store_registers(jit_compiler *c, unsigned int dirty) {
+  unsigned int i;
 
-  if (gbl$debug)
-    printf("\tread_source_operand: mode=%01X, reg=%01X, skip_increment=%d\n\r", mode, regaddr, suppress_increment);
+  for (i = 0; i < SR; i++)
+    if (dirty & (1 << i))
+      x86_64_store(c->code, jit_memory_register(i), c->host[i]);
+}
 
-  switch (mode) { /* Mode bits of source operand */
-    case 0: /* Rxx */
-      source = read_register(regaddr);
-      break;
-    case 1: /* @Rxx */
-      source = access_memory(read_register(regaddr), READ_MEMORY, 0);
-      break;
-    case 2: /* @Rxx++ */
-      source = access_memory(read_register(regaddr), READ_MEMORY, 0);
-      if (!suppress_increment)
-        write_register(regaddr, read_register(regaddr) + 1);
-      break;
-    case 3: /* @--Rxx */
-      write_register(regaddr, read_register(regaddr) - 1);
-      source = access_memory(read_register(regaddr), READ_MEMORY, 0);
+/* Keep the registers used at least twice in host registers, the most frequently used ones in callee saved ones */
+void jit_allocate_registers(jit_compiler *c, unsigned int address, unsigned int length) {
+  decoded_instruction *entry;
+  unsigned int uses[SR] = {0}, i, j, best;
+
+  for (i = 0; i < length; i++, address += 1 + entry->source_constant)
+    if (jit_native(entry = gbl$decoded + address)) {
+      if (!entry->source_constant && entry->source_regaddr < SR)
+        uses[entry->source_regaddr]++;
+      if (entry->opcode != GENERIC_BRANCH_OPCODE && entry->destination_regaddr < SR)
+        uses[entry->destination_regaddr]++;
+      else if (entry->opcode == GENERIC_BRANCH_OPCODE && (entry->instruction & 0x10)) /* ASUB, RSUB */
+        uses[SP]++;
+    }
+
+  for (i = 0; i < 16; c->host[i++] = X86_NONE);
+  for (i = 0; i < JIT_HOST_REGISTERS; i++) {
+    for (best = SR, j = 0; j < SR; j++)
+      if (c->host[j] == X86_NONE && uses[j] >= 2 && (best == SR || uses[j] > uses[best]))
+        best = j;
+    if (best == SR)
       break;
-    default:
-      printf("Internal error, fetch operand!\n");
-      exit(-1);
+    c->host[best] = gbl$jit_host_registers[i];
   }
+}
 
-  if (gbl$gather_statistics)
-    gbl$stat.addressing_modes[0][mode]++;
+/* Jump to an exit which is emitted after the block, see jit_emit_exit() */
+void jit_exit_jump(jit_compiler *c, int condition, unsigned int pc, unsigned int result) {
+  jit_exit *exit = c->exit + c->exits++;
+
+  exit->jump = x86_64_jump(c->code, condition);
+  exit->count = c->count;
+  exit->pc = pc;
+  exit->result = result;
+  exit->dirty = c->dirty;
+  exit->cycles = c->cycles;
+  exit->instructions = c->instructions;
+}
 
-  if (gbl$debug)
-    printf("\tread_source_operand: value=%04X, r15=%04X\n\r", source, read_register(PC));
-  return source & 0xffff;
+void jit_epilogue(x86_64_code *code) {
+  x86_64_alu_immediate(code, X86_ADD, x86_64_register(X86_RSP), 8, TRUE);
+  x86_64_pop(code, X86_R15);
+  x86_64_pop(code, X86_R14);
+  x86_64_pop(code, X86_R13);
+  x86_64_pop(code, X86_R12);
+  x86_64_pop(code, X86_RBP);
+  x86_64_pop(code, X86_RBX);
+  x86_64_return(code);
 }
 
-/*
-** This is the counterpart function to read_source_operand. The major difference (apart from writing instead of reading :-) )
-** is that predecrements can be suppressed, autoincrements will be executed always.
-*/
-void write_destination(unsigned int mode, unsigned int regaddr, unsigned int value, int suppress_decrement) {
-  if (gbl$debug)
-    printf("\twrite_operand: mode=%01X, reg=%01X, value=%04X, skip_increment=%d\n\r", mode, regaddr, value, suppress_decrement);
+/* Write back the registers and counters, the PC and gbl$last_addresses as core_execute_block() does and return */
+void jit_emit_exit(jit_compiler *c, jit_exit *exit) {
+  x86_64_code *code = c->code;
+  unsigned int i;
 
-  value &= 0xffff;
-  switch (mode) {
-    case 0: /* rxx */
-      write_register(regaddr, value);
-      break;
-    case 1: /* @Rxx */
-      access_memory(read_register(regaddr), WRITE_MEMORY, value);
-      break;
-    case 2: /* @Rxx++ */
-      access_memory(read_register(regaddr), WRITE_MEMORY, value);
-      write_register(regaddr, read_register(regaddr) + 1);
-      break;
-    case 3: /* @--Rxx */
-      if (!suppress_decrement)
-        write_register(regaddr, read_register(regaddr) - 1);
-      access_memory(read_register(regaddr), WRITE_MEMORY, value);
-      break;
-    default:
-      printf("Internal error, write operand!\n");
-      exit(-1);
+  if (exit->result == JIT_RESULT_DYNAMIC)
+    x86_64_load(code, X86_RDI, x86_64_register(X86_RAX));
+  jit_store_registers(c, exit->dirty);
+  if (exit->cycles)
+    x86_64_alu_immediate(code, X86_ADD, JIT_MACHINE(cycles), exit->cycles, TRUE);
+  if (exit->instructions)
+    x86_64_alu_immediate(code, X86_ADD, JIT_MACHINE(instructions), exit->instructions, TRUE);
+  if (exit->pc == JIT_PC_DYNAMIC)
+    x86_64_store(code, JIT_MACHINE(registers[PC]), X86_RSI);
+  else if (exit->pc != JIT_PC_SET)
+    x86_64_move_immediate(code, JIT_MACHINE(registers[PC]), exit->pc);
+
+  x86_64_load(code, X86_RAX, JIT_MACHINE(last_addresses_pointer));
+  for (i = exit->count > MAX_LAST_ADDRESSES ? exit->count - MAX_LAST_ADDRESSES : 0; i < exit->count; i++) {
+    x86_64_lea(code, X86_RCX, x86_64_memory(X86_RAX, i), FALSE);
+    x86_64_alu_immediate(code, X86_AND, x86_64_register(X86_RCX), MAX_LAST_ADDRESSES - 1, FALSE);
+    x86_64_move_immediate(code, x86_64_indexed(X86_R15, X86_RCX, sizeof(int),
+                                               offsetof(qnice_machine, last_addresses)), c->addresses[i]);
   }
+  x86_64_alu_immediate(code, X86_ADD, x86_64_register(X86_RAX), exit->count, FALSE);
+  x86_64_store(code, JIT_MACHINE(last_addresses_pointer), X86_RAX);
+  x86_64_move_immediate(code, JIT_MACHINE(last_address), c->addresses[exit->count - 1]);
 
-  if (gbl$gather_statistics)
-    gbl$stat.addressing_modes[1][mode]++;
+  if (exit->result == JIT_RESULT_DYNAMIC)
+    x86_64_lea(code, X86_RAX, x86_64_memory(X86_RDI, 2 * exit->count), FALSE);
+  else
+    x86_64_move_immediate(code, x86_64_register(X86_RAX), 2 * exit->count + exit->result);
+  jit_epilogue(code);
+}
 
-  if (gbl$debug)
-    printf("\twrite_destination: r15=%04X\n\r", read_register(PC));
+/* Exit at the end of the block, emitted in place */
+void jit_final_exit(jit_compiler *c, unsigned int pc, unsigned int result) {
+  jit_exit exit = {0, c->count, pc, result, c->dirty, c->cycles, c->instructions};
+
+  jit_emit_exit(c, &exit);
 }
 
-/*
-**  The following function updates the lower six bits of the status register R14 according to 
-** the result of some machine instruction. Please keep in mind that the destination (result)
-** parameter may occupy 17 bits (including the carry)! Do not truncate this parameter prior
-** to calling this routine!
-**
-**  Caveat: There are currently two implementations of the overflow logic: The old behaviour,
-**          which is not "by the book" and the new behaviour which works as described in 
-**          http://www.righto.com/2012/12/the-6502-overflow-flag-explained.html.
-**
-**          As of 13-AUG-2020 the old logic should be active as the new (more correct :-} )
-**          breaks our existing code! To switch between these two implementation variants,
-**          OLD_V_LOGIC must be defined or undefined.
-*/
-void update_status_bits(unsigned int destination, unsigned int source_0, unsigned int source_1, 
-                        unsigned int control_bitmask, unsigned int operation) {
-  unsigned int x, c, z, n, v, sr_bits;
+/* Access to the IO area (or the first two words for a write), the counters are up to date during the call */
+void jit_emit_slow_path(jit_compiler *c, jit_slow_path *slow_path) {
+  static const int saved[] = {X86_RCX, X86_RDX, X86_RSI, X86_RDI, X86_R8, X86_R9, X86_R10, X86_R11};
+  x86_64_code *code = c->code;
+  size_t stop, done;
+  int i;
 
-  sr_bits = read_register(SR);
+  x86_64_patch(code, slow_path->jump, code->used);
+  for (i = 0; i < 8; x86_64_push(code, saved[i++]));
+  if (slow_path->cycles)
+    x86_64_alu_immediate(code, X86_ADD, JIT_MACHINE(cycles), slow_path->cycles, TRUE);
+  if (slow_path->instructions)
+    x86_64_alu_immediate(code, X86_ADD, JIT_MACHINE(instructions), slow_path->instructions, TRUE);
+  x86_64_load(code, X86_RDI, x86_64_register(X86_RCX));
+  if (slow_path->write)
+    x86_64_load(code, X86_RSI, x86_64_register(X86_RDX));
+  x86_64_call(code, slow_path->write ? (void *) jit_write_memory : (void *) jit_read_memory);
+  if (slow_path->cycles)
+    x86_64_alu_immediate(code, X86_SUB, JIT_MACHINE(cycles), slow_path->cycles, TRUE);
+  if (slow_path->instructions)
+    x86_64_alu_immediate(code, X86_SUB, JIT_MACHINE(instructions), slow_path->instructions, TRUE);
+  for (i = 7; i >= 0; x86_64_pop(code, saved[i--]));
+
+  x86_64_alu_immediate(code, X86_CMP, JIT_MACHINE(error), 0, FALSE);
+  stop = x86_64_jump(code, X86_NE);
+  x86_64_alu_immediate(code, X86_CMP, JIT_MACHINE(block_generation), c->generation, FALSE);
+  done = x86_64_jump(code, X86_E);
+  x86_64_patch(code, stop, code->used);
+  x86_64_move_immediate(code, JIT_STOP, TRUE);
+  x86_64_patch(code, done, code->used);
+  x86_64_patch(code, x86_64_jump(code, X86_ALWAYS), slow_path->back);
+}
 
-  if (!(control_bitmask & DO_NOT_MODIFY_X)) 
-    x = (destination & 0xffff) == 0xffff ? 1 : 0;
-  else 
-    x = (sr_bits >> 1) & 1; // Retain old X-flag
+jit_slow_path *jit_add_slow_path(jit_compiler *c, int condition, unsigned int write) {
+  jit_slow_path *slow_path = c->slow_path + c->slow_paths++;
 
-  if (!(control_bitmask & DO_NOT_MODIFY_CARRY)) 
-    c = destination & 0x10000 ? 1 : 0;
-  else 
-    c = (sr_bits >> 2) & 1; // Retain old C-flag
+  slow_path->jump = x86_64_jump(c->code, condition);
+  slow_path->write = write;
+  slow_path->cycles = c->cycles;
+  slow_path->instructions = c->instructions;
+  c->memory = TRUE;
+  return slow_path;
+}
 
-  z = !(destination & 0xffff) ? 1 : 0;
+/* Read the word at the address in ECX into EAX */
+void jit_read(jit_compiler *c) {
+  x86_64_code *code = c->code;
+  jit_slow_path *slow_path;
 
-  n = destination & 0x8000 ? 1 : 0;
+  x86_64_alu_immediate(code, X86_CMP, x86_64_register(X86_RCX), IO_AREA_START, FALSE);
+  slow_path = jit_add_slow_path(c, X86_AE, FALSE);
+  x86_64_load(code, X86_RAX, x86_64_indexed(X86_R15, X86_RCX, sizeof(int), offsetof(qnice_machine, memory)));
+  slow_path->back = code->used;
+}
 
-  if (!(control_bitmask & DO_NOT_MODIFY_OVERFLOW) && (operation == ADD_INSTRUCTION || operation == SUB_INSTRUCTION)) {
+/* Write EDX (16 bits) to the address in ECX, see core_access_memory() and invalidate_decoded_instruction() */
+void jit_write(jit_compiler *c) {
+  x86_64_code *code = c->code;
+  jit_slow_path *slow_path;
+  size_t done;
+  int i;
+
+  x86_64_lea(code, X86_RAX, x86_64_memory(X86_RCX, -2), FALSE); /* The first two words wrap around, see below */
+  x86_64_alu_immediate(code, X86_CMP, x86_64_register(X86_RAX), IO_AREA_START - 2, FALSE);
+  slow_path = jit_add_slow_path(c, X86_AE, TRUE);
+  x86_64_store(code, x86_64_indexed(X86_R15, X86_RCX, sizeof(int), offsetof(qnice_machine, memory)), X86_RDX);
+  x86_64_load(code, X86_RAX, x86_64_register(X86_RCX));
+  x86_64_shift(code, X86_SHR, x86_64_register(X86_RAX), __builtin_ctz(DIRTY_PAGE_SIZE));
+  x86_64_store_byte(code, x86_64_indexed(X86_R15, X86_RAX, 1, offsetof(qnice_machine, dirty_pages)), TRUE);
+  x86_64_multiply_immediate(code, X86_RAX, x86_64_register(X86_RCX), sizeof(decoded_instruction));
+  for (i = 0; i < 3; i++) /* An instruction occupies up to three words */
+    x86_64_move_immediate(code, x86_64_indexed(X86_R15, X86_RAX, 1, offsetof(qnice_machine, decoded)
+                                               + offsetof(decoded_instruction, valid) - i * sizeof(decoded_instruction)),
+                          FALSE);
+  x86_64_alu_immediate(code, X86_CMP, x86_64_indexed(X86_R15, X86_RCX, sizeof(int),
+                                                     offsetof(qnice_machine, translated)), c->generation, FALSE);
+  done = x86_64_jump(code, X86_NE);
+  x86_64_unary(code, X86_INC, JIT_MACHINE(block_generation)); /* Self modifying code */
+  x86_64_move_immediate(code, JIT_STOP, TRUE);
+  x86_64_patch(code, done, code->used);
+  slow_path->back = code->used;
+}
+
+/* read_flag() without caching the flag: 0 or 1 in EAX, clobbers ECX and EDX */
+void jit_read_flag(jit_compiler *c, unsigned int flag) {
+  x86_64_code *code = c->code;
+  size_t lazy, done;
+
+  if (flag > V_FLAG) { /* Never computed lazily */
+    x86_64_load(code, X86_RAX, JIT_MACHINE(flags[flag]));
+    return;
+  }
+  x86_64_test_immediate(code, JIT_MACHINE(lazy.valid), 1 << flag);
+  lazy = x86_64_jump(code, X86_E);
+  x86_64_load(code, X86_RAX, JIT_MACHINE(flags[flag]));
+  done = x86_64_jump(code, X86_ALWAYS);
+  x86_64_patch(code, lazy, code->used);
+  switch (flag) {
+    case X_FLAG:
+    case Z_FLAG:
+      x86_64_extend(code, X86_MOVZX16, X86_RAX, JIT_MACHINE(lazy.result));
+      x86_64_alu_immediate(code, X86_CMP, x86_64_register(X86_RAX), flag == X_FLAG ? 0xffff : 0, FALSE);
+      x86_64_setcc(code, X86_E, X86_RAX);
+      x86_64_extend(code, X86_MOVZX8, X86_RAX, x86_64_register(X86_RAX));
+      break;
+    case C_FLAG:
+    case N_FLAG:
+      x86_64_load(code, X86_RAX, flag == C_FLAG ? JIT_MACHINE(lazy.carry_result) : JIT_MACHINE(lazy.result));
+      x86_64_shift(code, X86_SHR, x86_64_register(X86_RAX), flag == C_FLAG ? 16 : 15);
+      x86_64_alu_immediate(code, X86_AND, x86_64_register(X86_RAX), 1, FALSE);
+      break;
+    case V_FLAG:
+      x86_64_load(code, X86_RCX, JIT_MACHINE(lazy.source_1));
 #ifdef OLD_V_LOGIC
-    v = (((!(source_0 & 0x8000) && !(source_1 & 0x8000) && (destination & 0x8000)) ||
-         ((source_0 & 0x8000) && (source_1 & 0x8000) && !(destination & 0x8000))) && !(control_bitmask & DO_NOT_MODIFY_OVERFLOW))
-        ? 1 :0;
+      x86_64_load(code, X86_RAX, JIT_MACHINE(lazy.source_0));
+      x86_64_load(code, X86_RDX, JIT_MACHINE(lazy.overflow_result));
+      x86_64_alu(code, X86_XOR, x86_64_register(X86_RDX), X86_RAX);   /* Sign of the result differs from source_0 */
+      x86_64_alu(code, X86_XOR, x86_64_register(X86_RAX), X86_RCX);   /* and both sources have the same sign */
+      x86_64_unary(code, X86_NOT, x86_64_register(X86_RAX));
 #else
-  // See http://www.righto.com/2012/12/the-6502-overflow-flag-explained.html for the logic behind this:
-    if (operation == ADD_INSTRUCTION)
-      v = ((source_0 & 0xffff) ^ (destination & 0xffff)) & ((source_1 & 0xffff) ^ (destination & 0xffff)) & 0x8000 ? 1 : 0;
-    else if (operation == SUB_INSTRUCTION)
-      v = ((source_0 & 0xffff) ^ (destination & 0xffff)) & (((~source_1) & 0xffff) ^ (destination & 0xffff)) & 0x8000 ? 1 : 0;
+      x86_64_alu_immediate(code, X86_CMP, JIT_MACHINE(lazy.operation), ADD_INSTRUCTION, FALSE);
+      lazy = x86_64_jump(code, X86_E);
+      x86_64_unary(code, X86_NOT, x86_64_register(X86_RCX));
+      x86_64_patch(code, lazy, code->used);
+      x86_64_load(code, X86_RDX, JIT_MACHINE(lazy.overflow_result));
+      x86_64_load(code, X86_RAX, JIT_MACHINE(lazy.source_0));
+      x86_64_alu(code, X86_XOR, x86_64_register(X86_RAX), X86_RDX);
+      x86_64_alu(code, X86_XOR, x86_64_register(X86_RDX), X86_RCX);
 #endif
-  } else 
-    v = (sr_bits >> 5) & 1; // Retain old V-flag
+      x86_64_alu(code, X86_AND, x86_64_register(X86_RAX), X86_RDX);
+      x86_64_shift(code, X86_SHR, x86_64_register(X86_RAX), 15);
+      x86_64_alu_immediate(code, X86_AND, x86_64_register(X86_RAX), 1, FALSE);
+      break;
+  }
+  x86_64_patch(code, done, code->used);
+}
 
-  sr_bits &= 0xffc1;    // Keep the upper 10 bits and the LSB.
-  sr_bits |= (x << 1) | (c << 2) | (z << 3) | (n << 4) | (v << 5);  // Set/clear all required flags
+/* update_status_bits() of the instructions which only set X, Z and N, the result is in reg */
+void jit_logic_flags(jit_compiler *c, int reg) {
+  x86_64_store(c->code, JIT_MACHINE(lazy.result), reg);
+  x86_64_alu_immediate(c->code, X86_AND, JIT_MACHINE(lazy.valid), ~JIT_LOGIC_FLAGS, FALSE);
+}
 
-  write_register(SR, sr_bits);
+/* Source operand into ESI, see read_source() */
+void jit_read_source(jit_compiler *c, decoded_instruction *entry) {
+  x86_64_code *code = c->code;
+  unsigned int number = entry->source_regaddr;
+
+  if (entry->source_constant)
+    x86_64_move_immediate(code, x86_64_register(X86_RSI), entry->constant[0]);
+  else if (!entry->source_mode && number == PC)
+    x86_64_move_immediate(code, x86_64_register(X86_RSI), (entry->address + 1) & 0xffff);
+  else if (!entry->source_mode)
+    x86_64_load(code, X86_RSI, jit_register(c, number));
+  else {
+    if (entry->source_mode == 3)
+      jit_add_register(c, number, -1);
+    x86_64_load(code, X86_RCX, jit_register(c, number));
+    jit_read(c);
+    x86_64_load(code, X86_RSI, x86_64_register(X86_RAX));
+    if (entry->source_mode == 2)
+      jit_add_register(c, number, 1);
+  }
 }
 
-/*
-** The following function executes a single QNICE instruction. The return value will be TRUE if an illegal instruction is found.
-*/
-int execute() {
-  unsigned int instruction, address, opcode, source_mode, source_regaddr, destination_mode, destination_regaddr,
-    source_0, source_1, destination, i, debug_address, temp_flag, sr_bits, command, rb;
+/* Destination operand into EDI, see read_destination() */
+void jit_read_destination(jit_compiler *c, decoded_instruction *entry, int suppress_increment) {
+  x86_64_code *code = c->code;
+  unsigned int number = entry->destination_regaddr;
 
-  int condition, cmp_0, cmp_1;
+  if (!entry->destination_mode)
+    x86_64_load(code, X86_RDI, jit_register(c, number));
+  else {
+    if (entry->destination_mode == 3)
+      jit_add_register(c, number, -1);
+    x86_64_load(code, X86_RCX, jit_register(c, number));
+    jit_read(c);
+    x86_64_load(code, X86_RDI, x86_64_register(X86_RAX));
+    if (entry->destination_mode == 2 && !suppress_increment)
+      jit_add_register(c, number, 1);
+  }
+}
 
-  gbl$error = FALSE;
+/* Write EDX (16 bits) to the destination operand, see write_destination() */
+void jit_write_destination(jit_compiler *c, decoded_instruction *entry, int suppress_decrement) {
+  x86_64_code *code = c->code;
+  unsigned int number = entry->destination_regaddr;
 
-#ifdef USE_VGA
-  /* global instruction counter for MIPS calcluation; slightly different semantics than gbl$cycle_counter++ */
-  gbl$mips_inst_cnt++;
-  if (gbl$sdl_ticks - gbl$mips_tick_cnt > 1000) {
-    gbl$mips = (float) gbl$mips_inst_cnt / (float) 1000000;
-    gbl$mips_inst_cnt = 0;
-    gbl$mips_tick_cnt = gbl$sdl_ticks;
+  if (!entry->destination_mode)
+    jit_store_register(c, number, X86_RDX);
+  else {
+    if (entry->destination_mode == 3 && !suppress_decrement)
+      jit_add_register(c, number, -1);
+    x86_64_load(code, X86_RCX, jit_register(c, number));
+    jit_write(c);
+    if (entry->destination_mode == 2)
+      jit_add_register(c, number, 1);
   }
-#endif
-
-  // Take care of interrupts
-  if (gbl$interrupt_request && !gbl$interrupt_active) { // Interrupts cannot be nested!
-    gbl$interrupt_active  = TRUE;               // Remember that we are currently servicing an interrupt
-    gbl$interrupt_request = FALSE;
-    gbl$interrupt_R14 = read_register(SR);      // Save status register 
-    gbl$interrupt_R15 = read_register(PC);      // and program counter
-    write_register(PC, gbl$interrupt_address);  // Jump to interrupt service routine
+}
 
-    if (gbl$debug) {
-      printf("Interrupt");
-      if (gbl$verbose)
-        printf(": Address = %04X\n", gbl$interrupt_address);
-      else
-        printf("!\n");
-    }
+/* An instruction which is not compiled: execute_decoded() brings the counters, PC and registers up to date */
+void jit_compile_call(jit_compiler *c, decoded_instruction *entry, int last) {
+  x86_64_code *code = c->code;
+
+  jit_store_registers(c, c->dirty);
+  if (c->cycles)
+    x86_64_alu_immediate(code, X86_ADD, JIT_MACHINE(cycles), c->cycles, TRUE);
+  if (c->instructions)
+    x86_64_alu_immediate(code, X86_ADD, JIT_MACHINE(instructions), c->instructions, TRUE);
+  c->dirty = c->cycles = c->instructions = 0;
+  c->count++;
+
+  x86_64_lea(code, X86_RDI, x86_64_memory(X86_R15, offsetof(qnice_machine, decoded)
+                                                   + entry->address * sizeof(decoded_instruction)), TRUE);
+  x86_64_call(code, (void *) jit_execute);
+  if (last) {
+    jit_final_exit(c, JIT_PC_SET, JIT_RESULT_DYNAMIC);
+    return;
   }
 
-  if (gbl$cycle_counter_state & 0x0002)
-    gbl$cycle_counter++; /* Increment cycle counter which is an instruction counter in the emulator as opposed to the hardware. */
+  x86_64_alu_immediate(code, X86_CMP, x86_64_register(X86_RAX), 0, FALSE);
+  jit_exit_jump(c, X86_NE, JIT_PC_SET, TRUE);
+  x86_64_alu_immediate(code, X86_CMP, JIT_MACHINE(error), 0, FALSE);
+  jit_exit_jump(c, X86_NE, JIT_PC_SET, FALSE);
+  x86_64_alu_immediate(code, X86_CMP, JIT_MACHINE(block_generation), c->generation, FALSE);
+  jit_exit_jump(c, X86_NE, JIT_PC_SET, FALSE);
+  jit_load_registers(c);
+}
 
-  gbl$last_address = gbl$last_addresses[gbl$last_addresses_pointer++ % MAX_LAST_ADDRESSES] 
-                   = debug_address = address = read_register(PC); /* Get PC */
-  opcode = ((instruction = access_memory(address++, READ_MEMORY, 0)) >> 12 & 0Xf);
-  write_register(PC, address); /* Update program counter */
+void jit_compile_branch(jit_compiler *c, decoded_instruction *entry) {
+  x86_64_code *code = c->code;
+  unsigned int pc = (entry->address + 1 + entry->source_constant) & 0xffff, flag = entry->instruction & 0x7,
+    negate = entry->instruction & 0x8, dirty, cycles;
+  size_t not_taken = 0;
 
-  if (gbl$debug || gbl$verbose)
-    printf("execute: %04X %04X %s\n\r", debug_address, instruction, 
-           opcode == GENERIC_BRANCH_OPCODE ? gbl$branch_mnemonics[(instruction >> 4) & 0x3] 
-                                           : gbl$normal_mnemonics[opcode]);
+  jit_read_source(c, entry);
+  if (!flag && negate) { /* Never taken */
+    jit_final_exit(c, pc, FALSE);
+    return;
+  }
+  if (flag) { /* The 1 of SR always is */
+    jit_read_flag(c, flag);
+    x86_64_alu_immediate(code, X86_CMP, x86_64_register(X86_RAX), 0, FALSE);
+    not_taken = x86_64_jump(code, negate ? X86_NE : X86_E);
+  }
 
-  source_mode    = (instruction >> 6) & 0x3;
-  source_regaddr = (instruction >> 8) & 0xf;
+  dirty = c->dirty;
+  cycles = c->cycles;
+  if (entry->instruction & 0x10) { /* ASUB, RSUB: push the return address, one more cycle */
+    x86_64_alu_immediate(code, X86_ADD, JIT_MACHINE(cycles), 1, TRUE);
+    jit_add_register(c, SP, -1);
+    x86_64_load(code, X86_RCX, jit_register(c, SP));
+    x86_64_move_immediate(code, x86_64_register(X86_RDX), pc);
+    jit_write(c);
+  }
+  if (entry->instruction & 0x20) { /* RBRA, RSUB */
+    x86_64_alu_immediate(code, X86_ADD, x86_64_register(X86_RSI), pc, FALSE);
+    x86_64_alu_immediate(code, X86_AND, x86_64_register(X86_RSI), 0xffff, FALSE);
+  }
+  jit_final_exit(c, JIT_PC_DYNAMIC, FALSE);
+
+  if (flag) {
+    x86_64_patch(code, not_taken, code->used);
+    c->dirty = dirty;
+    c->cycles = cycles;
+    jit_final_exit(c, pc, FALSE);
+  }
+}
 
-  destination_mode    = instruction & 0x3;
-  destination_regaddr = (instruction >> 2) & 0xf;
+void jit_compile_instruction(jit_compiler *c, decoded_instruction *entry, int last) {
+  x86_64_code *code = c->code;
+  unsigned int next = (entry->address + 1 + entry->source_constant) & 0xffff, opcode = entry->opcode;
 
-  /* Update the statistics counters */
-  if (opcode < GENERIC_BRANCH_OPCODE && gbl$gather_statistics)
-    gbl$stat.instruction_frequency[opcode]++;
-  else if (opcode == GENERIC_BRANCH_OPCODE && gbl$gather_statistics)
-    gbl$stat.instruction_frequency[opcode + ((instruction >> 4) & 0x3)]++;
+  c->addresses[c->count] = entry->address;
+  if (!jit_native(entry)) {
+    jit_compile_call(c, entry, last);
+    return;
+  }
+
+  c->cycles += entry->cycles;
+  c->instructions++;
+  c->count++;
+  c->memory = FALSE;
+  if (opcode == GENERIC_BRANCH_OPCODE) {
+    jit_compile_branch(c, entry);
+    return;
+  }
 
+  jit_read_source(c, entry);
   switch (opcode) {
     case 0: /* MOVE */
-      destination = read_source_operand(source_mode, source_regaddr, FALSE);
-      update_status_bits(destination, destination, destination, DO_NOT_MODIFY_CARRY | DO_NOT_MODIFY_OVERFLOW, 
-                         NO_ADD_SUB_INSTRUCTION);
-      write_destination(destination_mode, destination_regaddr, destination, FALSE);
-      break;
-    case 1: /* ADD */
-      source_1 = read_source_operand(source_mode, source_regaddr, FALSE);
-      source_0 = read_source_operand(destination_mode, destination_regaddr, TRUE);
-      destination = source_0 + source_1;
-      update_status_bits(destination, source_0, source_1, MODIFY_ALL, ADD_INSTRUCTION); 
-      write_destination(destination_mode, destination_regaddr, destination, TRUE);
-      break;
-    case 2: /* ADDC */
-      source_1 = read_source_operand(source_mode, source_regaddr, FALSE);
-      source_0 = read_source_operand(destination_mode, destination_regaddr, TRUE);
-      destination = source_0 + source_1 + ((read_register(SR) >> 2) & 1); /* Take carry into account */
-      update_status_bits(destination, source_0, source_1, MODIFY_ALL, ADD_INSTRUCTION);
-      write_destination(destination_mode, destination_regaddr, destination, TRUE);
-      break;
-    case 3: /* SUB */
-      source_1 = read_source_operand(source_mode, source_regaddr, FALSE);
-      source_0 = read_source_operand(destination_mode, destination_regaddr, TRUE);
-      destination = source_0 - source_1;
-      update_status_bits(destination, source_0, source_1, MODIFY_ALL, SUB_INSTRUCTION);
-      write_destination(destination_mode, destination_regaddr, destination, TRUE);
-      break;
-    case 4: /* SUBC */
-      source_1 = read_source_operand(source_mode, source_regaddr, FALSE);
-      source_0 = read_source_operand(destination_mode, destination_regaddr, TRUE);
-      destination = source_0 - source_1 - ((read_register(SR) >> 2) & 1); /* Take carry into account */
-      update_status_bits(destination, source_0, source_1, MODIFY_ALL, SUB_INSTRUCTION);
-      write_destination(destination_mode, destination_regaddr, destination, TRUE);
-      break;
-    case 5: /* SHL */
-      source_0 = read_source_operand(source_mode, source_regaddr, FALSE);
-      destination = read_source_operand(destination_mode, destination_regaddr, TRUE);
-      if (source_0) {
-        for (i = 0; i < source_0; i++) {
-          temp_flag = (destination & 0x8000) >> 13;
-          destination = (destination << 1) | ((read_register(SR) >> 1) & 1);          /* Fill with X bit */
-        }
-        write_register(SR, (read_register(SR) & 0xfffb) | temp_flag);                 /* Shift into C bit */
-        write_destination(destination_mode, destination_regaddr, destination, FALSE);
+      jit_logic_flags(c, X86_RSI);
+      if (entry->destination_regaddr == PC) {
+        jit_final_exit(c, JIT_PC_DYNAMIC, FALSE);
+        return;
       }
-      update_status_bits(destination, source_0, source_1, 
-                         DO_NOT_MODIFY_CARRY | DO_NOT_MODIFY_X | DO_NOT_MODIFY_OVERFLOW, 
-                         NO_ADD_SUB_INSTRUCTION);
+      x86_64_load(code, X86_RDX, x86_64_register(X86_RSI));
+      jit_write_destination(c, entry, FALSE);
       break;
-    case 6: /* SHR */
-      source_0 = read_source_operand(source_mode, source_regaddr, FALSE);
-      destination = read_source_operand(destination_mode, destination_regaddr, TRUE);
-      if (source_0) {
-        for (i = 0; i < source_0; i++) {
-          temp_flag = (destination & 1) << 1;
-          destination = ((destination >> 1) & 0xffff) | ((read_register(SR) & 4) << 13);  /* Fill with C bit */
-        }
-        write_register(SR, (read_register(SR) & 0xfffd) | temp_flag);                     /* Shift into X bit */
-        write_destination(destination_mode, destination_regaddr, destination, FALSE);
-      }
-      update_status_bits(destination, source_0, source_1, 
-                         DO_NOT_MODIFY_CARRY | DO_NOT_MODIFY_X | DO_NOT_MODIFY_OVERFLOW, 
-                         NO_ADD_SUB_INSTRUCTION);
+    case 1: /* ADD, ADDC, SUB, SUBC: source_1 in ESI, source_0 in EDI, the result has 17 bits resp. wraps around */
+    case 2:
+    case 3:
+    case 4:
+      jit_read_destination(c, entry, TRUE);
+      if (opcode == 2 || opcode == 4)
+        jit_read_flag(c, C_FLAG);
+      x86_64_load(code, X86_RDX, x86_64_register(X86_RDI));
+      x86_64_alu(code, opcode < 3 ? X86_ADD : X86_SUB, x86_64_register(X86_RDX), X86_RSI);
+      if (opcode == 2 || opcode == 4)
+        x86_64_alu(code, opcode < 3 ? X86_ADD : X86_SUB, x86_64_register(X86_RDX), X86_RAX);
+      x86_64_store(code, JIT_MACHINE(lazy.result), X86_RDX);
+      x86_64_store(code, JIT_MACHINE(lazy.carry_result), X86_RDX);
+      x86_64_store(code, JIT_MACHINE(lazy.source_0), X86_RDI);
+      x86_64_store(code, JIT_MACHINE(lazy.source_1), X86_RSI);
+      x86_64_store(code, JIT_MACHINE(lazy.overflow_result), X86_RDX);
+      x86_64_move_immediate(code, JIT_MACHINE(lazy.operation), opcode < 3 ? ADD_INSTRUCTION : SUB_INSTRUCTION);
+      x86_64_alu_immediate(code, X86_AND, JIT_MACHINE(lazy.valid), ~JIT_ARITHMETIC_FLAGS, FALSE);
+      x86_64_extend(code, X86_MOVZX16, X86_RDX, x86_64_register(X86_RDX));
+      jit_write_destination(c, entry, TRUE);
+      break;
+    case 5: /* SHL, SHR of a register */
+    case 6:
+      x86_64_load(code, X86_RDI, x86_64_register(X86_RSI));
+      x86_64_load(code, X86_RSI, jit_register(c, entry->destination_regaddr));
+      x86_64_push(code, X86_R8);
+      x86_64_push(code, X86_R9);
+      x86_64_push(code, X86_R10);
+      x86_64_push(code, X86_R11);
+      x86_64_call(code, opcode == 5 ? (void *) jit_shift_left : (void *) jit_shift_right);
+      x86_64_pop(code, X86_R11);
+      x86_64_pop(code, X86_R10);
+      x86_64_pop(code, X86_R9);
+      x86_64_pop(code, X86_R8);
+      jit_store_register(c, entry->destination_regaddr, X86_RAX);
       break;
     case 7: /* SWAP */
-      source_0 = read_source_operand(source_mode, source_regaddr, FALSE);
-      destination = (source_0 >> 8) | ((source_0 << 8) & 0xff00);
-      update_status_bits(destination, source_0, source_0, DO_NOT_MODIFY_CARRY | DO_NOT_MODIFY_OVERFLOW, NO_ADD_SUB_INSTRUCTION);
-      write_destination(destination_mode, destination_regaddr, destination, FALSE);
+      x86_64_load(code, X86_RDX, x86_64_register(X86_RSI));
+      x86_64_shift(code, X86_SHL, x86_64_register(X86_RDX), 8);
+      x86_64_load(code, X86_RAX, x86_64_register(X86_RSI));
+      x86_64_shift(code, X86_SHR, x86_64_register(X86_RAX), 8);
+      x86_64_alu(code, X86_OR, x86_64_register(X86_RDX), X86_RAX);
+      x86_64_extend(code, X86_MOVZX16, X86_RDX, x86_64_register(X86_RDX));
+      jit_logic_flags(c, X86_RDX);
+      jit_write_destination(c, entry, FALSE);
       break;
     case 8: /* NOT */
-      source_0 = read_source_operand(source_mode, source_regaddr, FALSE);
-      destination = ~source_0 & 0xffff;
-      update_status_bits(destination, source_0, source_0, DO_NOT_MODIFY_CARRY | DO_NOT_MODIFY_OVERFLOW, NO_ADD_SUB_INSTRUCTION);
-      write_destination(destination_mode, destination_regaddr, destination, FALSE);
+      x86_64_load(code, X86_RDX, x86_64_register(X86_RSI));
+      x86_64_unary(code, X86_NOT, x86_64_register(X86_RDX));
+      x86_64_extend(code, X86_MOVZX16, X86_RDX, x86_64_register(X86_RDX));
+      jit_logic_flags(c, X86_RDX);
+      jit_write_destination(c, entry, FALSE);
       break;
-    case 9: /* AND */
-      source_1 = read_source_operand(source_mode, source_regaddr, FALSE);
-      source_0 = read_source_operand(destination_mode, destination_regaddr, TRUE);
-      destination = source_0 & source_1;
-      update_status_bits(destination, source_0, source_1, DO_NOT_MODIFY_CARRY | DO_NOT_MODIFY_OVERFLOW, NO_ADD_SUB_INSTRUCTION);
-      write_destination(destination_mode, destination_regaddr, destination, TRUE);
+    case 9: /* AND, OR, XOR */
+    case 10:
+    case 11:
+      jit_read_destination(c, entry, TRUE);
+      x86_64_load(code, X86_RDX, x86_64_register(X86_RDI));
+      x86_64_alu(code, opcode == 9 ? X86_AND : opcode == 10 ? X86_OR : X86_XOR, x86_64_register(X86_RDX), X86_RSI);
+      jit_logic_flags(c, X86_RDX);
+      jit_write_destination(c, entry, TRUE);
       break;
-    case 10: /* OR */
-      source_1 = read_source_operand(source_mode, source_regaddr, FALSE);
-      source_0 = read_source_operand(destination_mode, destination_regaddr, TRUE);
-      destination = source_0 | source_1;
-      update_status_bits(destination, source_0, source_1, DO_NOT_MODIFY_CARRY | DO_NOT_MODIFY_OVERFLOW, NO_ADD_SUB_INSTRUCTION);
-      write_destination(destination_mode, destination_regaddr, destination, TRUE);
+    case 12: /* CMP: source_0 in ESI, source_1 in EDI */
+      jit_read_destination(c, entry, FALSE);
+      x86_64_alu(code, X86_CMP, x86_64_register(X86_RSI), X86_RDI);
+      x86_64_setcc(code, X86_E, X86_RAX);
+      x86_64_setcc(code, X86_A, X86_RCX);
+      x86_64_extend(code, X86_MOVZX8, X86_RAX, x86_64_register(X86_RAX));
+      x86_64_extend(code, X86_MOVZX8, X86_RCX, x86_64_register(X86_RCX));
+      x86_64_store(code, JIT_MACHINE(flags[Z_FLAG]), X86_RAX);
+      x86_64_store(code, JIT_MACHINE(flags[N_FLAG]), X86_RCX);
+      x86_64_extend(code, X86_MOVSX16, X86_RAX, x86_64_register(X86_RSI));
+      x86_64_extend(code, X86_MOVSX16, X86_RCX, x86_64_register(X86_RDI));
+      x86_64_alu(code, X86_CMP, x86_64_register(X86_RAX), X86_RCX);
+      x86_64_setcc(code, X86_G, X86_RAX);
+      x86_64_extend(code, X86_MOVZX8, X86_RAX, x86_64_register(X86_RAX));
+      x86_64_store(code, JIT_MACHINE(flags[V_FLAG]), X86_RAX);
+      x86_64_alu_immediate(code, X86_OR, JIT_MACHINE(lazy.valid), (1 << Z_FLAG) | (1 << N_FLAG) | (1 << V_FLAG),
+                           FALSE);
       break;
-    case 11: /* XOR */
-      source_1 = read_source_operand(source_mode, source_regaddr, FALSE);
-      source_0 = read_source_operand(destination_mode, destination_regaddr, TRUE);
-      destination = source_0 ^ source_1;
-      update_status_bits(destination, source_0, source_1, DO_NOT_MODIFY_CARRY | DO_NOT_MODIFY_OVERFLOW, NO_ADD_SUB_INSTRUCTION);
-      write_destination(destination_mode, destination_regaddr, destination, TRUE);
-      break;
-    case 12: /* CMP */
-      source_0 = read_source_operand(source_mode, source_regaddr, FALSE);
-      source_1 = read_source_operand(destination_mode, destination_regaddr, FALSE);
+  }
+
+  if (last)
+    jit_final_exit(c, next, FALSE);
+  else if (c->memory) { /* Self modifying code or an error */
+    x86_64_alu_immediate(code, X86_CMP, JIT_STOP, FALSE, FALSE);
+    jit_exit_jump(c, X86_NE, next, FALSE);
+  }
+}
 
-      sr_bits = read_register(SR); // CMP does NOT use the standard logic for setting the SR bits - this is done explicitly here.
+/*
+**  Compile a translated block, returns FALSE if the buffer is full. All instructions of the block are in the
+** instruction cache, see translate_block().
+*/
+int jit_compile_block(unsigned int address, translated_block *block) {
+  jit_compiler compiler, *c = &compiler;
+  x86_64_code *code = &gbl$jit.code;
+  decoded_instruction *entry;
+  size_t start;
+  unsigned int i;
 
-      if ((source_0 & 0xffff) == (source_1 & 0xffff))
-        sr_bits |= 0x0008;  // Set Z-bit
-      else
-        sr_bits &= 0xfff7;  // Clear Z-bit
+  if (gbl$jit.generation != gbl$block_generation) { /* All code in the buffer belongs to invalid blocks */
+    code->used = 0;
+    code->full = FALSE;
+    gbl$jit.generation = gbl$block_generation;
+  }
+  if (code->full || code->used + JIT_BLOCK_SIZE > code->size)
+    return FALSE;
 
-      if (source_0 > source_1)
-        sr_bits |= 0x0010;  // Set N-bit
-      else
-        sr_bits &= 0xffef;  // Clear N-bit
+  c->code = code;
+  c->generation = gbl$block_generation;
+  c->count = c->dirty = c->cycles = c->instructions = c->exits = c->slow_paths = 0;
+  jit_allocate_registers(c, address, block->length);
+
+  start = code->used;
+  x86_64_push(code, X86_RBX);
+  x86_64_push(code, X86_RBP);
+  x86_64_push(code, X86_R12);
+  x86_64_push(code, X86_R13);
+  x86_64_push(code, X86_R14);
+  x86_64_push(code, X86_R15);
+  x86_64_alu_immediate(code, X86_SUB, x86_64_register(X86_RSP), 8, TRUE); /* JIT_STOP, aligns the stack for calls */
+  x86_64_load_wide(code, X86_R15, x86_64_register(X86_RDI));
+  x86_64_move_immediate(code, JIT_STOP, FALSE);
+  jit_load_registers(c);
+
+  for (i = 0; i < block->length; i++, address += 1 + entry->source_constant)
+    jit_compile_instruction(c, entry = gbl$decoded + address, i == block->length - 1);
+  for (i = 0; i < c->exits; i++) {
+    x86_64_patch(code, c->exit[i].jump, code->used);
+    jit_emit_exit(c, c->exit + i);
+  }
+  for (i = 0; i < c->slow_paths; i++)
+    jit_emit_slow_path(c, c->slow_path + i);
 
-      /* Ugly but it works: Convert the unsigned int source_0/1 to signed ints with possible sign extension: */
-      cmp_0 = source_0;
-      cmp_1 = source_1;
+  if (code->full) {
+    code->used = start;
+    return FALSE;
+  }
+  block->native = (unsigned int (*)(qnice_machine *)) (code->start + start);
+  gbl$jit.blocks++;
+  return TRUE;
+}
+#endif
 
-      if (source_0 & 0x8000) cmp_0 |= 0xffffffffffff0000;
-      if (source_1 & 0x8000) cmp_1 |= 0xffffffffffff0000;
-      if (cmp_0 > cmp_1)
-        sr_bits |= 0x0020;  // Set V-bit
-      else
-        sr_bits &= 0xffdf;  // Clear V-bit
+/*
+** Execute one or more chained basic blocks starting at the current PC. The number of executed instructions is
+** returned in *instructions, the return value has the same meaning as the one of execute().
+*/
+INLINE int core_execute_block(unsigned long *instructions, unsigned int hooks) {
+  unsigned int address, generation, i, chained, start, idle = 0, io_reads = gbl$idle.io_reads;
+#ifdef USE_JIT
+  unsigned int native;
+#endif
+  translated_block *block;
+  decoded_instruction *entry;
+  unsigned long long executed;
+  int result = FALSE;
+
+  gbl$idle.batch = FALSE;
+  gbl$idle.polled = 0;
+  address = read_register(PC);
+  if (VERBOSE(hooks) || (gbl$interrupt_request && !gbl$interrupt_active) || address >= IO_AREA_START - 2
+      || (gbl$hle.mode && gbl$hle.entry[address])) {
+    executed = gbl$instructions;
+    result = execute_instruction(hooks);
+    *instructions = gbl$instructions - executed; /* A call verified in strict HLE mode executes the whole routine */
+    return result;
+  }
+
+  gbl$error = FALSE;
+  *instructions = 0;
+#ifdef USE_JIT
+  native = hooks == NO_HOOKS && jit_usable();
+#endif
+  for (chained = 0; chained < MAX_CHAINED_BLOCKS; chained++) {
+    if ((block = gbl$blocks + address)->generation != gbl$block_generation)
+      translate_block(address, block);
+
+    generation = gbl$block_generation;
+    start = address;
+#ifdef USE_JIT
+    if (native && (block->native || (++block->runs >= JIT_THRESHOLD && jit_compile_block(address, block)))) {
+      i = block->native(gbl$m);
+      result = i & 1;
+      i >>= 1;
+      address = read_register(PC);
+    } else
+#endif
+    for (i = 0; i < block->length;) {
+      gbl$last_address = gbl$last_addresses[gbl$last_addresses_pointer++ % MAX_LAST_ADDRESSES] = address;
+      if (STATISTICS(hooks))
+        gbl$stat.memory_accesses[READ_MEMORY]++;
+
+      entry = gbl$decoded + address;
+      result = execute_decoded(entry, hooks);
+      i++;
+      if (result || gbl$error || generation != gbl$block_generation) /* Stop, the code might have been modified */
+        break;
+      address = read_register(PC);
+    }
+    *instructions += i;
 
-      write_register(SR, sr_bits | 1);
+    if (result || gbl$error || generation != gbl$block_generation)
       break;
-    case 13: /* Reserved */
-      printf("Attempt to execute a reserved instruction at %04X\n", debug_address);
-      return 1;
-    case 14: /* Control group */
-      switch (command = (instruction >> 6) & 0x3f) {
-        case HALT_INSTRUCTION:
-          printf("HALT instruction executed at address %04X.\n\n", debug_address);
-          return TRUE;
-          break;    // Not really necessary but good style... :-)
-        case RTI_INSTRUCTION:
-          if (!gbl$interrupt_active) {
-            printf("Rogue RTI instruction, not servicing an interrupt at address %04X. HALT!\n", debug_address);
-            return TRUE;
-          }
-          gbl$interrupt_active = FALSE;
-          write_register(SR, gbl$interrupt_R14);
-          write_register(PC, gbl$interrupt_R15);
-          break;
-        case INT_INSTRUCTION:
-          if (gbl$interrupt_active) {
-            printf("Rogue INT instruction with an ISR at address %04X. HALT!\n", debug_address);
-            return TRUE;
-          }
-          gbl$interrupt_address = read_source_operand(destination_mode, destination_regaddr, TRUE);
-          write_destination(destination_mode, destination_regaddr, gbl$interrupt_address, TRUE);
-          gbl$interrupt_request = TRUE;
-          break;
-        case INCRB_INSTRUCTION:
-          sr_bits = read_register(SR);
-          rb = ((sr_bits >> 8) + 1) & 0xff;
-          write_register(SR, ((sr_bits & 0x00ff) | (rb << 8)) & 0xffff);
-          break;
-        case DECRB_INSTRUCTION:
-          sr_bits = read_register(SR);
-          rb = (((sr_bits >> 8) & 0xff) - 1) & 0xff;
-          write_register(SR, ((sr_bits & 0x00ff) | (rb << 8)) & 0xffff);
-          break;
-        default:
-          fprintf(stderr, "Illegal control instruction found: %02X\n", command);
-      }
+    idle += block->idle && address == start; /* One more iteration of an idle loop */
+
+    if (BREAK_HIT(&gbl$breakpoints, BREAK_EXECUTE, address) && (result = break_execute(address)))
       break;
-    case 15: /* Branch or subroutine call */
-      /* Determine destination address in case the branch/subroutine instruction will be performed */
-      destination = read_source_operand(source_mode, source_regaddr, FALSE); /* Perform autoincrement since no write back occurs! */
-
-      /* Determine which SR bit to use, etc. */
-      condition = (read_register(SR) >> (instruction & 0x7)) & 1;
-      if (instruction & 0x0008) /* Invert bit to be checked? */
-        condition = 1 - condition;
-
-      /* Now it is time to determine which branch resp. subroutine call type to execute if the condition is satisfied */
-      if (condition) {
-        switch((instruction >> 4) & 0x3) {
-          case 0: /* ABRA */
-            write_register(PC, destination);
-            break;
-          case 1: /* ASUB */
-            write_register(SP, read_register(SP) - 1);
-            access_memory(read_register(SP), WRITE_MEMORY, read_register(PC));
-            write_register(PC, destination);
-            break;
-          case 2: /* RBRA */
-            write_register(PC, (read_register(PC) + destination) & 0xffff);
-            break;
-          case 3: /* RSUB */
-            write_register(SP, read_register(SP) - 1);
-            access_memory(read_register(SP), WRITE_MEMORY, read_register(PC));
-            write_register(PC, (read_register(PC) + destination) & 0xffff);
-            break;
-        }
-      }
-      /* We must increment the PC in case of a constant destination address even if the branch is not taken! */
-// NO, we must not since the PC has already been incremented during the fetch operation!
-//      else if (source_mode == 0x2 && source_regaddr == 0xf) /* This is mode @R15++ */
-//        write_register(PC, read_register(PC) + 1);
+
+    if ((gbl$interrupt_request && !gbl$interrupt_active) || address >= IO_AREA_START - 2
+        || (gbl$hle.mode && gbl$hle.entry[address]))
       break;
-    default:
-      printf("PANIK: Illegal instruction found: Opcode %0X at address %04X.\n", opcode, address);
-      return TRUE;
   }
+  gbl$idle.batch = idle == MAX_CHAINED_BLOCKS && io_reads == gbl$idle.io_reads;
 
-  if (read_register(PC) == gbl$breakpoint) {
-    printf("Breakpoint reached: %04X\n", read_register(PC));
-    return TRUE;
+#ifdef USE_VGA
+  gbl$mips_inst_cnt += *instructions;
+  if (gbl$sdl_ticks - gbl$mips_tick_cnt > 1000) {
+    gbl$mips = (float) gbl$mips_inst_cnt / (float) 1000000;
+    gbl$mips_inst_cnt = 0;
+    gbl$mips_tick_cnt = gbl$sdl_ticks;
   }
+#endif
 
-  if (gbl$error) // We encountered some error (division attempt by zero in EAE)
+  if (result)
+    return result;
+  if (gbl$error)
     return TRUE;
+  address = read_register(PC);
+  return generation != gbl$block_generation && BREAK_HIT(&gbl$breakpoints, BREAK_EXECUTE, address)
+         && break_execute(address);
+}
 
-/*  write_register(PC, read_register(PC) + 1); */ /* Update program counter */
-  return FALSE; /* No HALT instruction executed */
+/*
+**  Execute blocks using one of the core variants: NO_HOOKS is used for normal runs, STATISTICS_HOOKS if statistics
+** have been requested by STAT ON, TRACE_HOOKS in debug or verbose mode. Each variant is a separate copy of the core
+** where the instrumentation not needed has been removed by the compiler.
+*/
+int execute_block(unsigned long *instructions, unsigned int hooks) {
+  switch (hooks) {
+    case NO_HOOKS:
+      return core_execute_block(instructions, NO_HOOKS);
+    case STATISTICS_HOOKS:
+      return core_execute_block(instructions, STATISTICS_HOOKS);
+    default:
+      return core_execute_block(instructions, TRACE_HOOKS);
+  }
 }
 
 #if defined(USE_VGA) && !defined(__EMSCRIPTEN__)
@@ -1099,7 +3270,103 @@ int mips_adjustment_thread(void* param) {
 }
 #endif
 
-void run() {
+/*
+**  Wait at most timeout_ns nanoseconds for input to the input status registers polled by an idle loop. The result
+** is one of the IO_INPUT_* values of io.h, IO_INPUT_NEVER is returned at once if no input can arrive meanwhile.
+*/
+int idle_wait_input(long long timeout_ns) {
+#if defined(USE_VGA) && !defined(__EMSCRIPTEN__)
+  if (gbl$idle.polled & IDLE_POLLS_KEYBOARD) { /* The keyboard has no FIFO to wait for, see kbd_wait_input() */
+    for (; timeout_ns > 0; timeout_ns -= IDLE_POLL_NS) {
+# ifdef USE_UART
+      if ((gbl$idle.polled & IDLE_POLLS_UART) && uart_wait_input(0) == IO_INPUT_READY)
+        return IO_INPUT_READY;
+# endif
+      if (kbd_wait_input(timeout_ns < IDLE_POLL_NS ? timeout_ns : IDLE_POLL_NS))
+        return IO_INPUT_READY;
+    }
+    return IO_INPUT_TIMEOUT;
+  }
+#endif
+#ifdef USE_UART
+  if (gbl$idle.polled & IDLE_POLLS_UART)
+    return uart_wait_input(timeout_ns);
+#endif
+  return IO_INPUT_NEVER; /* Only an interrupt can end the loop */
+}
+
+/* Advance the counters by instructions skipped in idle loops, see idle_fast_forward() and replay_skips() */
+void idle_skip(unsigned long long instructions, unsigned long long cycles) {
+  gbl$cycles += cycles;
+  gbl$instructions += instructions;
+  gbl$instructions_executed += instructions;
+  gbl$last_addresses_pointer += instructions;
+  gbl$idle.instructions += instructions;
+#ifdef USE_TIMER
+  timerAdvance(&gbl$timer, cycles);
+#endif
+}
+
+/*
+**  Idle loop detection: A guest waiting for input polls a status register in a tight loop (see idle_loop()). Once
+** execute_block() ran nothing but such a loop, all following batches would do the same until input arrives, a
+** timer fires or the instruction budget is nearly used up. These batches are skipped by advancing the cycle and
+** instruction counters: At once if no input can arrive meanwhile (e.g. at the end of a redirected input file),
+** otherwise the CPU thread blocks until input arrives and the emulated time follows the wall clock. Since exactly the
+** batches run() would have executed are skipped, the results of a run do not depend on the idle detection.
+** Returns TRUE if batches were skipped or the CPU thread waited.
+*/
+int idle_fast_forward(unsigned long instructions, unsigned long long cycles) {
+  unsigned long long batches = IDLE_UNLIMITED, limit, elapsed_ns;
+  long long wait_ns = IDLE_MAX_WAIT_NS;
+  struct timespec start, now, pause;
+  int input;
+
+#ifdef USE_TIMER
+  if (timerNextDeadline(&gbl$timer) != TIMER_NO_DEADLINE) /* The batch reaching the deadline raises the interrupt */
+    batches = (timerNextDeadline(&gbl$timer) - timerNow(&gbl$timer) - 1) / cycles;
+#endif
+  if (gbl$instruction_budget) { /* run() executes the instructions before the budget is reached one by one */
+    if (gbl$instructions_executed + MAX_BLOCK_LENGTH * MAX_CHAINED_BLOCKS > gbl$instruction_budget)
+      return FALSE;
+    limit = (gbl$instruction_budget - gbl$instructions_executed - MAX_BLOCK_LENGTH * MAX_CHAINED_BLOCKS) / instructions;
+    if (limit + 1 < batches)
+      batches = limit + 1;
+  }
+  if (!batches)
+    return FALSE;
+  if (batches < IDLE_MAX_WAIT_NS / (cycles * CLOCK_CYCLE_NS))
+    wait_ns = batches * cycles * CLOCK_CYCLE_NS;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if ((input = idle_wait_input(wait_ns)) == IO_INPUT_NEVER && batches == IDLE_UNLIMITED) {
+    pause.tv_sec = 0; /* Only CTRL-C or the timeout can end this run */
+    pause.tv_nsec = wait_ns;
+    nanosleep(&pause, NULL);
+  }
+  if (input != IO_INPUT_NEVER || batches == IDLE_UNLIMITED) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed_ns = (now.tv_sec - start.tv_sec) * 1000000000ull + now.tv_nsec - start.tv_nsec;
+    gbl$idle.wait_ns += elapsed_ns;
+    if (elapsed_ns / (cycles * CLOCK_CYCLE_NS) < batches)
+      batches = elapsed_ns / (cycles * CLOCK_CYCLE_NS);
+  }
+
+  if (gbl$recorder.armed) /* A replay skips the same batches, see replay_skips() */
+    recorder_skip(&gbl$recorder, gbl$cycles, batches * instructions, batches * cycles);
+  idle_skip(batches * instructions, batches * cycles);
+  return TRUE;
+}
+
+void run() {
+  if (gbl$recorder.mode == RECORDER_REPLAYING && gbl$recorder.complete
+      && gbl$recorder.instructions == gbl$recorder.trailer.instructions) {
+    MESSAGE("The end of the trace has been reached\n");
+    gbl$stop_reason = STOP_TRACE_END;
+    gbl$instructions_executed = gbl$cycles_executed = 0;
+    return;
+  }
+
   for (unsigned int i = gbl$last_addresses_pointer = 0; i < MAX_LAST_ADDRESSES; gbl$last_addresses[i++] = 0);
 
   if (gbl$initial_run)
@@ -1110,19 +3377,93 @@ void run() {
   uart_hardware_initialization(&gbl$first_uart);
 #endif
 
-  gbl$gather_statistics = TRUE;
+  gbl$gather_statistics = gbl$statistics_enabled;
   gbl$cpu_running = true;
+  gbl$breakpoints.armed = TRUE; /* Accesses of the host (DUMP, SET, ...) do not trigger watchpoints */
+  record_arm();
 
+  unsigned long instructions, iterations = 0;
+#if defined(USE_TIMER) && !defined(USE_VGA)
+  unsigned long pacing_iterations = 0;
+#endif
+  unsigned int hooks = gbl$debug || gbl$verbose ? TRACE_HOOKS
+                     : gbl$gather_statistics || gbl$profiling || gbl$coverage.enabled || gbl$recorder.armed
+                       ? STATISTICS_HOOKS : NO_HOOKS;
+  /* Statistics, profiles etc. see every iteration of an idle loop, a recorded trace contains the skipped ones */
+  int skip_idle = hooks == NO_HOOKS || (hooks == STATISTICS_HOOKS && gbl$recorder.mode == RECORDER_RECORDING
+                                        && !gbl$gather_statistics && !gbl$profiling && !gbl$coverage.enabled);
+  int result, idled;
+  struct timespec run_start, now;
+  clock_gettime(CLOCK_MONOTONIC, &run_start);
 #if defined(USE_VGA) && !defined(__EMSCRIPTEN__)
   unsigned long instruction_counter = gbl$target_iptms;
   struct timespec tstart, tend;
   clock_gettime(CLOCK_REALTIME, &tstart);
 #endif
 
-  while (!execute() && !gbl$ctrl_c && !gbl$shutdown_signal) {
+  unsigned long long run_cycles = gbl$cycles, cycles, budget = gbl$instruction_budget, remaining;
+
+  /* A replay stops at the end of the trace, the budget makes it stop exactly there */
+  if (gbl$recorder.mode == RECORDER_REPLAYING && gbl$recorder.complete) {
+    remaining = gbl$recorder.trailer.instructions - gbl$recorder.instructions;
+    if (!budget || remaining < budget)
+      gbl$instruction_budget = remaining;
+  }
+
+  gbl$stop_reason = STOP_ERROR; /* Changed by HALT, breakpoints etc. */
+  gbl$instructions_executed = 0;
+  for (;;) {
+    cycles = gbl$cycles;
+    /* The last instructions before reaching the budget are executed one by one, so the budget is met exactly */
+    if (gbl$instruction_budget &&
+        gbl$instructions_executed + MAX_BLOCK_LENGTH * MAX_CHAINED_BLOCKS > gbl$instruction_budget) {
+      if (gbl$instructions_executed >= gbl$instruction_budget) {
+        gbl$stop_reason = STOP_BUDGET;
+        break;
+      }
+      instructions = gbl$instructions;
+      result = execute();
+      instructions = gbl$instructions - instructions;
+    } else
+      result = execute_block(&instructions, hooks);
+    gbl$instructions_executed += instructions;
+#ifdef USE_TIMER
+    timerAdvance(&gbl$timer, gbl$cycles - cycles);
+#endif
+    if (result || gbl$ctrl_c || gbl$shutdown_signal)
+      break;
+
+    /* Skip the following batches if the last one only polled the input */
+    idled = gbl$idle.batch && gbl$idle.enabled && skip_idle && !(gbl$interrupt_request && !gbl$interrupt_active)
+            && idle_fast_forward(instructions, gbl$cycles - cycles);
+    if (gbl$recorder.armed && gbl$recorder.mode == RECORDER_REPLAYING)
+      replay_skips();
+
+#if defined(USE_TIMER) && !defined(USE_VGA)
+    if (gbl$pacing && !(++pacing_iterations & 0xf)) { /* Sleep while the emulated time is ahead of the wall clock */
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      long long ahead_ns = (long long) ((gbl$cycles - run_cycles) / TIMER_CYCLES_PER_TICK) * TIMER_TICK_NS -
+                           ((now.tv_sec - run_start.tv_sec) * 1000000000ll + (now.tv_nsec - run_start.tv_nsec));
+      if (ahead_ns > 1000000) {
+        struct timespec pause = {ahead_ns / 1000000000, ahead_ns % 1000000000};
+        nanosleep(&pause, NULL);
+      }
+    }
+#endif
+
+    if (gbl$timeout && (!(++iterations & 0xff) || idled)) {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if ((now.tv_sec - run_start.tv_sec) + (now.tv_nsec - run_start.tv_nsec) / 1e9 >= gbl$timeout) {
+        gbl$stop_reason = STOP_TIMEOUT;
+        break;
+      }
+    }
+
 #if defined(USE_VGA) && !defined(__EMSCRIPTEN__)
-    if (gbl$target_mips != gbl$max_mips)
-      if (!--instruction_counter) {
+    if (gbl$target_mips != gbl$max_mips) {
+      if (instruction_counter > instructions)
+        instruction_counter -= instructions;
+      else {
         clock_gettime(CLOCK_REALTIME, &tend);
         unsigned long delta_us = ((tend.tv_sec * 1e9 + tend.tv_nsec) - (tstart.tv_sec * 1e9 + tstart.tv_nsec)) / 1000.0f;
         if (delta_us < 10e3)
@@ -1130,12 +3471,27 @@ void run() {
         instruction_counter = (unsigned long) ((float) gbl$target_iptms * (float) gbl$target_iptms_adjustment_factor);
         clock_gettime(CLOCK_REALTIME, &tstart);
       }
+    }
 #endif
   }
 
+  gbl$cycles_executed = gbl$cycles - run_cycles;
+  if (gbl$gather_statistics)
+    gbl$stat.cycles += gbl$cycles_executed;
+
   gbl$cpu_running = false;
-  if (gbl$ctrl_c)
+  gbl$breakpoints.armed = FALSE;
+  record_disarm();
+  gbl$instruction_budget = budget;
+  if (gbl$recorder.mode == RECORDER_REPLAYING && gbl$stop_reason == STOP_BUDGET
+      && gbl$recorder.complete && gbl$recorder.instructions == gbl$recorder.trailer.instructions) {
+    MESSAGE("The end of the trace has been reached after %llu instructions\n", gbl$recorder.instructions);
+    gbl$stop_reason = STOP_TRACE_END;
+  }
+  if (gbl$ctrl_c) {
+    gbl$stop_reason = STOP_CTRL_C;
     printf("\n\tAborted by CTRL-C!\n");
+  }
   gbl$gather_statistics = FALSE;
 
 #ifdef USE_UART
@@ -1172,12 +3528,15 @@ void print_statistics() {
 
   for (i = value = 0; i < NO_OF_INSTRUCTIONS; value += gbl$stat.instruction_frequency[i++]);
   if (!value)
-    printf("No statistics have been gathered so far!\n");
+    printf("No statistics have been gathered so far!%s\n",
+           gbl$statistics_enabled ? "" : " Use STAT ON to gather statistics during RUN.");
   else {
-    printf("\n%llu memory reads, %llu memory writes and\n%llu instructions have been executed so far:\n\n\
+    printf("\n%llu memory reads, %llu memory writes and\n%llu instructions have been executed so far\n\
+in %llu clock cycles (%.2f cycles per instruction, %.2f MIPS at 50 MHz):\n\n\
 INSTR ABSOLUTE         RELATIVE INSTR ABSOLUTE         RELATIVE\n\
 ---------------------------------------------------------------\n", 
-           gbl$stat.memory_accesses[READ_MEMORY], gbl$stat.memory_accesses[WRITE_MEMORY], value);
+           gbl$stat.memory_accesses[READ_MEMORY], gbl$stat.memory_accesses[WRITE_MEMORY], value, gbl$stat.cycles,
+           (float) gbl$stat.cycles / (float) value, 50.0 * (float) value / (float) gbl$stat.cycles);
     for (i = 0; i < NO_OF_INSTRUCTIONS; i++)
       printf("%s%-4s: %16llu (%5.2f%%)\t",
              !(i & 1) && i ? "\n" : "", /* New line every second round */
@@ -1216,6 +3575,71 @@ MODE   ABSOLUTE         RELATIVE        MODE   ABSOLUTE         RELATIVE\n\
   dump_registers();
 }
 
+/*
+**  Load an image in the binary format described in qbin.h. The whole file is read at once, checked and then
+** copied directly into the main memory. Only words belonging to the IO area are written using access_memory.
+*/
+int load_qbin_file(FILE *handle, char *file_name) {
+  unsigned char *buffer;
+  unsigned int size, words, i, j, address, length, segments, checksum = 0;
+
+  fseek(handle, 0, SEEK_END);
+  size = ftell(handle);
+  fseek(handle, 0, SEEK_SET);
+  if (!(buffer = malloc(size)) || fread(buffer, 1, size, handle) != size) {
+    printf("Unable to read file >>%s<<\n", file_name);
+    free(buffer);
+    return -1;
+  }
+
+#define QBIN_WORD(i) (buffer[QBIN_MAGIC_SIZE + 2 * (i)] | (buffer[QBIN_MAGIC_SIZE + 2 * (i) + 1] << 8))
+  words = (size - QBIN_MAGIC_SIZE) / 2;
+  if (size < QBIN_MAGIC_SIZE + 2 * QBIN_HEADER_WORDS || (size - QBIN_MAGIC_SIZE) & 1 || QBIN_WORD(0) != QBIN_VERSION) {
+    printf("Unsupported binary image >>%s<<\n", file_name);
+    free(buffer);
+    return -1;
+  }
+
+  /* First pass: Check the segment structure and the checksum before touching the memory. */
+  segments = QBIN_WORD(1);
+  checksum = QBIN_WORD(0) + segments;
+  for (i = QBIN_HEADER_WORDS, j = 0; j < segments; j++, i += length) {
+    if (i + QBIN_SEGMENT_WORDS > words)
+      break;
+    address = QBIN_WORD(i);
+    length  = QBIN_WORD(i + 1);
+    checksum += address + length;
+    i += QBIN_SEGMENT_WORDS;
+    if (i + length > words || address + length > MEMORY_SIZE)
+      break;
+    for (unsigned int k = 0; k < length; k++)
+      checksum += QBIN_WORD(i + k);
+  }
+
+  if (j != segments || i != words || (checksum & 0xffff) != QBIN_WORD(2)) {
+    printf("Corrupt binary image >>%s<<\n", file_name);
+    free(buffer);
+    return -1;
+  }
+
+  for (i = QBIN_HEADER_WORDS, j = 0; j < segments; j++, i += length) {
+    address = QBIN_WORD(i);
+    length  = QBIN_WORD(i + 1);
+    i += QBIN_SEGMENT_WORDS;
+    for (unsigned int k = 0; k < length; k++, address++)
+      if (address < IO_AREA_START) {
+        gbl$memory[address] = QBIN_WORD(i + k);
+        gbl$dirty_pages[address / DIRTY_PAGE_SIZE] = TRUE;
+        invalidate_decoded_instruction(address);
+      } else
+        access_memory(address, WRITE_MEMORY, QBIN_WORD(i + k));
+  }
+#undef QBIN_WORD
+
+  free(buffer);
+  return 0;
+}
+
 int load_binary_file(char *file_name) {
   unsigned int address;
   char scratch[STRING_LENGTH], *token;
@@ -1225,6 +3649,13 @@ int load_binary_file(char *file_name) {
     printf("Unable to open file >>%s<<\n", file_name);
     return -1;
   } else {
+    if (fread(scratch, 1, QBIN_MAGIC_SIZE, handle) == QBIN_MAGIC_SIZE && !strncmp(scratch, QBIN_MAGIC, QBIN_MAGIC_SIZE)) {
+      int result = load_qbin_file(handle, file_name);
+      fclose(handle);
+      return result;
+    }
+    rewind(handle);
+
     fgets(scratch, STRING_LENGTH, handle);
     upstr(scratch);
     chomp(scratch);
@@ -1257,6 +3688,7 @@ int load_binary_file(char *file_name) {
 int main_loop(char **argv) {
   char command[STRING_LENGTH], *token, *delimiters = " ,", scratch[STRING_LENGTH];
   unsigned int start, stop, i, j, address, value, last_command_was_step = 0;
+  unsigned long long cycles;
   wordexp_t expanded_filename;
   FILE *handle;
 
@@ -1265,7 +3697,8 @@ int main_loop(char **argv) {
         return -1;
 
       run();
-      print_statistics();
+      if (gbl$statistics_enabled)
+        print_statistics();
   }
 
   for (;;) {
@@ -1278,7 +3711,10 @@ int main_loop(char **argv) {
     chomp(command);
     if (feof(stdin)) {
 #ifdef USE_SD
-      sd_detach();
+      sd_detach(&gbl$sd);
+#endif
+#ifdef USE_IDE
+      detachIDEImage();
 #endif
       return 0;
     }
@@ -1291,15 +3727,50 @@ int main_loop(char **argv) {
     if ((token = tokenize(NULL, delimiters))) {
       upstr(token);
       if (!strcmp(token, "QUIT") || !strcmp(token, "EXIT")) {
+        record_stop();
 #ifdef USE_SD
-        sd_detach();
+        sd_detach(&gbl$sd);
+#endif
+#ifdef USE_IDE
+        detachIDEImage();
 #endif
         return 0;
-      } else if (!strcmp(token, "CB"))
-        gbl$breakpoint = -1;
-      else if (!strcmp(token, "SB"))
-        printf("Breakpoint set to %04X\n", gbl$breakpoint = str2int(tokenize(NULL, delimiters)));
-      else if (!strcmp(token, "DUMP")) {
+      } else if (!strcmp(token, "CB")) {
+        if (!breakpoint_delete(&gbl$breakpoints, str2int(tokenize(NULL, delimiters))))
+          printf("No such breakpoint or watchpoint\n");
+        invalidate_all_blocks();
+      } else if (!strcmp(token, "LB"))
+        breakpoint_list(&gbl$breakpoints, stdout);
+      else if (!strcmp(token, "SB") || !strcmp(token, "SW")) {
+        value = 1 << BREAK_EXECUTE;
+        if (token[1] == 'W') {
+          if ((token = tokenize(NULL, delimiters)))
+            upstr(token);
+          if (!token || strspn(token, "RW") != strlen(token)) {
+            printf("Illegal kind of watchpoint. Use R, W or RW.\n");
+            continue;
+          }
+          value = (strchr(token, 'R') ? 1 << BREAK_READ : 0) | (strchr(token, 'W') ? 1 << BREAK_WRITE : 0);
+        }
+
+        start = stop = str2int(tokenize(NULL, delimiters)) & 0xffff;
+        if (value != 1 << BREAK_EXECUTE && (token = tokenize(NULL, delimiters))) {
+          upstr(token);
+          if (strcmp(token, "IF"))
+            stop = str2int(token) & 0xffff;
+        }
+
+        if ((i = breakpoint_add(&gbl$breakpoints, value, start, stop, break_condition(command), scratch,
+                                STRING_LENGTH)) == (unsigned int) -1)
+          printf("Illegal condition: %s\n", scratch);
+        else if (value == 1 << BREAK_EXECUTE) {
+          printf("Breakpoint %u set to %04X\n", i, start);
+          invalidate_all_blocks();
+        } else if (stop > start)
+          printf("Watchpoint %u set to %04X..%04X\n", i, start, stop);
+        else
+          printf("Watchpoint %u set to %04X\n", i, start);
+      } else if (!strcmp(token, "DUMP")) {
         start = str2int(tokenize(NULL, delimiters));
         stop  = str2int(tokenize(NULL, delimiters));
         *scratch = (char) 0;
@@ -1331,7 +3802,36 @@ int main_loop(char **argv) {
             fclose(handle);
           }
         }
-      } else if (!strcmp(token, "LOAD")) { /* Load expects a file with a row format like "<addr> <value>\n", etc. */
+      } else if (!strcmp(token, "SNAPSHOT")) { /* Without a filename the snapshot is kept in memory */
+        if (!(token = tokenize(NULL, delimiters))) {
+          snapshot_free(gbl$snapshot);
+          if (!(gbl$snapshot = snapshot_take()))
+            printf("Not enough memory for a snapshot!\n");
+        } else {
+          snapshot *snap;
+
+          wordexp(token, &expanded_filename, 0);
+          if (!(snap = snapshot_take()))
+            printf("Not enough memory for a snapshot!\n");
+          else
+            snapshot_save(snap, expanded_filename.we_wordv[0]);
+          snapshot_free(snap);
+        }
+      } else if (!strcmp(token, "RESTORE")) {
+        if (!(token = tokenize(NULL, delimiters))) {
+          if (gbl$snapshot)
+            snapshot_restore(gbl$snapshot);
+          else
+            printf("There is no snapshot in memory, use SNAPSHOT first!\n");
+        } else {
+          snapshot *snap;
+
+          wordexp(token, &expanded_filename, 0);
+          if ((snap = snapshot_load(expanded_filename.we_wordv[0])))
+            snapshot_restore(snap);
+          snapshot_free(snap);
+        }
+      } else if (!strcmp(token, "LOAD")) { /* Load expects a file with a row format like "<addr> <value>\n" or .qbin */
         if (!(token = tokenize(NULL, delimiters)))
           printf("LOAD expects a filename as its 1st parameter!\n");
         else {
@@ -1345,10 +3845,29 @@ int main_loop(char **argv) {
           printf("ATTACH expects a filename as its 1st parameter!\n");
         else {
           wordexp(token, &expanded_filename, 0);
-          sd_attach(expanded_filename.we_wordv[0]);
+          if ((token = tokenize(NULL, delimiters)))
+            upstr(token);
+          attach_sd_image(expanded_filename.we_wordv[0],
+                          token && !strcmp(token, "OVERLAY") ? SD_OVERLAY : SD_READ_WRITE);
         }
       } else if (!strcmp(token, "DETACH"))
-        sd_detach();
+        sd_detach(&gbl$sd);
+      else if (!strcmp(token, "SDLATENCY")) {
+        if ((token = tokenize(NULL, delimiters)))
+          sd_set_latency(&gbl$sd, str2int(token));
+        printf("SD-card commands keep the card busy for %u clock cycles\n", sd_get_latency(&gbl$sd));
+      }
+#endif
+#ifdef USE_IDE
+      else if (!strcmp(token, "IDEATTACH")) { /* Attach an image file to the IDE-simulation */
+        if (!(token = tokenize(NULL, delimiters)))
+          printf("IDEATTACH expects a filename as its 1st parameter!\n");
+        else {
+          wordexp(token, &expanded_filename, 0);
+          attachIDEImage(expanded_filename.we_wordv[0]);
+        }
+      } else if (!strcmp(token, "IDEDETACH"))
+        detachIDEImage();
 #endif
       else if (!strcmp(token, "RDUMP"))
         dump_registers();
@@ -1372,13 +3891,159 @@ int main_loop(char **argv) {
       } else if (!strcmp(token, "DIS")) {
         start = str2int(tokenize(NULL, delimiters));
         disassemble(start, str2int(tokenize(NULL, delimiters)));
-      } else if (!strcmp(token, "STAT"))
-        print_statistics();
+      } else if (!strcmp(token, "STAT")) {
+        if ((token = tokenize(NULL, delimiters))) {
+          upstr(token);
+          if (!strcmp(token, "ON"))
+            gbl$statistics_enabled = TRUE;
+          else if (!strcmp(token, "OFF"))
+            gbl$statistics_enabled = FALSE;
+          else
+            printf("Illegal switch. Use ON or OFF. STAT is currently %s\n", gbl$statistics_enabled ? "ON" : "OFF");
+        } else
+          print_statistics();
+      }
+      else if (!strcmp(token, "PROF")) {
+        if (!(token = tokenize(NULL, delimiters)))
+          profile_report(stdout, PROFILE_REPORT_ENTRIES);
+        else {
+          upstr(token);
+          if (!strcmp(token, "ON"))
+            gbl$profiling = TRUE;
+          else if (!strcmp(token, "OFF"))
+            gbl$profiling = FALSE;
+          else if (!strcmp(token, "RESET"))
+            profile_reset();
+          else if (!strcmp(token, "DIS")) {
+            start = str2int(tokenize(NULL, delimiters));
+            profile_annotate(stdout, start, str2int(tokenize(NULL, delimiters)), disassemble_instruction);
+          } else if (!strcmp(token, "FOLDED") && (token = tokenize(NULL, delimiters))) {
+            wordexp(token, &expanded_filename, 0);
+            if (!(handle = fopen(expanded_filename.we_wordv[0], "w")))
+              printf("Unable to create file >>%s<<\n", expanded_filename.we_wordv[0]);
+            else {
+              profile_folded(handle);
+              fclose(handle);
+            }
+          } else
+            printf("Illegal switch. Use ON, OFF, RESET, DIS or FOLDED. PROF is currently %s\n",
+                   gbl$profiling ? "ON" : "OFF");
+        }
+      } else if (!strcmp(token, "HLE")) {
+        if (!(token = tokenize(NULL, delimiters)))
+          hle_report(&gbl$hle, stdout);
+        else {
+          upstr(token);
+          if (!strcmp(token, "ON") || !strcmp(token, "STRICT") || !strcmp(token, "OFF")) {
+            value = !strcmp(token, "ON") ? HLE_ON : !strcmp(token, "STRICT") ? HLE_STRICT : HLE_OFF;
+            if ((token = tokenize(NULL, delimiters))) {
+              wordexp(token, &expanded_filename, 0);
+              if (hle_load(&gbl$hle, expanded_filename.we_wordv[0]) < 0)
+                printf("Unable to open file >>%s<<\n", expanded_filename.we_wordv[0]);
+            }
+            set_hle_mode(value);
+            printf("HLE is %s, %u routines of the monitor are known\n",
+                   value == HLE_ON ? "ON" : value == HLE_STRICT ? "STRICT" : "OFF", gbl$hle.routines);
+          } else
+            printf("Illegal switch. Use ON, STRICT or OFF.\n");
+        }
+      } else if (!strcmp(token, "IDLE")) {
+        if ((token = tokenize(NULL, delimiters))) {
+          upstr(token);
+          if (!strcmp(token, "ON"))
+            gbl$idle.enabled = TRUE;
+          else if (!strcmp(token, "OFF"))
+            gbl$idle.enabled = FALSE;
+          else
+            printf("Illegal switch. Use ON or OFF.\n");
+        }
+        printf("IDLE is %s, %llu instructions of idle loops skipped, waited %.2f s for input\n",
+               gbl$idle.enabled ? "ON" : "OFF", gbl$idle.instructions, gbl$idle.wait_ns / 1e9);
+      } else if (!strcmp(token, "JIT")) {
+#ifdef USE_JIT
+        if ((token = tokenize(NULL, delimiters))) {
+          upstr(token);
+          if (!strcmp(token, "ON") && gbl$jit.code.start)
+            gbl$jit.enabled = TRUE;
+          else if (!strcmp(token, "OFF"))
+            gbl$jit.enabled = FALSE;
+          else
+            printf("Illegal switch. Use ON or OFF (ON needs executable memory).\n");
+        }
+        printf("JIT is %s, %llu blocks compiled, %lu bytes of native code\n", gbl$jit.enabled ? "ON" : "OFF",
+               gbl$jit.blocks, (unsigned long) gbl$jit.code.used);
+#else
+        printf("This emulator has no JIT, it is only available on x86-64 hosts.\n");
+#endif
+      } else if (!strcmp(token, "COV")) {
+        if (!(token = tokenize(NULL, delimiters))) {
+          printf("COV is %s\n", gbl$coverage.enabled ? "ON" : "OFF");
+          coverage_report(&gbl$coverage, stdout);
+        } else {
+          upstr(token);
+          if (!strcmp(token, "ON"))
+            gbl$coverage.enabled = TRUE;
+          else if (!strcmp(token, "OFF"))
+            gbl$coverage.enabled = FALSE;
+          else if (!strcmp(token, "CLEAR"))
+            coverage_clear(&gbl$coverage);
+          else if (!strcmp(token, "SAVE") && (token = tokenize(NULL, delimiters))) {
+            wordexp(token, &expanded_filename, 0);
+            if (coverage_save(&gbl$coverage, expanded_filename.we_wordv[0]))
+              printf("Unable to merge the coverage into >>%s<<\n", expanded_filename.we_wordv[0]);
+          } else
+            printf("Illegal switch. Use ON, OFF, CLEAR or SAVE. COV is currently %s\n",
+                   gbl$coverage.enabled ? "ON" : "OFF");
+        }
+      } else if (!strcmp(token, "RECORD") || !strcmp(token, "REPLAY")) {
+        value = token[2] == 'C';
+        if (!(token = tokenize(NULL, delimiters)))
+          recorder_status(&gbl$recorder, stdout);
+        else {
+          wordexp(token, &expanded_filename, 0);
+          upstr(token);
+          if (!strcmp(token, "OFF"))
+            record_stop();
+          else if (value)
+            record_start(expanded_filename.we_wordv[0]);
+          else
+            replay_start(expanded_filename.we_wordv[0]);
+        }
+      } else if (!strcmp(token, "SYMBOLS")) {
+        if (!(token = tokenize(NULL, delimiters)))
+          symbols_clear();
+        else {
+          wordexp(token, &expanded_filename, 0);
+          symbols_load(expanded_filename.we_wordv[0]);
+        }
+      }
+#if defined(USE_TIMER) && !defined(USE_VGA)
+      else if (!strcmp(token, "PACE")) {
+        if ((token = tokenize(NULL, delimiters))) {
+          upstr(token);
+          if (!strcmp(token, "ON"))
+            gbl$pacing = TRUE;
+          else if (!strcmp(token, "OFF"))
+            gbl$pacing = FALSE;
+          else
+            printf("Illegal switch. Use ON or OFF.\n");
+        }
+        printf("PACE is %s\n", gbl$pacing ? "ON" : "OFF");
+      }
+#endif
       else if (!strcmp(token, "STEP")) {
         last_command_was_step = 1;
         if ((token = tokenize(NULL, delimiters)))
           write_register(PC, str2int(token));
+        cycles = gbl$cycles;
+        gbl$breakpoints.armed = TRUE;
+        record_arm();
         execute();
+        gbl$breakpoints.armed = FALSE;
+        record_disarm();
+#ifdef USE_TIMER
+        timerAdvance(&gbl$timer, gbl$cycles - cycles);
+#endif
       } else if (!strcmp(token, "SWITCH")) {
         if ((token = tokenize(NULL, delimiters)))
           access_memory(IO_SWITCH_REG, WRITE_MEMORY, str2int(token));
@@ -1426,38 +4091,92 @@ int main_loop(char **argv) {
         run();
       } else if (!strcmp(token, "HELP")) {
         printf("\n\
-ATTACH <FILENAME>              Attach a disk image file (only with SD-support)\n\
-CB                             Clear Breakpoint\n\
+ATTACH <FILENAME> [OVERLAY]    Attach a disk image file (only with SD-support),\n\
+                               with OVERLAY writes do not change the file\n\
+CB [<NUMBER>]                  Clear a breakpoint or watchpoint resp. all\n\
+COV [ON | OFF | CLEAR]         Displays the code coverage or switches recording\n\
+                               it during RUN on or off resp. clears it\n\
+COV SAVE <FILENAME>            Merge the coverage into a coverage file for\n\
+                               qnice-coverage\n\
 DEBUG                          Toggle debug mode (for development only)\n\
 DETACH                         Detach a disk image file\n\
 DIS  <START>, <STOP>           Disassemble a memory region\n\
 DUMP <START>, <STOP>           Dump a memory area, START and STOP can be\n\
                                hexadecimal or plain decimal\n\
-LOAD <FILENAME>                Loads a binary file into main memory\n");
+HLE                            Displays the calls of monitor routines which\n\
+                               were executed natively (high-level emulation)\n\
+HLE ON | STRICT | OFF [<FILE>] Switches the HLE on resp. off, STRICT compares\n\
+                               each call with the interpreted routine, FILE is\n\
+                               the monitor.lis with the entry addresses\n");
+#ifdef USE_IDE
+        printf("\
+IDEATTACH <FILENAME>           Attach an image file to the CF card of the IDE\n\
+                               simulation, it is created if necessary\n\
+IDEDETACH                      Detach the image file, the card is empty then\n");
+#endif
+        printf("\
+IDLE [ON | OFF]                Skip loops polling for input (the CPU thread\n\
+                               waits for input or the next timer interrupt)\n\
+JIT [ON | OFF]                 Compile frequently executed blocks to native\n\
+                               code (x86-64 only)\n\
+LB                             List the breakpoints and watchpoints\n\
+LOAD <FILENAME>                Loads a .out or .qbin file into main memory\n");
 #if defined(USE_VGA) && defined(USE_UART) && !defined(__EMSCRIPTEN__)
         printf("\
 MIPS [<TARGET MIPS> | MAX]     Displays/sets the emulator's speed in MIPS\n");
+#endif
+#if defined(USE_TIMER) && !defined(USE_VGA)
+        printf("\
+PACE [ON | OFF]                Run at the speed of the hardware (50 MHz) so\n\
+                               timers fire at wall clock rate\n");
 #endif
         printf("\
+PROF [ON | OFF | RESET]        Displays the execution profile (hot spots and\n\
+                               costs per subroutine) or switches profiling\n\
+                               during RUN on or off resp. clears the profile\n\
+PROF DIS <START>, <STOP>       Disassemble a memory region with execution and\n\
+                               branch counts\n\
+PROF FOLDED <FILENAME>         Write the call tree as folded stacks, e.g. for\n\
+                               flamegraph.pl\n\
 QUIT/EXIT                      Stop the emulator and return to the shell\n\
 RESET                          Reset the whole machine\n\
 RDUMP                          Print a register dump\n\
+RECORD [<FILENAME> | OFF]      Record an execution trace of the following runs\n\
+                               for REPLAY and qnice-trace, without a filename\n\
+                               displays the trace recorded resp. replayed\n\
+REPLAY <FILENAME> | OFF        Restore the machine state a trace starts with,\n\
+                               RUN then reproduces the recorded run exactly\n\
+RESTORE [<FILENAME>]           Restore the machine state from a snapshot file\n\
+                               or from the snapshot in memory\n\
 RUN [<ADDR>]                   Run a program beginning at ADDR\n\
 SET <REG | ADDR> <VALUE>       Either set a register or a memory cell\n\
 SAVE <FILENAME> <START> <STOP> Create a loadable binary file\n\
-SB <ADDR>                      Set breakpoint to an address\n");
+SB <ADDR> [IF <COND>]          Set a breakpoint at an address which triggers\n\
+                               only if the condition holds, e.g.\n\
+                               SB 0x8010 IF R8 == 0x0D && @R9 != 0\n\
+SDLATENCY [<CYCLES>]           Displays/sets the clock cycles the SD-card\n\
+                               stays busy after a command (default 0)\n\
+SNAPSHOT [<FILENAME>]          Save the machine state to a file or (without\n\
+                               a filename) keep it in memory for RESTORE\n");
 #if defined(USE_VGA) && defined(USE_UART) && !defined(__EMSCRIPTEN__)
         printf("\
 SPEEDSTATS [ON | OFF]          Set the display of MIPS and FPS in VGA window\n");
 #endif
         printf("\
-STAT                           Displays some execution statistics\n\
+STAT [ON | OFF]                Displays some execution statistics or switches\n\
+                               gathering them during RUN on or off\n\
 STEP [<ADDR>]                  Executes a single instruction at address\n\
                                ADDR. If not address is specified the current\n\
                                program counter will be used instead.\n\
                                If the last command was step, an empty command\n\
                                string will perform the next step!\n\
+SW R|W|RW <ADDR> [<LAST>] [IF <COND>]\n\
+                               Set a watchpoint stopping after an instruction\n\
+                               reading resp. writing ADDR (..LAST), VALUE and\n\
+                               ADDR in COND are the word and address accessed\n\
 SWITCH [<VALUE>]               Set the switch register to a value\n\
+SYMBOLS [<FILENAME>]           Load labels from a .def or .lis file for the\n\
+                               profiler, without a filename clear them\n\
 VERBOSE                        Toggle verbosity mode\n\
 ");
 
@@ -1477,6 +4196,164 @@ ALT+v                          Set to maximum hardware speed\n\
   }
 }
 
+/*
+**  Write the result of the last run as a JSON object: Stop reason, number of instructions, registers and the
+** statistics (if these were gathered).
+*/
+void print_result_json(FILE *handle) {
+  unsigned int i;
+
+  fprintf(handle, "{\n  \"stop_reason\": \"%s\",\n  \"instructions\": %llu,\n  \"cycles\": %llu,\n\
+  \"last_address\": %u,\n", gbl$stop_reasons[gbl$stop_reason], gbl$instructions_executed, gbl$cycles_executed,
+          gbl$last_address);
+  fprintf(handle, "  \"registers\": {");
+  for (i = 0; i < 0x10; i++)
+    fprintf(handle, "%s\"R%d\": %u", i ? ", " : "", i, read_register(i));
+  fprintf(handle, "},\n  \"bank\": %u", read_register(SR) >> 8);
+
+  if (gbl$statistics_enabled) {
+    fprintf(handle, ",\n  \"statistics\": {\n    \"memory_reads\": %llu,\n    \"memory_writes\": %llu,\n\
+    \"instruction_frequency\": {", gbl$stat.memory_accesses[READ_MEMORY], gbl$stat.memory_accesses[WRITE_MEMORY]);
+    for (i = 0; i < NO_OF_INSTRUCTIONS; i++)
+      fprintf(handle, "%s\"%s\": %llu", i ? ", " : "",
+              i < GENERIC_BRANCH_OPCODE ? gbl$normal_mnemonics[i] : gbl$branch_mnemonics[i - GENERIC_BRANCH_OPCODE],
+              gbl$stat.instruction_frequency[i]);
+    for (unsigned int j = 0; j < 2; j++) {
+      fprintf(handle, "},\n    \"addressing_modes_%s\": {", j ? "write" : "read");
+      for (i = 0; i < NO_OF_ADDRESSING_MODES; i++)
+        fprintf(handle, "%s\"%s\": %llu", i ? ", " : "", gbl$addressing_mnemonics[i], gbl$stat.addressing_modes[j][i]);
+    }
+    fprintf(handle, "}\n  }");
+  }
+  fprintf(handle, "\n}\n");
+}
+
+#ifndef USE_VGA
+/*
+**  Headless batch mode (qnice -b ...) for automated test runs: All files (and snapshots) are loaded in the given
+** order, the CPU is started without entering the Q> shell and the result is written as JSON. The exit code is the
+** index into gbl$stop_reasons, so 0 means a HALT instruction was executed. Without -x a HALT enters the Q> shell
+** after writing the result.
+*/
+int headless_main(char **argv) {
+  char *option, *json_name = NULL, *profile_name = NULL, *coverage_name = NULL;
+  FILE *input = NULL, *output = NULL, *json = stdout;
+  unsigned int start = 0, set_start = FALSE, exit_on_halt = FALSE, files = 0;
+  snapshot *snap;
+
+  for (; *argv; argv++) {
+    if (**argv != '-') {
+      if (load_binary_file(*argv))
+        return -1;
+      files++;
+      continue;
+    }
+
+    option = *argv;
+    if (!strcmp(option, "-s"))
+      gbl$statistics_enabled = TRUE;
+    else if (!strcmp(option, "-x"))
+      exit_on_halt = TRUE;
+    else if (!strcmp(option, "-I"))
+      gbl$idle.enabled = FALSE;
+    else if (!*++argv) {
+      printf("Expected a parameter after %s but none found.\n", option);
+      return -1;
+    } else if (!strcmp(option, "-n"))
+      gbl$instruction_budget = strtoull(*argv, NULL, 0);
+    else if (!strcmp(option, "-t"))
+      gbl$timeout = atof(*argv);
+    else if (!strcmp(option, "-p"))
+      start = str2int(*argv), set_start = TRUE;
+    else if (!strcmp(option, "-r")) { /* Restore a snapshot, files given afterwards are loaded on top of it */
+      if (!(snap = snapshot_load(*argv)))
+        return -1;
+      snapshot_restore(snap);
+      snapshot_free(snap);
+      files++;
+    } else if (!strcmp(option, "-R")) { /* Replay a trace, it starts with a snapshot */
+      if (replay_start(*argv))
+        return -1;
+      files++;
+    } else if (!strcmp(option, "-T")) {
+      if (record_start(*argv))
+        return -1;
+    } else if (!strcmp(option, "-j"))
+      json_name = *argv;
+    else if (!strcmp(option, "-P"))
+      profile_name = *argv, gbl$profiling = TRUE;
+    else if (!strcmp(option, "-C"))
+      coverage_name = *argv, gbl$coverage.enabled = TRUE;
+    else if (!strcmp(option, "-y"))
+      symbols_load(*argv);
+    else if ((!strcmp(option, "-H") || !strcmp(option, "-V")) && hle_load(&gbl$hle, *argv) < 0) {
+      printf("Unable to open file >>%s<<\n", *argv);
+      return -1;
+    } else if (!strcmp(option, "-H") || !strcmp(option, "-V"))
+      set_hle_mode(strcmp(option, "-V") ? HLE_ON : HLE_STRICT);
+#ifdef USE_UART
+    else if (!strcmp(option, "-i") && !(input = fopen(*argv, "r"))) {
+      printf("Unable to open file >>%s<<\n", *argv);
+      return -1;
+    } else if (!strcmp(option, "-o") && !(output = fopen(*argv, "w"))) {
+      printf("Unable to create file >>%s<<\n", *argv);
+      return -1;
+    } else if (strcmp(option, "-i") && strcmp(option, "-o")) {
+#else
+    else {
+#endif
+      printf("Unknown option %s, see \"qnice -h\".\n", option);
+      return -1;
+    }
+  }
+
+  if (!files) {
+    printf("Expected at least one file or snapshot to run but none found.\n");
+    return -1;
+  }
+
+#ifdef USE_UART
+  uart_redirect(input, output);
+#endif
+  if (set_start)
+    write_register(PC, start);
+  run();
+  record_stop();
+
+  if (json_name && !(json = fopen(json_name, "w"))) {
+    printf("Unable to create file >>%s<<\n", json_name);
+    return -1;
+  }
+  print_result_json(json);
+  if (json != stdout)
+    fclose(json);
+  if (profile_name) {
+    if (!(json = fopen(profile_name, "w"))) {
+      printf("Unable to create file >>%s<<\n", profile_name);
+      return -1;
+    }
+    profile_report(json, PROFILE_REPORT_ENTRIES);
+    fclose(json);
+  }
+  if (coverage_name && coverage_save(&gbl$coverage, coverage_name)) {
+    printf("Unable to merge the coverage into >>%s<<\n", coverage_name);
+    return -1;
+  }
+  if (output)
+    fclose(output);
+
+  if (gbl$stop_reason == STOP_HALT && !exit_on_halt) {
+#ifdef USE_UART
+    uart_redirect(input, NULL);
+#endif
+    return main_loop(argv);
+  }
+  if (input)
+    fclose(input);
+  return gbl$stop_reason;
+}
+#endif
+
 #ifdef USE_VGA
 static int emulator_main_loop(void* param) {
     int retval = main_loop((char**) param);
@@ -1485,6 +4362,157 @@ static int emulator_main_loop(void* param) {
 }
 #endif
 
+#ifdef QNICE_LIBRARY
+/*
+**  Library API, see qnice_machine.h: Each function makes the given machine the current machine of the calling thread
+** and then uses the functions of the emulator.
+*/
+qnice_machine *qnice_create() {
+  if (!(gbl$m = calloc(1, sizeof(qnice_machine))))
+    return NULL;
+
+  initialize_machine();
+  reset_machine();
+  return gbl$m;
+}
+
+void qnice_destroy(qnice_machine *machine) {
+  if (gbl$m == machine)
+    gbl$m = NULL;
+  free(machine->hle_verification);
+  breakpoint_free(&machine->breakpoints);
+#ifdef USE_JIT
+  x86_64_destroy(&machine->jit.code);
+#endif
+#ifdef USE_SD
+  sd_detach(&machine->sd);
+#endif
+  free(machine);
+}
+
+void qnice_reset(qnice_machine *machine) {
+  gbl$m = machine;
+  reset_machine();
+}
+
+int qnice_load(qnice_machine *machine, const char *file_name) {
+  gbl$m = machine;
+  return load_binary_file((char *) file_name);
+}
+
+int qnice_run(qnice_machine *machine, unsigned long long instructions) {
+  gbl$m = machine;
+  gbl$instruction_budget = instructions;
+#ifdef USE_UART
+  uart_redirect(machine->uart_input, machine->uart_output);
+#endif
+  run();
+  return gbl$stop_reason;
+}
+
+const char *qnice_stop_reason_name(int reason) {
+  return reason >= 0 && reason < sizeof(gbl$stop_reasons) / sizeof(*gbl$stop_reasons) ? gbl$stop_reasons[reason]
+                                                                                       : "unknown";
+}
+
+unsigned long long qnice_instructions(qnice_machine *machine) {
+  return machine->instructions;
+}
+
+unsigned long long qnice_cycles(qnice_machine *machine) {
+  return machine->cycles;
+}
+
+unsigned int qnice_read_memory(qnice_machine *machine, unsigned int address) {
+  gbl$m = machine;
+  return access_memory(address, READ_MEMORY, 0);
+}
+
+void qnice_write_memory(qnice_machine *machine, unsigned int address, unsigned int value) {
+  gbl$m = machine;
+  access_memory(address, WRITE_MEMORY, value);
+}
+
+unsigned int qnice_read_register(qnice_machine *machine, unsigned int number) {
+  gbl$m = machine;
+  return read_register(number & 0xf);
+}
+
+void qnice_write_register(qnice_machine *machine, unsigned int number, unsigned int value) {
+  gbl$m = machine;
+  write_register(number & 0xf, value);
+}
+
+void qnice_uart_redirect(qnice_machine *machine, FILE *input, FILE *output) {
+#ifdef USE_UART
+  machine->uart_input = input;
+  machine->uart_output = output;
+#endif
+}
+
+int qnice_sd_attach(qnice_machine *machine, const char *file_name, int overlay) {
+#ifdef USE_SD
+  return sd_attach(&machine->sd, (char *) file_name, overlay ? SD_OVERLAY : SD_READ_WRITE) < 0 ? -1 : 0;
+#else
+  return -1;
+#endif
+}
+
+void qnice_sd_detach(qnice_machine *machine) {
+#ifdef USE_SD
+  sd_detach(&machine->sd);
+#endif
+}
+
+void qnice_set_messages(qnice_machine *machine, FILE *messages) {
+  machine->messages = messages;
+}
+
+void qnice_set_breakpoint(qnice_machine *machine, int address) {
+  gbl$m = machine;
+  breakpoint_delete(&gbl$breakpoints, 0);
+  if (address >= 0)
+    qnice_add_breakpoint(machine, QNICE_BREAK_EXECUTE, address, address, NULL);
+  invalidate_all_blocks();
+}
+
+int qnice_add_breakpoint(qnice_machine *machine, unsigned int kinds, unsigned int first, unsigned int last,
+                         const char *condition) {
+  char error[STRING_LENGTH];
+  int number;
+
+  gbl$m = machine;
+  if ((number = breakpoint_add(&gbl$breakpoints, kinds, first, last, condition, error, sizeof(error))) < 0)
+    MESSAGE("Illegal condition: %s\n", error);
+  else if (kinds & QNICE_BREAK_EXECUTE)
+    invalidate_all_blocks();
+  return number;
+}
+
+int qnice_delete_breakpoint(qnice_machine *machine, unsigned int number) {
+  gbl$m = machine;
+  if (!breakpoint_delete(&gbl$breakpoints, number))
+    return -1;
+  invalidate_all_blocks();
+  return 0;
+}
+
+void qnice_set_coverage(qnice_machine *machine, int enabled) {
+  machine->coverage.enabled = enabled;
+}
+
+int qnice_save_coverage(qnice_machine *machine, const char *file_name) {
+  return coverage_save(&machine->coverage, file_name);
+}
+
+int qnice_set_hle(qnice_machine *machine, int mode, const char *labels) {
+  gbl$m = machine;
+  if (labels && hle_load(&gbl$hle, labels) < 0)
+    return -1;
+  set_hle_mode(mode);
+  return gbl$hle.routines;
+}
+#else
 int main(int argc, char **argv) {
   /* CTRL+C can be used in the terminal window to stop a running program
      (e.g. the Monitor) and to return back to the Q> shell.
@@ -1511,34 +4539,54 @@ int main(int argc, char **argv) {
 # endif
 #endif
   
+  initialize_machine();
+  register_machine_state();
   reset_machine();
+  profile_reset();
 
 #ifdef USE_IDE
   initializeIDEDevice();
 #endif
 
-#ifdef USE_TIMER
-  initializeTimerModule(&gbl$interrupt_request, &gbl$interrupt_address);
-#endif
-
   if (*++argv) { /* At least one argument */
     if (!strcmp(*argv, "-h")) {
       printf("\nUsage:\n\
         \"qnice\" without arguments will start an interactive session\n\
         \"qnice -h\" will print this help text\n\
         \"qnice -a <disk_image>\" will attach an SD-card image file\n\
+        \"qnice -A <disk_image>\" will attach it with an overlay, so that writes do not change the file\n\
         \"qnice -a <disk_image> <file.bin> \" attaches an images and runs a file\n\
-        \"qnice <file.bin>\" will run in batch mode and print statistics\n\n");
+        \"qnice <file.bin>\" will run in batch mode and print statistics\n\
+        \"qnice -b [<options>] <file> ...\" loads the files and runs headless, the result is written as JSON:\n\
+            -C <file>     record the code coverage and merge it into the coverage <file> (switches -H off)\n\
+            -n <count>    stop after <count> instructions\n\
+            -T <file>     record an execution trace of the run into <file>\n\
+            -t <seconds>  stop after <seconds> of wall clock time\n\
+            -i <file>     read the UART input from <file> instead of STDIN\n\
+            -o <file>     write the UART output to <file> instead of STDOUT\n\
+            -j <file>     write the JSON result to <file> instead of STDOUT\n\
+            -H <file>     execute monitor routines natively, their addresses are read from the monitor.lis <file>\n\
+            -I            execute loops polling for input instead of skipping them (see IDLE)\n\
+            -P <file>     profile the run and write the report to <file>\n\
+            -p <address>  start address (default 0 resp. the PC of the snapshot)\n\
+            -R <file>     replay a trace recorded by RECORD <file> resp. -T <file>\n\
+            -r <file>     restore a snapshot taken by SNAPSHOT <file>\n\
+            -s            gather statistics\n\
+            -V <file>     like -H, but verify each call against the interpreted routine\n\
+            -x            exit after a HALT instruction instead of entering the Q> shell\n\
+            -y <file>     load labels for the profile report from a .def or .lis file\n\n");
       return 0;
     }
 #ifdef USE_SD
-    else if (!strcmp(*argv, "-a")) { /* We will try to attach an SD-disk image... */
+    else if (!strcmp(*argv, "-a") || !strcmp(*argv, "-A")) { /* We will try to attach an SD-disk image... */
+      int mode = strcmp(*argv, "-A") ? SD_READ_WRITE : SD_OVERLAY;
+
       if (!*++argv) { /* No more arguments! */
-        printf("Expected a filename after -a but none found.\n");
+        printf("Expected a filename after -a resp. -A but none found.\n");
         return -1;
       }
 
-      sd_attach(*argv++);
+      attach_sd_image(*argv++, mode);
     }
 #endif
   }
@@ -1547,6 +4595,8 @@ int main(int argc, char **argv) {
    Standard environment emulating an UART on a POSIX terminal
    ----------------------------------------------------------------------------------------- */
 #ifndef USE_VGA
+  if (*argv && !strcmp(*argv, "-b"))
+    return headless_main(++argv);
   return main_loop(argv);
 #else
 
@@ -1566,12 +4616,12 @@ int main(int argc, char **argv) {
   emscripten_run_script("Module.setStatus('Please wait: Downloading 32MB SD card disk image...');");    
   emscripten_wget("https://sy2002x.de/hwdp/qnice_disk_v16.img", "qnice_disk_v16.img");
   emscripten_run_script("statusElement.style.display = 'none';");
-  sd_attach("qnice_disk_v16.img");
+  attach_sd_image("qnice_disk_v16.img", SD_READ_WRITE);
 
   vga_init();
   while (1) {
-    for (unsigned long i = 0; i < gbl$instructions_per_iteration; i++)
-      execute();
+    for (unsigned long i = 0, instructions; i < gbl$instructions_per_iteration; i += instructions)
+      execute_block(&instructions, NO_HOOKS);
 
     emscripten_sleep(0); //cooperative multitasking, otherwise the browser kills the emulator
     vga_one_iteration_keyboard();
@@ -1615,3 +4665,4 @@ int main(int argc, char **argv) {
 # endif
 #endif
 }
+#endif
@@ -0,0 +1,123 @@
+/*
+**  Header file of the QNICE emulator library: libqnice (see make-lib.bash) contains the CPU core with the EAE, the
+** cycle and instruction counters, the timers, the UART and the SD card, but not the VGA and IDE emulations. Each
+** machine created by qnice_create() is completely independent of all others (including its SD card), so many
+** machines can run in one process.
+**
+**  Every function is given the machine it works on. A machine must not be used by two threads at the same time, but
+** different machines can run concurrently on different threads and a machine may move from one thread to another
+** between two calls, so the machines can be run by a thread pool.
+**
+**  The UART reads from and writes to the files given by qnice_uart_redirect(), without input files the receiver is
+** always empty and without output file the output is discarded. The terminal of the process is never used.
+*/
+
+#ifndef QNICE_MACHINE_H
+#define QNICE_MACHINE_H
+
+#include <stdio.h>
+
+#if defined(QNICE_LIBRARY) && defined(__GNUC__)
+# define QNICE_API __attribute__((visibility("default")))
+#else
+# define QNICE_API
+#endif
+
+/* Reasons for the end of qnice_run(), the same as in the JSON result of the headless mode */
+#define QNICE_STOP_HALT        0
+#define QNICE_STOP_BREAKPOINT  1
+#define QNICE_STOP_ILLEGAL     2 /* Reserved instruction, rogue RTI or INT */
+#define QNICE_STOP_ERROR       3
+#define QNICE_STOP_BUDGET      4 /* The given number of instructions has been executed */
+#define QNICE_STOP_TIMEOUT     5
+#define QNICE_STOP_CTRL_C      6
+#define QNICE_STOP_WATCHPOINT  7 /* A watchpoint (read or write access) triggered */
+#define QNICE_STOP_TRACE_END   8 /* A replayed trace (see recorder.h) has been reproduced completely */
+
+/* Kinds of breakpoints for qnice_add_breakpoint(), can be combined */
+#define QNICE_BREAK_EXECUTE    1
+#define QNICE_BREAK_READ       2
+#define QNICE_BREAK_WRITE      4
+
+/* Modes of the high-level emulation of monitor routines, see qnice_set_hle() */
+#define QNICE_HLE_OFF          0
+#define QNICE_HLE_ON           1
+#define QNICE_HLE_STRICT       2 /* Each call is verified against the interpreted routine */
+
+typedef struct qnice_machine qnice_machine;
+
+/* Create a machine which has just been reset resp. NULL if there is not enough memory. */
+QNICE_API qnice_machine *qnice_create();
+QNICE_API void qnice_destroy(qnice_machine *);
+
+/* Reset the processor state, the registers and the memory. */
+QNICE_API void qnice_reset(qnice_machine *);
+
+/* Load a .out file or a binary image (see qbin.h) into the memory, 0 on success. */
+QNICE_API int qnice_load(qnice_machine *, const char *file_name);
+
+/*
+**  Run the machine starting at the current PC until it executes HALT or another stop condition occurs, but at most
+** the given number of instructions (0 means unlimited). Returns one of the QNICE_STOP_* reasons.
+*/
+QNICE_API int qnice_run(qnice_machine *, unsigned long long instructions);
+QNICE_API const char *qnice_stop_reason_name(int reason);
+
+/* Number of instructions resp. clock cycles the machine has executed since it has been created. */
+QNICE_API unsigned long long qnice_instructions(qnice_machine *);
+QNICE_API unsigned long long qnice_cycles(qnice_machine *);
+
+/* Access the memory, addresses in the IO area (0xFF00..0xFFFF) access the devices like the CPU would do. */
+QNICE_API unsigned int qnice_read_memory(qnice_machine *, unsigned int address);
+QNICE_API void qnice_write_memory(qnice_machine *, unsigned int address, unsigned int value);
+
+/* Access the registers R0..R15 of the current register bank, R14 is SR and R15 is PC. */
+QNICE_API unsigned int qnice_read_register(qnice_machine *, unsigned int number);
+QNICE_API void qnice_write_register(qnice_machine *, unsigned int number, unsigned int value);
+
+/* Files used by the UART from the next qnice_run() on, NULL disables the input resp. discards the output. */
+QNICE_API void qnice_uart_redirect(qnice_machine *, FILE *input, FILE *output);
+
+/*
+**  Attach an SD-card image (e.g. a FAT32 file system) to the machine, replacing the image attached before. With
+** overlay set, writes only go to a copy-on-write overlay of the machine which is dropped on detach, so many machines
+** can share one image. A read only image is always attached with an overlay. Returns 0 on success, -1 if the image
+** cannot be opened. qnice_destroy() detaches the image, too.
+*/
+QNICE_API int qnice_sd_attach(qnice_machine *, const char *file_name, int overlay);
+QNICE_API void qnice_sd_detach(qnice_machine *);
+
+/* File for the messages of the core (HALT, breakpoint reached, EAE errors etc.), NULL discards them (default). */
+QNICE_API void qnice_set_messages(qnice_machine *, FILE *messages);
+
+/*
+**  Stop qnice_run() with QNICE_STOP_BREAKPOINT before the instruction at the address is executed. Replaces all
+** breakpoints and watchpoints, -1 clears them.
+*/
+QNICE_API void qnice_set_breakpoint(qnice_machine *, int address);
+
+/*
+**  Add a breakpoint (QNICE_BREAK_EXECUTE) resp. watchpoint (QNICE_BREAK_READ, QNICE_BREAK_WRITE) for the addresses
+** first..last which only triggers if the condition (see breakpoints.h, may be NULL) holds. A watchpoint stops
+** qnice_run() with QNICE_STOP_WATCHPOINT after the instruction accessing the address. Returns the number of the
+** breakpoint for qnice_delete_breakpoint() (0 deletes all) resp. -1 if the condition is invalid.
+*/
+QNICE_API int qnice_add_breakpoint(qnice_machine *, unsigned int kinds, unsigned int first, unsigned int last,
+                                   const char *condition);
+QNICE_API int qnice_delete_breakpoint(qnice_machine *, unsigned int number);
+
+/*
+**  Record the executed instructions and the outcomes of conditional branches (see coverage.h). qnice_save_coverage()
+** merges them into a coverage file for qnice-coverage, it returns 0 on success. The HLE (see qnice_set_hle()) is
+** switched off while the coverage is recorded, so the routines of the monitor are interpreted and recorded, too.
+*/
+QNICE_API void qnice_set_coverage(qnice_machine *, int enabled);
+QNICE_API int qnice_save_coverage(qnice_machine *, const char *file_name);
+
+/*
+**  Execute the routines of the monitor known to the HLE natively (see hle.h), their addresses are read from labels
+** (the monitor.lis) unless it is NULL. Returns the number of routines known resp. -1 if labels cannot be read.
+*/
+QNICE_API int qnice_set_hle(qnice_machine *, int mode, const char *labels);
+
+#endif
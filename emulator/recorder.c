@@ -0,0 +1,410 @@
+/*
+**  Execution traces of the QNICE-emulator, see recorder.h.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "recorder.h"
+
+#ifndef TRUE
+# define TRUE 1
+# define FALSE 0
+#endif
+
+/* The writer thread: Moves the records from the ring buffer to the file until recorder_close() stops it */
+static void *recorder_writer(void *context) {
+  recorder_module *module = context;
+  unsigned char chunk[RECORDER_BUFFER_SIZE];
+  unsigned int count, stop;
+
+  do {
+    stop = atomic_load(&module->stop); /* Everything pushed before the stop is written below */
+    fifo_wait(module->ring, RECORDER_WAIT_NS);
+    while ((count = fifo_pull_bulk(module->ring, chunk, sizeof(chunk))))
+      fwrite(chunk, 1, count, module->handle);
+  } while (!stop);
+  return NULL;
+}
+
+/* Hand the buffer over to the ring buffer, waits for the writer thread if the ring buffer is full */
+static void recorder_flush(recorder_module *module) {
+  struct timespec pause = {0, 100000};
+  unsigned int pushed = 0;
+
+  while ((pushed += fifo_push_bulk(module->ring, module->buffer + pushed, module->used - pushed)) < module->used)
+    nanosleep(&pause, NULL);
+  module->used = 0;
+}
+
+static unsigned char *recorder_reserve(recorder_module *module) {
+  if (module->used + RECORD_MAX_LENGTH > RECORDER_BUFFER_SIZE)
+    recorder_flush(module);
+  return module->buffer + module->used;
+}
+
+static unsigned char *put_varint(unsigned char *p, unsigned long long value) {
+  for (; value >= 0x80; value >>= 7)
+    *p++ = (value & 0x7f) | 0x80;
+  *p++ = value;
+  return p;
+}
+
+static unsigned char *put_word(unsigned char *p, unsigned int value) {
+  *p++ = value & 0xff;
+  *p++ = (value >> 8) & 0xff;
+  return p;
+}
+
+/* The difference to the last address of the kind of access, zigzag encoded */
+static unsigned char *put_address(recorder_module *module, unsigned char *p, unsigned int input, unsigned int address) {
+  int delta = (short) (address - module->address[input]);
+
+  module->address[input] = address;
+  return put_varint(p, delta < 0 ? -2 * delta - 1 : 2 * delta);
+}
+
+/* Start a record with a tag and the cycles since the last record having a cycle count */
+static unsigned char *put_tag(recorder_module *module, unsigned int type, unsigned long long cycles) {
+  unsigned char *p = recorder_reserve(module);
+
+  *p++ = RECORD_TAG_JUMP + type;
+  p = put_varint(p, cycles - module->cycles);
+  module->cycles = cycles;
+  module->events[type]++;
+  return p;
+}
+
+static void put_end(recorder_module *module, unsigned char *p) {
+  module->used = p - module->buffer;
+}
+
+static int write_header(FILE *handle, record_header *header) {
+  return fwrite(RECORD_MAGIC, 1, RECORD_MAGIC_LENGTH, handle) == RECORD_MAGIC_LENGTH
+         && fwrite(&header->version, sizeof(header->version), 1, handle) == 1
+         && fwrite(&header->snapshot_size, sizeof(header->snapshot_size), 1, handle) == 1
+         && fwrite(&header->instructions, sizeof(header->instructions), 1, handle) == 1
+         && fwrite(&header->cycles, sizeof(header->cycles), 1, handle) == 1 ? 0 : -1;
+}
+
+static int read_header(FILE *handle, record_header *header) {
+  char magic[RECORD_MAGIC_LENGTH];
+
+  return fread(magic, 1, RECORD_MAGIC_LENGTH, handle) == RECORD_MAGIC_LENGTH
+         && !memcmp(magic, RECORD_MAGIC, RECORD_MAGIC_LENGTH)
+         && fread(&header->version, sizeof(header->version), 1, handle) == 1 && header->version == RECORD_VERSION
+         && fread(&header->snapshot_size, sizeof(header->snapshot_size), 1, handle) == 1
+         && fread(&header->instructions, sizeof(header->instructions), 1, handle) == 1
+         && fread(&header->cycles, sizeof(header->cycles), 1, handle) == 1 ? 0 : -1;
+}
+
+int recorder_create(recorder_module *module, const char *file_name) {
+  FILE *handle;
+
+  if (!(handle = fopen(file_name, "wb")))
+    return -1;
+
+  memset(module, 0, sizeof(recorder_module));
+  module->handle = handle;
+  module->mode = RECORDER_RECORDING;
+  strncpy(module->file_name, file_name, sizeof(module->file_name) - 1);
+  return 0;
+}
+
+int recorder_begin(recorder_module *module, snapshot *start, unsigned long long instructions,
+                   unsigned long long cycles) {
+  long position;
+
+  module->header.version = RECORD_VERSION;
+  module->header.instructions = instructions;
+  module->header.cycles = module->cycles = cycles;
+  if (write_header(module->handle, &module->header) || (position = ftell(module->handle)) < 0
+      || snapshot_write(start, module->handle))
+    return -1;
+
+  /* Patch the length of the snapshot into the header */
+  module->header.snapshot_size = ftell(module->handle) - position;
+  if (fseek(module->handle, 0, SEEK_SET) || write_header(module->handle, &module->header)
+      || fseek(module->handle, 0, SEEK_END))
+    return -1;
+
+  if (!(module->ring = fifo_init(RECORDER_RING_SIZE, 1)))
+    return -1;
+  atomic_init(&module->stop, FALSE);
+  if (pthread_create(&module->writer, NULL, recorder_writer, module)) {
+    fifo_free(module->ring);
+    module->ring = NULL;
+    return -1;
+  }
+  module->started = TRUE;
+  return 0;
+}
+
+void recorder_instruction(recorder_module *module, unsigned int address) {
+  unsigned char *p = recorder_reserve(module);
+  unsigned int delta = (address - module->pc + RECORD_DELTA_BIAS) & 0xffff;
+
+  if (delta < RECORD_TAG_JUMP)
+    *p++ = delta;
+  else {
+    *p++ = RECORD_TAG_JUMP;
+    p = put_word(p, address);
+  }
+  put_end(module, p);
+  module->pc = address;
+  module->instructions++;
+  module->events[RECORD_INSTRUCTION]++;
+}
+
+void recorder_write(recorder_module *module, unsigned long long cycles, unsigned int address, unsigned int value) {
+  unsigned char *p = put_tag(module, RECORD_WRITE, cycles);
+
+  p = put_address(module, p, FALSE, address);
+  put_end(module, put_word(p, value));
+}
+
+void recorder_input(recorder_module *module, unsigned long long cycles, unsigned int address, unsigned int value) {
+  unsigned char *p = put_tag(module, RECORD_INPUT, cycles);
+
+  p = put_address(module, p, TRUE, address);
+  put_end(module, put_word(p, value));
+}
+
+void recorder_interrupt(recorder_module *module, unsigned long long cycles, unsigned int address) {
+  put_end(module, put_word(put_tag(module, RECORD_INTERRUPT, cycles), address));
+}
+
+void recorder_skip(recorder_module *module, unsigned long long cycles, unsigned long long instructions,
+                   unsigned long long skipped_cycles) {
+  unsigned char *p = put_tag(module, RECORD_SKIP, cycles);
+
+  p = put_varint(p, instructions);
+  put_end(module, put_varint(p, skipped_cycles));
+  module->cycles += skipped_cycles;
+  module->instructions += instructions;
+}
+
+int recorder_open(recorder_module *module, const char *file_name, snapshot **start) {
+  FILE *handle;
+  long position, end;
+  unsigned char *trailer;
+
+  if (!(handle = fopen(file_name, "rb")))
+    return -1;
+
+  memset(module, 0, sizeof(recorder_module));
+  strncpy(module->file_name, file_name, sizeof(module->file_name) - 1);
+  if (start)
+    *start = NULL;
+  if (read_header(handle, &module->header))
+    goto failed;
+  if (start) {
+    if (!(*start = snapshot_read(handle, file_name)))
+      goto failed;
+  } else if (fseek(handle, module->header.snapshot_size, SEEK_CUR))
+    goto failed;
+
+  if ((position = ftell(handle)) < 0 || fseek(handle, 0, SEEK_END) || (end = ftell(handle)) < position
+      || fseek(handle, position, SEEK_SET))
+    goto failed;
+  module->size = end - position;
+  if (!(module->data = malloc(module->size + 1)) || fread(module->data, 1, module->size, handle) != module->size)
+    goto failed;
+  fclose(handle);
+
+  /* The trailer can only be recognized from the end since its numbers may contain any byte */
+  if (module->size >= RECORD_TRAILER_LENGTH
+      && *(trailer = module->data + module->size - RECORD_TRAILER_LENGTH) == RECORD_TAG_END) {
+    memcpy(&module->trailer.instructions, trailer + 1, sizeof(module->trailer.instructions));
+    memcpy(&module->trailer.cycles, trailer + 9, sizeof(module->trailer.cycles));
+    module->size -= RECORD_TRAILER_LENGTH;
+    module->complete = TRUE;
+  }
+
+  module->cycles = module->header.cycles;
+  module->mode = RECORDER_REPLAYING;
+  return 0;
+
+failed:
+  if (start && *start) {
+    snapshot_free(*start);
+    *start = NULL;
+  }
+  free(module->data);
+  module->data = NULL;
+  fclose(handle);
+  return -1;
+}
+
+static int get_varint(recorder_module *module, unsigned long long *value) {
+  unsigned int shift = 0, byte;
+
+  *value = 0;
+  do {
+    if (module->position >= module->size || shift > 63)
+      return FALSE;
+    byte = module->data[module->position++];
+    *value |= (unsigned long long) (byte & 0x7f) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  return TRUE;
+}
+
+static int get_word(recorder_module *module, unsigned int *value) {
+  if (module->position + 2 > module->size)
+    return FALSE;
+  *value = module->data[module->position] | module->data[module->position + 1] << 8;
+  module->position += 2;
+  return TRUE;
+}
+
+static int get_address(recorder_module *module, unsigned int input, unsigned int *address) {
+  unsigned long long value;
+
+  if (!get_varint(module, &value))
+    return FALSE;
+  *address = module->address[input] = (module->address[input] + (value & 1 ? -(value >> 1) - 1 : value >> 1)) & 0xffff;
+  return TRUE;
+}
+
+int recorder_read(recorder_module *module, record_event *event) {
+  unsigned long long cycles;
+  unsigned int tag;
+  size_t position = module->position;
+
+  memset(event, 0, sizeof(record_event));
+  event->instruction = module->instructions;
+  event->cycles = module->cycles;
+  if (module->position >= module->size)
+    goto end;
+
+  if ((tag = module->data[module->position++]) <= RECORD_TAG_JUMP) {
+    event->type = RECORD_INSTRUCTION;
+    if (tag < RECORD_TAG_JUMP)
+      event->address = (module->pc + tag - RECORD_DELTA_BIAS) & 0xffff;
+    else if (!get_word(module, &event->address))
+      goto end;
+    module->pc = event->address;
+    module->instructions++;
+  } else {
+    if (tag > RECORD_TAG_SKIP || !get_varint(module, &cycles))
+      goto end;
+    event->type = tag - RECORD_TAG_JUMP;
+    event->cycles = module->cycles += cycles;
+    event->instruction = module->instructions ? module->instructions - 1 : 0; /* Caused by the last instruction */
+    switch (tag) {
+      case RECORD_TAG_WRITE:
+      case RECORD_TAG_INPUT:
+        if (!get_address(module, tag == RECORD_TAG_INPUT, &event->address) || !get_word(module, &event->value))
+          goto end;
+        break;
+      case RECORD_TAG_INTERRUPT:
+        if (!get_word(module, &event->address))
+          goto end;
+        break;
+      default:
+        if (!get_varint(module, &event->instructions) || !get_varint(module, &event->skipped_cycles))
+          goto end;
+        event->instruction = module->instructions;
+        module->instructions += event->instructions;
+        module->cycles += event->skipped_cycles;
+    }
+  }
+  module->events[event->type]++;
+  return TRUE;
+
+end: /* A truncated record ends the trace as well */
+  module->position = position;
+  event->type = RECORD_END;
+  event->instructions = module->complete ? module->trailer.instructions : module->instructions;
+  event->skipped_cycles = module->complete ? module->trailer.cycles : module->cycles - module->header.cycles;
+  return FALSE;
+}
+
+int recorder_peek(recorder_module *module, record_event *event) {
+  size_t position = module->position;
+  unsigned int pc = module->pc, write = module->address[FALSE], input = module->address[TRUE];
+  unsigned long long cycles = module->cycles, instructions = module->instructions;
+  int result;
+
+  if ((result = recorder_read(module, event)))
+    module->events[event->type]--;
+  module->position = position;
+  module->pc = pc;
+  module->address[FALSE] = write;
+  module->address[TRUE] = input;
+  module->cycles = cycles;
+  module->instructions = instructions;
+  return result;
+}
+
+void recorder_describe(record_event *event, char *text, unsigned int size) {
+  switch (event->type) {
+    case RECORD_INSTRUCTION:
+      snprintf(text, size, "instruction %llu at %04X", event->instruction, event->address);
+      break;
+    case RECORD_WRITE:
+      snprintf(text, size, "write of %04X to %04X at cycle %llu", event->value, event->address, event->cycles);
+      break;
+    case RECORD_INPUT:
+      snprintf(text, size, "read of %04X from %04X at cycle %llu", event->value, event->address, event->cycles);
+      break;
+    case RECORD_INTERRUPT:
+      snprintf(text, size, "interrupt to %04X at cycle %llu", event->address, event->cycles);
+      break;
+    case RECORD_SKIP:
+      snprintf(text, size, "idle loop of %llu instructions skipped at cycle %llu", event->instructions, event->cycles);
+      break;
+    default:
+      snprintf(text, size, "end of the trace after %llu instructions", event->instructions);
+  }
+}
+
+int recorder_close(recorder_module *module, unsigned long long cycles) {
+  unsigned char trailer[RECORD_TRAILER_LENGTH];
+  int result = 0;
+
+  if (module->mode == RECORDER_RECORDING) {
+    if (module->started) {
+      cycles -= module->header.cycles;
+      trailer[0] = RECORD_TAG_END;
+      memcpy(trailer + 1, &module->instructions, sizeof(module->instructions));
+      memcpy(trailer + 9, &cycles, sizeof(cycles));
+      memcpy(recorder_reserve(module), trailer, sizeof(trailer));
+      module->used += sizeof(trailer);
+      recorder_flush(module);
+      atomic_store(&module->stop, TRUE);
+      pthread_join(module->writer, NULL);
+      fifo_free(module->ring);
+      module->ring = NULL;
+    }
+    if (ferror(module->handle) | fclose(module->handle))
+      result = -1;
+    module->handle = NULL;
+  }
+  free(module->data);
+  module->data = NULL;
+  module->mode = RECORDER_OFF;
+  module->armed = FALSE;
+  return result;
+}
+
+void recorder_status(recorder_module *module, FILE *handle) {
+  static const char *names[] = {"Instructions", "Writes", "IO reads", "Interrupts", "Idle loops skipped"};
+  unsigned int i;
+
+  if (module->mode == RECORDER_OFF) {
+    fprintf(handle, "\tNo trace is recorded or replayed\n");
+    return;
+  }
+
+  fprintf(handle, "\t%s %s\n", module->mode == RECORDER_RECORDING ? "Recording into" : "Replaying", module->file_name);
+  for (i = 0; i < RECORD_END; i++)
+    fprintf(handle, "\t%-20s %12llu\n", names[i], module->events[i]);
+  if (module->mode == RECORDER_RECORDING)
+    fprintf(handle, "\t%-20s %12llu\n", "Cycles", module->cycles - module->header.cycles);
+  else
+    fprintf(handle, "\t%-20s %12llu of %llu bytes\n", "Position", (unsigned long long) module->position,
+            (unsigned long long) module->size);
+}
@@ -0,0 +1,146 @@
+/*
+**  Header file for the execution traces of the QNICE-emulator: While recording, the core reports every executed
+** instruction, every write, every IO read, every interrupt taken and every skipped idle loop (see idle_fast_forward()
+** in qnice.c) to the recorder. The values of the IO reads are the only inputs of a run which do not follow from the
+** state of the machine (UART, keyboard, switches, SD card, ...), so a trace starting with a snapshot of the machine
+** contains everything needed to replay the run: While replaying, IO reads return the recorded values instead of
+** those of the devices and all other events are compared with the trace, so a replay either reproduces the recorded
+** run exactly or stops at the first difference.
+**
+**  The core appends the records to a buffer which is handed over to a ring buffer (see fifo.h) when it is full, a
+** background thread writes the ring buffer to the file, so the emulation does not wait for the file system.
+**
+**  A trace file consists of RECORD_MAGIC, the header below, a snapshot (see snapshot.h), the records and a trailer.
+** A record starts with a byte 0..0x7f for an instruction: its address minus the address of the last instruction
+** plus 64. All other records start with a RECORD_* tag followed by the number of clock cycles since the last record
+** having a cycle count (a varint: 7 bits per byte, least significant first, bit 7 set if more bytes follow) and their
+** operands. Addresses and values are 16 bit little endian, except for the address of a write resp. input which is
+** the difference to the address of the last write resp. input as a varint (zigzag encoded: 2 * d resp. -2 * d - 1):
+**
+**      RECORD_TAG_JUMP         address                 Instruction too far away from the last one for a delta
+**      RECORD_TAG_WRITE        cycles address value    Write to the memory resp. the IO area
+**      RECORD_TAG_INPUT        cycles address value    Value returned by the read of an IO register
+**      RECORD_TAG_INTERRUPT    cycles address          Interrupt taken, address of the service routine
+**      RECORD_TAG_SKIP         cycles instructions skipped_cycles (varints)   Idle loop skipped
+**
+**  The trailer consists of RECORD_TAG_END, the number of instructions and the number of clock cycles of the whole
+** trace as 64 bit numbers. It is written when the recording ends, a trace without it can still be replayed until
+** its last record.
+*/
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "fifo.h"
+#include "snapshot.h"
+
+#define RECORDER_OFF            0 /* Modes */
+#define RECORDER_RECORDING      1
+#define RECORDER_REPLAYING      2
+
+#define RECORD_INSTRUCTION      0 /* Types of the events returned by recorder_read() */
+#define RECORD_WRITE            1
+#define RECORD_INPUT            2
+#define RECORD_INTERRUPT        3
+#define RECORD_SKIP             4
+#define RECORD_END              5
+#define RECORD_TYPES            6
+
+#define RECORD_TAG_JUMP         0x80
+#define RECORD_TAG_WRITE        0x81
+#define RECORD_TAG_INPUT        0x82
+#define RECORD_TAG_INTERRUPT    0x83
+#define RECORD_TAG_SKIP         0x84
+#define RECORD_TAG_END          0x85
+
+#define RECORD_MAGIC            "QNICETRC"
+#define RECORD_MAGIC_LENGTH     8
+#define RECORD_VERSION          1
+#define RECORD_DELTA_BIAS       64
+#define RECORD_MAX_LENGTH       32        /* Longest record */
+#define RECORD_TRAILER_LENGTH   17
+
+#define RECORDER_BUFFER_SIZE    4096      /* Records collected before they are handed over to the ring buffer */
+#define RECORDER_RING_SIZE      (1 << 22)
+#define RECORDER_WAIT_NS        10000000  /* Longest sleep of the writer thread */
+
+typedef struct record_header {
+  unsigned int version;
+  unsigned long long snapshot_size,         /* Length of the snapshot following the header */
+    instructions, cycles;                   /* Counters of the machine at the start of the trace */
+} record_header;
+
+typedef struct record_event {
+  unsigned int type,
+    address,                                /* Instruction, write, input resp. service routine */
+    value;                                  /* Written resp. read */
+  unsigned long long cycles,                /* Cycle counter of the machine at the event (not for instructions) */
+    instruction,                            /* Number of the instruction (counting from 0) the event belongs to */
+    instructions, skipped_cycles;           /* Skipped by RECORD_SKIP resp. total of the trace for RECORD_END */
+} record_event;
+
+typedef struct recorder_module {
+  unsigned int mode,
+    armed;                                  /* The core reports events only while set (during RUN and STEP) */
+  char file_name[256];
+  record_header header;
+  unsigned int pc,                          /* Address of the last instruction, the base of the deltas */
+    address[2];                             /* Address of the last write resp. input */
+  unsigned long long cycles,                /* Cycle counter of the last record having one */
+    instructions,                           /* Instructions recorded resp. replayed (including skipped ones) */
+    events[RECORD_TYPES];
+  /* Recording */
+  FILE *handle;
+  fifo_t *ring;
+  pthread_t writer;
+  atomic_uint stop;
+  unsigned int started,                     /* TRUE once the header and the snapshot have been written */
+    used;
+  unsigned char buffer[RECORDER_BUFFER_SIZE];
+  /* Replaying */
+  unsigned char *data;                      /* The records of the trace */
+  size_t size, position;
+  unsigned int complete;                    /* TRUE if the trace has a trailer, see header.instructions */
+  record_header trailer;                    /* Instructions and cycles of the whole trace */
+} recorder_module;
+
+/*
+**  Start recording into a file. The header and the snapshot of the machine are written by recorder_begin(), i.e.
+** when the first run of the recording starts. Returns -1 if the file cannot be created.
+*/
+int recorder_create(recorder_module *, const char *file_name);
+int recorder_begin(recorder_module *, snapshot *start, unsigned long long instructions, unsigned long long cycles);
+
+void recorder_instruction(recorder_module *, unsigned int address);
+void recorder_write(recorder_module *, unsigned long long cycles, unsigned int address, unsigned int value);
+void recorder_input(recorder_module *, unsigned long long cycles, unsigned int address, unsigned int value);
+void recorder_interrupt(recorder_module *, unsigned long long cycles, unsigned int address);
+void recorder_skip(recorder_module *, unsigned long long cycles, unsigned long long instructions,
+                   unsigned long long skipped_cycles);
+
+/*
+**  Open a trace for replaying resp. querying it. If start is not NULL, the snapshot is read into *start (it has to
+** match the emulator), otherwise it is skipped. Returns -1 if the file cannot be read or is no trace.
+*/
+int recorder_open(recorder_module *, const char *file_name, snapshot **start);
+
+/* Decode the next record, returns FALSE (and an event of the type RECORD_END) at the end of the trace */
+int recorder_read(recorder_module *, record_event *);
+int recorder_peek(recorder_module *, record_event *);
+
+/* Describe an event for messages, e.g. "write of 0041 to FF21 at cycle 1234" */
+void recorder_describe(record_event *, char *text, unsigned int size);
+
+/*
+**  End recording (writing the trailer with the cycle counter of the machine at the end and waiting for the writer
+** thread) resp. replaying. Returns -1 if the trace could not be written completely.
+*/
+int recorder_close(recorder_module *, unsigned long long cycles);
+
+void recorder_status(recorder_module *, FILE *handle);
+
+#endif
@@ -0,0 +1,349 @@
+/*
+**  Regression runner, built on the emulator library (see qnice_machine.h and run-regression.bash).
+**
+**  Every test of the manifest is run in a fresh machine: The monitor is loaded, then the program, and the machine
+** is started at the monitor's cold start address 0x0000. The UART receives the monitor command to start the program
+** followed by the contents of <name>.in (if present), then the machine runs until it reaches the stop address, a HALT
+** or the end of its instruction budget. The result - the reason of the stop, the counters, the registers, hashes of
+** the memory, the messages of the core and the UART output - is compared against the golden file <name>.golden.
+** Golden files and inputs are located in the directory of the manifest.
+**
+**  The tests are run in parallel by a pool of threads (one per core unless -j is given). The result of each test is
+** printed together with the time it took as soon as it is finished. With -S the monitor routines known to the HLE
+** are verified on each call (strict mode, see hle.h), so the results have to be the same as without HLE. With
+** -c <file> the code coverage of all tests is merged into the coverage file (see coverage.h and qnice-coverage).
+**
+**  Each line of the manifest describes one test, empty lines and everything after a # are ignored:
+**
+**      <name> <program> <start> <stop> <budget>
+**
+** <program> is the .out file to load, <start> the address the monitor starts via C/R and <stop> the address ending
+** the test (both hex, - for none: without start address the program has to be loaded to 0x0000 replacing the
+** monitor's entry point). <budget> is the maximum number of instructions.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "qnice_machine.h"
+
+#define MAX_TESTS         1024
+#define MAX_NAME_LENGTH   64
+#define MAX_PATH_LENGTH   512
+#define MEMORY_HASH_PAGES 16        /* One hash per 4 kW page, so a mismatch tells roughly where it is */
+#define MEMORY_END        0xff00    /* The IO area is not part of the state compared */
+
+typedef struct regression_test {
+  char name[MAX_NAME_LENGTH], program[MAX_PATH_LENGTH];
+  int start, stop;
+  unsigned long long budget;
+  char *result;                     /* Textual result of the run, compared with the golden file */
+  size_t result_size;
+  int status;
+  double milliseconds;
+  unsigned long long instructions;
+} regression_test;
+
+enum {PASSED, FAILED, NEW, UPDATED, SKIPPED, ERROR};
+static const char *gbl$status_names[] = {"PASS", "FAIL", "NEW", "UPDATED", "SKIP", "ERROR"};
+
+static regression_test gbl$tests[MAX_TESTS];
+static int gbl$number_of_tests, gbl$next_test, gbl$update, gbl$strict_hle;
+static char gbl$directory[MAX_PATH_LENGTH], gbl$labels[MAX_PATH_LENGTH], *gbl$monitor = "monitor/monitor.out",
+  *gbl$coverage;
+static pthread_mutex_t gbl$mutex = PTHREAD_MUTEX_INITIALIZER;
+
+double now_ms() {
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000.0 + t.tv_nsec / 1000000.0;
+}
+
+/* Read a whole file into a zero terminated buffer, returns NULL if it does not exist. */
+char *read_file(char *file_name, size_t *size) {
+  FILE *handle;
+  char *buffer;
+  long length;
+
+  if (!(handle = fopen(file_name, "rb")))
+    return NULL;
+
+  fseek(handle, 0, SEEK_END);
+  length = ftell(handle);
+  rewind(handle);
+  if (!(buffer = malloc(length + 1)) || fread(buffer, 1, length, handle) != (size_t) length) {
+    free(buffer);
+    fclose(handle);
+    return NULL;
+  }
+
+  fclose(handle);
+  buffer[length] = 0;
+  if (size)
+    *size = length;
+  return buffer;
+}
+
+int parse_address(char *token) {
+  return strcmp(token, "-") ? (int) strtol(token, NULL, 16) & 0xffff : -1;
+}
+
+int read_manifest(char *file_name) {
+  FILE *handle;
+  char line[2 * MAX_PATH_LENGTH], start[16], stop[16], *p;
+  int line_number = 0;
+  regression_test *test;
+
+  if (!(handle = fopen(file_name, "r"))) {
+    perror(file_name);
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), handle)) {
+    line_number++;
+    if ((p = strchr(line, '#')))
+      *p = 0;
+    for (p = line; *p == ' ' || *p == '\t'; p++);
+    if (!*p || *p == '\n' || *p == '\r')
+      continue;
+
+    if (gbl$number_of_tests == MAX_TESTS) {
+      fprintf(stderr, "%s: More than %d tests!\n", file_name, MAX_TESTS);
+      fclose(handle);
+      return -1;
+    }
+
+    test = &gbl$tests[gbl$number_of_tests];
+    if (sscanf(p, "%63s %511s %15s %15s %llu", test->name, test->program, start, stop, &test->budget) != 5) {
+      fprintf(stderr, "%s, line %d: Expected <name> <program> <start> <stop> <budget>\n", file_name, line_number);
+      fclose(handle);
+      return -1;
+    }
+
+    test->start = parse_address(start);
+    test->stop = parse_address(stop);
+    gbl$number_of_tests++;
+  }
+
+  fclose(handle);
+  return 0;
+}
+
+/* Run a single test and write its result into the given file. */
+int run_test(regression_test *test, FILE *result) {
+  qnice_machine *machine;
+  FILE *input, *output, *messages;
+  char path[2 * MAX_PATH_LENGTH], *typed, *script, *uart, *message_text;
+  size_t script_size = 0, uart_size, message_size;
+  unsigned int i, address, hash;
+  int reason;
+
+  if (!(machine = qnice_create()))
+    return -1;
+
+  if (qnice_load(machine, gbl$monitor) || qnice_load(machine, test->program)) {
+    fprintf(result, "Could not load %s resp. %s\n", gbl$monitor, test->program);
+    qnice_destroy(machine);
+    return -1;
+  }
+
+  if (gbl$strict_hle && qnice_set_hle(machine, QNICE_HLE_STRICT, gbl$labels) < 0) {
+    fprintf(result, "Could not load %s\n", gbl$labels);
+    qnice_destroy(machine);
+    return -1;
+  }
+
+  /* The monitor is started just like after a reset, the input starts with the command to run the program */
+  snprintf(path, sizeof(path), "%s/%s.in", gbl$directory, test->name);
+  script = read_file(path, &script_size);
+  typed = malloc(script_size + 8);
+  if (test->start < 0)
+    *typed = 0;
+  else
+    sprintf(typed, "CR%04X", test->start);
+  if (script)
+    strcat(typed, script);
+  free(script);
+
+  input = strlen(typed) ? fmemopen(typed, strlen(typed), "r") : NULL;
+  output = open_memstream(&uart, &uart_size);
+  messages = open_memstream(&message_text, &message_size);
+  qnice_uart_redirect(machine, input, output);
+  qnice_set_messages(machine, messages);
+  qnice_set_breakpoint(machine, test->stop);
+  qnice_set_coverage(machine, gbl$coverage != NULL);
+  qnice_write_register(machine, 15, 0);
+
+  reason = qnice_run(machine, test->budget);
+  test->instructions = qnice_instructions(machine);
+  if (gbl$coverage) {
+    pthread_mutex_lock(&gbl$mutex);
+    if (qnice_save_coverage(machine, gbl$coverage))
+      fprintf(stderr, "Could not merge the coverage of %s into %s\n", test->name, gbl$coverage);
+    pthread_mutex_unlock(&gbl$mutex);
+  }
+
+  fclose(output);
+  fclose(messages);
+  if (input)
+    fclose(input);
+  free(typed);
+
+  fprintf(result, "stop %s\ninstructions %llu\ncycles %llu\n", qnice_stop_reason_name(reason), test->instructions,
+          qnice_cycles(machine));
+  for (i = 0; i < 16; i++)
+    fprintf(result, "R%-2d %04X%s", i, qnice_read_register(machine, i), (i & 7) == 7 ? "\n" : "  ");
+
+  /* FNV-1a over the words of each page */
+  for (i = 0; i < MEMORY_HASH_PAGES; i++) {
+    hash = 2166136261u;
+    for (address = i << 12; address < (i + 1) << 12 && address < MEMORY_END; address++)
+      hash = (hash ^ qnice_read_memory(machine, address)) * 16777619u;
+    fprintf(result, "memory %04X %08X\n", i << 12, hash);
+  }
+
+  fprintf(result, "messages\n%s", message_text);
+  fprintf(result, "uart\n%s", uart);
+  free(message_text);
+  free(uart);
+  qnice_destroy(machine);
+  return 0;
+}
+
+/* Returns the line number of the first difference of the two texts. */
+int first_difference(char *a, char *b) {
+  int line = 1;
+
+  for (; *a && *a == *b; a++, b++)
+    if (*a == '\n')
+      line++;
+  return line;
+}
+
+void *worker(void *unused) {
+  regression_test *test;
+  FILE *result, *handle;
+  char path[2 * MAX_PATH_LENGTH], *golden;
+  double start;
+  int index;
+
+  for (;;) {
+    pthread_mutex_lock(&gbl$mutex);
+    index = gbl$next_test++;
+    pthread_mutex_unlock(&gbl$mutex);
+    if (index >= gbl$number_of_tests)
+      return NULL;
+
+    test = &gbl$tests[index];
+    if (access(test->program, R_OK)) {         /* E.g. the C programs without the C toolchain */
+      test->status = SKIPPED;
+      pthread_mutex_lock(&gbl$mutex);
+      printf("%-8s%-24s  (%s does not exist)\n", gbl$status_names[SKIPPED], test->name, test->program);
+      pthread_mutex_unlock(&gbl$mutex);
+      continue;
+    }
+
+    start = now_ms();
+    result = open_memstream(&test->result, &test->result_size);
+    test->status = run_test(test, result) ? ERROR : PASSED;
+    fclose(result);
+    test->milliseconds = now_ms() - start;
+
+    snprintf(path, sizeof(path), "%s/%s.golden", gbl$directory, test->name);
+    golden = read_file(path, NULL);
+    if (test->status != ERROR && (!golden || strcmp(golden, test->result))) {
+      if (gbl$update) {
+        if ((handle = fopen(path, "w"))) {
+          fputs(test->result, handle);
+          fclose(handle);
+          test->status = golden ? UPDATED : NEW;
+        } else
+          test->status = ERROR;
+      } else
+        test->status = golden ? FAILED : NEW;
+    }
+
+    pthread_mutex_lock(&gbl$mutex);
+    printf("%-8s%-24s%10.1f ms %14llu instructions", gbl$status_names[test->status], test->name,
+           test->milliseconds, test->instructions);
+    if (test->status == FAILED)
+      printf("  (first difference in line %d of %s)", first_difference(golden, test->result), path);
+    else if (test->status == ERROR)
+      printf("  (%s)", strtok(test->result, "\n") ? test->result : "could not create machine");
+    printf("\n");
+    fflush(stdout);
+    pthread_mutex_unlock(&gbl$mutex);
+
+    free(golden);
+  }
+}
+
+int main(int argc, char **argv) {
+  pthread_t threads[256];
+  int i, option, number_of_threads = sysconf(_SC_NPROCESSORS_ONLN), count[ERROR + 1] = {0};
+  double start;
+  char *p;
+
+  while ((option = getopt(argc, argv, "c:j:m:Su")) != -1)
+    switch (option) {
+      case 'c': gbl$coverage = optarg; break;
+      case 'j': number_of_threads = atoi(optarg); break;
+      case 'm': gbl$monitor = optarg; break;
+      case 'S': gbl$strict_hle = 1; break;
+      case 'u': gbl$update = 1; break;
+      default:
+        fprintf(stderr, "Usage: %s [-c coverage] [-j threads] [-m monitor] [-S] [-u] <manifest>\n\
+\t-c merges the code coverage of all tests into the file, see qnice-coverage\n\
+\t-S verifies the high-level emulation of the monitor routines, the labels are read from the monitor's .lis\n\
+\t-u writes the results of all tests which are new or differ as golden files\n", argv[0]);
+        return 2;
+    }
+
+  if (optind != argc - 1) {
+    fprintf(stderr, "Usage: %s [-c coverage] [-j threads] [-m monitor] [-S] [-u] <manifest>\n", argv[0]);
+    return 2;
+  }
+
+  /* The label list of the monitor is expected next to it, e.g. monitor/monitor.lis */
+  strncpy(gbl$labels, gbl$monitor, sizeof(gbl$labels) - 5);
+  if ((p = strrchr(gbl$labels, '.')) && !strchr(p, '/'))
+    *p = 0;
+  strcat(gbl$labels, ".lis");
+
+  strncpy(gbl$directory, argv[optind], sizeof(gbl$directory) - 1);
+  if ((p = strrchr(gbl$directory, '/')))
+    *p = 0;
+  else
+    strcpy(gbl$directory, ".");
+
+  if (read_manifest(argv[optind]))
+    return 2;
+
+  if (number_of_threads < 1)
+    number_of_threads = 1;
+  if (number_of_threads > sizeof(threads) / sizeof(*threads))
+    number_of_threads = sizeof(threads) / sizeof(*threads);
+  if (number_of_threads > gbl$number_of_tests)
+    number_of_threads = gbl$number_of_tests;
+
+  start = now_ms();
+  for (i = 0; i < number_of_threads; i++)
+    pthread_create(&threads[i], NULL, worker, NULL);
+  for (i = 0; i < number_of_threads; i++)
+    pthread_join(threads[i], NULL);
+
+  for (i = 0; i < gbl$number_of_tests; i++) {
+    count[gbl$tests[i].status]++;
+    free(gbl$tests[i].result);
+  }
+
+  printf("\n%d tests, %d passed, %d failed, %d new, %d updated, %d skipped, %d errors, %.1f ms on %d threads\n",
+         gbl$number_of_tests, count[PASSED], count[FAILED], count[NEW], count[UPDATED], count[SKIPPED], count[ERROR],
+         now_ms() - start, number_of_threads);
+  return count[FAILED] || count[ERROR] || (count[NEW] && !gbl$update);
+}
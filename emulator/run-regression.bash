@@ -0,0 +1,51 @@
+#!/usr/bin/env bash
+#Assemble resp. compile the programs of regression/tests.txt and run them against their golden files, see regression.c
+#Options are passed to the runner, e.g. -u to write new golden files or -j 4 to use four threads
+source ../tools/detect.include
+
+if [ ! -f ../assembler/qasm ] || [ ! -f ../assembler/qasm2rom ]; then
+    cd ..
+    $COMPILER assembler/qasm.c -o assembler/qasm
+    $COMPILER assembler/qasm2rom.c -o assembler/qasm2rom -std=c99
+    cd emulator
+fi
+
+if [ ! -f ../monitor/monitor.out ]; then
+    cd ../monitor
+    ../assembler/asm monitor.asm
+    cd ../emulator
+fi
+
+./make-lib.bash || exit 1
+$COMPILER regression.c libqnice.a -O3 -lpthread -o qnice-regression || exit 1
+
+#The C programs are only compiled if the toolchain has been built (see c/make-vbcc.sh etc.)
+HAS_C_COMPILER=0
+if [ -d ../c/vbcc/bin ]; then
+    cd ../c
+    source setenv.source
+    cd ../emulator
+    if hash vc 2>/dev/null; then
+        HAS_C_COMPILER=1
+    fi
+fi
+
+#The assembler uses a fixed temporary file, so the programs are assembled one after the other
+ASSEMBLER=`cd ../assembler && pwd`/asm
+
+for PROGRAM in `sed -e 's/#.*//' regression/tests.txt | awk '{print $2}'`; do
+    DIRECTORY=`dirname ../$PROGRAM`
+    SOURCE=`basename ${PROGRAM%.out}`
+    if [ -f $DIRECTORY/$SOURCE.asm ]; then
+        (cd $DIRECTORY && QNICE_ASM_NO_ROM=1 $ASSEMBLER $SOURCE.asm > /dev/null) || exit 1
+    elif [ -f $DIRECTORY/$SOURCE.c ] && [ $HAS_C_COMPILER = 1 ]; then
+        (cd $DIRECTORY && qvc $SOURCE.c -c99 -O3 > /dev/null && rm -f $SOURCE.bin mapfile) || exit 1
+    fi
+done
+
+if [ $HAS_C_COMPILER = 0 ]; then
+    echo "The C toolchain has not been built, so the C programs are not compiled (tests without program are skipped)."
+fi
+
+cd ..
+emulator/qnice-regression "$@" emulator/regression/tests.txt
@@ -1,64 +1,289 @@
 /*
 ** SD-card emulator.
 **
+** The image file is memory mapped, so reading or writing a sector is a memcpy and the kernel's page cache does the
+** caching. Writes either go to the image file (SD_READ_WRITE, MAP_SHARED) or to a copy-on-write overlay that is
+** dropped on detach (SD_OVERLAY, MAP_PRIVATE). If the image can not be mapped (e.g. a device or a file system without
+** mmap support like Emscripten's), the sectors are accessed with pread/pwrite through a small LRU cache and the overlay is a sorted
+** table of the written sectors.
+**
+** Optionally every command keeps the busy bit of the CSR set for a number of clock cycles of emulated time, so that
+** the polling loops of the monitor (SD$WAIT_BUSY) are exercised like on the hardware.
+**
+** The state of a card is kept in an sd_card (see sd.h) which is part of the machine, so every machine of the emulator
+** library has its own card.
+**
 ** 28-DEC-2016, B. Ulmann fecit
 */
 
 #include "sd.h"
+#include "snapshot.h"
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-#undef DEBUG
-#define VERBOSE
-
-FILE *image = (FILE *) 0;
+#define SD_MAX_SECTORS 0x10000000 /* The LBA has 28 bits */
 
-unsigned static int sd_addr_lo = 0, sd_addr_hi = 0, sd_data_pos = 0, sd_error = 0, sd_csr = 0;
-
-unsigned char sd_data[SD_SECTOR_SIZE];
+#undef DEBUG
+#ifndef QNICE_LIBRARY /* The library never uses the terminal, see qnice_machine.h */
+# define VERBOSE
+#endif
 
 #ifdef DEBUG
-void dump_sd_buffer()
+void dump_sd_buffer(sd_card *card)
 {
     int i;
 
     for (i = 0; i < SD_SECTOR_SIZE; i++)
     {
         if (!(i % 16)) printf("\n");
-        printf("%02x ", sd_data[i]);
+        printf("%02x ", card->data[i]);
     }
     printf("\n");
 }
 #endif
 
-void sd_attach(char *filename)
+void sd_initialize(sd_card *card, unsigned long long *clock)
+{
+  card->clock = clock;
+  card->image_fd = -1;
+}
+
+void sd_set_latency(sd_card *card, unsigned int cycles)
+{
+  card->latency = cycles;
+}
+
+unsigned int sd_get_latency(sd_card *card)
+{
+  return card->latency;
+}
+
+/* Returns the mode the image has been attached with (SD_OVERLAY if the file is read only) resp. -1 on failure. */
+int sd_attach(sd_card *card, char *filename, int mode)
 {
+  struct stat status;
+
 #ifdef DEBUG
   printf("sd_init: Open >>%s<<\n", filename);
 #endif
 
-  if (image) /* If there is already an image attached, detach it first. */
-    sd_detach();
+  if (card->image_fd >= 0) /* If there is already an image attached, detach it first. */
+    sd_detach(card);
+
+  if ((card->image_fd = open(filename, mode == SD_OVERLAY ? O_RDONLY : O_RDWR)) < 0 && mode == SD_READ_WRITE &&
+      (card->image_fd = open(filename, O_RDONLY)) >= 0)
+    mode = SD_OVERLAY;
+
+  if (card->image_fd < 0 || fstat(card->image_fd, &status))
+  {
+    if (card->image_fd >= 0)
+      close(card->image_fd);
+    card->image_fd = -1;
+    return -1;
+  }
+
+  /* Devices are not mapped, their size might be unknown (e.g. raw devices under macOS) */
+  if (!S_ISREG(status.st_mode))
+  {
+    if ((card->image_size = lseek(card->image_fd, 0, SEEK_END)) <= 0)
+      card->image_size = (off_t) SD_MAX_SECTORS * SD_SECTOR_SIZE;
+  }
+  else if ((card->image_size = status.st_size) > 0 &&
+           (card->image_map = mmap(NULL, card->image_size, PROT_READ | PROT_WRITE,
+                                   mode == SD_OVERLAY ? MAP_PRIVATE : MAP_SHARED, card->image_fd, 0)) == MAP_FAILED)
+    card->image_map = NULL;
+
+  strncpy(card->image_name, filename, SD_IMAGE_NAME_LENGTH - 1);
+  strcpy(card->attached_name, card->image_name);
+  card->image_mode = card->attached_mode = mode;
+  return mode;
+}
+
+void sd_detach(sd_card *card)
+{
+  if (card->image_map)
+  {
+    if (card->attached_mode == SD_READ_WRITE)
+      msync(card->image_map, card->image_size, MS_SYNC);
+    munmap(card->image_map, card->image_size);
+  }
+  if (card->image_fd >= 0)
+    close(card->image_fd);
+  card->image_fd = -1;
+  card->image_map = NULL;
+  card->image_size = 0;
+
+  memset(card->cache, 0, sizeof(card->cache));
+  free(card->overlay);
+  card->overlay = NULL;
+  card->overlay_used = card->overlay_size = 0;
+
+  memset(card->data, 0, SD_SECTOR_SIZE);
+  *card->image_name = *card->attached_name = 0;
+}
+
+/* Find the overlay entry of a sector, optionally inserting it (uninitialized) into the table sorted by LBA. */
+static sd_sector *sd_overlay_sector(sd_card *card, unsigned long lba, int insert)
+{
+  unsigned int low = 0, high = card->overlay_used, middle;
+  sd_sector *table;
+
+  while (low < high)
+  {
+    middle = (low + high) / 2;
+    if (card->overlay[middle].lba < lba)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  if (low < card->overlay_used && card->overlay[low].lba == lba)
+    return &card->overlay[low];
+  if (!insert)
+    return NULL;
+
+  if (card->overlay_used == card->overlay_size)
+  {
+    if (!(table = realloc(card->overlay,
+                          (card->overlay_size ? 2 * card->overlay_size : SD_CACHE_SECTORS) * sizeof(sd_sector))))
+      return NULL;
+    card->overlay = table;
+    card->overlay_size = card->overlay_size ? 2 * card->overlay_size : SD_CACHE_SECTORS;
+  }
+
+  memmove(&card->overlay[low + 1], &card->overlay[low], (card->overlay_used++ - low) * sizeof(sd_sector));
+  card->overlay[low].lba = lba;
+  return &card->overlay[low];
+}
+
+/* Return the cache entry of a sector, reading it on a miss into the least recently used entry. */
+static sd_sector *sd_cached_sector(sd_card *card, unsigned long lba)
+{
+  sd_sector *victim = card->cache;
+  ssize_t length;
+  int i;
 
-  if (!(image = fopen(filename, "rb")))
+  for (i = 0; i < SD_CACHE_SECTORS; i++)
   {
-    printf("Unable to attach SD-card image file >>%s<<!\n", filename);
-    return;
+    if (card->cache[i].last_use && card->cache[i].lba == lba)
+    {
+      card->cache[i].last_use = ++card->cache_clock;
+      return &card->cache[i];
+    }
+    if (card->cache[i].last_use < victim->last_use)
+      victim = &card->cache[i];
   }
+
+  if ((length = pread(card->image_fd, victim->data, SD_SECTOR_SIZE, (off_t) lba * SD_SECTOR_SIZE)) < 0)
+    length = 0;
+  memset(victim->data + length, 0, SD_SECTOR_SIZE - length);
+  victim->lba = lba;
+  victim->last_use = ++card->cache_clock;
+  return victim;
 }
 
-void sd_detach()
+/* Read a sector into the buffer, the part beyond the end of the image reads as zeros. Returns an SD_ERR_* code. */
+static unsigned int sd_read_sector(sd_card *card, unsigned long lba)
 {
-  if (image)
-    fclose(image);
-  image = 0;
-  memset(sd_data, 0, SD_SECTOR_SIZE);
+  off_t offset = (off_t) lba * SD_SECTOR_SIZE;
+  sd_sector *sector;
+
+  if (card->image_fd < 0) /* The emulation behaves like an empty card if no image is attached */
+    return 0;
+  if (offset >= card->image_size)
+    return SD_ERR_R1_ERROR;
+
+  if (card->image_map)
+  {
+    if (offset + SD_SECTOR_SIZE <= card->image_size)
+      memcpy(card->data, card->image_map + offset, SD_SECTOR_SIZE);
+    else
+    {
+      memcpy(card->data, card->image_map + offset, card->image_size - offset);
+      memset(card->data + (card->image_size - offset), 0, SD_SECTOR_SIZE - (card->image_size - offset));
+    }
+  }
+  else
+  {
+    if (!(sector = sd_overlay_sector(card, lba, 0)))
+      sector = sd_cached_sector(card, lba);
+    memcpy(card->data, sector->data, SD_SECTOR_SIZE);
+  }
+  return 0;
 }
 
-void sd_write_register(unsigned int address, unsigned int value)
+/* Write the buffer to a sector, the part beyond the end of the image is dropped. Returns an SD_ERR_* code. */
+static unsigned int sd_write_sector(sd_card *card, unsigned long lba)
 {
-  unsigned int block_start_address;
+  off_t offset = (off_t) lba * SD_SECTOR_SIZE;
+  size_t length = offset + SD_SECTOR_SIZE <= card->image_size ? SD_SECTOR_SIZE : card->image_size - offset;
+  sd_sector *sector;
+  int i;
+
+  if (card->image_fd < 0)
+    return 0;
+  if (offset >= card->image_size)
+    return SD_ERR_R1_ERROR;
+
+  if (card->image_map)
+    memcpy(card->image_map + offset, card->data, length);
+  else if (card->attached_mode == SD_OVERLAY)
+  {
+    if (!(sector = sd_overlay_sector(card, lba, 1)))
+      return SD_ERR_WRITE_TIMEOUT;
+    memcpy(sector->data, card->data, SD_SECTOR_SIZE);
+  }
+  else
+  {
+    if (pwrite(card->image_fd, card->data, length, offset) != (ssize_t) length)
+      return SD_ERR_WRITE_TIMEOUT;
+    for (i = 0; i < SD_CACHE_SECTORS; i++) /* Write through */
+      if (card->cache[i].last_use && card->cache[i].lba == lba)
+        memcpy(card->cache[i].data, card->data, SD_SECTOR_SIZE);
+  }
+  return 0;
+}
+
+/* A snapshot might have been taken with another image attached (or none at all). The card contents are not part of
+** a snapshot, so the changes of an overlay survive a restore only as long as the same image stays attached. */
+static void sd_after_restore(void *context)
+{
+  sd_card *card = context;
+
+  if (strcmp(card->image_name, card->attached_name) || card->image_mode != card->attached_mode)
+  {
+    unsigned char data[SD_SECTOR_SIZE];
+    char name[SD_IMAGE_NAME_LENGTH];
+
+    memcpy(data, card->data, SD_SECTOR_SIZE); /* Attaching and detaching clear the buffer */
+    strcpy(name, card->image_name);
+    if (!*name || sd_attach(card, name, card->image_mode) < 0)
+      sd_detach(card);
+    memcpy(card->data, data, SD_SECTOR_SIZE);
+  }
+}
+
+void sd_register_snapshot(sd_card *card)
+{
+  snapshot_register("sd_addr_lo", &card->addr_lo, sizeof(card->addr_lo), NULL, sd_after_restore, card, NULL, 0);
+  snapshot_register("sd_addr_hi", &card->addr_hi, sizeof(card->addr_hi), NULL, NULL, NULL, NULL, 0);
+  snapshot_register("sd_data_pos", &card->data_pos, sizeof(card->data_pos), NULL, NULL, NULL, NULL, 0);
+  snapshot_register("sd_error", &card->error, sizeof(card->error), NULL, NULL, NULL, NULL, 0);
+  snapshot_register("sd_csr", &card->csr, sizeof(card->csr), NULL, NULL, NULL, NULL, 0);
+  snapshot_register("sd_data", card->data, sizeof(card->data), NULL, NULL, NULL, NULL, 0);
+  snapshot_register("sd_busy_until", &card->busy_until, sizeof(card->busy_until), NULL, NULL, NULL, NULL, 0);
+  snapshot_register("sd_image_name", card->image_name, sizeof(card->image_name), NULL, NULL, NULL, NULL, 0);
+  snapshot_register("sd_image_mode", &card->image_mode, sizeof(card->image_mode), NULL, NULL, NULL, NULL, 0);
+}
+
+void sd_write_register(sd_card *card, unsigned int address, unsigned int value)
+{
+  unsigned long lba;
 
 #ifdef DEBUG
   printf("sd_write_register(%04X, %04X)\n", address & 0xffff, value & 0xffff);
@@ -66,43 +291,40 @@ void sd_write_register(unsigned int address, unsigned int value)
   switch (address)
   {
     case SD_ADDR_LO:
-      sd_addr_lo = value & 0xffff;
+      card->addr_lo = value & 0xffff;
       break;
     case SD_ADDR_HI:
-      sd_addr_hi = value & 0xffff;
+      card->addr_hi = value & 0xffff;
       break;
     case SD_DATA_POS:
-      sd_data_pos = value & 0xffff;
+      card->data_pos = value & 0xffff;
       break;
     case SD_DATA:
-      sd_data[sd_data_pos & 0x01ff] = value & 0xffff;
+      card->data[card->data_pos & 0x01ff] = value & 0xffff;
       break;
     case SD_CSR:
-      if ((value & 0xffff) == 1) /* Read 512 bytes from the block addressed by the current LBA. */
+      lba = (card->addr_lo & 0xffff) | ((unsigned long) (card->addr_hi & 0xfff) << 16);
+      card->csr = value & 0xffff;
+      if (card->csr == 0) /* Reset */
+        card->error = 0;
+      else if (card->csr == 1) /* Read 512 bytes from the block addressed by the current LBA. */
       {
-        block_start_address = ((sd_addr_lo & 0xffff) | ((sd_addr_hi & 0xfff) << 16)) * SD_SECTOR_SIZE;
-        if (image)
-        {
-          fseek(image, block_start_address, SEEK_SET);
-          fread(sd_data, SD_SECTOR_SIZE, 1, image);
-        }
+        card->error = sd_read_sector(card, lba);
 #ifdef DEBUG
-        printf("SD: Read block %08X.\n", (sd_addr_lo & 0xffff) | ((sd_addr_hi & 0xfff) << 16));
-        dump_sd_buffer();
+        printf("SD: Read block %08lX.\n", lba);
+        dump_sd_buffer(card);
 #endif
       }
-      else if ((value & 0xffff) == 2) /* Write 512 bytes to the block address by the current LBA. */
+      else if (card->csr == 2) /* Write 512 bytes to the block address by the current LBA. */
       {
-        block_start_address = ((sd_addr_lo & 0xffff) | ((sd_addr_hi & 0xfff) << 16)) * SD_SECTOR_SIZE;
 #ifdef DEBUG
-        printf("SD: Write block %08X.\n", block_start_address);
+        printf("SD: Write block %08lX.\n", lba);
 #endif
-        if (image)
-        {
-          fwrite(sd_data, SD_SECTOR_SIZE, 1, image);
-          fseek(image, block_start_address, SEEK_SET);
-        }
+        card->error = sd_write_sector(card, lba);
       }
+
+      if (card->clock && card->latency)
+        card->busy_until = *card->clock + card->latency;
       break;
     default:
 #ifdef VERBOSE
@@ -111,32 +333,36 @@ void sd_write_register(unsigned int address, unsigned int value)
   }
 }
 
-unsigned int sd_read_register(unsigned int address)
+unsigned int sd_read_register(sd_card *card, unsigned int address)
 {
-  unsigned int value;
+  unsigned int value = 0;
 
   switch (address)
   {
     case SD_ADDR_LO:
-      value = sd_addr_lo;
+      value = card->addr_lo;
       break;
     case SD_ADDR_HI:
-      value = sd_addr_hi;
+      value = card->addr_hi;
       break;
     case SD_DATA_POS:
-      value = sd_data_pos;
+      value = card->data_pos;
       break;
     case SD_DATA:
-      value = sd_data[sd_data_pos & 0x01ff];
+      value = card->data[card->data_pos & 0x01ff];
 #ifdef DEBUG
-      printf("SD: Read from buffer [%05X]: %04X\n", sd_data_pos & 0x01ff, value);
+      printf("SD: Read from buffer [%05X]: %04X\n", card->data_pos & 0x01ff, value);
 #endif
       break;
     case SD_ERROR:
-      value = sd_error & 0xffff;
+      value = card->error & 0xffff;
       break;
-    case SD_CSR: /* More or less a dummy operation as there is no room for errors in the emulation. :-) */
-      value = 0x2000; /* Report card type SD V2. */
+    case SD_CSR: /* The transfer itself happens immediately, only the busy bit reflects the latency */
+      value = SD_CARD_TYPE_V2;
+      if (card->clock && *card->clock < card->busy_until)
+        value |= SD_BIT_BUSY;
+      else if (card->error)
+        value |= SD_BIT_ERROR;
       break;
     default:
 #ifdef VERBOSE
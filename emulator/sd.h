@@ -4,6 +4,8 @@
 ** 28-DEC-2016, B. Ulmann fecit
 */
 
+#include <sys/types.h>
+
 #define SD_NUMBER_OF_REGISTERS 6
 
 #define SD_ADDR_LO  0
@@ -14,8 +16,52 @@
 #define SD_CSR      5
 
 #define SD_SECTOR_SIZE 512
+#define SD_IMAGE_NAME_LENGTH 256
+
+#define SD_CACHE_SECTORS 64   /* Size of the LRU sector cache used when the image can not be memory mapped */
+
+#define SD_CARD_TYPE_V2 0x2000
+#define SD_BIT_ERROR    0x4000
+#define SD_BIT_BUSY     0x8000
+
+#define SD_ERR_R1_ERROR      0x0001   /* Reported for sectors beyond the end of the image (address error) */
+#define SD_ERR_WRITE_TIMEOUT 0x0002   /* Reported if the image file could not be written */
+
+/* Attach modes: Writes go to the image file or only to a copy-on-write overlay that is dropped on detach */
+#define SD_READ_WRITE 0
+#define SD_OVERLAY    1
+
+typedef struct sd_sector
+{
+  unsigned long lba;
+  unsigned long long last_use; /* 0 marks an unused cache entry */
+  unsigned char data[SD_SECTOR_SIZE];
+} sd_sector;
+
+/* State of one SD card, every emulated machine has its own one. */
+typedef struct sd_card
+{
+  unsigned int addr_lo, addr_hi, data_pos, error, csr;          /* Registers */
+  unsigned char data[SD_SECTOR_SIZE];                           /* Sector buffer */
+  unsigned long long *clock,                                    /* Emulated time (clock cycles) for the busy bit */
+    busy_until;
+  unsigned int latency;                                         /* Every command keeps the card busy this long */
+  int image_fd;                                                 /* -1 if no image is attached */
+  unsigned char *image_map;                                     /* NULL if the image is not memory mapped */
+  off_t image_size;
+  sd_sector cache[SD_CACHE_SECTORS], *overlay;                  /* Used if the image is not memory mapped */
+  unsigned long long cache_clock;
+  unsigned int overlay_used, overlay_size;
+  char image_name[SD_IMAGE_NAME_LENGTH],                        /* Name and mode of the image, part of snapshots */
+    attached_name[SD_IMAGE_NAME_LENGTH];                        /* Name and mode of the image actually attached */
+  int image_mode, attached_mode;
+} sd_card;
 
-void sd_attach(char *);
-void sd_detach();
-unsigned int sd_read_register(unsigned int);
-void sd_write_register(unsigned int, unsigned int);
+void sd_initialize(sd_card *, unsigned long long *);
+int sd_attach(sd_card *, char *, int);
+void sd_detach(sd_card *);
+void sd_set_latency(sd_card *, unsigned int);
+unsigned int sd_get_latency(sd_card *);
+unsigned int sd_read_register(sd_card *, unsigned int);
+void sd_write_register(sd_card *, unsigned int, unsigned int);
+void sd_register_snapshot(sd_card *);
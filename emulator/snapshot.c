@@ -0,0 +1,227 @@
+/*
+**  Machine snapshots, see snapshot.h.
+**
+**  The file format is a magic "QSNP", a version and the number of regions followed by each region as name length,
+** name, size and the raw data. The data is stored in the byte order of the host, so snapshot files are meant to be
+** restored by the same emulator binary.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC   "QSNP"
+#define SNAPSHOT_VERSION 1
+
+typedef struct snapshot_region {
+  const char *name;
+  void *data, *context;
+  size_t size, page_size;
+  snapshot_handler before_save, after_restore;
+  unsigned char *dirty;
+} snapshot_region;
+
+struct snapshot {
+  void *data[SNAPSHOT_MAX_REGIONS];
+};
+
+static snapshot_region regions[SNAPSHOT_MAX_REGIONS];
+static unsigned int no_of_regions = 0;
+static snapshot *last_snapshot = NULL; /* The dirty maps are relative to this snapshot */
+
+void snapshot_register(const char *name, void *data, size_t size, snapshot_handler before_save,
+                       snapshot_handler after_restore, void *context, unsigned char *dirty, size_t page_size) {
+  if (no_of_regions == SNAPSHOT_MAX_REGIONS) {
+    printf("snapshot_register: too many regions, >>%s<< is not part of snapshots!\n", name);
+    return;
+  }
+
+  regions[no_of_regions].name = name;
+  regions[no_of_regions].data = data;
+  regions[no_of_regions].size = size;
+  regions[no_of_regions].before_save = before_save;
+  regions[no_of_regions].after_restore = after_restore;
+  regions[no_of_regions].context = context;
+  regions[no_of_regions].dirty = dirty;
+  regions[no_of_regions++].page_size = page_size;
+}
+
+static size_t no_of_pages(snapshot_region *region) {
+  return (region->size + region->page_size - 1) / region->page_size;
+}
+
+static void clear_dirty_maps() {
+  for (unsigned int i = 0; i < no_of_regions; i++)
+    if (regions[i].dirty)
+      memset(regions[i].dirty, 0, no_of_pages(regions + i));
+}
+
+static snapshot *snapshot_allocate() {
+  snapshot *snap;
+
+  if (!(snap = calloc(1, sizeof(snapshot))))
+    return NULL;
+
+  for (unsigned int i = 0; i < no_of_regions; i++)
+    if (!(snap->data[i] = malloc(regions[i].size))) {
+      snapshot_free(snap);
+      return NULL;
+    }
+
+  return snap;
+}
+
+snapshot *snapshot_take() {
+  snapshot *snap;
+  unsigned int i;
+
+  if (!(snap = snapshot_allocate()))
+    return NULL;
+
+  for (i = 0; i < no_of_regions; i++)
+    if (regions[i].before_save)
+      regions[i].before_save(regions[i].context);
+
+  for (i = 0; i < no_of_regions; i++)
+    memcpy(snap->data[i], regions[i].data, regions[i].size);
+
+  clear_dirty_maps();
+  last_snapshot = snap;
+  return snap;
+}
+
+void snapshot_restore(snapshot *snap) {
+  snapshot_region *region;
+  size_t page, offset, length;
+  unsigned int i;
+
+  for (i = 0, region = regions; i < no_of_regions; i++, region++) {
+    if (!region->dirty || snap != last_snapshot) { /* Copy everything and let after_restore see all pages as dirty */
+      memcpy(region->data, snap->data[i], region->size);
+      if (region->dirty)
+        memset(region->dirty, 1, no_of_pages(region));
+      continue;
+    }
+
+    for (page = 0; page < no_of_pages(region); page++)
+      if (region->dirty[page]) {
+        offset = page * region->page_size;
+        length = offset + region->page_size > region->size ? region->size - offset : region->page_size;
+        memcpy((char *) region->data + offset, (char *) snap->data[i] + offset, length);
+      }
+  }
+
+  for (i = 0; i < no_of_regions; i++)
+    if (regions[i].after_restore)
+      regions[i].after_restore(regions[i].context);
+
+  clear_dirty_maps();
+  last_snapshot = snap;
+}
+
+void snapshot_free(snapshot *snap) {
+  if (!snap)
+    return;
+
+  if (snap == last_snapshot)
+    last_snapshot = NULL;
+  for (unsigned int i = 0; i < SNAPSHOT_MAX_REGIONS; i++)
+    free(snap->data[i]);
+  free(snap);
+}
+
+int snapshot_write(snapshot *snap, FILE *handle) {
+  unsigned int i, value;
+  unsigned long long size;
+
+  fwrite(SNAPSHOT_MAGIC, 1, strlen(SNAPSHOT_MAGIC), handle);
+  value = SNAPSHOT_VERSION;
+  fwrite(&value, sizeof(value), 1, handle);
+  fwrite(&no_of_regions, sizeof(no_of_regions), 1, handle);
+  for (i = 0; i < no_of_regions; i++) {
+    value = strlen(regions[i].name);
+    size = regions[i].size;
+    fwrite(&value, sizeof(value), 1, handle);
+    fwrite(regions[i].name, 1, value, handle);
+    fwrite(&size, sizeof(size), 1, handle);
+    fwrite(snap->data[i], 1, regions[i].size, handle);
+  }
+  return ferror(handle) ? -1 : 0;
+}
+
+int snapshot_save(snapshot *snap, const char *file_name) {
+  FILE *handle;
+
+  if (!(handle = fopen(file_name, "wb"))) {
+    printf("Unable to create file >>%s<<\n", file_name);
+    return -1;
+  }
+
+  if (snapshot_write(snap, handle) | fclose(handle)) {
+    printf("Unable to write file >>%s<<\n", file_name);
+    return -1;
+  }
+  return 0;
+}
+
+snapshot *snapshot_read(FILE *handle, const char *file_name) {
+  snapshot *snap;
+  char magic[sizeof(SNAPSHOT_MAGIC)], name[256];
+  unsigned int i, j, version, count, length, found[SNAPSHOT_MAX_REGIONS] = {0};
+  unsigned long long size;
+
+  if (!(snap = snapshot_allocate()))
+    return NULL;
+
+  if (fread(magic, 1, strlen(SNAPSHOT_MAGIC), handle) != strlen(SNAPSHOT_MAGIC) ||
+      strncmp(magic, SNAPSHOT_MAGIC, strlen(SNAPSHOT_MAGIC)) ||
+      fread(&version, sizeof(version), 1, handle) != 1 || version != SNAPSHOT_VERSION ||
+      fread(&count, sizeof(count), 1, handle) != 1)
+    goto corrupt;
+
+  for (i = 0; i < count; i++) {
+    if (fread(&length, sizeof(length), 1, handle) != 1 || length >= sizeof(name) ||
+        fread(name, 1, length, handle) != length || fread(&size, sizeof(size), 1, handle) != 1)
+      goto corrupt;
+    name[length] = 0;
+
+    for (j = 0; j < no_of_regions && strcmp(regions[j].name, name); j++);
+    if (j == no_of_regions || regions[j].size != size) {
+      printf("Snapshot >>%s<< does not match this emulator (region >>%s<<)\n", file_name, name);
+      goto failed;
+    }
+    if (fread(snap->data[j], 1, size, handle) != size)
+      goto corrupt;
+    found[j] = 1;
+  }
+
+  for (j = 0; j < no_of_regions; j++)
+    if (!found[j]) {
+      printf("Snapshot >>%s<< does not match this emulator (region >>%s<< missing)\n", file_name, regions[j].name);
+      goto failed;
+    }
+
+  return snap;
+
+corrupt:
+  printf("Corrupt snapshot >>%s<<\n", file_name);
+failed:
+  snapshot_free(snap);
+  return NULL;
+}
+
+snapshot *snapshot_load(const char *file_name) {
+  FILE *handle;
+  snapshot *snap;
+
+  if (!(handle = fopen(file_name, "rb"))) {
+    printf("Unable to open file >>%s<<\n", file_name);
+    return NULL;
+  }
+
+  snap = snapshot_read(handle, file_name);
+  fclose(handle);
+  return snap;
+}
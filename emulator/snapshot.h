@@ -0,0 +1,41 @@
+/*
+**  Header file for machine snapshots of the QNICE-emulator: The emulator and every device register the memory regions
+** which make up their state using snapshot_register(...). A snapshot is a copy of all registered regions, it can be
+** kept in memory or written to and read from a file.
+**
+**  Regions registered with a dirty page map are restored copy-on-write: Restoring the snapshot which was taken or
+** restored last only copies the pages which have been marked dirty by their owner since then. This is used for the
+** main memory, so a warmed-up machine can be restored thousands of times per second.
+*/
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define SNAPSHOT_MAX_REGIONS 64
+
+typedef void (*snapshot_handler)(void *context);
+
+typedef struct snapshot snapshot;
+
+/*
+**  Register a region of the machine state. before_save is called before the region is copied (e.g. to bring the data
+** up to date), after_restore after it has been restored (e.g. to recalculate derived data). If dirty is not NULL, it
+** points to one byte per page of page_size bytes which the owner sets to a value different from zero on each write.
+*/
+void snapshot_register(const char *name, void *data, size_t size, snapshot_handler before_save,
+                       snapshot_handler after_restore, void *context, unsigned char *dirty, size_t page_size);
+
+snapshot *snapshot_take();
+void snapshot_restore(snapshot *);
+void snapshot_free(snapshot *);
+int snapshot_save(snapshot *, const char *file_name);
+snapshot *snapshot_load(const char *file_name);
+
+/* Write resp. read a snapshot at the current position of an open file, e.g. as part of a trace (see recorder.h) */
+int snapshot_write(snapshot *, FILE *handle);
+snapshot *snapshot_read(FILE *handle, const char *file_name);
+
+#endif
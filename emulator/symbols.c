@@ -0,0 +1,124 @@
+/*
+**  Symbol table, see symbols.h.
+**
+**  Two formats are understood: Lines like "NAME .EQU 0x1234" (definition files) and the symbol table at the end of a
+** listing which contains several "NAME : 0x1234" entries per line. If there are several symbols for an address, the
+** first one loaded wins, but labels are preferred to local labels of the monitor (starting with "_") and these are
+** preferred to constants (.EQU statements inside a listing).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "symbols.h"
+
+#define SYMBOLS_ADDRESSES   65536
+#define SYMBOLS_LINE_LENGTH 1024
+
+#define SYMBOL_CONSTANT     0
+#define SYMBOL_LOCAL        1
+#define SYMBOL_LABEL        2
+
+static char *symbols[SYMBOLS_ADDRESSES];
+static unsigned char priorities[SYMBOLS_ADDRESSES];
+
+void symbols_clear() {
+  for (unsigned int i = 0; i < SYMBOLS_ADDRESSES; i++) {
+    free(symbols[i]);
+    symbols[i] = NULL;
+  }
+}
+
+static void symbols_add(const char *name, const char *value, unsigned int priority) {
+  char *end;
+  unsigned long address = strtoul(value, &end, 0);
+
+  if (end == value || *end || address >= SYMBOLS_ADDRESSES)
+    return;
+
+  if (priority == SYMBOL_LABEL && *name == '_')
+    priority = SYMBOL_LOCAL;
+  if (symbols[address] && priorities[address] >= priority)
+    return;
+
+  free(symbols[address]);
+  symbols[address] = strdup(name);
+  priorities[address] = priority;
+}
+
+static int symbols_compare(const void *a, const void *b) {
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+int symbols_load(const char *file_name) {
+  FILE *handle;
+  char line[SYMBOLS_LINE_LENGTH], *token[SYMBOLS_LINE_LENGTH / 2], **constants = NULL, **more;
+  unsigned int i, count, no_of_constants = 0, sorted = 0;
+
+  if (!(handle = fopen(file_name, "r"))) {
+    printf("Unable to open file >>%s<<\n", file_name);
+    return -1;
+  }
+
+  while (fgets(line, SYMBOLS_LINE_LENGTH, handle)) {
+    if (*line == ';')
+      continue;
+
+    for (count = 0, token[0] = strtok(line, " \t\r\n"); token[count]; token[++count] = strtok(NULL, " \t\r\n"));
+
+    if (count == 3 && !strcmp(token[1], ".EQU")) /* Definition file */
+      symbols_add(token[0], token[2], SYMBOL_LABEL);
+    else
+      for (i = 0; i + 2 < count; i++)
+        if (!strcmp(token[i + 1], ":")) { /* Symbol table of a listing, it follows all .EQU statements */
+          if (!sorted++)
+            qsort(constants, no_of_constants, sizeof(char *), symbols_compare);
+          symbols_add(token[i], token[i + 2],
+                      bsearch(token + i, constants, no_of_constants, sizeof(char *), symbols_compare)
+                        ? SYMBOL_CONSTANT : SYMBOL_LABEL);
+          i += 2;
+        } else if (!strcmp(token[i + 1], ".EQU")) { /* Constant in a listing, the rest of the line is a comment */
+          if ((more = realloc(constants, (no_of_constants + 1) * sizeof(char *)))) {
+            constants = more;
+            constants[no_of_constants++] = strdup(token[i]);
+          }
+          break;
+        }
+  }
+
+  for (i = 0; i < no_of_constants; i++)
+    free(constants[i]);
+  free(constants);
+  fclose(handle);
+  return 0;
+}
+
+const char *symbols_name(unsigned int address) {
+  return symbols[address & 0xffff];
+}
+
+const char *symbols_lookup(unsigned int address, unsigned int *offset) {
+  int i;
+
+  for (i = address & 0xffff; i >= 0 && !symbols[i]; i--);
+  if (i < 0)
+    return NULL;
+
+  *offset = (address & 0xffff) - i;
+  return symbols[i];
+}
+
+char *symbols_format(unsigned int address, char *buffer, unsigned int size) {
+  const char *name;
+  unsigned int offset;
+
+  if (!(name = symbols_lookup(address, &offset)))
+    snprintf(buffer, size, "0x%04X", address & 0xffff);
+  else if (!offset)
+    snprintf(buffer, size, "%s", name);
+  else
+    snprintf(buffer, size, "%s+0x%X", name, offset);
+
+  return buffer;
+}
@@ -0,0 +1,22 @@
+/*
+**  Header file for the symbol table of the QNICE-emulator: Symbols are read from the definition files (.def) and from
+** the symbol table at the end of the listings (.lis) created by the assembler. They are used to show addresses as
+** labels, e.g. in the reports of the profiler.
+*/
+
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+int symbols_load(const char *file_name);
+void symbols_clear();
+
+/* Name of a symbol with exactly this address or NULL */
+const char *symbols_name(unsigned int address);
+
+/* Name of the closest symbol at or below address (NULL if there is none), *offset is the distance to it */
+const char *symbols_lookup(unsigned int address, unsigned int *offset);
+
+/* Format address as "NAME" resp. "NAME+0xOFFSET" or as a plain hexadecimal number if there is no symbol */
+char *symbols_format(unsigned int address, char *buffer, unsigned int size);
+
+#endif
@@ -11,110 +11,168 @@
 **  - The register TIMER_x_INT contains the address of the interrupt service routine to be called.
 **
 **  In order to activate one of the (currently) four timers all of its three registers must be different from zero!
+**
+**  The emulation runs on emulated time instead of the host clock: The emulator calls timerAdvance() after each batch
+** of instructions, one tick of the 100 kHz timer base corresponds to TIMER_CYCLES_PER_TICK clock cycles. The
+** deadlines of all active timers are kept in a min-heap, so only the earliest one has to be checked. Timer interrupts
+** are thus independent of the speed of the host and reproducible.
 */
 
 #undef DEBUG
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
-#include <signal.h>
 #include "timer.h"
+#include "snapshot.h"
 
 #ifndef TRUE
 # define TRUE 1
 # define FALSE !TRUE
 #endif
 
-unsigned int timer_registers[NUMBER_OF_TIMERS * REG_PER_TIMER], // Global register variables
-    *interrupt_request,                                         // This is mapped to the interrupt_request flag in qnice.c
-    *interrupt_address,                                         // This is mapped to the interrupt_address in the emulator
-    id[NUMBER_OF_TIMERS];                                       // Timer id for each thread
+static void heap_swap(timer_module *unit, unsigned int a, unsigned int b) {
+    timer_event event = unit->heap[a];
 
-struct timespec requested[NUMBER_OF_TIMERS], remaining[NUMBER_OF_TIMERS];
+    unit->heap[a] = unit->heap[b];
+    unit->heap[b] = event;
+    unit->heap_position[unit->heap[a].timer] = a;
+    unit->heap_position[unit->heap[b].timer] = b;
+}
 
-pthread_t thread_list[NUMBER_OF_TIMERS];
+static void heap_sift_up(timer_module *unit, unsigned int i) {
+    for (; i && unit->heap[i].deadline < unit->heap[(i - 1) / 2].deadline; i = (i - 1) / 2)
+        heap_swap(unit, i, (i - 1) / 2);
+}
 
-void initializeTimerModule(unsigned int *request, unsigned int *address) {
-    interrupt_request = request;
-    interrupt_address = address;
+static void heap_sift_down(timer_module *unit, unsigned int i) {
+    timer_event *heap = unit->heap;
+
+    for (unsigned int smallest; ; i = smallest) {
+        smallest = i;
+        if (2 * i + 1 < unit->heap_size && heap[2 * i + 1].deadline < heap[smallest].deadline)
+            smallest = 2 * i + 1;
+        if (2 * i + 2 < unit->heap_size && heap[2 * i + 2].deadline < heap[smallest].deadline)
+            smallest = 2 * i + 2;
+        if (smallest == i)
+            return;
+        heap_swap(unit, i, smallest);
+    }
+}
+
+static void heap_remove(timer_module *unit, unsigned int timer) {
+    int i = unit->heap_position[timer];
 
-    for (unsigned int i = 0; i < NUMBER_OF_TIMERS * 3; timer_registers[i++] = 0);
+    if (i < 0)
+        return;
 
-    for (unsigned int i = 0; i < NUMBER_OF_TIMERS; i++) {
-        thread_list[i] = (pthread_t) 0;
-        id[i] = i;
+    unit->heap_position[timer] = -1;
+    if (i != --unit->heap_size) {   // Move the last entry into the gap and restore the heap property
+        unit->heap[i] = unit->heap[unit->heap_size];
+        unit->heap_position[timer = unit->heap[i].timer] = i;
+        heap_sift_up(unit, i);
+        heap_sift_down(unit, unit->heap_position[timer]);
     }
 }
 
-unsigned int readTimerDeviceRegister(unsigned int address) {
-    return timer_registers[address];
+static void heap_insert(timer_module *unit, unsigned int timer, unsigned long long deadline) {
+    unit->heap[unit->heap_size].deadline = deadline;
+    unit->heap[unit->heap_size].timer = timer;
+    unit->heap_position[timer] = unit->heap_size;
+    heap_sift_up(unit, unit->heap_size++);
+}
+
+void initializeTimerModule(timer_module *unit, unsigned int *request, unsigned int *address) {
+    unit->interrupt_request = request;
+    unit->interrupt_address = address;
+
+    for (unsigned int i = 0; i < NUMBER_OF_TIMERS * REG_PER_TIMER; unit->registers[i++] = 0);
+
+    for (unsigned int i = 0; i < NUMBER_OF_TIMERS; i++)
+        unit->heap_position[i] = -1;
+    unit->heap_size = unit->pending = 0;
+    unit->now = 0;
+}
+
+/* Everything but the pointers into the emulator is part of the machine state. */
+void registerTimerSnapshot(timer_module *unit) {
+    snapshot_register("timer_registers", unit->registers, sizeof(unit->registers), NULL, NULL, NULL, NULL, 0);
+    snapshot_register("timer_pending", &unit->pending, sizeof(unit->pending), NULL, NULL, NULL, NULL, 0);
+    snapshot_register("timer_now", &unit->now, sizeof(unit->now), NULL, NULL, NULL, NULL, 0);
+    snapshot_register("timer_period", unit->period, sizeof(unit->period), NULL, NULL, NULL, NULL, 0);
+    snapshot_register("timer_heap", unit->heap, sizeof(unit->heap), NULL, NULL, NULL, NULL, 0);
+    snapshot_register("timer_heap_size", &unit->heap_size, sizeof(unit->heap_size), NULL, NULL, NULL, NULL, 0);
+    snapshot_register("timer_heap_position", unit->heap_position, sizeof(unit->heap_position), NULL, NULL, NULL, NULL,
+                      0);
+}
+
+unsigned int readTimerDeviceRegister(timer_module *unit, unsigned int address) {
+    return unit->registers[address];
 }
 
-void writeTimerDeviceRegister(unsigned int address, unsigned int value) {
-    int i;
+void writeTimerDeviceRegister(timer_module *unit, unsigned int address, unsigned int value) {
+    unsigned int *timer_registers = unit->registers, i;
 
-    unsigned long long duration;
 #ifdef DEBUG
     printf("timer: write access at address %04X.\n", address);
 #endif
 
     timer_registers[address] = value;
 
-    i = (int) (address / REG_PER_TIMER);    // Which timer was accessed?
+    i = address / REG_PER_TIMER;    // Which timer was accessed?
 
-    if (timer_registers[i * REG_PER_TIMER + REG_PRE] && 
-        timer_registers[i * REG_PER_TIMER + REG_CNT] && 
+    heap_remove(unit, i);           // If the timer is being reconfigured, it starts counting again
+    unit->pending &= ~(1 << i);
+    if (timer_registers[i * REG_PER_TIMER + REG_PRE] &&
+        timer_registers[i * REG_PER_TIMER + REG_CNT] &&
         timer_registers[i * REG_PER_TIMER + REG_INT]) {
-        if (thread_list[i]) {   // If the timer is being reconfigured, cancel and recreate it
-            if (pthread_cancel(thread_list[i])) {
-              perror("[0, 0] timer could not be removed!");
-              exit(-1);
-            }
-
-            if (pthread_join(thread_list[i], NULL)) {
-                perror("[0, 1] timer could not be removed!");
-                exit(-1);
-            }
-        }
-
-        duration = timer_registers[i * REG_PER_TIMER + REG_CNT] * timer_registers[i * REG_PER_TIMER + REG_PRE] * 10000; // In ns
-        requested[i].tv_nsec = duration - ((int) (duration / 1e9) * 1e9);
-        requested[i].tv_sec  = (int) (duration / 1e9);
+        unit->period[i] = (unsigned long long) timer_registers[i * REG_PER_TIMER + REG_CNT] *
+                    timer_registers[i * REG_PER_TIMER + REG_PRE] * TIMER_CYCLES_PER_TICK;
 #ifdef DEBUG
         printf("\t%d : %d\n", timer_registers[i * REG_PER_TIMER + REG_CNT], timer_registers[i * REG_PER_TIMER + REG_PRE]);
-        printf("\tTimer %d was off, will now be activated for %ld s, %ld ns.\n", i, requested[i].tv_sec, requested[i].tv_nsec);
+        printf("\tTimer %d will now be activated for %llu cycles.\n", i, unit->period[i]);
 #endif
-        pthread_create(thread_list + i, NULL, (void *) timer, (void *) (id + i));
-    } else {
-        if (thread_list[i]) {
+        heap_insert(unit, i, unit->now + unit->period[i]);
+    }
 #ifdef DEBUG
-            printf("\tTimer %d was on, will now be deactivated.\n", i);
+    else
+        printf("\tTimer %d is deactivated.\n", i);
 #endif
-            if (pthread_cancel(thread_list[i])) {
-              perror("[1, 0] timer could not be removed");
-              exit(-1);
-            }
-
-            if (pthread_join(thread_list[i], NULL)) {
-                perror("[1, 1] timer could not be removed");
-                exit(-1);
-            }
-        }
-    }
 }
 
-void timer(unsigned int *id) {  // This implements one of n timers.
-    for (;;) {
-#ifdef DEBUG
-        printf("\t\tTimer %d instantiated. Interval = %ld s, %ld ns\n", *id, requested[*id].tv_sec, requested[*id].tv_nsec);
-#endif
-        nanosleep(&requested[*id], &remaining[*id]);
+/*
+**  Advance the emulated time and mark every timer whose deadline has been reached as pending. Since there is only one
+** interrupt request line, a pending interrupt is delivered as soon as the previous request has been taken by the CPU.
+*/
+void timerAdvance(timer_module *unit, unsigned long long cycles) {
+    timer_event *heap = unit->heap;
+    unsigned int timer;
+
+    unit->now += cycles;
+    while (unit->heap_size && heap[0].deadline <= unit->now) {
+        timer = heap[0].timer;
 #ifdef DEBUG
-        printf("\t\tTimer %d triggered: INT = %04X.\n", *id, timer_registers[*id * REG_PER_TIMER + REG_INT]);;
+        printf("\t\tTimer %d triggered: INT = %04X.\n", timer, unit->registers[timer * REG_PER_TIMER + REG_INT]);
 #endif
+        unit->pending |= 1 << timer;
 
-        *interrupt_address = timer_registers[*id * REG_PER_TIMER + REG_INT];
-        *interrupt_request = TRUE;
+        // Intervals which have completely passed in between (long batches) are skipped like lost interrupts
+        heap[0].deadline += unit->period[timer] * ((unit->now - heap[0].deadline) / unit->period[timer] + 1);
+        heap_sift_down(unit, 0);
     }
+
+    if (unit->pending && !*unit->interrupt_request) {
+        for (timer = 0; !(unit->pending & (1 << timer)); timer++);
+        unit->pending &= ~(1 << timer);
+        *unit->interrupt_address = unit->registers[timer * REG_PER_TIMER + REG_INT];
+        *unit->interrupt_request = TRUE;
+    }
+}
+
+/* Emulated time of the next timer interrupt, TIMER_NO_DEADLINE if no timer is active. */
+unsigned long long timerNextDeadline(timer_module *unit) {
+    return unit->heap_size ? unit->heap[0].deadline : TIMER_NO_DEADLINE;
+}
+
+unsigned long long timerNow(timer_module *unit) {
+    return unit->now;
 }
@@ -4,8 +4,6 @@
 ** 26-JUL-2020, B. Ulmann fecit
 */
 
-#include <pthread.h>
-
 #define NUMBER_OF_TIMERS    2
 #define REG_PER_TIMER       3
 
@@ -13,6 +11,11 @@
 #define REG_CNT             1
 #define REG_INT             2
 
+/* The system clock is 50 MHz, so one tick of the 100 kHz timer base lasts 500 clock cycles of emulated time. */
+#define TIMER_CYCLES_PER_TICK       500
+#define TIMER_TICK_NS               10000
+#define TIMER_NO_DEADLINE           (~0ull)
+
 #define TIMER_0_PRE         0
 #define TIMER_0_CNT         1
 #define TIMER_0_INT         2
@@ -20,7 +23,28 @@
 #define TIMER_1_CNT         4
 #define TIMER_1_INT         5
 
-unsigned int readTimerDeviceRegister(unsigned int);
-void writeTimerDeviceRegister(unsigned int, unsigned int);
-void initializeTimerModule(unsigned int *, unsigned int *);
-void timer(unsigned int *);
+typedef struct timer_event {
+    unsigned long long deadline;                                // Emulated time of the next interrupt
+    unsigned int timer;
+} timer_event;
+
+/* State of one timer module, every emulated machine has its own one. */
+typedef struct timer_module {
+    unsigned int registers[NUMBER_OF_TIMERS * REG_PER_TIMER],   // Register variables
+        *interrupt_request,                                     // This is mapped to the interrupt_request flag in qnice.c
+        *interrupt_address,                                     // This is mapped to the interrupt_address in the emulator
+        pending;                                                // Bitmask of timers whose interrupt is not yet delivered
+    unsigned long long now,                                     // Emulated time in clock cycles
+        period[NUMBER_OF_TIMERS];                               // Interval of each active timer in clock cycles
+    timer_event heap[NUMBER_OF_TIMERS];                         // Min-heap of the deadlines of all active timers
+    unsigned int heap_size;
+    int heap_position[NUMBER_OF_TIMERS];                        // Index into heap for each timer, -1 if inactive
+} timer_module;
+
+unsigned int readTimerDeviceRegister(timer_module *, unsigned int);
+void writeTimerDeviceRegister(timer_module *, unsigned int, unsigned int);
+void initializeTimerModule(timer_module *, unsigned int *, unsigned int *);
+void registerTimerSnapshot(timer_module *);
+void timerAdvance(timer_module *, unsigned long long);
+unsigned long long timerNextDeadline(timer_module *);
+unsigned long long timerNow(timer_module *);
@@ -0,0 +1,104 @@
+/*
+**  Queries of execution traces, built from recorder.c (see recorder.h and make-trace.bash).
+**
+**  Without options the number of events of a trace is printed. -w answers "who wrote this address last?": the last
+** write to the address (before the cycle given by -c) with the instruction performing it, -a lists all writes to the
+** address instead. -l lists the events of the instructions -f ... -f + -n - 1, e.g. to see what led to a write.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "recorder.h"
+
+#define DEFAULT_LIST_LENGTH 100
+
+static recorder_module gbl$trace;
+
+/* The instruction (address) performing a write is the last one before it */
+void print_write(record_event *event, unsigned int pc) {
+  printf("%12llu %12llu  %04X  %04X -> %04X\n", event->cycles, event->instruction, pc, event->value, event->address);
+}
+
+int main(int argc, char **argv) {
+  unsigned long long before = ~0ull, first = 0, count = DEFAULT_LIST_LENGTH, instructions = 0, cycles = 0;
+  unsigned int address = 0, pc = 0, last_pc = 0, query_writes = 0, all_writes = 0, list = 0, found = 0;
+  record_event event, last_write;
+  char text[128];
+  int option;
+
+  while ((option = getopt(argc, argv, "ac:f:ln:w:")) != -1)
+    switch (option) {
+      case 'a': all_writes = 1; break;
+      case 'c': before = strtoull(optarg, NULL, 0); break;
+      case 'f': first = strtoull(optarg, NULL, 0); break;
+      case 'l': list = 1; break;
+      case 'n': count = strtoull(optarg, NULL, 0); break;
+      case 'w': address = strtoul(optarg, NULL, 16) & 0xffff, query_writes = 1; break;
+      default:
+        fprintf(stderr, "Usage: %s [-w address [-a] [-c cycle]] [-l [-f first] [-n count]] trace\n\
+\t-w prints the last write to the (hexadecimal) address and the instruction performing it\n\
+\t-a prints all writes to the address\n\
+\t-c only considers the events before the cycle\n\
+\t-l lists the events of -n instructions starting with instruction -f (counting from 0)\n", argv[0]);
+        return 2;
+    }
+
+  if (optind + 1 != argc) {
+    fprintf(stderr, "Expected one trace written by qnice (RECORD, -T)\n");
+    return 2;
+  }
+  if (recorder_open(&gbl$trace, argv[optind], NULL)) {
+    fprintf(stderr, "%s is no trace\n", argv[optind]);
+    return 2;
+  }
+
+  if (query_writes)
+    printf("       Cycle  Instruction    PC  Value    Address\n");
+  while (recorder_read(&gbl$trace, &event)) {
+    if (event.type != RECORD_INSTRUCTION && event.cycles >= before)
+      break;
+    if (event.type == RECORD_INSTRUCTION)
+      pc = event.address;
+    else if (event.type == RECORD_WRITE && query_writes && event.address == address) {
+      if (all_writes)
+        print_write(&event, pc);
+      last_write = event;
+      last_pc = pc;
+      found++;
+    }
+
+    if (list && !query_writes && event.instruction - first >= count && event.instruction >= first)
+      break;
+    if (list && event.instruction >= first && event.instruction - first < count) {
+      recorder_describe(&event, text, sizeof(text));
+      printf("%s\n", text);
+    }
+  }
+  instructions = gbl$trace.instructions;
+  cycles = gbl$trace.cycles - gbl$trace.header.cycles;
+
+  if (query_writes && !all_writes && found)
+    print_write(&last_write, last_pc);
+  if (query_writes && !found)
+    printf("No write to %04X\n", address);
+
+  if (!query_writes && !list) {
+    printf("Trace %s starting at cycle %llu, %s\n", argv[optind], gbl$trace.header.cycles,
+           gbl$trace.complete ? "complete" : "without trailer (the recording has not been ended)");
+    printf("\tInstructions:        %16llu (%llu skipped in idle loops)\n", instructions,
+           instructions - gbl$trace.events[RECORD_INSTRUCTION]);
+    printf("\tCycles:              %16llu\n", gbl$trace.complete ? gbl$trace.trailer.cycles : cycles);
+    printf("\tWrites:              %16llu\n", gbl$trace.events[RECORD_WRITE]);
+    printf("\tIO reads:            %16llu\n", gbl$trace.events[RECORD_INPUT]);
+    printf("\tInterrupts:          %16llu\n", gbl$trace.events[RECORD_INTERRUPT]);
+    printf("\tIdle loops skipped:  %16llu\n", gbl$trace.events[RECORD_SKIP]);
+    printf("\tBytes per instruction: %14.2f\n", gbl$trace.events[RECORD_INSTRUCTION]
+           ? (double) gbl$trace.size / gbl$trace.events[RECORD_INSTRUCTION] : 0.0);
+  }
+
+  recorder_close(&gbl$trace, 0);
+  return 0;
+}
@@ -6,6 +6,11 @@
 ** 03-AUG-2015, B. Ulmann Changed from curses to select-calls.
 ** 28-DEC-2015, B. Ulmann Adapted to the current FPGA-implementation.
 ** FEB-2020, sy2002 added non-blocking multithreaded version for the VGA emulator
+**
+** The terminal build (no USE_VGA) reads STDIN in a background thread, too, as long as STDIN is
+** a terminal. Reading SRA and RHRA then only checks the FIFO instead of waiting in select().
+** For headless runs, input and output can be redirected to files using uart_redirect().
+** The library build (QNICE_LIBRARY) only uses redirected input and output, see qnice_machine.h.
 */
 
 #undef TEST /* Define to perform stand alone test */
@@ -15,13 +20,15 @@
 #include <stdlib.h>
 #include <termios.h>
 #include <unistd.h>
+#include <poll.h>
 
+#include "io.h"
 #include "uart.h"
+#include "fifo.h"
 
-#ifdef USE_VGA
-# include <poll.h>
-# include "fifo.h"
 fifo_t*             uart_fifo; 
+
+#ifdef USE_VGA
 bool                uart_getchar_thread_running;  //flag to safely free the FIFO's memory
 extern bool         gbl$cpu_running;              //the getchar thread stops when the CPU stops
 
@@ -43,25 +50,68 @@ extern bool         gbl$cpu_running;              //the getchar thread stops whe
        such a big FIFO at Emscripten. */
     const unsigned int  uart_fifo_size = 2*32*1024;
     #endif
+#else
+# include <pthread.h>
+/* Same reasoning as above: Pasting .out files into the M/L mode of the monitor must not overflow the FIFO. */
+const unsigned int  uart_fifo_size = 16*2*32*1024;
+pthread_t           uart_reader_thread_id;
+volatile bool       uart_reader_thread_stop;      //set by uart_run_down to end the reader thread
+bool                uart_reader_thread_active = false;
+# ifndef QNICE_LIBRARY
+FILE                *uart_input = NULL, *uart_output = NULL; //NULL means STDIN resp. STDOUT, see uart_redirect
+# else
+/* Every thread of the library runs its own machine which sets its handles before each run, see qnice_machine.h.
+   NULL means that there is no input resp. that the output is discarded, the terminal is never touched. */
+static __thread FILE *uart_input = NULL, *uart_output = NULL;
+# endif
 #endif
 
 /* Ugly global variable to hold the original tty state in order to restore it during rundown */
 struct termios tty_state_old, tty_state;
+bool tty_state_valid = false;
 enum uart_status_t uart_status = uart_undef;
 
-unsigned int uart_read_register(uart *state, unsigned int address)
+#ifndef USE_VGA
+/*
+** Without a reader thread (STDIN is a file or a pipe) the input is polled directly. select() must not
+** wait here, since the monitor polls SRA in a tight loop.
+*/
+static bool uart_stdin_ready()
 {
-  unsigned int value;
-  char last_character;
   fd_set fd;
-  struct timeval tv;
-  int ret_val;
+  struct timeval tv = {0, 0};
+  FILE *input = uart_input ? uart_input : stdin;
+  int c;
 
-  /* Initialize data structures for following select calls */
-  FD_ZERO(&fd);
-  FD_SET(STDIN_FILENO, &fd);
-  tv.tv_sec = 0;
-  tv.tv_usec = 1000; /* Wait 1 ms */
+#ifdef QNICE_LIBRARY
+  if (!uart_input)
+    return false;
+#endif
+
+  /* Redirected input never blocks, it is ready unless its end has been reached */
+  if (!uart_input)
+  {
+    FD_ZERO(&fd);
+    FD_SET(STDIN_FILENO, &fd);
+    if (select(1, &fd, NULL, NULL, &tv) <= 0) /* -1 might be caused by a catched CTRL-C signal! */
+      return false;
+  }
+
+  /* At the end of a file or pipe select() reports STDIN to be ready, too. A redirected input file stays at its end. */
+  if (feof(input) || (c = getc(input)) == EOF)
+  {
+    if (!uart_input)
+      clearerr(input);
+    return false;
+  }
+  ungetc(c, input);
+  return true;
+}
+#endif
+
+unsigned int uart_read_register(uart *state, unsigned int address)
+{
+  unsigned int value;
 
   switch (address)
   {
@@ -71,21 +121,19 @@ unsigned int uart_read_register(uart *state, unsigned int address)
       break;
     case SRA:
 #ifndef USE_VGA
-      /* Check if there is a character in the input buffer */
-      if ((ret_val = select(1, &fd, NULL, NULL, &tv)) == -1)
+      if (!uart_reader_thread_active)
       {
-        /* Don't stop here as it might be caused by a catched CTRL-C signal! */
+        if (uart_stdin_ready()) /* Check if there is a character in the input buffer */
+          state->sra |= 1;
+        else
+          state->sra &= 0xfe; /* Do not touch the transmit-ready bit! */
       }
-      else if (!ret_val) /* No data available */
-        state->sra &= 0xfe; /* Do not touch the transmit-ready bit! */
-      else /* Data available */
-        state->sra |= 1;
-#else
-      if (uart_fifo->count)
+      else
+#endif
+      if (fifo_count(uart_fifo))
         state->sra |= 1;
       else
         state->sra &= 0xfe;
-#endif
       value = state->sra;
       break;
     case BRG_TEST:
@@ -93,20 +141,14 @@ unsigned int uart_read_register(uart *state, unsigned int address)
       break;
     case RHRA:
 #ifndef USE_VGA
-      if ((ret_val = select(1, &fd, NULL, NULL, &tv)) == -1)
-      {
-        /* Don't stop here as it might be caused by a catched CTRL-C signal! */
-      }
-      else if (!ret_val) /* No data available */
-        state->rhra = 0;
-      else /* Data available */
-        state->rhra = getchar() & 0xff;
-#else
-      if (uart_fifo->count)
+      if (!uart_reader_thread_active)
+        state->rhra = uart_stdin_ready() ? getc(uart_input ? uart_input : stdin) & 0xff : 0;
+      else
+#endif
+      if (fifo_count(uart_fifo))
         state->rhra = fifo_pull(uart_fifo);
       else
         state->rhra = 0;
-#endif
       value = state->rhra;
       break;
     case IPCR:
@@ -170,8 +212,17 @@ void uart_write_register(uart *state, unsigned int address, unsigned int value)
       break;
     case THRA:
       state->thra = value;
+#ifndef USE_VGA
+      if (uart_output) /* Redirected output is flushed by uart_run_down */
+      {
+        putc((int) value, uart_output);
+        break;
+      }
+#endif
+#ifndef QNICE_LIBRARY
       putchar((int) value);
       fflush(stdout);
+#endif
       break;
     case ACR:
       state->acr = value;
@@ -213,7 +264,7 @@ void uart_write_register(uart *state, unsigned int address, unsigned int value)
 #ifdef USE_VGA
 void uart_fifo_init()
 {
-  uart_fifo = fifo_init(uart_fifo_size);
+  uart_fifo = fifo_init(uart_fifo_size, 1);
 }
 
 void uart_fifo_free()
@@ -228,28 +279,89 @@ int uart_getchar_thread(void* param)
     usleep(10000);
 
   struct pollfd fds = {.fd = 0, .events = POLLIN}; // 0 means STDIN
-  int ret_val;
+  unsigned char buffer[4096];
+  ssize_t length, pushed, n;
 
   uart_getchar_thread_running = true;
   while (gbl$cpu_running)
   {
-      ret_val = poll(&fds, 1, 5); //timeout = 5ms
-      if (ret_val)
-        fifo_push(uart_fifo, getchar() & 0xff);
+      //pasted input is read and pushed in chunks; if the FIFO is full, wait for the CPU instead of dropping input
+      if (poll(&fds, 1, 5) > 0 && (length = read(0, buffer, sizeof(buffer))) > 0) //timeout = 5ms
+        for (pushed = 0; pushed < length && gbl$cpu_running; pushed += n)
+          if (!(n = fifo_push_bulk(uart_fifo, buffer + pushed, length - pushed)))
+            usleep(1000);
   }
   uart_getchar_thread_running = false;
   return 1;
 }
+#else
+/*
+** Background reader of the terminal build: Everything typed or pasted into the terminal is read in chunks
+** and stored in the FIFO, the thread is started by uart_hardware_initialization and ended by uart_run_down.
+*/
+static void *uart_reader_thread(void *param)
+{
+  struct pollfd fds = {.fd = STDIN_FILENO, .events = POLLIN};
+  unsigned char buffer[4096];
+  ssize_t length, pushed, n;
+
+  while (!uart_reader_thread_stop)
+  {
+    /* If the FIFO is full, wait for the CPU instead of dropping input */
+    if (poll(&fds, 1, 5) > 0 && (length = read(STDIN_FILENO, buffer, sizeof(buffer))) > 0) //timeout = 5ms
+      for (pushed = 0; pushed < length && !uart_reader_thread_stop; pushed += n)
+        if (!(n = fifo_push_bulk(uart_fifo, buffer + pushed, length - pushed)))
+          usleep(1000);
+  }
+  return NULL;
+}
+
+/* Read from input and write to output instead of STDIN/STDOUT, NULL keeps the respective default. */
+void uart_redirect(FILE *input, FILE *output)
+{
+  uart_input = input;
+  uart_output = output;
+}
+#endif
+
+/*
+** Wait at most timeout_ns nanoseconds for input, this is used by the idle loop detection of the emulator. The result
+** is one of the IO_INPUT_* values of io.h, IO_INPUT_NEVER is returned at once if no input can arrive anymore.
+*/
+int uart_wait_input(long long timeout_ns)
+{
+#ifndef USE_VGA
+  if (!uart_reader_thread_active)
+  {
+# ifndef QNICE_LIBRARY
+    /* STDIN might be a pipe whose writer has not yet delivered anything */
+    fd_set fd;
+    struct timeval tv = {timeout_ns / 1000000000, timeout_ns % 1000000000 / 1000};
+
+    FD_ZERO(&fd);
+    FD_SET(STDIN_FILENO, &fd);
+    if (!uart_input && select(1, &fd, NULL, NULL, &tv) <= 0)
+      return IO_INPUT_TIMEOUT;
+# endif
+    /* Redirected input is a file, at its end nothing will follow */
+    return uart_stdin_ready() ? IO_INPUT_READY : IO_INPUT_NEVER;
+  }
 #endif
+  return fifo_wait(uart_fifo, timeout_ns) ? IO_INPUT_READY : IO_INPUT_TIMEOUT;
+}
 
 void uart_hardware_initialization(uart *state)
 {
-  /* Turn off buffering on STDIN and save original state for later */
-  tcgetattr(STDIN_FILENO, &tty_state_old);
-  tty_state = tty_state_old;
-  tty_state.c_lflag &= ~ICANON;
-  tty_state.c_lflag &= ~ECHO;
-  tcsetattr(STDIN_FILENO, TCSANOW, &tty_state);
+#ifndef QNICE_LIBRARY
+  /* Turn off buffering on STDIN (if it is a terminal) and save original state for later */
+  if ((tty_state_valid = !tcgetattr(STDIN_FILENO, &tty_state_old)))
+  {
+    tty_state = tty_state_old;
+    tty_state.c_lflag &= ~ICANON;
+    tty_state.c_lflag &= ~ECHO;
+    tcsetattr(STDIN_FILENO, TCSANOW, &tty_state);
+  }
+#endif
 
   /*
   ** bit 1, 0: 11 -> 8 bits/character
@@ -268,14 +380,40 @@ void uart_hardware_initialization(uart *state)
   state->csra = state->cra = state->thra = state->acr = state->imr = state->crur = state->ctlr = state->csrb = state->crb =
   state->thrb = state->opcr = state->set_output_port = state->reset_output_port = (unsigned int) 0;
 
+#ifndef QNICE_LIBRARY
   uart_status = uart_init;
+#endif
+
+#if !defined(USE_VGA) && !defined(QNICE_LIBRARY)
+  /* Only terminals are read in the background, otherwise input following a RUN command in a file or pipe
+     would be consumed, too. */
+  if (!uart_fifo)
+    uart_fifo = fifo_init(uart_fifo_size, 1);
+  uart_reader_thread_stop = false;
+  uart_reader_thread_active = !uart_input && isatty(STDIN_FILENO) &&
+                              !pthread_create(&uart_reader_thread_id, NULL, uart_reader_thread, NULL);
+#endif
 }
 
 void uart_run_down()
 {
+#ifndef USE_VGA
+  if (uart_reader_thread_active)
+  {
+    uart_reader_thread_stop = true;
+    pthread_join(uart_reader_thread_id, NULL);
+    uart_reader_thread_active = false;
+  }
+  if (uart_output)
+    fflush(uart_output);
+#endif
+
+#ifndef QNICE_LIBRARY
   /* Reset the terminal to its original settings */
-  tcsetattr(STDIN_FILENO, TCSANOW, &tty_state_old);
+  if (tty_state_valid)
+    tcsetattr(STDIN_FILENO, TCSANOW, &tty_state_old);
   uart_status = uart_rundown;
+#endif
 }
 
 /*
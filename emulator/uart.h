@@ -7,6 +7,7 @@
 */
 
 #include <stdbool.h>
+#include <stdio.h>
 
 //QNICE-FPGA is currently only emulating registers 1, 2 and 3
 #define UART_NUMBER_OF_REGISTERS    4
@@ -55,16 +56,22 @@ typedef struct uart
 #define RESET_OUTPUT_PORT 15
 
 //flag to ensure restoring a working terminal when closing the emulator by closing the SDL window
-enum uart_status_t {uart_undef, uart_init, uart_rundown} uart_status;
+enum uart_status_t {uart_undef, uart_init, uart_rundown};
+extern enum uart_status_t uart_status;
 
 unsigned int uart_read_register(uart *, unsigned int);
 void uart_write_register(uart *, unsigned int, unsigned int);
 void uart_hardware_initialization(uart *);
 void uart_run_down();
+int uart_wait_input(long long timeout_ns);
+
+#ifndef USE_VGA
+void uart_redirect(FILE *input, FILE *output);
+#endif
 
 #ifdef USE_VGA
 int  uart_getchar_thread(void* param);
-bool uart_getchar_thread_running;
+extern bool uart_getchar_thread_running;
 void uart_fifo_init();
 void uart_fifo_free();
 #endif
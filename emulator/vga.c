@@ -13,7 +13,15 @@
 ** In this context and for better code readability, we did not prevent these
 ** harmless race-conditions. If this changes one day, here are the sensitive areas:
 ** kbd_state, kbd_data, vga_state, vga_x, vga_y, vga_offs_display,
-** vga_offs_rw, vram, screen_pixels
+** vga_offs_rw, vram
+**
+** Rendering: The CPU thread only writes to the video ram (vram). Once per frame,
+** the display thread compares the visible part of the vram with the characters
+** that are currently rendered in the pixel buffer (rendered_chars) and renders
+** only the cells that differ, so scrolling via VGA$OFFS_DISPLAY and any number of
+** characters printed between two frames cost at most one pass over the screen.
+** Only the rows of characters that have been rendered are uploaded to the texture.
+** Glyphs are expanded from the 1-bit font with SSE2 resp. AVX2 if available.
 */
 
 #include <stdbool.h>
@@ -23,9 +31,16 @@
 #include "fifo.h"
 #include "vga.h"
 #include "vga_font.h"
+#include "snapshot.h"
 
 #include "../dist_kit/sysdef.h"
 
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
 //in native VGA mode (no emscripten): stabilize display thread to ~60 FPS
 const unsigned long stable_fps_ms = 16; 
 
@@ -58,8 +73,14 @@ fifo_t*         kbd_fifo;
 
 const float     zoom_x      = (float) display_dx / (float) render_dx;
 const float     zoom_y      = (float) display_dy / (float) render_dy;
+const Uint32    font_color  = 0x0000ff00;
 static Uint32   font[font_dx * font_dy * QNICE_FONT_CHARS];
 
+//character currently rendered in each cell of the pixel buffer, no_char forces rendering the cell
+#define no_char   ((Uint16) 0xFFFF)
+static Uint16   rendered_chars[screen_dx * screen_dy];
+static Uint64   dirty_rows;     //bit n: row n of characters has to be uploaded to the texture
+
 static bool     cursor = false;
 static float    cursor_fx, cursor_fy; //compensation factors for non-propotionally resized window
 
@@ -84,7 +105,6 @@ extern float         gbl$mips;
 extern unsigned long gbl$mips_inst_cnt;
 extern bool          gbl$shutdown_signal;
 extern bool          gbl$speedstats;
-bool                 speedstats_rendered;
 
 const unsigned int   speed_change_timer_duration = 3000;    //display duration of speed change in ms
 unsigned int         speed_change_timer = 0;
@@ -114,10 +134,10 @@ unsigned int kbd_read_register(unsigned int address)
             kbd_state &= 0xFFFC; //clear new key indicators
             return kbd_data;
 #else
-            if (kbd_fifo->count)
+            if (fifo_count(kbd_fifo))
             {
                 //no more keys after this key?
-                if (kbd_fifo->count == 1)
+                if (fifo_count(kbd_fifo) == 1)
                     kbd_state &= 0xFFFC;
                 return fifo_pull(kbd_fifo);
             }
@@ -136,6 +156,14 @@ void kbd_write_register(unsigned int address, unsigned int value)
     }
 }
 
+/* Wait at most timeout_ns nanoseconds for a key (idle loop detection), keys are set by the SDL event loop */
+bool kbd_wait_input(long long timeout_ns)
+{
+    for (; !(kbd_state & KBD_NEW_ANY) && timeout_ns > 0; timeout_ns -= 1000000)
+        SDL_Delay(1);
+    return kbd_state & KBD_NEW_ANY;
+}
+
 void kbd_handle_keydown(SDL_Keycode keycode, SDL_Keymod keymod)
 {
     bool shift_pressed;
@@ -358,7 +386,6 @@ void vga_write_register(unsigned int address, unsigned int value)
 
         case VGA_OFFS_DISPLAY:
             vga_offs_display = value;
-            vga_refresh_rendering();
             break;
 
         /* As you can see in "write_vga_registers" in file "vga_textmode.vhd" of hardware
@@ -374,16 +401,30 @@ void vga_write_register(unsigned int address, unsigned int value)
             break;
 
         case VGA_CHAR:
-            //store character to video ram (vram)
+            //store character to video ram (vram), the next frame renders it (see vga_update_pixelbuffer)
             vram[((vga_y * screen_dx + vga_x) & 0x0FFF) + vga_offs_rw] = value;
-            //make sure that the to-be-printed char is within the visible window
-            unsigned int print_addr = vga_offs_rw + vga_y * screen_dx + vga_x;
-            if (print_addr >= vga_offs_display && print_addr < vga_offs_display + screen_dy * screen_dx)
-                vga_render_to_pixelbuffer(vga_x, vga_y, (Uint8) value);
             break;
     }
 }
 
+/* After restoring a snapshot the pixel buffer has to be rendered from the restored video ram. */
+static void vga_after_restore(void* context)
+{
+    vga_refresh_rendering();
+}
+
+void vga_register_snapshot()
+{
+    snapshot_register("vga_vram", vram, sizeof(vram), NULL, vga_after_restore, NULL, NULL, 0);
+    snapshot_register("vga_state", &vga_state, sizeof(vga_state), NULL, NULL, NULL, NULL, 0);
+    snapshot_register("vga_x", &vga_x, sizeof(vga_x), NULL, NULL, NULL, NULL, 0);
+    snapshot_register("vga_y", &vga_y, sizeof(vga_y), NULL, NULL, NULL, NULL, 0);
+    snapshot_register("vga_offs_display", &vga_offs_display, sizeof(vga_offs_display), NULL, NULL, NULL, NULL, 0);
+    snapshot_register("vga_offs_rw", &vga_offs_rw, sizeof(vga_offs_rw), NULL, NULL, NULL, NULL, 0);
+    snapshot_register("kbd_state", &kbd_state, sizeof(kbd_state), NULL, NULL, NULL, NULL, 0);
+    snapshot_register("kbd_data", &kbd_data, sizeof(kbd_data), NULL, NULL, NULL, NULL, 0);
+}
+
 int vga_init()
 {
 #ifndef __EMSCRIPTEN__
@@ -413,16 +454,16 @@ int vga_init()
     gbl$sdl_ticks = SDL_GetTicks(); //in non-emscripten mode done by vga_timebase_thread
 #endif
     fps = fps_framecounter = 0;
-    speedstats_rendered = gbl$speedstats;
     
-    kbd_fifo = fifo_init(kbd_fifo_size);
+    kbd_fifo = fifo_init(kbd_fifo_size, sizeof(Uint16)); //keyboard codes are 16 bits wide
 
     unsigned long pixelheap = render_dx * render_dy * sizeof(Uint32);
-    if ((screen_pixels = malloc(pixelheap)) == 0)
+    if ((screen_pixels = calloc(1, pixelheap)) == 0)
     {
         printf("Out of memory. Need %lu bytes of heap.", pixelheap);
         return 0;
     }
+    vga_refresh_rendering();
 
     Uint32 create_win_flags = SDL_WINDOW_OPENGL;
 #ifndef __EMSCRIPTEN__
@@ -465,13 +506,13 @@ int vga_init()
     return 1;
 }
 
+/* The font cache is used by the scalar renderer, the SIMD renderers expand the glyphs directly from the font */
 void vga_create_font_cache()
 {
-    const Uint32 green = 0x0000ff00;
     for (int i = 0; i < QNICE_FONT_CHARS; i++)
         for (int char_y = 0; char_y < font_dy; char_y++)
             for (int char_x = 0; char_x < font_dx; char_x++)
-                font[i * font_dx * font_dy + char_y * font_dx + char_x] = qnice_font[i * font_dy + char_y] & (128 >> char_x) ? green : 0;
+                font[i * font_dx * font_dy + char_y * font_dx + char_x] = qnice_font[i * font_dy + char_y] & (128 >> char_x) ? font_color : 0;
 }
 
 void vga_shutdown()
@@ -504,8 +545,6 @@ void vga_clear_screen()
     vga_state |= VGA_BUSY | VGA_CLR_SCRN;
     for (Uint32 i = 0; i < 65535; i++)
         vram[i] = ' ';
-    for (Uint32 i = 0; i < render_dx * render_dy; i++)
-        screen_pixels[i] = 0;
     vga_state &= ~(VGA_BUSY | VGA_CLR_SCRN);
 }
 
@@ -517,15 +556,26 @@ void vga_print(int x, int y, char* s)
         vga_render_to_pixelbuffer(x + i, y, s[i]);
 }    
 
-/* For performance reasons, during normal operation, the vram is not completely rendered, but only the
-   region that changed while writing a char using the respective registers.
-   vga_refresh_rendering is used to restore the vram on screen (inside the pixelbuffer), e.g. to restore
-   the background after having shown the speed change window or the speedstats */
+/* vga_refresh_rendering forces the next frame to render the whole vram on screen (inside the pixelbuffer),
+   e.g. after the vram has been restored from a snapshot */
 void vga_refresh_rendering()
 {
-    for (int y = 0; y < screen_dy; y++)
-        for (int x = 0; x < screen_dx; x++)
-            vga_render_to_pixelbuffer(x, y, vram[y * screen_dx + x + vga_offs_display]);
+    for (int i = 0; i < screen_dx * screen_dy; i++)
+        rendered_chars[i] = no_char;
+}
+
+/* For performance reasons, the vram is not completely rendered on each frame, but only the cells that differ
+   from the characters in the pixelbuffer. This also restores the background after having shown the speed
+   change window or the speedstats, as these are printed directly into the pixelbuffer by vga_print */
+void vga_update_pixelbuffer()
+{
+    for (int y = 0, i = 0; y < screen_dy; y++)
+        for (int x = 0; x < screen_dx; x++, i++)
+        {
+            Uint8 c = (Uint8) vram[i + vga_offs_display];
+            if (rendered_chars[i] != c)
+                vga_render_to_pixelbuffer(x, y, c);
+        }
 }
 
 void vga_render_to_pixelbuffer(int x, int y, Uint8 c)
@@ -533,15 +583,35 @@ void vga_render_to_pixelbuffer(int x, int y, Uint8 c)
     if (x < 0 || x >= screen_dx || y < 0 || y >= screen_dy)
         return;
 
-    unsigned long scr_offs = y * font_dy * render_dx + x * font_dx;
-    unsigned long fnt_offs = font_dx * font_dy * c;
-    for (int char_y = 0; char_y < font_dy; char_y++)
+    rendered_chars[y * screen_dx + x] = c;
+    dirty_rows |= (Uint64) 1 << y;
+
+    Uint32* pixels = screen_pixels + y * font_dy * render_dx + x * font_dx;
+#if defined(__AVX2__)
+    //one glyph row (8 pixels) per instruction: lane n is set if bit 7-n of the font byte is set
+    const __m256i bits  = _mm256_set_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i color = _mm256_set1_epi32(font_color);
+    for (int char_y = 0; char_y < font_dy; char_y++, pixels += render_dx)
+    {
+        __m256i row = _mm256_and_si256(_mm256_set1_epi32(qnice_font[c * font_dy + char_y]), bits);
+        _mm256_storeu_si256((__m256i*) pixels, _mm256_and_si256(_mm256_cmpeq_epi32(row, bits), color));
+    }
+#elif defined(__SSE2__)
+    //one glyph row (8 pixels) per two instructions: lane n is set if bit 7-n resp. 3-n of the font byte is set
+    const __m128i bits_lo = _mm_set_epi32(16, 32, 64, 128);
+    const __m128i bits_hi = _mm_set_epi32(1, 2, 4, 8);
+    const __m128i color   = _mm_set1_epi32(font_color);
+    for (int char_y = 0; char_y < font_dy; char_y++, pixels += render_dx)
     {
-        for (int char_x = 0; char_x < font_dx; char_x++)
-            screen_pixels[scr_offs + char_x] = font[fnt_offs + char_x]; 
-        scr_offs += render_dx;
-        fnt_offs += font_dx;
+        __m128i row = _mm_set1_epi32(qnice_font[c * font_dy + char_y]);
+        _mm_storeu_si128((__m128i*) pixels, _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(row, bits_lo), bits_lo), color));
+        _mm_storeu_si128((__m128i*) (pixels + 4), _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(row, bits_hi), bits_hi), color));
     }
+#else
+    const Uint32* glyph = font + font_dx * font_dy * c;
+    for (int char_y = 0; char_y < font_dy; char_y++, pixels += render_dx, glyph += font_dx)
+        memcpy(pixels, glyph, font_dx * sizeof(Uint32));
+#endif
 }
 
 void vga_render_cursor()
@@ -637,6 +707,7 @@ void vga_render_speedwin(const char* message)
 void vga_one_iteration_screen()
 {
     SDL_RenderClear(renderer);  
+    vga_update_pixelbuffer();
     
     //calculate FPS
     fps_framecounter++;
@@ -655,12 +726,6 @@ void vga_one_iteration_screen()
     {
         sprintf(fps_print_buffer, "    %.1f MIPS @ %d FPS", gbl$mips, fps);
         vga_print(screen_dx - strlen(fps_print_buffer), 0, fps_print_buffer);
-        speedstats_rendered = true;
-    }
-    else if (speedstats_rendered)
-    {
-        vga_refresh_rendering();
-        speedstats_rendered = false;
     }
 
     //show speed change window
@@ -669,14 +734,21 @@ void vga_one_iteration_screen()
         if (gbl$sdl_ticks - speed_change_timer < speed_change_timer_duration)
             vga_render_speedwin(speed_change_msg);
         else
-        {
-            vga_refresh_rendering();
             speed_change_timer = 0;
-        }
     }
 
-    //high-performance way of displaying the screen using streaming textures
-    SDL_UpdateTexture(screen_texture, NULL, screen_pixels, render_dx * sizeof(Uint32));
+    //high-performance way of displaying the screen using streaming textures: only upload the rows that changed
+    if (dirty_rows)
+    {
+        int first = 0, last = screen_dy - 1;
+        while (!(dirty_rows & ((Uint64) 1 << first)))
+            first++;
+        while (!(dirty_rows & ((Uint64) 1 << last)))
+            last--;
+        SDL_Rect rows = {0, first * font_dy, render_dx, (last - first + 1) * font_dy};
+        SDL_UpdateTexture(screen_texture, &rows, screen_pixels + rows.y * render_dx, render_dx * sizeof(Uint32));
+        dirty_rows = 0;
+    }
     SDL_RenderCopy(renderer, screen_texture, NULL, NULL);
     vga_render_cursor();    
     SDL_RenderPresent(renderer);
@@ -20,6 +20,7 @@ void            vga_write_register(unsigned int address, unsigned int value);
 
 unsigned int    kbd_read_register(unsigned int address);
 void            kbd_write_register(unsigned int address, unsigned int value);
+bool            kbd_wait_input(long long timeout_ns);
 
 int             vga_init();
 void            vga_shutdown();
@@ -27,12 +28,14 @@ void            vga_create_font_cache();
 int             vga_create_thread(vga_tft thread_func, const char* thread_name, void* param);
 void            vga_clear_screen();
 void            vga_refresh_rendering();
+void            vga_update_pixelbuffer();
 void            vga_render_to_pixelbuffer(int x, int y, Uint8 c);
 void            vga_render_cursor();
 void            vga_render_speedwin(const char* message);
 void            vga_print(int x, int y, char* s);
 void            vga_one_iteration_keyboard();
 void            vga_one_iteration_screen();
+void            vga_register_snapshot();
 
 #if defined(USE_VGA) && !defined(__EMSCRIPTEN__)
 int             vga_main_loop();
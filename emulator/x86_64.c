@@ -0,0 +1,209 @@
+/*
+**  Minimal x86-64 code emitter of the QNICE-emulator, see x86_64.h.
+**
+**  All instructions with a register or memory operand are encoded by emit_modrm(): an optional REX prefix, the
+** opcode, the ModRM byte, an optional SIB byte and an 8 or 32 bit displacement. Only the instructions needed by
+** the block compiler are supported, so there is no RIP relative or absolute addressing.
+*/
+
+#if defined(__x86_64__) && !defined(__EMSCRIPTEN__)
+
+#include <sys/mman.h>
+
+#include "x86_64.h"
+
+#ifndef TRUE
+# define TRUE 1
+# define FALSE !TRUE
+#endif
+
+int x86_64_create(x86_64_code *code, size_t size) {
+  code->start = mmap(NULL, size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  code->size = code->start == MAP_FAILED ? 0 : size;
+  code->used = 0;
+  code->full = FALSE;
+  if (code->start != MAP_FAILED)
+    return 0;
+
+  code->start = NULL;
+  return -1;
+}
+
+void x86_64_destroy(x86_64_code *code) {
+  if (code->start)
+    munmap(code->start, code->size);
+  code->start = NULL;
+  code->size = code->used = 0;
+}
+
+x86_64_operand x86_64_register(int reg) {
+  return (x86_64_operand) {.base = reg, .index = X86_NONE, .scale = 1, .displacement = 0, .direct = TRUE};
+}
+
+x86_64_operand x86_64_memory(int base, int displacement) {
+  return (x86_64_operand) {.base = base, .index = X86_NONE, .scale = 1, .displacement = displacement, .direct = FALSE};
+}
+
+x86_64_operand x86_64_indexed(int base, int index, int scale, int displacement) {
+  return (x86_64_operand) {.base = base, .index = index, .scale = scale, .displacement = displacement, .direct = FALSE};
+}
+
+static void emit_byte(x86_64_code *code, unsigned int byte) {
+  if (code->used < code->size)
+    code->start[code->used++] = byte;
+  else
+    code->full = TRUE;
+}
+
+static void emit_value(x86_64_code *code, unsigned long long value, unsigned int bytes) {
+  for (; bytes; bytes--, value >>= 8)
+    emit_byte(code, value & 0xff);
+}
+
+/* reg is a register or the /digit extending the opcode, opcodes above 0xff are two bytes (0x0f xx) */
+static void emit_modrm(x86_64_code *code, int wide, unsigned int opcode, int reg, x86_64_operand rm) {
+  unsigned int rex = 0x40 | (wide ? 8 : 0) | (reg & 8 ? 4 : 0) | (rm.index != X86_NONE && (rm.index & 8) ? 2 : 0)
+                   | (rm.base & 8 ? 1 : 0),
+    mode, sib = rm.index != X86_NONE || (rm.base & 7) == X86_RSP;
+
+  if (rex != 0x40)
+    emit_byte(code, rex);
+  if (opcode > 0xff)
+    emit_byte(code, opcode >> 8);
+  emit_byte(code, opcode & 0xff);
+
+  if (rm.direct) {
+    emit_byte(code, 0xc0 | (reg & 7) << 3 | (rm.base & 7));
+    return;
+  }
+
+  if (!rm.displacement && (rm.base & 7) != X86_RBP)
+    mode = 0;
+  else if (rm.displacement >= -128 && rm.displacement < 128)
+    mode = 1;
+  else
+    mode = 2;
+  emit_byte(code, mode << 6 | (reg & 7) << 3 | (sib ? 4 : rm.base & 7));
+  if (sib)
+    emit_byte(code, (rm.scale == 8 ? 3 : rm.scale == 4 ? 2 : rm.scale == 2 ? 1 : 0) << 6
+                    | (rm.index == X86_NONE ? 4 : rm.index & 7) << 3 | (rm.base & 7));
+  if (mode)
+    emit_value(code, rm.displacement, mode == 1 ? 1 : 4);
+}
+
+void x86_64_load(x86_64_code *code, int reg, x86_64_operand source) {
+  emit_modrm(code, FALSE, 0x8b, reg, source);
+}
+
+void x86_64_store(x86_64_code *code, x86_64_operand destination, int reg) {
+  emit_modrm(code, FALSE, 0x89, reg, destination);
+}
+
+void x86_64_load_wide(x86_64_code *code, int reg, x86_64_operand source) {
+  emit_modrm(code, TRUE, 0x8b, reg, source);
+}
+
+void x86_64_move_immediate(x86_64_code *code, x86_64_operand destination, unsigned int value) {
+  emit_modrm(code, FALSE, 0xc7, 0, destination);
+  emit_value(code, value, 4);
+}
+
+void x86_64_store_byte(x86_64_code *code, x86_64_operand destination, unsigned int value) {
+  emit_modrm(code, FALSE, 0xc6, 0, destination);
+  emit_byte(code, value & 0xff);
+}
+
+void x86_64_lea(x86_64_code *code, int reg, x86_64_operand address, int wide) {
+  emit_modrm(code, wide, 0x8d, reg, address);
+}
+
+void x86_64_extend(x86_64_code *code, unsigned int opcode, int reg, x86_64_operand source) {
+  emit_modrm(code, FALSE, opcode, reg, source);
+}
+
+void x86_64_alu(x86_64_code *code, int operation, x86_64_operand destination, int reg) {
+  emit_modrm(code, FALSE, operation << 3 | 1, reg, destination);
+}
+
+void x86_64_alu_load(x86_64_code *code, int operation, int reg, x86_64_operand source) {
+  emit_modrm(code, FALSE, operation << 3 | 3, reg, source);
+}
+
+void x86_64_alu_immediate(x86_64_code *code, int operation, x86_64_operand destination, int value, int wide) {
+  if (value >= -128 && value < 128) {
+    emit_modrm(code, wide, 0x83, operation, destination);
+    emit_byte(code, value & 0xff);
+  } else {
+    emit_modrm(code, wide, 0x81, operation, destination);
+    emit_value(code, value, 4);
+  }
+}
+
+void x86_64_multiply_immediate(x86_64_code *code, int reg, x86_64_operand source, int value) {
+  emit_modrm(code, FALSE, 0x69, reg, source);
+  emit_value(code, value, 4);
+}
+
+void x86_64_test_immediate(x86_64_code *code, x86_64_operand operand, unsigned int value) {
+  emit_modrm(code, FALSE, 0xf7, 0, operand);
+  emit_value(code, value, 4);
+}
+
+void x86_64_unary(x86_64_code *code, int operation, x86_64_operand operand) {
+  emit_modrm(code, FALSE, operation & 0x100 ? 0xff : 0xf7, operation & 0xff, operand);
+}
+
+void x86_64_shift(x86_64_code *code, int operation, x86_64_operand operand, unsigned int count) {
+  emit_modrm(code, FALSE, 0xc1, operation, operand);
+  emit_byte(code, count & 0x1f);
+}
+
+void x86_64_setcc(x86_64_code *code, int condition, int reg) {
+  emit_modrm(code, FALSE, 0x0f90 | condition, 0, x86_64_register(reg));
+}
+
+size_t x86_64_jump(x86_64_code *code, int condition) {
+  if (condition == X86_ALWAYS)
+    emit_byte(code, 0xe9);
+  else {
+    emit_byte(code, 0x0f);
+    emit_byte(code, 0x80 | condition);
+  }
+  emit_value(code, 0, 4);
+  return code->used;
+}
+
+void x86_64_patch(x86_64_code *code, size_t position, size_t target) {
+  unsigned int displacement = target - position, i;
+
+  if (code->full)
+    return;
+  for (i = 0; i < 4; i++, displacement >>= 8)
+    code->start[position - 4 + i] = displacement & 0xff;
+}
+
+void x86_64_call(x86_64_code *code, void *function) {
+  emit_byte(code, 0x48); /* mov rax, imm64 */
+  emit_byte(code, 0xb8);
+  emit_value(code, (unsigned long long) function, 8);
+  emit_byte(code, 0xff); /* call rax */
+  emit_byte(code, 0xd0);
+}
+
+void x86_64_push(x86_64_code *code, int reg) {
+  if (reg & 8)
+    emit_byte(code, 0x41);
+  emit_byte(code, 0x50 | (reg & 7));
+}
+
+void x86_64_pop(x86_64_code *code, int reg) {
+  if (reg & 8)
+    emit_byte(code, 0x41);
+  emit_byte(code, 0x58 | (reg & 7));
+}
+
+void x86_64_return(x86_64_code *code) {
+  emit_byte(code, 0xc3);
+}
+
+#endif
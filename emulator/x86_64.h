@@ -0,0 +1,115 @@
+/*
+**  Header file of a minimal x86-64 code emitter, used by the block compiler of the QNICE-emulator (see
+** jit_compile_block() in qnice.c). It only knows the handful of instructions the compiler needs. Operands are 32 bit
+** unless wide is set, memory operands are base + index * scale + displacement.
+**
+**  The code is written to a buffer of executable memory. An instruction not fitting into the buffer sets full, the
+** caller checks this after a sequence of instructions and discards what it emitted.
+*/
+
+#ifndef X86_64_H
+#define X86_64_H
+
+#include <stddef.h>
+
+#define X86_RAX     0
+#define X86_RCX     1
+#define X86_RDX     2
+#define X86_RBX     3
+#define X86_RSP     4
+#define X86_RBP     5
+#define X86_RSI     6
+#define X86_RDI     7
+#define X86_R8      8
+#define X86_R9      9
+#define X86_R10     10
+#define X86_R11     11
+#define X86_R12     12
+#define X86_R13     13
+#define X86_R14     14
+#define X86_R15     15
+#define X86_NONE    (-1)
+
+#define X86_ADD     0 /* Arithmetic operations, the /digit of the opcodes 0x81 and 0x83 */
+#define X86_OR      1
+#define X86_ADC     2
+#define X86_SBB     3
+#define X86_AND     4
+#define X86_SUB     5
+#define X86_XOR     6
+#define X86_CMP     7
+
+#define X86_NOT     2 /* Unary operations (opcode 0xf7) */
+#define X86_NEG     3
+#define X86_INC     0x100 /* Opcode 0xff */
+#define X86_DEC     0x101
+
+#define X86_SHL     4 /* Shifts by a constant (opcode 0xc1) */
+#define X86_SHR     5
+
+#define X86_O       0x0 /* Condition codes of Jcc and SETcc */
+#define X86_NO      0x1
+#define X86_B       0x2
+#define X86_AE      0x3
+#define X86_E       0x4
+#define X86_NE      0x5
+#define X86_BE      0x6
+#define X86_A       0x7
+#define X86_S       0x8
+#define X86_NS      0x9
+#define X86_L       0xc
+#define X86_GE      0xd
+#define X86_LE      0xe
+#define X86_G       0xf
+#define X86_ALWAYS  0x10 /* Unconditional jump */
+
+#define X86_MOVZX8  0x0fb6 /* Zero resp. sign extensions, see x86_64_extend() */
+#define X86_MOVZX16 0x0fb7
+#define X86_MOVSX16 0x0fbf
+
+typedef struct x86_64_code {
+  unsigned char *start;                     /* Executable memory */
+  size_t size, used;
+  unsigned int full;                        /* TRUE if an instruction did not fit into the buffer */
+} x86_64_code;
+
+typedef struct x86_64_operand {
+  int base, index, scale, displacement,
+    direct;                                 /* TRUE if the operand is the register base */
+} x86_64_operand;
+
+/* Map resp. unmap the buffer, returns -1 if no executable memory is available */
+int x86_64_create(x86_64_code *, size_t size);
+void x86_64_destroy(x86_64_code *);
+
+x86_64_operand x86_64_register(int reg);
+x86_64_operand x86_64_memory(int base, int displacement);
+x86_64_operand x86_64_indexed(int base, int index, int scale, int displacement);
+
+void x86_64_load(x86_64_code *, int reg, x86_64_operand source);                  /* mov reg, source */
+void x86_64_store(x86_64_code *, x86_64_operand destination, int reg);            /* mov destination, reg */
+void x86_64_load_wide(x86_64_code *, int reg, x86_64_operand source);             /* 64 bit mov reg, source */
+void x86_64_move_immediate(x86_64_code *, x86_64_operand destination, unsigned int value);
+void x86_64_store_byte(x86_64_code *, x86_64_operand destination, unsigned int value);
+void x86_64_lea(x86_64_code *, int reg, x86_64_operand address, int wide);
+void x86_64_extend(x86_64_code *, unsigned int opcode, int reg, x86_64_operand source);
+
+void x86_64_alu(x86_64_code *, int operation, x86_64_operand destination, int reg);        /* op destination, reg */
+void x86_64_alu_load(x86_64_code *, int operation, int reg, x86_64_operand source);        /* op reg, source */
+void x86_64_alu_immediate(x86_64_code *, int operation, x86_64_operand destination, int value, int wide);
+void x86_64_multiply_immediate(x86_64_code *, int reg, x86_64_operand source, int value);  /* imul reg, src, value */
+void x86_64_test_immediate(x86_64_code *, x86_64_operand operand, unsigned int value);
+void x86_64_unary(x86_64_code *, int operation, x86_64_operand operand);
+void x86_64_shift(x86_64_code *, int operation, x86_64_operand operand, unsigned int count);
+void x86_64_setcc(x86_64_code *, int condition, int reg);                          /* reg has to be RAX..RBX */
+
+/* Jumps are emitted with a 32 bit displacement, the returned position is resolved by x86_64_patch() */
+size_t x86_64_jump(x86_64_code *, int condition);
+void x86_64_patch(x86_64_code *, size_t position, size_t target);
+
+void x86_64_call(x86_64_code *, void *function);                                   /* Clobbers RAX */
+void x86_64_push(x86_64_code *, int reg);
+void x86_64_pop(x86_64_code *, int reg);
+void x86_64_return(x86_64_code *);
+
+#endif
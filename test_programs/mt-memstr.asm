@@ -0,0 +1,215 @@
+; Test the memory, character, string and 32 bit math routines of the Monitor
+; including the flags they return, which are printed together with the results. This is used by
+; the regression tests of the emulator to verify its high-level emulation (HLE) of
+; these routines (see emulator/hle.h).
+
+#include "../dist_kit/sysdef.asm"
+#include "../dist_kit/monitor.def"
+
+                .ORG 0x8000
+
+                MOVE    STR_TITLE, R8
+                SYSCALL(puts, 1)
+
+                ; memset and memcpy, including zero lengths
+                MOVE    BUFFER, R8
+                MOVE    8, R9
+                MOVE    0x1234, R10
+                SYSCALL(memset, 1)
+                RSUB    PRINT_SR, 1
+                MOVE    BUFFER, R8
+                MOVE    0, R9
+                SYSCALL(memset, 1)
+                RSUB    PRINT_SR, 1
+                MOVE    TEXT_1, R8
+                MOVE    BUFFER, R9
+                MOVE    4, R10
+                SYSCALL(memcpy, 1)
+                RSUB    PRINT_SR, 1
+                MOVE    0, R10
+                SYSCALL(memcpy, 1)
+                RSUB    PRINT_SR, 1
+                MOVE    BUFFER, R0
+                MOVE    8, R1
+_MEM_DUMP       MOVE    @R0++, R8
+                RSUB    PRINT_HEX, 1
+                SUB     1, R1
+                RBRA    _MEM_DUMP, !Z
+                SYSCALL(crlf, 1)
+
+                ; chr2upper and chr2lower of some critical characters
+                MOVE    CHARACTERS, R0
+_CHR_LOOP       CMP     CHARACTERS_END, R0
+                RBRA    _CHR_END, Z
+                MOVE    @R0++, R8
+                MOVE    R8, R1
+                SYSCALL(chr2upper, 1)
+                RSUB    PRINT_SR, 1
+                RSUB    PRINT_HEX, 1
+                MOVE    R1, R8
+                SYSCALL(chr2lower, 1)
+                RSUB    PRINT_SR, 1
+                RSUB    PRINT_HEX, 1
+                SYSCALL(crlf, 1)
+                RBRA    _CHR_LOOP, 1
+
+                ; str2upper, strlen and chomp of some strings
+_CHR_END        MOVE    STRINGS, R0
+_STR_LOOP       MOVE    @R0++, R1
+                RBRA    _STR_END, Z
+                MOVE    R1, R8
+                MOVE    BUFFER, R9
+                MOVE    16, R10
+                SYSCALL(memcpy, 1)
+                MOVE    BUFFER, R8
+                SYSCALL(str2upper, 1)
+                RSUB    PRINT_SR, 1
+                SYSCALL(strlen, 1)
+                RSUB    PRINT_SR, 1
+                MOVE    R9, R8
+                RSUB    PRINT_HEX, 1
+                MOVE    BUFFER, R8
+                SYSCALL(chomp, 1)
+                RSUB    PRINT_SR, 1
+                SYSCALL(strlen, 1)
+                MOVE    R9, R8
+                RSUB    PRINT_HEX, 1
+                MOVE    BUFFER, R8
+                SYSCALL(puts, 1)
+                SYSCALL(crlf, 1)
+                RBRA    _STR_LOOP, 1
+
+                ; strcmp and strchr
+_STR_END        MOVE    TEXT_1, R8
+                MOVE    TEXT_2, R9
+                RSUB    COMPARE, 1
+                MOVE    TEXT_2, R8
+                MOVE    TEXT_1, R9
+                RSUB    COMPARE, 1
+                MOVE    TEXT_1, R8
+                MOVE    TEXT_1, R9
+                RSUB    COMPARE, 1
+                MOVE    TEXT_EMPTY, R8
+                MOVE    TEXT_1, R9
+                RSUB    COMPARE, 1
+                SYSCALL(crlf, 1)
+
+                MOVE    'c', R8
+                MOVE    TEXT_1, R9
+                RSUB    SEARCH, 1
+                MOVE    'z', R8
+                RSUB    SEARCH, 1
+                MOVE    'a', R8
+                RSUB    SEARCH, 1
+                MOVE    TEXT_EMPTY, R9
+                RSUB    SEARCH, 1
+                SYSCALL(crlf, 1)
+
+                ; mulu32 and divu32 of the operand pairs in OPERANDS
+                MOVE    OPERANDS, R0
+_MTH_LOOP       CMP     OPERANDS_END, R0
+                RBRA    _MTH_END, Z
+                MOVE    @R0++, R8
+                MOVE    @R0++, R9
+                MOVE    @R0++, R10
+                MOVE    @R0++, R11
+                SYSCALL(mulu32, 1)
+                RSUB    PRINT_32, 1
+                SUB     4, R0
+                MOVE    @R0++, R8
+                MOVE    @R0++, R9
+                MOVE    @R0++, R10
+                MOVE    @R0++, R11
+                SYSCALL(divu32, 1)
+                RSUB    PRINT_32, 1
+                SYSCALL(crlf, 1)
+                RBRA    _MTH_LOOP, 1
+
+_MTH_END        SYSCALL(exit, 1)
+
+; Print R8..R11 and the flags
+PRINT_32        INCRB
+                MOVE    R8, R0
+                RSUB    PRINT_SR, 1
+                MOVE    R11, R8
+                RSUB    PRINT_HEX, 1
+                MOVE    R10, R8
+                RSUB    PRINT_HEX, 1
+                MOVE    R9, R8
+                RSUB    PRINT_HEX, 1
+                MOVE    R0, R8
+                RSUB    PRINT_HEX, 1
+                DECRB
+                RET
+
+; Print strcmp(R8, R9) and the flags
+COMPARE         INCRB
+                SYSCALL(strcmp, 1)
+                RSUB    PRINT_SR, 1
+                MOVE    R10, R8
+                RSUB    PRINT_HEX, 1
+                DECRB
+                RET
+
+; Print strchr(R8, R9) relative to R9 and the flags
+SEARCH          INCRB
+                MOVE    R8, R0
+                SYSCALL(strchr, 1)
+                RSUB    PRINT_SR, 1
+                MOVE    R10, R8
+                RBRA    _SEARCH_PRINT, Z
+                SUB     R9, R8
+_SEARCH_PRINT   RSUB    PRINT_HEX, 1
+                MOVE    R0, R8
+                DECRB
+                RET
+
+; Print the flags of SR (the lower eight bits) without changing R8, the flags are
+; changed by printing
+PRINT_SR        MOVE    SR, @--SP
+                INCRB
+                MOVE    @SP++, R0
+                MOVE    R8, R1
+                MOVE    R0, R8
+                AND     0x00FF, R8
+                RSUB    PRINT_HEX, 1
+                MOVE    R1, R8
+                DECRB
+                RET
+
+; Print R8 as hex number followed by a blank
+PRINT_HEX       INCRB
+                SYSCALL(puthex, 1)
+                MOVE    ' ', R8
+                SYSCALL(putc, 1)
+                DECRB
+                RET
+
+STR_TITLE       .ASCII_W "Monitor memory, character and string library test\n"
+
+TEXT_1          .ASCII_W "abcd"
+TEXT_2          .ASCII_W "abce"
+TEXT_EMPTY      .DW     0
+
+CHARACTERS      .DW     0x0000, 0x0040, 0x0041, 0x005A, 0x005B, 0x0060, 0x0061, 0x007A
+                .DW     0x007B, 0x00E4, 0x7FFF, 0x8000, 0x8061, 0xFFFE, 0xFFFF
+CHARACTERS_END  .DW     0
+
+OPERANDS        .DW     0x5678, 0x1234, 0x0000, 0x0000      ; LO|HI of both operands
+                .DW     0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF
+                .DW     0xFFFF, 0xFFFF, 0x0003, 0x0000
+                .DW     0x0000, 0x8000, 0xFFFF, 0x7FFF
+                .DW     0x0007, 0x0000, 0x0000, 0x0001
+OPERANDS_END    .DW     0
+
+STRINGS         .DW     STRING_1, STRING_2, STRING_3, STRING_4, STRING_5, STRING_6, 0
+STRING_1        .ASCII_W "Mixed {Case}\n"                   ; CR LF: only the LF is removed
+STRING_2        .ASCII_P "line"
+                .DW     0x000A, 0x000D, 0
+STRING_3        .ASCII_P "cr"
+                .DW     0x000D, 0
+STRING_4        .DW     0x000A, 0
+STRING_5        .DW     0
+STRING_6        .ASCII_W "`az{"
+
+BUFFER          .BLOCK  16, 0
@@ -7,6 +7,7 @@ $COMPILER bit2core.c -O3 -o bit2core
 cd ..
 $COMPILER assembler/qasm.c -o assembler/qasm
 $COMPILER assembler/qasm2rom.c -o assembler/qasm2rom -std=c99
+$COMPILER assembler/qasm2bin.c -o assembler/qasm2bin -std=c99
 
 cd monitor
 ./compile_and_distribute.sh 